@@ -211,6 +211,12 @@ extern "C" void app_main(void* param) {
                  coralmicro::testlib::RunTestConv1);
   jsonrpc_export(coralmicro::testlib::kMethodSetTPUPowerState,
                  coralmicro::testlib::SetTPUPowerState);
+  jsonrpc_export(coralmicro::testlib::kMethodSetTpuProfiling,
+                 coralmicro::testlib::SetTpuProfiling);
+  jsonrpc_export(coralmicro::testlib::kMethodGetTpuProfile,
+                 coralmicro::testlib::GetTpuProfile);
+  jsonrpc_export(coralmicro::testlib::kMethodGetTpuBringUp,
+                 coralmicro::testlib::GetTpuBringUp);
   jsonrpc_export(coralmicro::testlib::kMethodPosenetStressRun,
                  coralmicro::testlib::PosenetStressRun);
   jsonrpc_export(coralmicro::testlib::kMethodBeginUploadResource,
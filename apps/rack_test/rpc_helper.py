@@ -121,6 +121,25 @@ class CoralMicroRPCHelper(object):
     payload['params'].append({'enable': enable})
     return self.send_rpc(payload)
 
+  def set_tpu_profiling(self, enable):
+    """Enables or disables the Edge TPU profiler, clearing recorded events."""
+    payload = self.get_new_payload()
+    payload['method'] = 'set_tpu_profiling'
+    payload['params'].append({'enable': enable})
+    return self.send_rpc(payload)
+
+  def get_tpu_profile(self):
+    """Gets Edge TPU phase totals and a Chrome trace of recent inferences."""
+    payload = self.get_new_payload()
+    payload['method'] = 'get_tpu_profile'
+    return self.send_rpc(payload)
+
+  def get_tpu_bring_up(self):
+    """Gets the time of each step of the last Edge TPU bring-up."""
+    payload = self.get_new_payload()
+    payload['method'] = 'get_tpu_bring_up'
+    return self.send_rpc(payload)
+
   def call_tpu_stress_test(self, iterations):
     """Calls Posenet with specified number of iterations."""
     payload = self.get_new_payload()
@@ -28,13 +28,13 @@ namespace coralmicro {
 namespace arduino {
 
 namespace {
-inline constexpr int kNumDmaBuffers = 2;
+inline constexpr int kNumDmaBuffers = 3;
 inline constexpr int kDmaBufferSizeMs = 30;
 inline constexpr int kAudioServiceTaskPriority = 5;
-// For our AudioDriverConfig with 2 dma buffers, buffer size of 30ms, we
-// need a max of 2 * 30 * 4 bytes * 48 (48k sample rate) = 11520 ~= 12k (less
-// than that for 16k sample rate). This number is optimized for space, but could
-// be adjusted for better quality.
+// For our AudioDriverConfig with 3 dma buffers (the fewest `AudioService`
+// accepts), buffer size of 30ms, we need a max of 3 * 30 * 48 (48k sample
+// rate) = 4320 samples (less than that for 16k sample rate). This leaves room
+// for larger buffers, but could be reduced to save space.
 inline constexpr int kCombinedDmaBufferSize = 12 * 1024;
 }  // namespace
 
@@ -286,7 +286,7 @@ def main():
                       default='S32_LE', choices=SAMPLE_FORMATS.values(),
                       metavar='{%s}' % ','.join(SAMPLE_FORMATS.keys()),
                       help='audio sample format')
-  parser.add_argument('--num_dma_buffers', '-n', type=int, default=2,
+  parser.add_argument('--num_dma_buffers', '-n', type=int, default=4,
                       metavar='N', help='number of DMA buffers')
   parser.add_argument('--dma_buffer_size_ms', '-b', type=int, default=50,
                       metavar='MS',
@@ -15,6 +15,7 @@
 #include <algorithm>
 #include <cstdio>
 
+#include "libs/audio/audio_converter.h"
 #include "libs/audio/audio_service.h"
 #include "libs/base/led.h"
 #include "libs/base/network.h"
@@ -78,7 +79,7 @@ void ProcessClient(int client_socket) {
     return;
   }
 
-  if (num_dma_buffers <= 0) {
+  if (num_dma_buffers < 3) {
     printf("ERROR: Invalid number of DMA buffers: %d\r\n", num_dma_buffers);
     return;
   }
@@ -121,9 +122,10 @@ void ProcessClient(int client_socket) {
     }
   } else {
     std::vector<int16_t> buffer16(buffer32.size());
+    AudioConverter converter;
     while (true) {
       auto size = reader.FillBuffer();
-      for (size_t i = 0; i < size; ++i) buffer16[i] = buffer32[i] >> 16;
+      converter.ToInt16(buffer32.data(), size, buffer16.data());
       if (WriteArray(client_socket, buffer16.data(), size) != IOStatus::kOk)
         break;
       total_bytes += size * sizeof(int16_t);
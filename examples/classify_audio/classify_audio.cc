@@ -15,6 +15,7 @@
 #include "libs/audio/audio_service.h"
 #include "libs/base/filesystem.h"
 #include "libs/base/led.h"
+#include "libs/base/mutex.h"
 #include "libs/base/timer.h"
 #include "libs/tensorflow/audio_models.h"
 #include "libs/tensorflow/utils.h"
@@ -37,7 +38,7 @@ namespace {
 
 constexpr int kTensorArenaSize = 1 * 1024 * 1024;
 STATIC_TENSOR_ARENA_IN_SDRAM(tensor_arena, kTensorArenaSize);
-constexpr int kNumDmaBuffers = 2;
+constexpr int kNumDmaBuffers = 3;
 constexpr int kDmaBufferSizeMs = 50;
 constexpr int kDmaBufferSize =
     kNumDmaBuffers * tensorflow::kYamnetSampleRateMs * kDmaBufferSizeMs;
@@ -54,7 +55,15 @@ constexpr int kAudioBufferSize =
 constexpr float kThreshold = 0.3;
 constexpr int kTopK = 5;
 
-std::array<int16_t, tensorflow::kYamnetAudioSize> audio_input;
+// The frontend runs on each new audio buffer as it arrives, so inference only
+// needs to convert the latest features. They're copied out under the mutex
+// and normalized after releasing it, so the audio service isn't held up.
+tensorflow::AudioFrontendStream frontend_stream;
+SemaphoreHandle_t frontend_mutex;
+std::array<int16_t, tensorflow::kYamnetFeatureElementCount> features;
+tensorflow::AudioFeatureNormalizer normalizer(tensorflow::AudioModel::kYAMNet);
+// Converts the test input, which is a single window.
+tensorflow::AudioPreprocessor preprocessor(tensorflow::AudioModel::kYAMNet);
 
 #ifdef YAMNET_CPU
 // To run YamNet on the CPU, see the CMakeLists file to enable this.
@@ -65,15 +74,8 @@ constexpr char kModelName[] = "/models/yamnet_spectra_in_edgetpu.tflite";
 constexpr bool kUseTpu = true;
 #endif
 
-// Run invoke and get the results after the interpreter have already been
-// populated with raw audio input.
-void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
-  auto input_tensor = interpreter->input_tensor(0);
-  auto preprocess_start = TimerMillis();
-  tensorflow::YamNetPreprocessInput(audio_input.data(), input_tensor,
-                                    frontend_state);
-  // Reset frontend state.
-  FrontendReset(frontend_state);
+// Run invoke and get the results after the input tensor has been populated.
+void run(tflite::MicroInterpreter* interpreter, uint64_t preprocess_start) {
   auto preprocess_end = TimerMillis();
   if (interpreter->Invoke() != kTfLiteOk) {
     printf("Failed to invoke on test input\r\n");
@@ -91,6 +93,14 @@ void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
   printf("%s\r\n", tensorflow::FormatClassificationOutput(results).c_str());
 }
 
+// Runs the frontend on new audio, from the audio service task. The service
+// converts the samples to int16.
+bool AddAudioSamples(void*, const int16_t* samples, size_t num_samples) {
+  MutexLock lock(frontend_mutex);
+  frontend_stream.AddSamples(samples, num_samples);
+  return true;
+}
+
 [[noreturn]] void Main() {
   printf("YamNet Example!\r\n");
   // Turn on Status LED to show the board is on.
@@ -127,10 +137,8 @@ void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
     vTaskSuspend(nullptr);
   }
 
-  FrontendState frontend_state{};
-  if (!coralmicro::tensorflow::PrepareAudioFrontEnd(
-          &frontend_state, coralmicro::tensorflow::AudioModel::kYAMNet)) {
-    printf("coralmicro::tensorflow::PrepareAudioFrontEnd() failed.\r\n");
+  if (!preprocessor.Init()) {
+    printf("Failed to initialize the audio preprocessor.\r\n");
     vTaskSuspend(nullptr);
   }
 
@@ -146,40 +154,41 @@ void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
     vTaskSuspend(nullptr);
   }
   auto input_tensor = interpreter.input_tensor(0);
-  std::memcpy(tflite::GetTensorData<uint8_t>(input_tensor),
-              yamnet_test_input_bin.data(), yamnet_test_input_bin.size());
-  run(&interpreter, &frontend_state);
+  auto preprocess_start = TimerMillis();
+  CHECK(preprocessor.Preprocess(
+      reinterpret_cast<const int16_t*>(yamnet_test_input_bin.data()),
+      input_tensor));
+  run(&interpreter, preprocess_start);
+
+  frontend_mutex = xSemaphoreCreateMutex();
+  CHECK(frontend_mutex);
+  if (!frontend_stream.Init(tensorflow::AudioModel::kYAMNet)) {
+    printf("Failed to initialize the audio frontend stream.\r\n");
+    vTaskSuspend(nullptr);
+  }
 
   // Setup audio
   AudioDriverConfig audio_config{AudioSampleRate::k16000_Hz, kNumDmaBuffers,
                                  kDmaBufferSizeMs};
   AudioService audio_service(&audio_driver, audio_config, kAudioServicePriority,
                              kDropFirstSamplesMs);
-  LatestSamples audio_latest(
-      MsToSamples(AudioSampleRate::k16000_Hz, tensorflow::kYamnetDurationMs));
-  audio_service.AddCallback(
-      &audio_latest,
-      +[](void* ctx, const int32_t* samples, size_t num_samples) {
-        static_cast<LatestSamples*>(ctx)->Append(samples, num_samples);
-        return true;
-      });
+  audio_service.AddCallback(nullptr, AddAudioSamples,
+                            audio_config.sample_rate);
   // Delay for the first buffers to fill.
   vTaskDelay(pdMS_TO_TICKS(tensorflow::kYamnetDurationMs));
   while (true) {
-    audio_latest.AccessLatestSamples(
-        [](const std::vector<int32_t>& samples, size_t start_index) {
-          size_t i, j = 0;
-          // Starting with start_index, grab until the end of the buffer.
-          for (i = 0; i < samples.size() - start_index; ++i) {
-            audio_input[i] = samples[i + start_index] >> 16;
-          }
-          // Now fill the rest of the data with the beginning of the
-          // buffer.
-          for (j = 0; j < samples.size() - i; ++j) {
-            audio_input[i + j] = samples[j] >> 16;
-          }
-        });
-    run(&interpreter, &frontend_state);
+    preprocess_start = TimerMillis();
+    bool ready;
+    {
+      MutexLock lock(frontend_mutex);
+      ready = frontend_stream.CopyFeatures(features.data());
+    }
+    if (!ready) {
+      vTaskDelay(pdMS_TO_TICKS(kDmaBufferSizeMs));
+      continue;
+    }
+    CHECK(normalizer.Normalize(features.data(), input_tensor));
+    run(&interpreter, preprocess_start);
 #ifndef YAMNET_CPU
     // Delay 975 ms to rate limit the TPU version.
     vTaskDelay(pdMS_TO_TICKS(tensorflow::kYamnetDurationMs));
@@ -14,6 +14,7 @@
 
 #include "libs/audio/audio_service.h"
 #include "libs/base/filesystem.h"
+#include "libs/base/mutex.h"
 #include "libs/base/timer.h"
 #include "libs/tensorflow/audio_models.h"
 #include "libs/tensorflow/utils.h"
@@ -27,7 +28,7 @@ namespace coralmicro {
 namespace {
 constexpr int kTensorArenaSize = 1 * 1024 * 1024;
 STATIC_TENSOR_ARENA_IN_SDRAM(tensor_arena, kTensorArenaSize);
-constexpr int kNumDmaBuffers = 2;
+constexpr int kNumDmaBuffers = 3;
 constexpr int kDmaBufferSizeMs = 50;
 constexpr int kDmaBufferSize = kNumDmaBuffers *
                                tensorflow::kKeywordDetectorSampleRateMs *
@@ -47,18 +48,18 @@ constexpr int kTopK = 5;
 constexpr char kModelName[] = "/models/voice_commands_v0.7_edgetpu.tflite";
 constexpr char kLabelsName[] = "/models/labels_gc2.raw.txt";
 
-std::array<int16_t, tensorflow::kKeywordDetectorAudioSize> audio_input;
+// The frontend runs on each new audio buffer as it arrives, so inference only
+// needs to convert the latest features. They're copied out under the mutex
+// and normalized after releasing it, so the audio service isn't held up.
+tensorflow::AudioFrontendStream frontend_stream;
+SemaphoreHandle_t frontend_mutex;
+std::array<int16_t, tensorflow::kKeywordDetectorFeatureElementCount> features;
+tensorflow::AudioFeatureNormalizer normalizer(
+    tensorflow::AudioModel::kKeywordDetector);
 std::vector<std::string> labels;
 
-// Run invoke and get the results after the interpreter have already been
-// populated with raw audio input.
-void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
-  auto input_tensor = interpreter->input_tensor(0);
-  auto preprocess_start = TimerMillis();
-  tensorflow::KeywordDetectorPreprocessInput(audio_input.data(), input_tensor,
-                                             frontend_state);
-  // Reset frontend state.
-  FrontendReset(frontend_state);
+// Run invoke and get the results after the input tensor has been populated.
+void run(tflite::MicroInterpreter* interpreter, uint64_t preprocess_start) {
   auto preprocess_end = TimerMillis();
   if (interpreter->Invoke() != kTfLiteOk) {
     printf("Failed to invoke on test input\r\n");
@@ -82,6 +83,14 @@ void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
   printf("\r\n");
 }
 
+// Runs the frontend on new audio, from the audio service task. The service
+// converts the samples to int16.
+bool AddAudioSamples(void*, const int16_t* samples, size_t num_samples) {
+  MutexLock lock(frontend_mutex);
+  frontend_stream.AddSamples(samples, num_samples);
+  return true;
+}
+
 }  // namespace
 
 [[noreturn]] void Main() {
@@ -124,10 +133,10 @@ void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
     vTaskSuspend(nullptr);
   }
 
-  FrontendState frontend_state{};
-  if (!tensorflow::PrepareAudioFrontEnd(
-          &frontend_state, tensorflow::AudioModel::kKeywordDetector)) {
-    printf("tensorflow::PrepareAudioFrontEnd() failed.\r\n");
+  frontend_mutex = xSemaphoreCreateMutex();
+  CHECK(frontend_mutex);
+  if (!frontend_stream.Init(tensorflow::AudioModel::kKeywordDetector)) {
+    printf("Failed to initialize the audio frontend stream.\r\n");
     vTaskSuspend(nullptr);
   }
 
@@ -136,33 +145,26 @@ void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
                                  kDmaBufferSizeMs};
   AudioService audio_service(&audio_driver, audio_config, kAudioServicePriority,
                              kDropFirstSamplesMs);
-  LatestSamples audio_latest(MsToSamples(
-      AudioSampleRate::k16000_Hz, tensorflow::kKeywordDetectorDurationMs));
-  audio_service.AddCallback(
-      &audio_latest,
-      +[](void* ctx, const int32_t* samples, size_t num_samples) {
-        static_cast<LatestSamples*>(ctx)->Append(samples, num_samples);
-        return true;
-      });
+  audio_service.AddCallback(nullptr, AddAudioSamples,
+                            audio_config.sample_rate);
 
   // Delay for the first buffers to fill.
   vTaskDelay(pdMS_TO_TICKS(tensorflow::kKeywordDetectorDurationMs));
 
+  auto input_tensor = interpreter.input_tensor(0);
   while (true) {
-    audio_latest.AccessLatestSamples(
-        [](const std::vector<int32_t>& samples, size_t start_index) {
-          size_t i, j = 0;
-          // Starting with start_index, grab until the end of the buffer.
-          for (i = 0; i < samples.size() - start_index; ++i) {
-            audio_input[i] = samples[i + start_index] >> 16;
-          }
-          // Now fill the rest of the data with the beginning of the
-          // buffer.
-          for (j = 0; j < samples.size() - i; ++j) {
-            audio_input[i + j] = samples[j] >> 16;
-          }
-        });
-    run(&interpreter, &frontend_state);
+    auto preprocess_start = TimerMillis();
+    bool ready;
+    {
+      MutexLock lock(frontend_mutex);
+      ready = frontend_stream.CopyFeatures(features.data());
+    }
+    if (!ready) {
+      vTaskDelay(pdMS_TO_TICKS(kDmaBufferSizeMs));
+      continue;
+    }
+    CHECK(normalizer.Normalize(features.data(), input_tensor));
+    run(&interpreter, preprocess_start);
 
     // Delay 2000ms to rate limit the TPU version.
     vTaskDelay(pdMS_TO_TICKS(tensorflow::kKeywordDetectorDurationMs));
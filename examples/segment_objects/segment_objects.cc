@@ -12,12 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <cstring>
+#include <string>
 #include <vector>
 
 #include "libs/base/filesystem.h"
 #include "libs/base/led.h"
+#include "libs/base/strings.h"
 #include "libs/camera/camera.h"
 #include "libs/rpc/rpc_http_server.h"
+#include "libs/tensorflow/segmentation.h"
 #include "libs/tensorflow/utils.h"
 #include "libs/tpu/edgetpu_manager.h"
 #include "libs/tpu/edgetpu_op.h"
@@ -53,10 +56,19 @@
 //     'width': int,
 //     'height': int,
 //     'base64_data': image_bytes,
-//     'output_mask': output_mask,
+//     'label_runs': label_runs,
+//     'classes': [
+//         {'id': int, 'area': int,
+//          'bbox': {'ymin': int, 'xmin': int, 'ymax': int, 'xmax': int}},
+//         ...
+//     ],
 //      }
 // }
 //
+// `label_runs` is the per-pixel class label map, run-length encoded as
+// described in libs/tensorflow/segmentation.h. `classes` has the area, in
+// pixels, and the inclusive bounding box of each class found in the image.
+//
 // This can theoretically run any supported segmentation model but has only
 // been tested with keras_post_training_unet_mv2_128_quant_edgetpu.tflite
 // which comes from the tutorial at
@@ -101,13 +113,39 @@ void SegmentFromCamera(struct jsonrpc_request* r) {
     jsonrpc_return_error(r, -1, "Invoke failed", nullptr);
     return;
   }
-  const auto& output_tensor = interpreter->output_tensor(0);
-  const auto& output_mask = tflite::GetTensorData<uint8_t>(output_tensor);
-  const auto mask_size = tensorflow::TensorSize(output_tensor);
-  jsonrpc_return_success(r, "{%Q: %d, %Q: %d, %Q: %V, %Q: %V}", "width",
-                         model_width, "height", model_height, "base64_data",
-                         image.size(), image.data(), "output_mask", mask_size,
-                         output_mask);
+  // The label map is much smaller than the raw logits, and run-length encodes
+  // to a few bytes per region boundary.
+  const auto* output_tensor = interpreter->output_tensor(0);
+  std::vector<uint8_t> labels(model_width * model_height);
+  int num_classes;
+  if (!tensorflow::GetSegmentationLabels(*output_tensor, labels.data(),
+                                         labels.size(), &num_classes)) {
+    jsonrpc_return_error(r, -1, "Unsupported segmentation output", nullptr);
+    return;
+  }
+  std::vector<tensorflow::SegmentationStats> stats(num_classes);
+  tensorflow::GetSegmentationStats(labels.data(), model_height, model_width,
+                                   num_classes, stats.data());
+  std::string classes = "[";
+  for (int i = 0; i < num_classes; ++i) {
+    if (stats[i].area == 0) continue;
+    StrAppend(&classes,
+              "%s{\"id\":%d,\"area\":%u,\"bbox\":{\"ymin\":%d,"
+              "\"xmin\":%d,\"ymax\":%d,\"xmax\":%d}}",
+              classes.size() > 1 ? "," : "", i,
+              static_cast<unsigned int>(stats[i].area), stats[i].bbox.ymin,
+              stats[i].bbox.xmin, stats[i].bbox.ymax, stats[i].bbox.xmax);
+  }
+  classes += "]";
+  std::vector<uint8_t> label_runs(
+      tensorflow::MaxEncodedLabelRunsSize(labels.size()));
+  const size_t runs_size = tensorflow::EncodeLabelRuns(
+      labels.data(), labels.size(), label_runs.data(), label_runs.size());
+  jsonrpc_return_success(r, "{%Q: %d, %Q: %d, %Q: %V, %Q: %V, %Q: %s}",
+                         "width", model_width, "height", model_height,
+                         "base64_data", image.size(), image.data(),
+                         "label_runs", runs_size, label_runs.data(),
+                         "classes", classes.c_str());
 }
 
 void Main() {
@@ -85,6 +85,38 @@ def label_to_color_image(label):
   return colormap[label]
 
 
+def decode_label_runs(data, width, height):
+  """Decodes a run-length encoded label map.
+
+  Each run is a label byte followed by the run length as an unsigned LEB128
+  varint.
+  Args:
+    data: The encoded runs.
+    width: The label map width.
+    height: The label map height.
+  Returns:
+    A 2D array with the label of each pixel.
+  """
+  labels = np.empty(width * height, dtype=np.uint8)
+  pos = 0
+  i = 0
+  while i < len(data):
+    label = data[i]
+    i += 1
+    length = 0
+    shift = 0
+    while True:
+      byte = data[i]
+      i += 1
+      length |= (byte & 0x7f) << shift
+      shift += 7
+      if not byte & 0x80:
+        break
+    labels[pos:pos + length] = label
+    pos += length
+  return labels.reshape(height, width)
+
+
 def get_field_or_die(data, field_name):
   if field_name not in data:
     print(f'Unable to parse {field_name} from data: {data}\r\n')
@@ -117,19 +149,15 @@ def main():
   image_data = base64.b64decode(image_data_base64)
   im = Image.frombytes('RGB', (width, height), image_data, 'raw')
 
-  mask_data_base64 = get_field_or_die(result, 'output_mask')
-  mask_data = base64.b64decode(mask_data_base64)
-
-  num_classes = len(mask_data) / (width * height)
-
-  predicted_mask = np.frombuffer(
-      mask_data, dtype=np.uint8, count=-1).reshape(width,
-                                                   height,
-                                                   int(num_classes))
-  np.set_printoptions(threshold=sys.maxsize)
-  predicted_mask = np.argmax(predicted_mask, axis=-1)
+  label_runs_base64 = get_field_or_die(result, 'label_runs')
+  predicted_mask = decode_label_runs(
+      base64.b64decode(label_runs_base64), width, height)
   mask_img = Image.fromarray(
       label_to_color_image(predicted_mask).astype(np.uint8))
+  for cls in result.get('classes', []):
+    bbox = cls['bbox']
+    print(f"Class {cls['id']}: {cls['area']} pixels, box "
+          f"({bbox['ymin']}, {bbox['xmin']}, {bbox['ymax']}, {bbox['xmax']})")
 
   # Display the input image and segmentation results.
   output_img = Image.new('RGB', (2 * width, height))
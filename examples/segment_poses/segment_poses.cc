@@ -131,7 +131,13 @@ void Main() {
   // Creates a micro interpreter.
   tflite::MicroMutableOpResolver<2> resolver;
   resolver.AddCustom(kCustomOp, RegisterCustomOp());
-  resolver.AddCustom(kPosenetDecoderOp, RegisterPosenetDecoderOp());
+  // Decodes the decoder op's instance masks at half resolution, and only
+  // around the detected poses, for a fraction of a full-resolution decode.
+  PosenetMaskOptions mask_options;
+  mask_options.downsample = 2;
+  mask_options.bbox_margin = 2.0f;
+  resolver.AddCustom(kPosenetDecoderOp,
+                     RegisterPosenetDecoderOp(mask_options));
   tflite::MicroInterpreter interpreter = tflite::MicroInterpreter{
       model, resolver, tensor_arena, kTensorArenaSize, &error_reporter};
   if (interpreter.AllocateTensors() != kTfLiteOk) {
@@ -12,9 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <atomic>
 #include <cstdio>
 
+#include "libs/audio/audio_converter.h"
 #include "libs/audio/audio_driver.h"
 #include "libs/base/led.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
@@ -68,6 +70,7 @@ constexpr int kAudioBufferSizeMs = 1000;
 constexpr int kAudioBufferSize = kAudioBufferSizeMs * kSamplesPerMs;
 int16_t g_audio_buffer[kAudioBufferSize] __attribute__((aligned(16)));
 std::atomic<int32_t> g_audio_buffer_end_index = 0;
+AudioConverter g_audio_converter;
 
 int16_t g_audio_buffer_out[kMaxAudioSampleSize] __attribute__((aligned(16)));
 
@@ -81,9 +84,13 @@ int16_t g_audio_buffer_out[kMaxAudioSampleSize] __attribute__((aligned(16)));
   driver.Enable(
       config, nullptr,
       +[](void* ctx, const int32_t* buffer, size_t buffer_size) {
-        int32_t offset = g_audio_buffer_end_index;
-        for (size_t i = 0; i < buffer_size; ++i)
-          g_audio_buffer[(offset + i) % kAudioBufferSize] = buffer[i] >> 16;
+        // The buffer wraps around the end of the ring at most once.
+        const size_t offset = g_audio_buffer_end_index % kAudioBufferSize;
+        const size_t first =
+            std::min<size_t>(buffer_size, kAudioBufferSize - offset);
+        g_audio_converter.ToInt16(buffer, first, g_audio_buffer + offset);
+        g_audio_converter.ToInt16(buffer + first, buffer_size - first,
+                                  g_audio_buffer);
         g_audio_buffer_end_index += buffer_size;
       });
 
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/audio/audio_converter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+#include "third_party/CMSIS/CMSIS/Core/Include/cmsis_compiler.h"
+#endif
+
+namespace coralmicro {
+namespace {
+// The DC offset estimate moves 1/1024 of the way to each sample, which puts
+// the high-pass cutoff at sample_rate / (2 * pi * 1024).
+constexpr int kDcShift = 10;
+constexpr int kDcFractionBits = 16;
+
+// Multiplies, keeping the high word of the 64-bit product.
+inline int32_t MulHigh(int32_t a, int32_t b) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  return __SMMUL(a, b);
+#else
+  return static_cast<int32_t>((static_cast<int64_t>(a) * b) >> 32);
+#endif
+}
+
+inline int32_t SaturateInt16(int32_t value) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  return __SSAT(value, 16);
+#else
+  return std::clamp<int32_t>(value, std::numeric_limits<int16_t>::min(),
+                             std::numeric_limits<int16_t>::max());
+#endif
+}
+
+// Packs two int16 samples into a word, `first` in the lower address.
+inline uint32_t PackInt16(int32_t first, int32_t second) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  return __PKHBT(first, second, 16);
+#else
+  return static_cast<uint16_t>(first) |
+         (static_cast<uint32_t>(static_cast<uint16_t>(second)) << 16);
+#endif
+}
+}  // namespace
+
+AudioConverter::AudioConverter(const AudioConverterOptions& options)
+    : options_(options),
+      gain_q16_(static_cast<int32_t>(
+          std::lround(std::clamp(options.gain, 0.0f, 32767.0f) * 65536.0f))),
+      float_scale_(std::clamp(options.gain, 0.0f, 32767.0f) / 2147483648.0f) {}
+
+inline int32_t AudioConverter::RemoveDc(int32_t sample) {
+  const int64_t scaled = sample * (int64_t{1} << kDcFractionBits);
+  if (!has_dc_offset_) {
+    dc_offset_ = scaled;
+    has_dc_offset_ = true;
+  }
+  // y[n] = x[n] - d[n-1], d[n] = d[n-1] + (x[n] - d[n-1]) / 1024, which is
+  // (1 - z^-1) / (1 - (1 - 1/1024) z^-1): a zero at DC and a pole just
+  // inside it.
+  const int64_t value =
+      static_cast<int64_t>(sample) - (dc_offset_ >> kDcFractionBits);
+  dc_offset_ += (scaled - dc_offset_) >> kDcShift;
+  return static_cast<int32_t>(
+      std::clamp<int64_t>(value, std::numeric_limits<int32_t>::min(),
+                          std::numeric_limits<int32_t>::max()));
+}
+
+void AudioConverter::ToInt16(const int32_t* samples, size_t num_samples,
+                             int16_t* out) {
+  const int32_t gain = gain_q16_;
+  if (options_.remove_dc) {
+    for (size_t i = 0; i < num_samples; ++i) {
+      out[i] = static_cast<int16_t>(
+          SaturateInt16(MulHigh(RemoveDc(samples[i]), gain)));
+    }
+    return;
+  }
+
+  // Two samples per iteration, stored as one word. `out` needn't be word
+  // aligned: the Cortex-M7 handles unaligned single-word stores.
+  size_t i = 0;
+  for (; i + 2 <= num_samples; i += 2) {
+    const uint32_t pair =
+        PackInt16(SaturateInt16(MulHigh(samples[i], gain)),
+                  SaturateInt16(MulHigh(samples[i + 1], gain)));
+    std::memcpy(out + i, &pair, sizeof(pair));
+  }
+  if (i < num_samples) {
+    out[i] = static_cast<int16_t>(SaturateInt16(MulHigh(samples[i], gain)));
+  }
+}
+
+void AudioConverter::ToFloat(const int32_t* samples, size_t num_samples,
+                             float* out) {
+  const float scale = float_scale_;
+  if (options_.remove_dc) {
+    for (size_t i = 0; i < num_samples; ++i) {
+      const float value = static_cast<float>(RemoveDc(samples[i])) * scale;
+      out[i] = std::clamp(value, -1.0f, 1.0f);
+    }
+    return;
+  }
+  for (size_t i = 0; i < num_samples; ++i) {
+    out[i] = std::clamp(static_cast<float>(samples[i]) * scale, -1.0f, 1.0f);
+  }
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_AUDIO_AUDIO_CONVERTER_H_
+#define LIBS_AUDIO_AUDIO_CONVERTER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace coralmicro {
+
+// Options for `AudioConverter`.
+struct AudioConverterOptions {
+  // Linear gain applied to the samples, from 0 to 32767. Converted samples
+  // that go out of range saturate.
+  float gain = 1.0f;
+  // Whether to subtract a running estimate of the DC offset, on top of the
+  // PDM peripheral's own DC remover.
+  bool remove_dc = false;
+};
+
+// Converts the 32-bit samples from `AudioDriver` into int16 or float samples,
+// with gain, DC removal and saturation, without allocating.
+//
+// With the default options, int16 samples are the top 16 bits of the driver's
+// samples (`sample >> 16`) and float samples are the driver's samples scaled
+// to [-1, 1).
+//
+// Each sample costs one 32x32-bit multiply keeping the high word and a
+// saturation. Without DC removal, int16 samples are converted in pairs with
+// the Cortex-M7 DSP instructions SMMUL, SSAT and PKHBT, and stored a word at
+// a time.
+//
+// DC removal is a one-pole high-pass filter, updated with every sample, with
+// its cutoff at 1/6434 of the sample rate (2.5 Hz at 16 kHz). The filter
+// state belongs to the converter, so each stream of samples needs its own
+// converter, and converting the same samples to both int16 and float takes
+// two converters.
+class AudioConverter {
+ public:
+  explicit AudioConverter(
+      const AudioConverterOptions& options = AudioConverterOptions());
+
+  // Clears the DC offset estimate, for example after a gap in the audio. The
+  // next sample converted restarts the estimate.
+  void Reset() {
+    dc_offset_ = 0;
+    has_dc_offset_ = false;
+  }
+
+  // Converts samples to int16. With DC removal, the samples continue the
+  // stream converted by the previous call.
+  //
+  // @param samples The driver's samples.
+  // @param num_samples The number of samples.
+  // @param out Receives `num_samples` samples.
+  void ToInt16(const int32_t* samples, size_t num_samples, int16_t* out);
+
+  // Converts samples to float, in [-1, 1]. With DC removal, the samples
+  // continue the stream converted by the previous call.
+  //
+  // @param samples The driver's samples.
+  // @param num_samples The number of samples.
+  // @param out Receives `num_samples` samples.
+  void ToFloat(const int32_t* samples, size_t num_samples, float* out);
+
+  // The options given to the constructor.
+  const AudioConverterOptions& options() const { return options_; }
+
+ private:
+  // Subtracts the DC offset estimate from `sample` and updates the estimate.
+  int32_t RemoveDc(int32_t sample);
+
+  AudioConverterOptions options_;
+  // The gain in Q16, so that `(sample * gain_q16_) >> 32` is the int16
+  // sample.
+  int32_t gain_q16_;
+  float float_scale_;
+  // The DC offset, with 16 extra fractional bits so that slow drift isn't
+  // rounded away.
+  int64_t dc_offset_ = 0;
+  bool has_dc_offset_ = false;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_AUDIO_AUDIO_CONVERTER_H_
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/audio/audio_decimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+
+#include "libs/base/check.h"
+
+namespace coralmicro {
+namespace {
+constexpr int kCoeffBits = 15;
+// The cutoff, relative to the output Nyquist frequency. The transition band
+// of `kTapsPerPhase` taps per phase is about 0.2 times the output Nyquist
+// frequency wide, centered on the cutoff.
+constexpr double kRelativeCutoff = 0.9;
+// About 80 dB of stopband attenuation; rounding the coefficients to Q15
+// leaves about 70 dB.
+constexpr double kKaiserBeta = 8.0;
+
+// Modified Bessel function of the first kind, order 0, for the Kaiser window.
+double BesselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; ++k) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+}  // namespace
+
+AudioDecimator::AudioDecimator(int factor)
+    : factor_(factor), num_taps_(factor * kTapsPerPhase) {
+  CHECK(factor >= 1 && factor <= kMaxFactor);
+  Reset();
+  if (factor_ == 1) return;
+
+  double h[kMaxTaps];
+  double sum = 0.0;
+  const double cutoff = kRelativeCutoff * 0.5 / factor_;
+  const double center = 0.5 * (num_taps_ - 1);
+  const double i0_beta = BesselI0(kKaiserBeta);
+  for (int i = 0; i < num_taps_; ++i) {
+    const double t = i - center;
+    const double sinc =
+        t == 0.0 ? 2.0 * cutoff
+                 : std::sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+    const double r = t / center;
+    h[i] = sinc * BesselI0(kKaiserBeta * std::sqrt(1.0 - r * r)) / i0_beta;
+    sum += h[i];
+  }
+  // Unity gain at DC, with the rounding error folded into the middle taps.
+  int total = 0;
+  for (int i = 0; i < num_taps_; ++i) {
+    coeffs_[i] = static_cast<int16_t>(
+        std::lround(h[i] / sum * (1 << kCoeffBits)));
+    total += coeffs_[i];
+  }
+  coeffs_[num_taps_ / 2] += (1 << kCoeffBits) - total;
+}
+
+void AudioDecimator::Reset() {
+  std::fill(std::begin(history_), std::end(history_), 0);
+  phase_ = 0;
+  pos_ = 0;
+}
+
+size_t AudioDecimator::Process(const int32_t* samples, size_t num_samples,
+                               int32_t* out) {
+  if (factor_ == 1) {
+    std::copy(samples, samples + num_samples, out);
+    return num_samples;
+  }
+
+  constexpr int64_t kMin = std::numeric_limits<int32_t>::min();
+  constexpr int64_t kMax = std::numeric_limits<int32_t>::max();
+  size_t size = 0;
+  for (size_t i = 0; i < num_samples; ++i) {
+    history_[pos_] = history_[pos_ + num_taps_] = samples[i];
+    if (++pos_ == num_taps_) pos_ = 0;
+    if (++phase_ < factor_) continue;
+    phase_ = 0;
+
+    // The window starts at the oldest input.
+    const int32_t* x = history_ + pos_;
+    int64_t acc = 0;
+    for (int j = 0; j < num_taps_; ++j) {
+      acc += static_cast<int64_t>(x[j]) * coeffs_[j];
+    }
+    acc = (acc + (1 << (kCoeffBits - 1))) >> kCoeffBits;
+    out[size++] = static_cast<int32_t>(std::clamp(acc, kMin, kMax));
+  }
+  return size;
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_AUDIO_AUDIO_DECIMATOR_H_
+#define LIBS_AUDIO_AUDIO_DECIMATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace coralmicro {
+
+// Lowers the sample rate of an audio stream by an integer factor, without
+// allocating.
+//
+// The stream goes through a Kaiser-windowed sinc low-pass filter with its
+// cutoff at 0.9 times the output Nyquist frequency, so the transition band
+// ends about at the output Nyquist frequency and nothing aliases into the
+// output band. The response is flat up to about 0.8 times the output Nyquist
+// frequency (6.4 kHz at 16 kHz). The filter runs in fixed point, with
+// Q15 coefficients and a 64-bit accumulator, and only the samples that are
+// kept are computed (the polyphase form of filtering then downsampling). The
+// filter state carries over between calls, so the stream can be processed in
+// blocks of any size.
+class AudioDecimator {
+ public:
+  // The largest supported decimation factor.
+  static constexpr int kMaxFactor = 3;
+  // The filter length for each output sample, per unit of the factor.
+  static constexpr int kTapsPerPhase = 48;
+
+  // @param factor The decimation factor, from 1 (samples are copied
+  //   unchanged) to `kMaxFactor`.
+  explicit AudioDecimator(int factor = 1);
+
+  // Clears the filter state, for example after a gap in the audio.
+  void Reset();
+
+  // Filters and decimates a block of samples.
+  //
+  // @param samples The input samples.
+  // @param num_samples The number of input samples.
+  // @param out Receives the output samples. Must have room for
+  //   `MaxOutputSize(num_samples)` samples.
+  // @return The number of output samples.
+  size_t Process(const int32_t* samples, size_t num_samples, int32_t* out);
+
+  // Gets the most output samples that `Process()` can produce from
+  // `num_samples` input samples.
+  size_t MaxOutputSize(size_t num_samples) const {
+    return (num_samples + factor_ - 1) / factor_;
+  }
+
+  // The decimation factor.
+  int factor() const { return factor_; }
+
+ private:
+  static constexpr int kMaxTaps = kMaxFactor * kTapsPerPhase;
+
+  int factor_;
+  int num_taps_;
+  // The number of inputs since the last output.
+  int phase_ = 0;
+  // Where the next input goes in `history_`.
+  int pos_ = 0;
+  int16_t coeffs_[kMaxTaps];
+  // The latest `num_taps_` inputs, stored twice in a row so the filter
+  // window is always contiguous.
+  int32_t history_[2 * kMaxTaps];
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_AUDIO_AUDIO_DECIMATOR_H_
@@ -60,12 +60,15 @@ void AudioDriver::PdmCallback(PDM_Type* base, pdm_edma_handle_t* handle,
                               status_t status) {
   auto& pdm_transfer = pdm_transfers_[pdm_transfer_index_];
 
-  fn_(ctx_,
-      const_cast<int32_t*>(
-          reinterpret_cast<volatile int32_t*>(pdm_transfer.data)),
-      pdm_transfer.dataSize / sizeof(int32_t));
+  if (fn_) {
+    fn_(ctx_,
+        const_cast<int32_t*>(
+            reinterpret_cast<volatile int32_t*>(pdm_transfer.data)),
+        pdm_transfer.dataSize / sizeof(int32_t));
+  }
 
   pdm_transfer_index_ = (pdm_transfer_index_ + 1) % pdm_transfer_count_;
+  ++completed_buffer_count_;
 
   __DSB();
 }
@@ -85,6 +88,7 @@ bool AudioDriver::Enable(const AudioDriverConfig& config, void* ctx,
 
   pdm_transfer_index_ = 0;
   pdm_transfer_count_ = config.num_dma_buffers;
+  completed_buffer_count_ = 0;
   ctx_ = ctx;
   fn_ = fn;
 
@@ -152,6 +156,38 @@ bool AudioDriver::Enable(const AudioDriverConfig& config, void* ctx,
   return true;
 }
 
+bool AudioDriver::LendBuffer(uint32_t sequence, AudioDmaBuffer* buffer) const {
+  // The count and the index are updated together by the ISR, so read them
+  // until they're consistent.
+  uint32_t count;
+  int index;
+  do {
+    count = completed_buffer_count_;
+    index = pdm_transfer_index_;
+  } while (count != completed_buffer_count_);
+
+  // The buffer at `index` is being filled with buffer `count`; the buffers
+  // before it completed in order. Unsigned differences handle wrapping.
+  const uint32_t age = count - sequence;
+  if (age == 0 || age > pdm_transfer_count_ - 2) return false;
+
+  const auto& pdm_transfer =
+      pdm_transfers_[(index + pdm_transfer_count_ - age) % pdm_transfer_count_];
+  buffer->samples = reinterpret_cast<const int32_t*>(pdm_transfer.data);
+  buffer->num_samples = pdm_transfer.dataSize / sizeof(int32_t);
+  buffer->sequence = sequence;
+  return true;
+}
+
+bool AudioDriver::IsBufferIntact(const AudioDmaBuffer& buffer) const {
+  // Samples read before this point must not be reordered after the count.
+  __DMB();
+  // When the count says the buffer before this one is being filled, the DMA
+  // may already have completed it and moved on to this one, ahead of the
+  // interrupt.
+  return completed_buffer_count_ - buffer.sequence <= pdm_transfer_count_ - 2;
+}
+
 void AudioDriver::Disable() {
   DisableIRQ(PDM_ERROR_IRQn);
   PDM_TransferTerminateReceiveEDMA(PDM, &pdm_edma_handle_);
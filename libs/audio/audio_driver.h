@@ -109,10 +109,29 @@ struct AudioDriverBuffers {
   // @endcond
 };
 
+// A completed DMA buffer lent by `AudioDriver::LendBuffer()`, without a copy.
+//
+// The samples stay in DMA memory, so they are only valid until the DMA comes
+// back around to the buffer. Read them within `num_dma_buffers - 2` buffer
+// durations of it completing, and check `AudioDriver::IsBufferIntact()` after
+// reading them.
+struct AudioDmaBuffer {
+  // The samples, read-only.
+  const int32_t* samples = nullptr;
+  // The number of samples.
+  size_t num_samples = 0;
+  // The buffer's sequence number, counting completed buffers since
+  // `AudioDriver::Enable()`. A gap in the sequence means buffers were missed.
+  uint32_t sequence = 0;
+};
+
 // Provides low-level access to the board's microphone with audio provided by a
 // callback function. The callback is called from an interrupt service routine
 // (ISR) context and receives audio samples using direct memory access (DMA).
 //
+// Instead of copying samples in the callback, a task can borrow each
+// completed DMA buffer with `LendBuffer()` and read the samples in place.
+//
 // An instance of this class is required for `AudioReader` and `AudioService`,
 // but you do not need to call `Enable()` and `Disable()` when using those APIs.
 //
@@ -152,12 +171,44 @@ class AudioDriver {
   // @param config Driver configuration such as the sample rate and sample size.
   // Used to check if there is space for the specific `AudioDriver`.
   // @param ctx Extra parameters to pass into the callback.
-  // @param fn Callback that receives the audio samples.
+  // @param fn Callback that receives the audio samples. May be nullptr if
+  // the samples are only read with `LendBuffer()`.
   // @return True if the microphone successfully starts, false otherwise.
   bool Enable(const AudioDriverConfig& config, void* ctx, Callback fn);
   // Stops processing of new audio data and turns off microphone.
   void Disable();
 
+  // Gets the number of DMA buffers completed since `Enable()`, which is also
+  // the sequence number of the buffer being filled.
+  //
+  // @return The number of completed DMA buffers.
+  uint32_t CompletedBufferCount() const { return completed_buffer_count_; }
+
+  // Lends a completed DMA buffer without copying it.
+  //
+  // A buffer can be lent from the moment it completes until the DMA could be
+  // filling it again. The DMA moves on to the next buffer before the
+  // completion interrupt counts the previous one, so a buffer is only safe
+  // while at most `num_dma_buffers - 2` buffers completed after it, and the
+  // consumer has `num_dma_buffers - 2` buffer durations to read it (so lending
+  // needs at least 3 DMA buffers). There's nothing to return: when done
+  // reading, call `IsBufferIntact()` to find out whether the samples were
+  // overwritten.
+  //
+  // @param sequence The sequence number of the buffer.
+  // @param buffer Receives the view of the buffer.
+  // @return False if the buffer hasn't completed yet or may already be
+  // overwritten.
+  bool LendBuffer(uint32_t sequence, AudioDmaBuffer* buffer) const;
+
+  // Checks whether the DMA may have started overwriting a lent buffer. If this
+  // returns true after the samples were read, every sample read was from
+  // `buffer.sequence`.
+  //
+  // @param buffer A buffer lent by `LendBuffer()`.
+  // @return True if the buffer still holds its samples.
+  bool IsBufferIntact(const AudioDmaBuffer& buffer) const;
+
  private:
   static void StaticPdmCallback(PDM_Type* base, pdm_edma_handle_t* handle,
                                 status_t status, void* user_data) {
@@ -179,6 +230,7 @@ class AudioDriver {
 
   volatile int pdm_transfer_index_;
   size_t pdm_transfer_count_;
+  volatile uint32_t completed_buffer_count_ = 0;
 
   void* ctx_;
   Callback fn_;
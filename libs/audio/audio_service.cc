@@ -28,14 +28,31 @@ enum class MessageType : uint8_t {
   kStop,
 };
 
+enum class SampleFormat : uint8_t {
+  kInt32,
+  kInt16,
+  kFloat,
+  // The DMA buffer itself, with its sequence number.
+  kBuffer,
+};
+
+struct Subscriber {
+  void* ctx;
+  SampleFormat format;
+  AudioSampleRate sample_rate;
+  union {
+    AudioService::Callback int32_fn;
+    AudioService::Int16Callback int16_fn;
+    AudioService::FloatCallback float_fn;
+    AudioService::BufferCallback buffer_fn;
+  };
+};
+
 struct Message {
   MessageType type;
   QueueHandle_t queue;
   union {
-    struct {
-      void* ctx;
-      AudioService::Callback fn;
-    } add;
+    Subscriber add;
 
     struct {
       int id;
@@ -45,10 +62,62 @@ struct Message {
 
 struct Cb {
   int id;
-  void* ctx;
-  AudioService::Callback fn;
+  Subscriber subscriber;
+};
+
+// The samples delivered at one sample rate, which are shared by all the
+// callbacks at that rate. Each format used by a callback is produced once per
+// buffer, into the stage's own storage, before any callback runs, so the
+// callbacks never read the DMA buffer.
+struct Stage {
+  AudioSampleRate sample_rate;
+  AudioDecimator decimator;
+  // Each conversion updates the converter's DC filter, so each format has its
+  // own converter.
+  AudioConverter int16_converter;
+  AudioConverter float_converter;
+  // The int32 samples: decimated, or copied at the driver's rate. Unused at
+  // the driver's rate without int32 callbacks, in which case the conversions
+  // read the DMA buffer.
+  std::vector<int32_t> int32_samples;
+  std::vector<int16_t> int16_samples;
+  std::vector<float> float_samples;
+  size_t num_samples;
+  bool uses_int32;
+  bool uses_int16;
+  bool uses_float;
 };
 
+// Clears a stage's filter history: the decimator's and the DC filters of the
+// converters.
+void ResetStage(Stage* stage) {
+  stage->decimator.Reset();
+  stage->int16_converter.Reset();
+  stage->float_converter.Reset();
+}
+
+int DecimationFactor(AudioSampleRate from, AudioSampleRate to) {
+  const int from_hz = static_cast<int>(from);
+  const int to_hz = static_cast<int>(to);
+  if (to_hz > from_hz || from_hz % to_hz != 0) return 0;
+  const int factor = from_hz / to_hz;
+  return factor <= AudioDecimator::kMaxFactor ? factor : 0;
+}
+
+int SendAddMessage(QueueHandle_t queue, const Subscriber& subscriber) {
+  Message msg{};
+  msg.type = MessageType::kAddCallback;
+  msg.queue = xQueueCreate(1, sizeof(int));
+  msg.add = subscriber;
+  CHECK(msg.queue);
+  CHECK(xQueueSendToBack(queue, &msg, portMAX_DELAY) == pdTRUE);
+
+  int id;
+  CHECK(xQueueReceive(msg.queue, &id, portMAX_DELAY) == pdTRUE);
+  vQueueDelete(msg.queue);
+  return id;
+}
+
 bool EraseCallbackById(std::vector<Cb>& callbacks, int id) {
   auto it = std::find_if(std::begin(callbacks), std::end(callbacks),
                          [id](const auto& cb) { return cb.id == id; });
@@ -56,45 +125,187 @@ bool EraseCallbackById(std::vector<Cb>& callbacks, int id) {
   callbacks.erase(it);
   return true;
 }
-}  // namespace
 
-AudioReader::AudioReader(AudioDriver* driver, const AudioDriverConfig& config)
-    : driver_(driver), dma_buffer_size_ms_(config.dma_buffer_size_ms) {
-  const auto dma_buffer_size_samples = config.dma_buffer_size_samples();
-  buffer_.resize(dma_buffer_size_samples);
+// Makes `stages` match the sample rates and formats the callbacks ask for.
+// Existing stages keep their filter state.
+void UpdateStages(const std::vector<Cb>& callbacks,
+                  const AudioDriverConfig& config,
+                  const AudioConverterOptions& converter_options,
+                  std::vector<Stage>* stages) {
+  auto used = [&callbacks](AudioSampleRate sample_rate) {
+    return std::any_of(
+        std::begin(callbacks), std::end(callbacks), [sample_rate](auto& cb) {
+          return cb.subscriber.format != SampleFormat::kBuffer &&
+                 cb.subscriber.sample_rate == sample_rate;
+        });
+  };
+  stages->erase(std::remove_if(std::begin(*stages), std::end(*stages),
+                               [&used](const Stage& stage) {
+                                 return !used(stage.sample_rate);
+                               }),
+                std::end(*stages));
+
+  for (auto& stage : *stages) {
+    stage.uses_int32 = false;
+    stage.uses_int16 = false;
+    stage.uses_float = false;
+  }
+  for (const auto& cb : callbacks) {
+    const Subscriber& subscriber = cb.subscriber;
+    if (subscriber.format == SampleFormat::kBuffer) continue;
+    auto it = std::find_if(std::begin(*stages), std::end(*stages),
+                           [&subscriber](const Stage& stage) {
+                             return stage.sample_rate ==
+                                    subscriber.sample_rate;
+                           });
+    if (it == std::end(*stages)) {
+      stages->push_back(Stage{subscriber.sample_rate,
+                              AudioDecimator(DecimationFactor(
+                                  config.sample_rate, subscriber.sample_rate)),
+                              AudioConverter(converter_options),
+                              AudioConverter(converter_options),
+                              {}, {}, {}, 0, false, false, false});
+      it = std::end(*stages) - 1;
+    }
+    const size_t size =
+        it->decimator.MaxOutputSize(config.dma_buffer_size_samples());
+    if (subscriber.format == SampleFormat::kInt32 ||
+        it->decimator.factor() > 1) {
+      it->int32_samples.resize(size);
+    }
+    if (subscriber.format == SampleFormat::kInt32) {
+      it->uses_int32 = true;
+    } else if (subscriber.format == SampleFormat::kInt16) {
+      it->uses_int16 = true;
+      it->int16_samples.resize(size);
+    } else if (subscriber.format == SampleFormat::kFloat) {
+      it->uses_float = true;
+      it->float_samples.resize(size);
+    }
+  }
+  // A converter that isn't run has a stale DC estimate by the time its format
+  // is used again.
+  for (auto& stage : *stages) {
+    if (!stage.uses_int16) stage.int16_converter.Reset();
+    if (!stage.uses_float) stage.float_converter.Reset();
+  }
+}
+
+// Produces the stage's samples from a DMA buffer, in each format its
+// callbacks use.
+void Prepare(const AudioDmaBuffer& buffer, Stage* stage) {
+  const int32_t* samples = buffer.samples;
+  size_t num_samples = buffer.num_samples;
+  if (stage->decimator.factor() > 1) {
+    num_samples = stage->decimator.Process(samples, num_samples,
+                                           stage->int32_samples.data());
+    samples = stage->int32_samples.data();
+  } else if (stage->uses_int32) {
+    std::copy(samples, samples + num_samples, stage->int32_samples.begin());
+    samples = stage->int32_samples.data();
+  }
+  stage->num_samples = num_samples;
+  if (stage->uses_int16) {
+    stage->int16_converter.ToInt16(samples, num_samples,
+                                   stage->int16_samples.data());
+  }
+  if (stage->uses_float) {
+    stage->float_converter.ToFloat(samples, num_samples,
+                                   stage->float_samples.data());
+  }
+}
 
-  ring_buffer_.Create(
-      /*xBufferSize=*/dma_buffer_size_samples * config.num_dma_buffers,
-      /*xTriggerLevel=*/dma_buffer_size_samples);
-  CHECK(ring_buffer_.Ok());
+bool Deliver(const Subscriber& subscriber, const Stage& stage) {
+  switch (subscriber.format) {
+    case SampleFormat::kInt32:
+      return subscriber.int32_fn(subscriber.ctx, stage.int32_samples.data(),
+                                 stage.num_samples);
+    case SampleFormat::kInt16:
+      return subscriber.int16_fn(subscriber.ctx, stage.int16_samples.data(),
+                                 stage.num_samples);
+    case SampleFormat::kFloat:
+      return subscriber.float_fn(subscriber.ctx, stage.float_samples.data(),
+                                 stage.num_samples);
+    case SampleFormat::kBuffer:
+      break;
+  }
+  return false;
+}
+}  // namespace
 
+AudioReader::AudioReader(AudioDriver* driver, const AudioDriverConfig& config)
+    : driver_(driver),
+      dma_buffer_size_ms_(config.dma_buffer_size_ms),
+      num_dma_buffers_(config.num_dma_buffers),
+      buffer_(config.dma_buffer_size_samples()),
+      buffer_ready_(xSemaphoreCreateBinary()) {
+  CHECK(num_dma_buffers_ >= 3);
+  CHECK(buffer_ready_);
   driver->Enable(config, this, Callback);
 }
 
-AudioReader::~AudioReader() { driver_->Disable(); }
+AudioReader::~AudioReader() {
+  driver_->Disable();
+  vSemaphoreDelete(buffer_ready_);
+}
 
 size_t AudioReader::FillBuffer() {
-  auto received_size = ring_buffer_.Receive(
-      buffer_.data(), buffer_.size(), pdMS_TO_TICKS(2 * dma_buffer_size_ms_));
-  if (received_size != buffer_.size()) ++underflow_count_;
-  return received_size;
+  AudioDmaBuffer buffer;
+  while (AcquireBuffer(&buffer)) {
+    std::copy(buffer.samples, buffer.samples + buffer.num_samples,
+              buffer_.begin());
+    // A torn copy is counted as an overflow and replaced by the next buffer.
+    if (ReleaseBuffer(buffer)) return buffer.num_samples;
+  }
+  return 0;
 }
 
-void AudioReader::Callback(void* ctx, const int32_t* buf, size_t size) {
+bool AudioReader::AcquireBuffer(AudioDmaBuffer* buffer) {
+  const TickType_t timeout = pdMS_TO_TICKS(2 * dma_buffer_size_ms_);
+  while (true) {
+    const uint32_t count = driver_->CompletedBufferCount();
+    if (count != next_sequence_) {
+      if (driver_->LendBuffer(next_sequence_, buffer)) {
+        ++next_sequence_;
+        return true;
+      }
+      // Overwritten before it was read: catch up to the oldest buffer that's
+      // still intact.
+      const uint32_t oldest =
+          driver_->CompletedBufferCount() - (num_dma_buffers_ - 2);
+      overflow_count_ += oldest - next_sequence_;
+      next_sequence_ = oldest;
+      continue;
+    }
+    if (xSemaphoreTake(buffer_ready_, timeout) != pdTRUE &&
+        driver_->CompletedBufferCount() == next_sequence_) {
+      ++underflow_count_;
+      return false;
+    }
+  }
+}
+
+bool AudioReader::ReleaseBuffer(const AudioDmaBuffer& buffer) {
+  if (driver_->IsBufferIntact(buffer)) return true;
+  ++overflow_count_;
+  return false;
+}
+
+void AudioReader::Callback(void* ctx, const int32_t*, size_t) {
   portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
   auto* self = static_cast<AudioReader*>(ctx);
-  auto sent_size =
-      self->ring_buffer_.SendFromISR(buf, size, &xHigherPriorityTaskWoken);
-  if (size != sent_size) ++self->overflow_count_;
+  xSemaphoreGiveFromISR(self->buffer_ready_, &xHigherPriorityTaskWoken);
   portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
 AudioService::AudioService(AudioDriver* driver, const AudioDriverConfig& config,
-                           int task_priority, int drop_first_samples_ms)
+                           int task_priority, int drop_first_samples_ms,
+                           const AudioConverterOptions& converter_options)
     : driver_(driver),
       config_(config),
       drop_first_samples_(
           MsToSamples(config.sample_rate, drop_first_samples_ms)),
+      converter_options_(converter_options),
       queue_(xQueueCreate(5, sizeof(Message))) {
   CHECK(queue_);
   CHECK(xTaskCreate(StaticRun, "audio_service", configMINIMAL_STACK_SIZE * 30,
@@ -113,18 +324,38 @@ AudioService::~AudioService() {
 }
 
 int AudioService::AddCallback(void* ctx, AudioService::Callback fn) {
-  Message msg{};
-  msg.type = MessageType::kAddCallback;
-  msg.queue = xQueueCreate(1, sizeof(int));
-  msg.add.ctx = ctx;
-  msg.add.fn = fn;
-  CHECK(msg.queue);
-  CHECK(xQueueSendToBack(queue_, &msg, portMAX_DELAY) == pdTRUE);
+  return AddCallback(ctx, fn, config_.sample_rate);
+}
 
-  int id;
-  CHECK(xQueueReceive(msg.queue, &id, portMAX_DELAY) == pdTRUE);
-  vQueueDelete(msg.queue);
-  return id;
+int AudioService::AddCallback(void* ctx, AudioService::Callback fn,
+                              AudioSampleRate sample_rate) {
+  if (!DecimationFactor(config_.sample_rate, sample_rate)) return -1;
+  Subscriber subscriber{ctx, SampleFormat::kInt32, sample_rate, {}};
+  subscriber.int32_fn = fn;
+  return SendAddMessage(queue_, subscriber);
+}
+
+int AudioService::AddCallback(void* ctx, AudioService::Int16Callback fn,
+                              AudioSampleRate sample_rate) {
+  if (!DecimationFactor(config_.sample_rate, sample_rate)) return -1;
+  Subscriber subscriber{ctx, SampleFormat::kInt16, sample_rate, {}};
+  subscriber.int16_fn = fn;
+  return SendAddMessage(queue_, subscriber);
+}
+
+int AudioService::AddCallback(void* ctx, AudioService::FloatCallback fn,
+                              AudioSampleRate sample_rate) {
+  if (!DecimationFactor(config_.sample_rate, sample_rate)) return -1;
+  Subscriber subscriber{ctx, SampleFormat::kFloat, sample_rate, {}};
+  subscriber.float_fn = fn;
+  return SendAddMessage(queue_, subscriber);
+}
+
+int AudioService::AddBufferCallback(void* ctx,
+                                    AudioService::BufferCallback fn) {
+  Subscriber subscriber{ctx, SampleFormat::kBuffer, config_.sample_rate, {}};
+  subscriber.buffer_fn = fn;
+  return SendAddMessage(queue_, subscriber);
 }
 
 bool AudioService::RemoveCallback(int id) {
@@ -153,6 +384,9 @@ void AudioService::Run() const {
   std::vector<int> callbacks_to_remove;
   callbacks_to_remove.reserve(3);
 
+  std::vector<Stage> stages;
+  stages.reserve(2);
+
   std::unique_ptr<AudioReader> reader;
 
   int id_counter = 0;
@@ -164,12 +398,14 @@ void AudioService::Run() const {
       switch (msg.type) {
         case MessageType::kAddCallback: {
           int id = id_counter++;
-          callbacks.push_back({id, msg.add.ctx, msg.add.fn});
+          callbacks.push_back({id, msg.add});
+          UpdateStages(callbacks, config_, converter_options_, &stages);
           CHECK(xQueueSendToBack(msg.queue, &id, portMAX_DELAY) == pdTRUE);
         } break;
 
         case MessageType::kRemoveCallback: {
           int found = EraseCallbackById(callbacks, msg.remove.id);
+          UpdateStages(callbacks, config_, converter_options_, &stages);
           CHECK(xQueueSendToBack(msg.queue, &found, portMAX_DELAY) == pdTRUE);
         } break;
         case MessageType::kStop:
@@ -186,27 +422,86 @@ void AudioService::Run() const {
     if (!reader) {
       reader = std::make_unique<AudioReader>(driver_, config_);
       reader->Drop(drop_first_samples_);
+      for (auto& stage : stages) ResetStage(&stage);
     }
 
-    // Blocks until buffer is full or timeout.
-    auto size = reader->FillBuffer();
+    // Blocks until the next DMA buffer completes or timeout.
+    AudioDmaBuffer buffer;
+    if (!reader->AcquireBuffer(&buffer)) continue;
+
+    // Reads the DMA buffer once for all the sample callbacks, then checks
+    // that the DMA didn't overwrite it meanwhile. If it did, the samples are
+    // dropped (the reader counts an overflow) and the decimators and DC
+    // filters, whose history now holds torn samples, start over.
+    for (auto& stage : stages) Prepare(buffer, &stage);
+    const bool intact = reader->ReleaseBuffer(buffer);
+    if (!intact) {
+      for (auto& stage : stages) ResetStage(&stage);
+    }
 
     callbacks_to_remove.clear();
-    for (const auto& cb : callbacks)
-      if (!cb.fn(cb.ctx, reader->Buffer().data(), size))
-        callbacks_to_remove.push_back(cb.id);
+    for (const auto& cb : callbacks) {
+      const Subscriber& subscriber = cb.subscriber;
+      bool keep = true;
+      if (subscriber.format == SampleFormat::kBuffer) {
+        // Reads in place, and checks the buffer itself.
+        keep = subscriber.buffer_fn(subscriber.ctx, buffer);
+      } else if (intact) {
+        auto stage = std::find_if(std::begin(stages), std::end(stages),
+                                  [&subscriber](const Stage& stage) {
+                                    return stage.sample_rate ==
+                                           subscriber.sample_rate;
+                                  });
+        keep = Deliver(subscriber, *stage);
+      }
+      if (!keep) callbacks_to_remove.push_back(cb.id);
+    }
 
     for (int id : callbacks_to_remove) EraseCallbackById(callbacks, id);
+    if (!callbacks_to_remove.empty()) {
+      UpdateStages(callbacks, config_, converter_options_, &stages);
+    }
 
     if (callbacks.empty()) reader.reset();
   }
 }
 
-LatestSamples::LatestSamples(size_t num_samples)
-    : mutex_(xSemaphoreCreateMutex()), samples_(num_samples) {
-  CHECK(mutex_);
+LatestSamples::LatestSamples(size_t num_samples) : num_samples_(num_samples) {
+  // At least half a window to spare, so that readers usually finish before
+  // the writer gets back around to the samples they're reading.
+  size_t capacity = 1;
+  while (capacity < num_samples + num_samples / 2) capacity <<= 1;
+  mask_ = capacity - 1;
+  samples_.resize(capacity);
 }
 
-LatestSamples::~LatestSamples() { vSemaphoreDelete(mutex_); }
+void LatestSamples::Append(const int32_t* samples, size_t num_samples) {
+  uint32_t end = end_.load(std::memory_order_relaxed);
+  // Only the latest samples that fit in the ring are kept.
+  if (num_samples > samples_.size()) {
+    end += num_samples - samples_.size();
+    samples += num_samples - samples_.size();
+    num_samples = samples_.size();
+  }
+  reserved_.store(end + num_samples, std::memory_order_relaxed);
+  // Orders the store to `reserved_` before the sample writes.
+  std::atomic_thread_fence(std::memory_order_release);
+
+  const size_t start = end & mask_;
+  const size_t first_size = std::min(num_samples, samples_.size() - start);
+  std::copy(samples, samples + first_size, samples_.begin() + start);
+  std::copy(samples + first_size, samples + num_samples, samples_.begin());
+  end_.store(end + num_samples, std::memory_order_release);
+}
+
+void LatestSamples::CopyLatestSamples(int32_t* samples) const {
+  auto copy = [samples](const int32_t* first, size_t first_size,
+                        const int32_t* second, size_t second_size) {
+    std::copy(first, first + first_size, samples);
+    std::copy(second, second + second_size, samples + first_size);
+  };
+  // Copies again if the writer got to the window during the copy.
+  while (!AccessLatestSamples(copy)) continue;
+}
 
 }  // namespace coralmicro
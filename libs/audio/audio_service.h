@@ -18,84 +18,31 @@
 #define LIBS_AUDIO_AUDIO_SERVICE_H_
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <vector>
 
+#include "libs/audio/audio_converter.h"
+#include "libs/audio/audio_decimator.h"
 #include "libs/audio/audio_driver.h"
-#include "libs/base/mutex.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
 #include "third_party/freertos_kernel/include/semphr.h"
-#include "third_party/freertos_kernel/include/stream_buffer.h"
 
 namespace coralmicro {
 
-template <typename T>
-// @cond
-class FreeRTOSStreamBuffer {
- public:
-  FreeRTOSStreamBuffer() : handle_(nullptr) {}
-
-  ~FreeRTOSStreamBuffer() {
-    if (handle_) vStreamBufferDelete(handle_);
-  }
-
-  bool Ok() const { return handle_ != nullptr; }
-
-  void Create(size_t xBufferSize, size_t xTriggerLevel) {
-    handle_ =
-        xStreamBufferCreate(xBufferSize * sizeof(T), xTriggerLevel * sizeof(T));
-  }
-
-  size_t Send(const T* pvTxData, size_t xDataLength, TickType_t xTicksToWait) {
-    return xStreamBufferSend(handle_, pvTxData, xDataLength * sizeof(T),
-                             xTicksToWait) /
-           sizeof(T);
-  }
-
-  size_t SendFromISR(const T* pvTxData, size_t xDataLength,
-                     BaseType_t* pxHigherPriorityTaskWoken) {
-    return xStreamBufferSendFromISR(handle_, pvTxData, xDataLength * sizeof(T),
-                                    pxHigherPriorityTaskWoken) /
-           sizeof(T);
-  }
-
-  size_t Receive(T* pvRxData, size_t xBufferLength, TickType_t xTicksToWait) {
-    return xStreamBufferReceive(handle_, pvRxData, xBufferLength * sizeof(T),
-                                xTicksToWait) /
-           sizeof(T);
-  }
-
-  size_t ReceiveFromISR(void* pvRxData, size_t xBufferLength,
-                        BaseType_t* pxHigherPriorityTaskWoken) {
-    return xStreamBufferReceiveFromISR(handle_, pvRxData,
-                                       xBufferLength * sizeof(T),
-                                       pxHigherPriorityTaskWoken) /
-           sizeof(T);
-  }
-
-  BaseType_t Reset() { return xStreamBufferReset(handle_); }
-
-  BaseType_t IsEmpty() const { return xStreamBufferIsEmpty(handle_); }
-
-  BaseType_t IsFull() const { return xStreamBufferIsFull(handle_); }
-
- private:
-  StreamBufferHandle_t handle_;
-};
-// @endcond
-
 // Provides a mechanism to read audio samples from the on-board
 // microphone on-demand.
 //
-// `AudioReader` manages an internal ring buffer that copies audio samples
-// from the `AudioDriver` you provide to the constructor. You can read samples
-// from the ring buffer at any time by calling
-// `FillBuffer()`. This moves the samples into a regular buffer provided by
-// `Buffer()`, which you can then read for audio processing. Be sure you call
-// `FillBuffer()` fast enough to remove the samples from the ring buffer
-// and make room for new incoming samples. If you don't, the ring buffer will
-// overflow (incrementing `OverflowCount()`) and you'll miss audio data
-// (the ring buffer continues to write so you always get the latest audio).
+// `AudioReader` borrows each DMA buffer from the `AudioDriver` you provide to
+// the constructor as soon as it completes, without copying it in the
+// interrupt. You can read the samples in place with `AcquireBuffer()` and
+// `ReleaseBuffer()`, or copy them with `FillBuffer()`, which moves the
+// samples into a regular buffer provided by `Buffer()`. A completed DMA
+// buffer is only kept until the DMA comes back around to it, so be sure you
+// read buffers fast enough: the reader has `num_dma_buffers - 2` buffer
+// durations to finish each one. If you don't, buffers are skipped
+// (incrementing `OverflowCount()`) and you'll miss audio data (the reader
+// always catches up to the latest audio).
 //
 // The microphone remains powered as long as the `AudioReader` is in scope;
 // it powers off as soon as the `AudioReader` is destroyed.
@@ -122,17 +69,30 @@ class FreeRTOSStreamBuffer {
 // }
 // ```
 //
+// Or, to read the samples without a copy:
+//
+// ```
+// AudioDmaBuffer buffer;
+// while (true) {
+//     if (!reader.AcquireBuffer(&buffer)) continue;
+//     ProcessBuffer(buffer.samples, buffer.num_samples);
+//     if (!reader.ReleaseBuffer(buffer)) DiscardResult();
+// }
+// ```
+//
 // For a complete example, see `examples/audio_streaming/`.
 class AudioReader {
  public:
   // Constructor.
   //
   // Activates the microphone by calling `Enable()` on the given `AudioDriver`.
-  // Although the mic is then active, you must call `FillBuffer()` to capture
-  // audio into the buffer provided by `Buffer()`.
+  // Although the mic is then active, you must call `FillBuffer()` or
+  // `AcquireBuffer()` to read the audio.
   //
   // @param driver An audio driver to manage the microphone.
-  // @param config A configuration for audio samples.
+  // @param config A configuration for audio samples. Must have at least 3 DMA
+  // buffers, so that one can be read while the next one is filled, with one
+  // more for the DMA to move on to before the completion interrupt runs.
   AudioReader(AudioDriver* driver, const AudioDriverConfig& config);
 
   // Destructor.
@@ -148,10 +108,10 @@ class AudioReader {
   // Fills the audio buffer (provided by `Buffer()`) with audio samples from
   // the microphone.
   //
-  // This copies audio samples from the internal ring buffer into the
-  // buffer provided by `Buffer()` so you can safely process them. This will
-  // fetch as many samples as possible, and if you fail to call it fast enough,
-  // the internal ring buffer will overflow and increment `OverflowCount()`.
+  // This copies the next DMA buffer into the buffer provided by `Buffer()` so
+  // you can safely process them. If you fail to call it fast enough, DMA
+  // buffers are skipped and `OverflowCount()` is incremented. A buffer that
+  // is overwritten while it's copied is skipped too.
   //
   // The samples match the sample rate and size you specify with
   // `AudioDriverConfig` and pass to the `AudioReader` constructor.
@@ -160,6 +120,26 @@ class AudioReader {
   // number so you can read the correct amount from the buffer.
   size_t FillBuffer();
 
+  // Waits for the next DMA buffer and lends it without a copy.
+  //
+  // The samples stay in DMA memory, so read them before the DMA comes back
+  // around to the buffer, then call `ReleaseBuffer()`. Buffers that were
+  // overwritten before this call are skipped and counted by
+  // `OverflowCount()`.
+  //
+  // @param buffer Receives the view of the buffer. Its `sequence` tells
+  // whether buffers were skipped since the previous one.
+  // @return False if no buffer completed within twice the buffer duration.
+  bool AcquireBuffer(AudioDmaBuffer* buffer);
+
+  // Ends the use of a buffer lent by `AcquireBuffer()`.
+  //
+  // @param buffer The lent buffer.
+  // @return False if the DMA started overwriting the buffer before it was
+  // released (counted by `OverflowCount()`), in which case anything computed
+  // from its samples should be discarded.
+  bool ReleaseBuffer(const AudioDmaBuffer& buffer);
+
   // Discards microphone samples.
   //
   // You should call this before you begin collecting samples in order to avoid
@@ -169,22 +149,24 @@ class AudioReader {
   // @return Number of samples dropped.
   int Drop(int min_count) {
     int count = 0;
-    while (count < min_count) count += FillBuffer();
+    AudioDmaBuffer buffer;
+    while (count < min_count) {
+      if (AcquireBuffer(&buffer)) count += buffer.num_samples;
+    }
     return count;
   }
 
   // Gets the number of times that samples from the mic were lost, because you
-  // did not read samples fast enough with `FillBuffer()`.
+  // did not read samples fast enough.
   //
-  // @return The number of times that `FillBuffer()` did not receive the length
-  // of samples requested (the ring buffer overflowed and samples were lost).
+  // @return The number of DMA buffers that were overwritten before they were
+  // read or released.
   int OverflowCount() const { return overflow_count_; }
 
-  // Gets the number of times the buffer was not filled when reading from
-  // the internal ring buffer.
+  // Gets the number of times no DMA buffer arrived in time.
   //
-  // @return The number of times that `FillBuffer()` was called but the buffer
-  // received less than `AudioDriverConfig::dma_buffer_size_samples()`.
+  // @return The number of times that `FillBuffer()` or `AcquireBuffer()` timed
+  // out waiting for a buffer.
   int UnderflowCount() const { return underflow_count_; }
 
  private:
@@ -193,11 +175,15 @@ class AudioReader {
   AudioDriver* driver_;
 
   int dma_buffer_size_ms_;
+  uint32_t num_dma_buffers_;
   std::vector<int32_t> buffer_;
-  FreeRTOSStreamBuffer<int32_t> ring_buffer_;
+  // Given by the ISR when a DMA buffer completes.
+  SemaphoreHandle_t buffer_ready_;
+  // The sequence number of the next buffer to lend.
+  uint32_t next_sequence_ = 0;
 
-  volatile int overflow_count_ = 0;
-  volatile int underflow_count_ = 0;
+  int overflow_count_ = 0;
+  int underflow_count_ = 0;
 };
 
 // Provides a mechanism for one or more clients to continuously receive audio
@@ -205,10 +191,20 @@ class AudioReader {
 //
 // This creates a separate FreeRTOS task that's dedicated to fetching
 // audio samples from the microphone and passing reference to those audio
-// samples to one or more callbacks that you specify with `AddCallback()`.
-// `AudioService` copies audio samples from the `AudioDriver` stream buffer into
-// its own buffer (actually managed by an internal `AudioReader`) and then sends
-// a reference to this buffer to each callback.
+// samples to one or more callbacks that you specify with `AddCallback()` or
+// `AddBufferCallback()`. `AudioService` borrows each completed DMA buffer from
+// the `AudioDriver` (through an internal `AudioReader`). Buffer callbacks read
+// it in place. The samples for the other callbacks are decimated, converted or
+// (for int32 callbacks at the driver's rate) copied out of the DMA buffer
+// first, and a buffer that was overwritten while they were is dropped, so
+// those callbacks never see torn audio. The samples are only valid during the
+// callback.
+//
+// Each callback can ask for a lower sample rate than the driver's (48 kHz
+// audio can be delivered at 16 kHz) and for int16 or float samples instead of
+// the driver's int32 samples. The audio is decimated once per sample rate
+// with an `AudioDecimator` and converted once per sample format, and the
+// results are shared by all callbacks that ask for them.
 //
 // If you don't want to immediately process the audio samples inside your
 // callback, you can copy the audio samples with `LatestSamples` and then
@@ -251,6 +247,41 @@ class AudioService {
   using Callback = bool (*)(void* ctx, const int32_t* samples,
                             size_t num_samples);
 
+  // The function type that receives new audio samples as int16 values, which
+  // can be given to `AddCallback()`. The samples go through the service's
+  // `AudioConverter`, so with the default options they're the top 16 bits of
+  // the int32 samples.
+  //
+  // @param ctx Extra parameters, defined with `AddCallback()`.
+  // @param samples A pointer to the buffer.
+  // @param num_samples The number of audio samples in the buffer.
+  // @return True if the callback should be continued to be called,
+  // false otherwise.
+  using Int16Callback = bool (*)(void* ctx, const int16_t* samples,
+                                 size_t num_samples);
+
+  // The function type that receives new audio samples as float values in
+  // [-1, 1], which can be given to `AddCallback()`. The samples go through the
+  // service's `AudioConverter`.
+  //
+  // @param ctx Extra parameters, defined with `AddCallback()`.
+  // @param samples A pointer to the buffer.
+  // @param num_samples The number of audio samples in the buffer.
+  // @return True if the callback should be continued to be called,
+  // false otherwise.
+  using FloatCallback = bool (*)(void* ctx, const float* samples,
+                                 size_t num_samples);
+
+  // The function type that receives each DMA buffer as a callback, which must
+  // be given to `AddBufferCallback()`.
+  //
+  // @param ctx Extra parameters, defined with `AddBufferCallback()`.
+  // @param buffer The DMA buffer, lent for the duration of the callback. Its
+  // `sequence` numbers are consecutive unless buffers were missed.
+  // @return True if the callback should be continued to be called,
+  // false otherwise.
+  using BufferCallback = bool (*)(void* ctx, const AudioDmaBuffer& buffer);
+
   // Constructor.
   //
   // @param driver An audio driver to manage the microphone.
@@ -259,8 +290,12 @@ class AudioService {
   // dispatches audio samples to registered callbacks.
   // @param drop_first_samples_ms Amount, in milliseconds,
   // of audio to drop at the start of recording.
+  // @param converter_options The gain and DC removal for the int16 and float
+  // callbacks. The int32 and buffer callbacks get the driver's samples.
   AudioService(AudioDriver* driver, const AudioDriverConfig& config,
-               int task_priority, int drop_first_samples_ms);
+               int task_priority, int drop_first_samples_ms,
+               const AudioConverterOptions& converter_options =
+                   AudioConverterOptions());
   //@cond
   AudioService(const AudioService&) = delete;
   AudioService& operator=(const AudioService&) = delete;
@@ -278,6 +313,36 @@ class AudioService {
   // @return A unique id for the callback function.
   int AddCallback(void* ctx, Callback fn);
 
+  // Adds a callback function to receive audio samples at a given sample rate
+  // and in the format of the function's samples (int32, int16 or float).
+  //
+  // @param ctx Extra parameters to pass through to the callback function.
+  // @param fn The function to receive audio samples.
+  // @param sample_rate The sample rate to deliver. It must be the driver's
+  // sample rate, or a rate it's an integer multiple of, up to
+  // `AudioDecimator::kMaxFactor` times.
+  // @return A unique id for the callback function, or -1 if the sample rate
+  // can't be produced from the driver's.
+  int AddCallback(void* ctx, Callback fn, AudioSampleRate sample_rate);
+  // @cond
+  int AddCallback(void* ctx, Int16Callback fn, AudioSampleRate sample_rate);
+  int AddCallback(void* ctx, FloatCallback fn, AudioSampleRate sample_rate);
+  // @endcond
+
+  // Adds a callback function to receive each DMA buffer with its sequence
+  // number, which tells the callback when buffers were missed.
+  //
+  // The callback runs while the buffer is lent, so it should return well
+  // within `num_dma_buffers - 2` buffer durations. The samples are read in
+  // place, so if the callback keeps anything computed from them, it should
+  // check `AudioDriver::IsBufferIntact()` once it's done reading.
+  //
+  // @param ctx Extra parameters to pass through to the callback function.
+  // @param fn The function to receive DMA buffers.
+  // @return A unique id for the callback function, which can be given to
+  // `RemoveCallback()`.
+  int AddBufferCallback(void* ctx, BufferCallback fn);
+
   // Removes a callback function.
   //
   // @param id The id of the callback function to remove.
@@ -293,6 +358,7 @@ class AudioService {
   AudioDriver* driver_;
   AudioDriverConfig config_;
   int drop_first_samples_;
+  AudioConverterOptions converter_options_;
   TaskHandle_t task_;
   QueueHandle_t queue_;
 
@@ -307,6 +373,12 @@ class AudioService {
 // to read the copied samples instead of trying to process the samples as
 // they arrive in the callback.
 //
+// `LatestSamples` is lock-free: a single writer appends samples to a ring
+// whose capacity is a power of two with room to spare beyond `NumSamples()`,
+// and readers check after reading that the writer didn't overwrite the
+// samples they read (like a seqlock), retrying if needed. The writer never
+// waits for a reader.
+//
 // Here's an example that saves the latest 1000 ms of audio samples from
 // an `AudioService` callback into `LatestSamples`:
 //
@@ -321,16 +393,19 @@ class AudioService {
 //     });
 // ```
 //
-// Then you can directly read the latest `num_samples` saved in `LatestSamples`
-// and apply a function to them by calling `AccessLatestSamples()` (samples
-// received by the function start at `start_index`):
+// Then you can directly read the latest `NumSamples()` samples saved in
+// `LatestSamples` and apply a function to them by calling
+// `AccessLatestSamples()`. The samples are in chronological order across two
+// spans, the second of which is empty unless the window wraps around the
+// ring:
 //
 // ```
-// latest.AccessLatestSamples([](const std::vector<int32_t>& samples,
-//                               size_t start_index) {
-//     1st: [samples.begin() + start_index, samples.end())
-//     2nd: [samples.begin(),               samples.begin() + start_index)
-// });
+// bool intact = latest.AccessLatestSamples(
+//     [](const int32_t* first, size_t first_size,
+//        const int32_t* second, size_t second_size) {
+//         Process(first, first_size);
+//         Process(second, second_size);
+//     });
 // ```
 //
 // Or you can get a copy of the latest samples by calling `CopyLatestSamples()`:
@@ -349,19 +424,18 @@ class LatestSamples {
   // @cond
   LatestSamples(const LatestSamples&) = delete;
   LatestSamples& operator=(const LatestSamples&) = delete;
-  ~LatestSamples();
   // @endcond
 
   // Gets the number of samples currently saved.
   //
   // @return The number of available samples.
-  size_t NumSamples() const { return samples_.size(); };
+  size_t NumSamples() const { return num_samples_; };
 
   // Adds new audio samples to the collection.
   //
   // New samples are appended to the collection at the index
   // position where this function left off after the
-  // previous append.
+  // previous append. Must only be called by one task at a time.
   //
   // You can read these samples without a copy using
   // 'AccessLatestSamples()'. Or get them with a copy using
@@ -370,43 +444,65 @@ class LatestSamples {
   // @param samples A pointer to the buffer position from which you want to
   // begin adding samples.
   // @param num_samples The number of audio samples to add from the buffer.
-  void Append(const int32_t* samples, size_t num_samples) {
-    MutexLock lock(mutex_);
-    for (size_t i = 0; i < num_samples; ++i)
-      samples_[(pos_ + i) % samples_.size()] = samples[i];
-    pos_ = (pos_ + num_samples) % samples_.size();
-  }
+  void Append(const int32_t* samples, size_t num_samples);
 
   // Gets the latest samples without a copy and applies a function to them.
   //
-  // @param f A function to apply to samples. The function receives a reference
-  // to the samples as an `int32_t` array and the start index as `size_t`.
-  // See the example above, in the `LatestSamples` introduction.
+  // The function reads the samples while new ones may be appended, so only
+  // trust what it computed if this returns true.
+  //
+  // @param f A function to apply to samples. The function receives the
+  // `NumSamples()` latest samples, oldest first, as two spans:
+  // `(const int32_t* first, size_t first_size, const int32_t* second,
+  // size_t second_size)`. See the example above, in the `LatestSamples`
+  // introduction.
+  // @return True if no sample the function could read was overwritten while
+  // it ran.
   template <typename F>
-  void AccessLatestSamples(F f) const {
-    MutexLock lock(mutex_);
-    f(samples_, pos_);
+  bool AccessLatestSamples(F f) const {
+    const uint32_t end = end_.load(std::memory_order_acquire);
+    const size_t start = (end - num_samples_) & mask_;
+    const size_t first_size = std::min(num_samples_, samples_.size() - start);
+    f(samples_.data() + start, first_size, samples_.data(),
+      num_samples_ - first_size);
+    return IsIntact(end);
   }
 
+  // Copies the latest samples in chronological order, without allocating.
+  //
+  // @param samples Receives `NumSamples()` samples, oldest first.
+  void CopyLatestSamples(int32_t* samples) const;
+
   // Gets a copy of the latest samples.
   //
   // This ensures that the samples copied out are actually in chronological
-  // order, rather than being a raw copy of the internal array (which can have
-  // newer samples at the beginning of the array due to the index position
-  // wrapping around after multiple calls to `Append()`).
+  // order, rather than being a raw copy of the internal ring (which can have
+  // newer samples at the beginning due to the index position wrapping
+  // around after multiple calls to `Append()`).
   //
   // @return A chronological copy of the latest samples.
   std::vector<int32_t> CopyLatestSamples() const {
-    MutexLock lock(mutex_);
-    std::vector<int32_t> copy(samples_);
-    std::rotate(std::begin(copy), std::begin(copy) + pos_, std::end(copy));
+    std::vector<int32_t> copy(num_samples_);
+    CopyLatestSamples(copy.data());
     return copy;
   }
 
  private:
-  SemaphoreHandle_t mutex_;
-  size_t pos_ = 0;                // protected by mutex_;
-  std::vector<int32_t> samples_;  // protected by mutex_;
+  // Whether the window that ended at `end` was left alone by the writer.
+  bool IsIntact(uint32_t end) const {
+    // Orders the sample reads before the load of `reserved_`.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint32_t reserved = reserved_.load(std::memory_order_relaxed);
+    return reserved - end <= samples_.size() - num_samples_;
+  }
+
+  size_t num_samples_;
+  size_t mask_;
+  std::vector<int32_t> samples_;
+  // The total number of samples appended, which wraps around. `reserved_` is
+  // advanced before the writer touches the ring and `end_` after it's done.
+  std::atomic<uint32_t> reserved_{0};
+  std::atomic<uint32_t> end_{0};
 };
 
 }  // namespace coralmicro
@@ -19,6 +19,19 @@
 
 #include <cstdio>
 
+#if CORAL_MICRO_HOST
+// Host builds (such as the tests under tests/host) have no console or
+// scheduler to halt, so a failed check aborts the process.
+#include <cstdlib>
+#define CHECK(a)                                                           \
+  do {                                                                     \
+    if (!(a)) {                                                            \
+      std::fprintf(stderr, "%s:%d %s was not true.\n", __FILE__, __LINE__, \
+                   #a);                                                    \
+      std::abort();                                                        \
+    }                                                                      \
+  } while (0)
+#else
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
 #include "third_party/freertos_kernel/include/task.h"
 #include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/fsl_device_registers.h"
@@ -46,5 +59,6 @@
 #else
 #error "Unsupported platform"
 #endif
+#endif  // CORAL_MICRO_HOST
 
 #endif  // LIBS_BASE_CHECK_H_
@@ -29,6 +29,8 @@
 #include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/drivers/cm4/fsl_cache.h"
 #endif
 
+#include <algorithm>
+#include <climits>
 #include <cstring>
 #include <memory>
 
@@ -128,48 +130,77 @@ int FramebufferPtrToIndex(const uint8_t* framebuffer_ptr) {
   return -1;
 }
 
+// Geometry of a nearest neighbor resize from `src_w` x `src_h` to `dst_w` x
+// `dst_h`.
+struct ResizeGeometry {
+  ResizeGeometry(int src_w, int src_h, int dst_w, int dst_h,
+                 bool preserve_aspect) {
+    float ratio_src = (float)src_w / src_h;
+    float ratio_dst = (float)dst_w / dst_h;
+    scaled_w =
+        preserve_aspect
+            ? (ratio_dst > ratio_src ? src_w * (float)dst_h / src_h : dst_w)
+            : dst_w;
+    scaled_h =
+        preserve_aspect
+            ? (ratio_dst > ratio_src ? dst_h : src_h * (float)dst_w / src_w)
+            : dst_h;
+    ratio_x = (float)src_w / scaled_w;
+    ratio_y = (float)src_h / scaled_h;
+  }
+
+  // Gets the source row of destination row `y`, or -1 for a padding row.
+  int SourceRow(int y) const {
+    return y < scaled_h ? static_cast<int>(y * ratio_y) : -1;
+  }
+
+  int scaled_w;
+  int scaled_h;
+  float ratio_x;
+  float ratio_y;
+};
+
+// Writes a destination row of a resize into `dst`, from its source row
+// `src_row` (see `ResizeGeometry::SourceRow()`), which is null for padding.
+void ResizeNearestNeighborRow(const uint8_t* src_row,
+                              const ResizeGeometry& geometry, uint8_t* dst,
+                              int dst_w, int comps) {
+  if (!src_row) {
+    std::memset(dst, 0, dst_w * comps);
+    return;
+  }
+  for (int x = 0; x < dst_w; x++) {
+    int offset_x = static_cast<int>(x * geometry.ratio_x) * comps;
+    for (int i = 0; i < comps; i++) {
+      *dst++ = x < geometry.scaled_w ? src_row[offset_x + i] : 0;
+    }
+  }
+}
+
 void ResizeNearestNeighbor(const uint8_t* src, int src_w, int src_h,
                            uint8_t* dst, int dst_w, int dst_h, int comps,
                            bool preserve_aspect) {
+  const ResizeGeometry geometry(src_w, src_h, dst_w, dst_h, preserve_aspect);
   int src_p = src_w * comps;
   int dst_p = dst_w * comps;
-  float ratio_src = (float)src_w / src_h;
-  float ratio_dst = (float)dst_w / dst_h;
-  int scaled_w =
-      preserve_aspect
-          ? (ratio_dst > ratio_src ? src_w * (float)dst_h / src_h : dst_w)
-          : dst_w;
-  int scaled_h =
-      preserve_aspect
-          ? (ratio_dst > ratio_src ? dst_h : src_h * (float)dst_w / src_w)
-          : dst_h;
-  float ratio_x = (float)src_w / scaled_w;
-  float ratio_y = (float)src_h / scaled_h;
-
   for (int y = 0; y < dst_h; y++) {
-    if (y >= scaled_h) {
-      std::memset(dst, 0, dst_p);
-      dst += dst_p;
-      continue;
-    }
-
-    int offset_y = static_cast<int>(y * ratio_y) * src_p;
-    for (int x = 0; x < dst_w; x++) {
-      int offset_x = static_cast<int>(x * ratio_x) * comps;
-      const uint8_t* src_y = src + offset_y;
-      for (int i = 0; i < comps; i++) {
-        *dst++ = x < scaled_w ? src_y[offset_x + i] : 0;
-      }
-    }
+    const int src_y = geometry.SourceRow(y);
+    ResizeNearestNeighborRow(src_y < 0 ? nullptr : src + src_y * src_p,
+                             geometry, dst + y * dst_p, dst_w, comps);
   }
 }
 
+// Demosaics rows `y_begin` to `y_end` of `camera_raw`, calling `callback`
+// with each pixel. Pixels within two of the edges aren't demosaiced.
 template <typename Callback>
 void BayerInternal(const uint8_t* camera_raw, int width, int height,
-                   CameraFilterMethod filter, Callback callback) {
+                   CameraFilterMethod filter, Callback callback,
+                   int y_begin = 0, int y_end = INT_MAX) {
+  y_begin = std::max(y_begin, 2);
+  y_end = std::min(y_end, height - 2);
   if (filter == CameraFilterMethod::kNearestNeighbor) {
-    bool blue = true, green = false;
-    for (int y = 2; y < height - 2; y++) {
+    bool blue = (y_begin - 2) % 2 == 0, green = !blue;
+    for (int y = y_begin; y < y_end; y++) {
       int start = green ? 3 : 2;
       for (int x = start; x < width - 2; x += 2) {
         int g1x = x + 1, g1y = y;
@@ -206,8 +237,8 @@ void BayerInternal(const uint8_t* camera_raw, int width, int height,
   } else if (filter == CameraFilterMethod::kBilinear) {
     int bayer_stride = width;
 
-    size_t bayer_offset = 0;
-    for (int y = 2; y < height - 2; y++) {
+    size_t bayer_offset = (y_begin - 2) * width;
+    for (int y = y_begin; y < y_end; y++) {
       bool odd_row = y & 1;
       int x = 1;
       size_t bayer_end = bayer_offset + (width - 2);
@@ -391,69 +422,114 @@ void BayerToGrayscale(const uint8_t* camera_raw, uint8_t* camera_grayscale,
                 });
 }
 
+void RgbRowToGrayscale(const uint8_t* camera_rgb, uint8_t* camera_grayscale,
+                       int width) {
+  for (int x = 0; x < width; ++x) {
+    float r_f = static_cast<float>(camera_rgb[(x * 3) + 0]) / kUint8Max;
+    float g_f = static_cast<float>(camera_rgb[(x * 3) + 1]) / kUint8Max;
+    float b_f = static_cast<float>(camera_rgb[(x * 3) + 2]) / kUint8Max;
+    camera_grayscale[x] = static_cast<uint8_t>(
+        ((kRedCoefficient * r_f * r_f) + (kGreenCoefficient * g_f * g_f) +
+         (kBlueCoefficient * b_f * b_f)) *
+        kUint8Max);
+  }
+}
+
 void RgbToGrayscale(const uint8_t* camera_rgb, uint8_t* camera_grayscale,
                     int width, int height) {
   for (int y = 0; y < height; ++y) {
-    for (int x = 0; x < width; ++x) {
-      float r_f =
-          static_cast<float>(camera_rgb[(x * 3) + (y * width * 3) + 0]) /
-          kUint8Max;
-      float g_f =
-          static_cast<float>(camera_rgb[(x * 3) + (y * width * 3) + 1]) /
-          kUint8Max;
-      float b_f =
-          static_cast<float>(camera_rgb[(x * 3) + (y * width * 3) + 2]) /
-          kUint8Max;
-      camera_grayscale[x + (y * width)] = static_cast<uint8_t>(
-          ((kRedCoefficient * r_f * r_f) + (kGreenCoefficient * g_f * g_f) +
-           (kBlueCoefficient * b_f * b_f)) *
-          kUint8Max);
-    }
+    RgbRowToGrayscale(camera_rgb + (y * width * 3),
+                      camera_grayscale + (y * width), width);
   }
 }
 
-void AutoWhiteBalance(uint8_t* camera_rgb, int width, int height) {
-  unsigned int r_sum = 0, g_sum = 0, b_sum = 0;
-  float r_sum_f = 0.0, g_sum_f = 0.0, b_sum_f = 0.0;
-  float threshold = 0.9f;
-  uint16_t threshold16 = static_cast<uint16_t>(threshold * 255);
-  uint16_t min_rgb, max_rgb;
-  for (int i = 0; i < width * height; ++i) {
-    uint8_t r = camera_rgb[i * 3 + 0];
-    uint8_t g = camera_rgb[i * 3 + 1];
-    uint8_t b = camera_rgb[i * 3 + 2];
-    min_rgb = static_cast<uint16_t>(std::min(r, std::min(g, b)));
-    max_rgb = static_cast<uint16_t>(std::max(r, std::max(g, b)));
-    if (((max_rgb - min_rgb) * 255) > (threshold16 * max_rgb)) {
-      continue;
+// Per-channel gains of the automatic white balance, in Q8.
+struct WhiteBalanceGains {
+  uint16_t r;
+  uint16_t g;
+  uint16_t b;
+};
+
+// Accumulates the pixels that the white balance gains are computed from.
+class WhiteBalanceStats {
+ public:
+  void Add(uint8_t r, uint8_t g, uint8_t b) {
+    uint16_t min_rgb = static_cast<uint16_t>(std::min(r, std::min(g, b)));
+    uint16_t max_rgb = static_cast<uint16_t>(std::max(r, std::max(g, b)));
+    if (((max_rgb - min_rgb) * 255) > (kThreshold16 * max_rgb)) {
+      return;
     }
-    r_sum += r;
-    g_sum += g;
-    b_sum += b;
-  }
-  r_sum_f = static_cast<float>(r_sum);
-  g_sum_f = static_cast<float>(g_sum);
-  b_sum_f = static_cast<float>(b_sum);
-  float max_channel = std::max(r_sum_f, std::max(g_sum_f, b_sum_f));
-  float epsilon = 0.1;
-  float r_gain_f = r_sum_f < epsilon ? 0.0f : max_channel / r_sum_f;
-  float g_gain_f = g_sum_f < epsilon ? 0.0f : max_channel / g_sum_f;
-  float b_gain_f = b_sum_f < epsilon ? 0.0f : max_channel / b_sum_f;
-  uint16_t r_gain_i = static_cast<uint16_t>(r_gain_f * (1 << 8));
-  uint16_t g_gain_i = static_cast<uint16_t>(g_gain_f * (1 << 8));
-  uint16_t b_gain_i = static_cast<uint16_t>(b_gain_f * (1 << 8));
-  for (int i = 0; i < width * height; ++i) {
+    r_sum_ += r;
+    g_sum_ += g;
+    b_sum_ += b;
+  }
+
+  WhiteBalanceGains Gains() const {
+    float r_sum_f = static_cast<float>(r_sum_);
+    float g_sum_f = static_cast<float>(g_sum_);
+    float b_sum_f = static_cast<float>(b_sum_);
+    float max_channel = std::max(r_sum_f, std::max(g_sum_f, b_sum_f));
+    float epsilon = 0.1;
+    float r_gain_f = r_sum_f < epsilon ? 0.0f : max_channel / r_sum_f;
+    float g_gain_f = g_sum_f < epsilon ? 0.0f : max_channel / g_sum_f;
+    float b_gain_f = b_sum_f < epsilon ? 0.0f : max_channel / b_sum_f;
+    return {static_cast<uint16_t>(r_gain_f * (1 << 8)),
+            static_cast<uint16_t>(g_gain_f * (1 << 8)),
+            static_cast<uint16_t>(b_gain_f * (1 << 8))};
+  }
+
+ private:
+  static constexpr uint16_t kThreshold16 = static_cast<uint16_t>(0.9f * 255);
+  unsigned int r_sum_ = 0, g_sum_ = 0, b_sum_ = 0;
+};
+
+// Gathers white balance statistics straight from a raw frame, without
+// demosaicing: each sampled 2x2 Bayer cell (blue and green on even rows, green
+// and red on odd rows) counts as one pixel, with the mean of its two greens.
+// Only every `step`th cell of every `step`th cell row is sampled.
+WhiteBalanceStats RawWhiteBalanceStats(const uint8_t* camera_raw, int width,
+                                       int height, int step) {
+  WhiteBalanceStats stats;
+  for (int y = 0; y + 1 < height; y += 2 * step) {
+    const uint8_t* even = camera_raw + y * width;
+    const uint8_t* odd = even + width;
+    for (int x = 0; x + 1 < width; x += 2 * step) {
+      const uint8_t g = static_cast<uint8_t>(
+          (static_cast<uint32_t>(even[x + 1]) + odd[x] + 1) >> 1);
+      stats.Add(odd[x + 1], g, even[x]);
+    }
+  }
+  return stats;
+}
+
+void ApplyWhiteBalance(uint8_t* camera_rgb, int num_pixels,
+                       const WhiteBalanceGains& gains) {
+  for (int i = 0; i < num_pixels; ++i) {
     uint8_t r = camera_rgb[i * 3 + 0];
     uint8_t g = camera_rgb[i * 3 + 1];
     uint8_t b = camera_rgb[i * 3 + 2];
     camera_rgb[i * 3 + 0] = static_cast<uint8_t>(
-        std::min(255UL, (static_cast<uint32_t>(r) * r_gain_i) >> 8));
+        std::min(255UL, (static_cast<uint32_t>(r) * gains.r) >> 8));
     camera_rgb[i * 3 + 1] = static_cast<uint8_t>(
-        std::min(255UL, (static_cast<uint32_t>(g) * g_gain_i) >> 8));
+        std::min(255UL, (static_cast<uint32_t>(g) * gains.g) >> 8));
     camera_rgb[i * 3 + 2] = static_cast<uint8_t>(
-        std::min(255UL, (static_cast<uint32_t>(b) * b_gain_i) >> 8));
+        std::min(255UL, (static_cast<uint32_t>(b) * gains.b) >> 8));
   }
 }
+
+void AutoWhiteBalance(uint8_t* camera_rgb, int width, int height) {
+  WhiteBalanceStats stats;
+  for (int i = 0; i < width * height; ++i) {
+    stats.Add(camera_rgb[i * 3 + 0], camera_rgb[i * 3 + 1],
+              camera_rgb[i * 3 + 2]);
+  }
+  ApplyWhiteBalance(camera_rgb, width * height, stats.Gains());
+}
+
+void ApplyLut(const uint8_t* lut, uint8_t* data, size_t size) {
+  if (!lut) return;
+  for (size_t i = 0; i < size; ++i) data[i] = lut[data[i]];
+}
 }  // namespace
 
 extern "C" void CSI_DriverIRQHandler(void);
@@ -473,25 +549,33 @@ int CameraFormatBpp(CameraFormat fmt) {
   return 0;
 }
 
-bool CameraTask::GetFrame(const std::vector<CameraFrameFormat>& fmts) {
+int CameraTask::AcquireFrame(uint8_t** raw) {
   if (!enabled_) {
     printf("Camera is not enabled, cannot capture frame.\r\n");
-    return false;
+    return -1;
   }
   if (mode_ == CameraMode::kTrigger && !GpioGet(Gpio::kCameraTrigger)) {
     printf("Camera is in trigger mode but was never triggered\r\n");
-    return false;
+    return -1;
+  }
+  int index = GetFrame(raw, true);
+  if (!*raw) {
+    return -1;
+  }
+  if (mode_ == CameraMode::kTrigger) {
+    GpioSet(Gpio::kCameraTrigger, false);
   }
+  return index;
+}
+
+bool CameraTask::GetFrame(const std::vector<CameraFrameFormat>& fmts) {
 
   bool ret = true;
   uint8_t* raw = nullptr;
-  int index = GetFrame(&raw, true);
-  if (!raw) {
+  int index = AcquireFrame(&raw);
+  if (index < 0) {
     return false;
   }
-  if (mode_ == CameraMode::kTrigger) {
-    GpioSet(Gpio::kCameraTrigger, false);
-  }
 
   for (const CameraFrameFormat& fmt : fmts) {
     switch (fmt.fmt) {
@@ -517,6 +601,8 @@ bool CameraTask::GetFrame(const std::vector<CameraFrameFormat>& fmts) {
                                 CameraFormatBpp(CameraFormat::kRgb),
                                 fmt.preserve_ratio);
         }
+        ApplyLut(fmt.lut, fmt.buffer,
+                 fmt.width * fmt.height * CameraFormatBpp(CameraFormat::kRgb));
         break;
         case CameraFormat::kY8: {
           if (fmt.width == kWidth && fmt.height == kHeight) {
@@ -536,6 +622,8 @@ bool CameraTask::GetFrame(const std::vector<CameraFrameFormat>& fmts) {
             RgbToGrayscale(buffer_rgb_scaled.get(), fmt.buffer, fmt.width,
                            fmt.height);
           }
+          ApplyLut(fmt.lut, fmt.buffer,
+                   fmt.width * fmt.height * CameraFormatBpp(CameraFormat::kY8));
         } break;
         case CameraFormat::kRaw:
           if (fmt.width != kWidth || fmt.height != kHeight) {
@@ -556,6 +644,160 @@ bool CameraTask::GetFrame(const std::vector<CameraFrameFormat>& fmts) {
   return ret;
 }
 
+CameraFrameStream::~CameraFrameStream() { Release(); }
+
+bool CameraFrameStream::Capture(const CameraFrameFormat& fmt) {
+  if (fmt.fmt != CameraFormat::kRgb && fmt.fmt != CameraFormat::kY8) {
+    printf("CameraFrameStream only supports RGB and Y8\r\n");
+    return false;
+  }
+  Release();
+  full_frame_ = false;
+  fmt_ = fmt;
+  fmt_.buffer = nullptr;
+  row_.resize(fmt.width * CameraFormatBpp(fmt.fmt));
+  rgb_row_.resize(fmt.width * CameraFormatBpp(CameraFormat::kRgb));
+  row_y_ = -1;
+  native_row_.resize(CameraTask::kWidth * CameraFormatBpp(CameraFormat::kRgb));
+  native_row_y_ = -1;
+
+  int index = CameraTask::GetSingleton()->AcquireFrame(&raw_);
+  if (index < 0) {
+    raw_ = nullptr;
+    return false;
+  }
+  raw_index_ = index;
+
+  // Like `CameraTask::GetFrame()`, grayscale images aren't white balanced.
+  white_balance_ =
+      fmt.fmt == CameraFormat::kRgb && fmt.white_balance &&
+      CameraTask::GetSingleton()->test_pattern_ == CameraTestPattern::kNone;
+
+  if (fmt.rotation == CameraRotation::k90 ||
+      fmt.rotation == CameraRotation::k270) {
+    // Each row of the image is a column of the sensor, so the whole frame is
+    // demosaiced now.
+    const size_t rgb_size = CameraFormatBpp(CameraFormat::kRgb) *
+                            CameraTask::kWidth * CameraTask::kHeight;
+    if (!rgb_) rgb_ = std::make_unique<uint8_t[]>(rgb_size);
+    BayerToRgb(raw_, rgb_.get(), CameraTask::kWidth, CameraTask::kHeight,
+               fmt.filter, fmt.rotation);
+    if (white_balance_) {
+      AutoWhiteBalance(rgb_.get(), CameraTask::kWidth, CameraTask::kHeight);
+    }
+    Release();
+    full_frame_ = true;
+    return true;
+  }
+
+  // Otherwise rows are demosaiced from the raw frame as they are read. The
+  // white balance gains are estimated from a sparse sample of the raw Bayer
+  // cells, so nothing here touches every pixel.
+  if (white_balance_) {
+    constexpr int kWhiteBalanceStep = 4;
+    const WhiteBalanceGains gains =
+        RawWhiteBalanceStats(raw_, CameraTask::kWidth, CameraTask::kHeight,
+                             kWhiteBalanceStep)
+            .Gains();
+    gains_ = {gains.r, gains.g, gains.b};
+  }
+  return true;
+}
+
+void CameraFrameStream::Release() {
+  if (raw_index_ >= 0) {
+    CameraTask::GetSingleton()->ReturnFrame(raw_index_);
+  }
+  raw_index_ = -1;
+  raw_ = nullptr;
+}
+
+size_t CameraFrameStream::size() const {
+  return fmt_.width * fmt_.height * CameraFormatBpp(fmt_.fmt);
+}
+
+const uint8_t* CameraFrameStream::NativeRow(int y) {
+  const int rgb_bpp = CameraFormatBpp(CameraFormat::kRgb);
+  if (full_frame_) {
+    return rgb_.get() + y * CameraTask::kWidth * rgb_bpp;
+  }
+  if (native_row_y_ == y) {
+    return native_row_.data();
+  }
+
+  // With a rotation of 0 or 180 degrees, each row of the image is demosaiced
+  // from a single row of the sensor.
+  std::fill(native_row_.begin(), native_row_.end(), 0);
+  const int sensor_y = fmt_.rotation == CameraRotation::k180
+                           ? static_cast<int>(CameraTask::kHeight) - y
+                           : y;
+  uint8_t* row = native_row_.data();
+  const CameraRotation rotation = fmt_.rotation;
+  BayerInternal(
+      raw_, CameraTask::kWidth, CameraTask::kHeight, fmt_.filter,
+      [row, rotation](int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+        int rot_x, rot_y;
+        RotateXY(rotation, x, y, &rot_x, &rot_y);
+        row[rot_x * 3 + 0] = r;
+        row[rot_x * 3 + 1] = g;
+        row[rot_x * 3 + 2] = b;
+      },
+      sensor_y, sensor_y + 1);
+  if (white_balance_) {
+    ApplyWhiteBalance(row, CameraTask::kWidth,
+                      {gains_[0], gains_[1], gains_[2]});
+  }
+  native_row_y_ = y;
+  return row;
+}
+
+void CameraFrameStream::ConvertRow(int y, uint8_t* dest) {
+  const bool native = fmt_.width == static_cast<int>(CameraTask::kWidth) &&
+                      fmt_.height == static_cast<int>(CameraTask::kHeight);
+  const int rgb_bpp = CameraFormatBpp(CameraFormat::kRgb);
+  uint8_t* rgb_row = fmt_.fmt == CameraFormat::kRgb ? dest : rgb_row_.data();
+  if (native) {
+    std::memcpy(rgb_row, NativeRow(y), CameraTask::kWidth * rgb_bpp);
+  } else {
+    const ResizeGeometry geometry(CameraTask::kWidth, CameraTask::kHeight,
+                                  fmt_.width, fmt_.height,
+                                  fmt_.preserve_ratio);
+    const int src_y = geometry.SourceRow(y);
+    ResizeNearestNeighborRow(src_y < 0 ? nullptr : NativeRow(src_y), geometry,
+                             rgb_row, fmt_.width, rgb_bpp);
+  }
+  if (fmt_.fmt == CameraFormat::kY8) {
+    RgbRowToGrayscale(rgb_row, dest, fmt_.width);
+  }
+  ApplyLut(fmt_.lut, dest, fmt_.width * CameraFormatBpp(fmt_.fmt));
+}
+
+bool CameraFrameStream::Read(uint8_t* dest, uint32_t offset, uint32_t length) {
+  if ((!full_frame_ && !raw_) || offset + length > size()) {
+    return false;
+  }
+  const uint32_t row_size = row_.size();
+  while (length > 0) {
+    const int y = offset / row_size;
+    const uint32_t x = offset % row_size;
+    const uint32_t count = std::min(row_size - x, length);
+    if (count == row_size) {
+      ConvertRow(y, dest);
+    } else {
+      // Rows split between two reads are converted once and kept.
+      if (row_y_ != y) {
+        ConvertRow(y, row_.data());
+        row_y_ = y;
+      }
+      std::memcpy(dest, row_.data() + x, count);
+    }
+    dest += count;
+    offset += count;
+    length -= count;
+  }
+  return true;
+}
+
 bool CameraTask::Read(uint16_t reg, uint8_t* val) {
   lpi2c_master_transfer_t transfer;
   transfer.flags = kLPI2C_TransferDefaultFlag;
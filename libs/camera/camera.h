@@ -17,8 +17,10 @@
 #ifndef LIBS_CAMERA_CAMERA_H_
 #define LIBS_CAMERA_CAMERA_H_
 
+#include <array>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <vector>
 
 #include "libs/base/queue_task.h"
@@ -212,6 +214,11 @@ struct CameraFrameFormat {
   uint8_t* buffer;
   // Set true to perform auto whitebalancing (default), false to disable it.
   bool white_balance = true;
+  // Optional 256-entry table applied to every byte of an RGB or Y8 image as
+  // it is produced, such as `tensorflow::ClassificationPreprocessor::lut()`
+  // to capture straight into a model's quantized input. The table must stay
+  // valid while frames are captured with this format.
+  const uint8_t* lut = nullptr;
 };
 
 // Provides access to the Dev Board Micro camera.
@@ -317,6 +324,10 @@ class CameraTask
   static constexpr size_t kHeight = 324;
 
  private:
+  friend class CameraFrameStream;
+  // Gets the next raw frame, which must be given back with `ReturnFrame()`.
+  // @return The frame's index, or -1 if no frame can be captured.
+  int AcquireFrame(uint8_t** raw);
   int GetFrame(uint8_t** buffer, bool block);
   void ReturnFrame(int index);
   void TaskInit() override;
@@ -344,6 +355,85 @@ class CameraTask
   bool enabled_{false};
 };
 
+// Captures a frame and converts it to a `CameraFrameFormat` in byte ranges on
+// demand, so the image can be consumed while it is produced instead of being
+// converted into a full buffer first. For example, this streams a camera
+// frame to the Edge TPU, resizing each chunk of the model input while the
+// previous chunk is sent over USB:
+//
+// ```
+// CameraFrameStream stream;
+// stream.Capture(fmt);
+// ScopedTpuInputProducer producer(
+//     interpreter->input(0),
+//     [&stream](uint8_t* buffer, uint32_t offset, uint32_t length) {
+//       return stream.Read(buffer, offset, length);
+//     });
+// interpreter->Invoke();
+// ```
+class CameraFrameStream {
+ public:
+  CameraFrameStream() = default;
+  ~CameraFrameStream();
+  CameraFrameStream(const CameraFrameStream&) = delete;
+  CameraFrameStream& operator=(const CameraFrameStream&) = delete;
+
+  // Captures a frame, which is then converted as it is read.
+  //
+  // With no rotation or a rotation of 180 degrees, the stream holds on to the
+  // camera's raw frame buffer and demosaics each row when it is read, so no
+  // frame-sized buffer is needed. White balance gains are estimated from a
+  // sample of the raw Bayer cells, 1/16 of them, rather than from the
+  // demosaiced frame. The raw frame is returned to the camera by
+  // `Release()`, the next `Capture()` or the destructor. Rotations of 90 and
+  // 270 degrees demosaic (and white balance) the whole frame here, into a
+  // native resolution RGB buffer that is allocated on first use and kept.
+  //
+  // @param fmt The output format. Only `kRgb` and `kY8` are supported, and
+  // `fmt.buffer` is ignored.
+  // @return True on success, false otherwise.
+  bool Capture(const CameraFrameFormat& fmt);
+
+  // Writes bytes `offset` to `offset + length` of the converted image.
+  //
+  // @param dest The destination buffer.
+  // @param offset The first byte of the image to write.
+  // @param length The number of bytes to write.
+  // @return True on success, false if no frame is captured (or it was
+  // released) or the range is outside of the image.
+  bool Read(uint8_t* dest, uint32_t offset, uint32_t length);
+
+  // Returns the raw frame held since `Capture()` to the camera.
+  void Release();
+
+  // Gets the size in bytes of the converted image.
+  size_t size() const;
+
+ private:
+  // Gets row `y` of the demosaiced, rotated and white balanced image at
+  // native resolution.
+  const uint8_t* NativeRow(int y);
+  void ConvertRow(int y, uint8_t* dest);
+
+  CameraFrameFormat fmt_;
+  // The raw frame held from the camera, and its index.
+  uint8_t* raw_ = nullptr;
+  int raw_index_ = -1;
+  // Whether the whole frame was converted into `rgb_` by `Capture()`.
+  bool full_frame_ = false;
+  std::unique_ptr<uint8_t[]> rgb_;
+  bool white_balance_ = false;
+  // White balance gains, in Q8.
+  std::array<uint16_t, 3> gains_{};
+  // The native resolution row `native_row_y_`.
+  std::vector<uint8_t> native_row_;
+  int native_row_y_ = -1;
+  // The converted row `row_y_`, kept for reads that end mid-row.
+  std::vector<uint8_t> row_;
+  int row_y_ = -1;
+  std::vector<uint8_t> rgb_row_;
+};
+
 }  // namespace coralmicro
 
 #endif  // LIBS_CAMERA_CAMERA_H_
@@ -16,12 +16,38 @@
 
 #include "libs/tensorflow/audio_models.h"
 
+#include <algorithm>
+
 #include "libs/base/check.h"
-#include "libs/base/filesystem.h"
-#include "libs/tpu/edgetpu_op.h"
+#include "libs/tensorflow/audio_requantize.h"
 #include "third_party/tflite-micro/tensorflow/lite/micro/micro_interpreter.h"
 
 namespace coralmicro::tensorflow {
+namespace {
+// Runs the frontend on `num_samples` samples and writes the slices to
+// `features`, dropping slices beyond `capacity`.
+void RunFrontend(const int16_t* audio_data, size_t num_samples,
+                 FrontendState* frontend_state, int16_t* features,
+                 size_t capacity) {
+  size_t count = 0;
+  while (num_samples > 0) {
+    size_t num_samples_read;
+    auto frontend_output = FrontendProcessSamples(
+        frontend_state, audio_data, num_samples, &num_samples_read);
+    audio_data += num_samples_read;
+    num_samples -= num_samples_read;
+    // A frontend that wasn't reset can produce an extra slice from samples
+    // left over from the previous window; it doesn't fit.
+    if (frontend_output.values != nullptr &&
+        count + frontend_output.size <= capacity) {
+      std::copy(frontend_output.values,
+                frontend_output.values + frontend_output.size,
+                features + count);
+      count += frontend_output.size;
+    }
+  }
+}
+}  // namespace
 
 bool PrepareAudioFrontEnd(FrontendState* frontend_state,
                           AudioModel model_type) {
@@ -66,55 +92,168 @@ bool PrepareAudioFrontEnd(FrontendState* frontend_state,
   return true;
 }
 
-void YamNetPreprocessInput(const int16_t* audio_input,
+bool YamNetPreprocessInput(const int16_t* audio_input,
                            TfLiteTensor* input_tensor,
                            FrontendState* frontend_state) {
   CHECK(input_tensor);
-  // Run frontend process for raw audio data.
-  // TODO(michaelbrooks): Properly slice the data so that we don't need to
-  // re-run the frontend on windows we've already processed.
+  // Run frontend process for raw audio data. This re-runs the frontend on
+  // the whole window; `AudioFrontendStream` only processes new audio.
   std::vector<int16_t> feature_buffer(kYamnetFeatureElementCount);
   PreprocessAudioInput(audio_input, frontend_state, kYAMNet, feature_buffer,
                        kYamnetAudioSize);
-
-  // Converts the int16_t raw_audio input to float spectrogram.
-  auto* input = tflite::GetTensorData<float>(input_tensor);
-  // Determine the offset and scalar based on the calculated data.
-  // TODO(michaelbrooks): This likely isn't needed, the values are always
-  // around the same. Can likely hard code.
-  constexpr float kExpectedSpectraMax = 3.5f;
-  const auto [min, max] =
-      std::minmax_element(std::begin(feature_buffer), std::end(feature_buffer));
-  int offset = (*max + *min) / 2;
-  float scalar = kExpectedSpectraMax / (*max - offset);
-  for (int i = 0; i < kYamnetFeatureElementCount; ++i) {
-    input[i] = (static_cast<float>(feature_buffer[i]) - offset) * scalar;
-  }
+  return AudioFeatureNormalizer(kYAMNet).Normalize(feature_buffer.data(),
+                                                  input_tensor);
 }
 
-void KeywordDetectorPreprocessInput(const int16_t* audio_data,
+bool KeywordDetectorPreprocessInput(const int16_t* audio_data,
                                     TfLiteTensor* input_tensor,
                                     FrontendState* frontend_state) {
   CHECK(input_tensor);
-  // Run frontend process for raw audio data.
-  // TODO(michaelbrooks): Properly slice the data so that we don't need to
-  // re-run the frontend on windows we've already processed.
+  // Run frontend process for raw audio data. This re-runs the frontend on
+  // the whole window; `AudioFrontendStream` only processes new audio.
   std::vector<int16_t> feature_buffer(kKeywordDetectorFeatureElementCount);
-  PreprocessAudioInput(audio_data, frontend_state, kYAMNet, feature_buffer,
-                       kKeywordDetectorAudioSize);
+  PreprocessAudioInput(audio_data, frontend_state, kKeywordDetector,
+                       feature_buffer, kKeywordDetectorAudioSize);
+  return AudioFeatureNormalizer(kKeywordDetector)
+      .Normalize(feature_buffer.data(), input_tensor);
+}
+
+AudioFrontendStream::~AudioFrontendStream() {
+  if (initialized_) FrontendFreeStateContents(&state_);
+}
+
+bool AudioFrontendStream::Init(AudioModel model_type) {
+  if (initialized_) {
+    FrontendFreeStateContents(&state_);
+    initialized_ = false;
+  }
+  if (!PrepareAudioFrontEnd(&state_, model_type)) return false;
+  initialized_ = true;
+  model_type_ = model_type;
+  if (model_type == kYAMNet) {
+    slice_size_ = kYamnetFeatureSliceSize;
+    slice_count_ = kYamnetFeatureSliceCount;
+  } else {
+    slice_size_ = kKeywordDetectorFeatureSliceSize;
+    slice_count_ = kKeywordDetectorFeatureSliceCount;
+  }
+  slices_.fill(0);
+  next_slice_ = 0;
+  num_slices_ = 0;
+  return true;
+}
+
+void AudioFrontendStream::AddSamples(const int16_t* samples,
+                                     size_t num_samples) {
+  CHECK(initialized_);
+  while (num_samples > 0) {
+    size_t num_samples_read;
+    auto frontend_output = FrontendProcessSamples(&state_, samples, num_samples,
+                                                  &num_samples_read);
+    samples += num_samples_read;
+    num_samples -= num_samples_read;
+    if (frontend_output.values == nullptr) continue;
+
+    // Write the slice to both copies of the ring.
+    int16_t* slice = slices_.data() + next_slice_ * slice_size_;
+    std::copy(frontend_output.values, frontend_output.values + slice_size_,
+              slice);
+    std::copy(slice, slice + slice_size_,
+              slice + slice_count_ * slice_size_);
+    next_slice_ = (next_slice_ + 1) % slice_count_;
+    num_slices_ = std::min(num_slices_ + 1, slice_count_);
+  }
+}
 
-  auto* input = tflite::GetTensorData<uint8>(input_tensor);
+bool AudioFrontendStream::CopyFeatures(int16_t* features) const {
+  CHECK(features);
+  if (!full()) return false;
+  const int16_t* window = this->features();
+  std::copy(window, window + slice_count_ * slice_size_, features);
+  return true;
+}
+
+void AudioFrontendStream::Reset() {
+  CHECK(initialized_);
+  FrontendReset(&state_);
+  slices_.fill(0);
+  next_slice_ = 0;
+  num_slices_ = 0;
+}
 
-  const auto [min, max] =
-      std::minmax_element(std::begin(feature_buffer), std::end(feature_buffer));
+bool AudioFeatureNormalizer::Normalize(const int16_t* features,
+                                       TfLiteTensor* input_tensor) const {
+  CHECK(input_tensor);
+  const bool yamnet = model_type_ == kYAMNet;
+  const size_t count = yamnet ? kYamnetFeatureElementCount
+                              : kKeywordDetectorFeatureElementCount;
+  const TfLiteType type = yamnet ? kTfLiteFloat32 : kTfLiteUInt8;
+  const size_t element_size = yamnet ? sizeof(float) : sizeof(uint8_t);
+  if (input_tensor->type != type ||
+      input_tensor->bytes != count * element_size) {
+    printf("Audio input tensor doesn't match the model\r\n");
+    return false;
+  }
 
-  float scale = static_cast<float>(*max - *min) / 256.0f;
+  const auto [min_it, max_it] = std::minmax_element(features, features + count);
+  const int min = *min_it;
+  const int max = *max_it;
+  if (yamnet) {
+    auto* input = tflite::GetTensorData<float>(input_tensor);
+    // Determine the offset and scalar based on the calculated data.
+    // TODO(michaelbrooks): This likely isn't needed, the values are always
+    // around the same. Can likely hard code.
+    constexpr float kExpectedSpectraMax = 3.5f;
+    const int offset = (max + min) / 2;
+    if (max == offset) {
+      std::fill(input, input + count, 0.0f);
+      return true;
+    }
+    const float scalar = kExpectedSpectraMax / (max - offset);
+    for (size_t i = 0; i < count; ++i) {
+      input[i] = (static_cast<float>(features[i]) - offset) * scalar;
+    }
+    return true;
+  }
 
-  for (int i = 0; i < kKeywordDetectorFeatureElementCount; ++i) {
-    // This conversion allows for requantization from int16 to uint8
-    input[i] = static_cast<uint8_t>(
-        static_cast<float>(feature_buffer[i] - *min) / scale);
+  // Requantizes from int16 to uint8 over the feature range. The top of the
+  // range maps to 256, which is clamped to 255.
+  auto* input = tflite::GetTensorData<uint8_t>(input_tensor);
+  if (max == min) {
+    std::fill(input, input + count, 0);
+    return true;
   }
+  RequantizeFeatures(features, count, min, max, input);
+  return true;
+}
+
+bool AudioFeatureNormalizer::Normalize(const AudioFrontendStream& stream,
+                                       TfLiteTensor* input_tensor) const {
+  CHECK(stream.full());
+  CHECK(stream.model_type() == model_type_);
+  return Normalize(stream.features(), input_tensor);
+}
+
+AudioPreprocessor::~AudioPreprocessor() {
+  if (initialized_) FrontendFreeStateContents(&state_);
+}
+
+bool AudioPreprocessor::Init() {
+  if (initialized_) return true;
+  initialized_ = PrepareAudioFrontEnd(&state_, model_type_);
+  return initialized_;
+}
+
+bool AudioPreprocessor::Preprocess(const int16_t* audio_data,
+                                   TfLiteTensor* input_tensor) {
+  CHECK(initialized_);
+  const bool yamnet = model_type_ == kYAMNet;
+  FrontendReset(&state_);
+  RunFrontend(audio_data, yamnet ? kYamnetAudioSize : kKeywordDetectorAudioSize,
+              &state_, features_.data(),
+              yamnet ? kYamnetFeatureElementCount
+                     : kKeywordDetectorFeatureElementCount);
+  return normalizer_.Normalize(features_.data(), input_tensor);
 }
 
 void PreprocessAudioInput(const int16_t* audio_data,
@@ -122,24 +261,8 @@ void PreprocessAudioInput(const int16_t* audio_data,
                           std::vector<int16_t>& feature_buffer,
                           size_t num_samples) {
   CHECK(frontend_state);
-  // Run frontend process for raw audio data.
-  // TODO(michaelbrooks): Properly slice the data so that we don't need to
-  // re-run the frontend on windows we've already processed.
-  size_t num_samples_remaining = num_samples;
-  auto* raw_audio = audio_data;
-  int count = 0;
-  while (num_samples_remaining > 0) {
-    size_t num_samples_read;
-    auto frontend_output = FrontendProcessSamples(
-        frontend_state, raw_audio, num_samples_remaining, &num_samples_read);
-    raw_audio += num_samples_read;
-    num_samples_remaining -= num_samples_read;
-    if (frontend_output.values != nullptr) {
-      for (size_t i = 0; i < frontend_output.size; ++i) {
-        feature_buffer[count++] = frontend_output.values[i];
-      }
-    }
-  }
+  RunFrontend(audio_data, num_samples, frontend_state, feature_buffer.data(),
+              feature_buffer.size());
 }
 
 }  // namespace coralmicro::tensorflow
@@ -17,6 +17,7 @@
 #ifndef LIBS_YAMNET_YAMNET_H_
 #define LIBS_YAMNET_YAMNET_H_
 
+#include <array>
 #include <vector>
 
 #include "libs/tensorflow/classification.h"
@@ -61,6 +62,13 @@ inline constexpr int kKeywordDetectorFeatureElementCount =
 inline constexpr int kKeywordDetectorFeatureSliceStrideMs = 10;
 inline constexpr int kKeywordDetectorFeatureSliceDurationMs = 25;
 
+// The number of features of the largest supported model, which sizes the
+// feature storage of `AudioFrontendStream` and `AudioPreprocessor`.
+inline constexpr int kMaxAudioFeatureElementCount =
+    kYamnetFeatureElementCount > kKeywordDetectorFeatureElementCount
+        ? kYamnetFeatureElementCount
+        : kKeywordDetectorFeatureElementCount;
+
 // Sets up the MicroMutableOpResolver with ops required for YamNet.
 //
 // @tparam tForTpu If true the Resolver will be setup for TPU else CPU.
@@ -97,26 +105,196 @@ bool PrepareAudioFrontEnd(FrontendState* frontend_state, AudioModel model_type);
 
 // Performs input preprocessing to convert raw input to spectrogram.
 //
+// This allocates the spectrogram on each call; `AudioPreprocessor` keeps it
+// in its own storage instead.
+//
 // @param audio_data An array of signed int16 audio data.
 // @param input_tensor The tensor where the preprocessed spectrogram data
 // is stored.
 // @param frontend_state The populated frontend state that you want to
 // preprocess the input tensor, must not be nullptr.
-void YamNetPreprocessInput(const int16_t* audio_data,
+// @return False if the tensor's type or size doesn't match the model.
+bool YamNetPreprocessInput(const int16_t* audio_data,
                            TfLiteTensor* input_tensor,
                            FrontendState* frontend_state);
 
 // Performs input preprocessing to convert raw audio input to spectrogram.
 //
+// This allocates the spectrogram on each call; `AudioPreprocessor` keeps it
+// in its own storage instead.
+//
 // @param audio_data An array of signed int16 audio data.
 // @param input_tensor The tensor you want to pre-process for a TensorFlow
 // model, must not be nullptr.
 // @param frontend_state The populated frontend state that you want to
 // preprocess the input tensor, must not be nullptr.
-void KeywordDetectorPreprocessInput(const int16_t* audio_data,
+// @return False if the tensor's type or size doesn't match the model.
+bool KeywordDetectorPreprocessInput(const int16_t* audio_data,
                                     TfLiteTensor* input_tensor,
                                     FrontendState* frontend_state);
 
+// Keeps the spectrogram of a sliding audio window up to date as audio
+// arrives, so that each inference only runs the frontend on the samples added
+// since the previous one, instead of on the whole window.
+//
+// Feature slices are kept in a ring of `slice_count()` slices. The frontend
+// configured by `PrepareAudioFrontEnd()` has noise reduction and PCAN gain
+// control disabled, so each slice depends only on its own window of audio, and
+// the slices match those `PreprocessAudioInput()` computes for a window that
+// starts on a slice boundary.
+//
+// The slices are stored in the object, sized for the largest supported model,
+// so the stream doesn't allocate after `Init()`. It is about 25 KB, so
+// allocate it statically rather than on a task stack.
+//
+// This class is not thread-safe. If samples are added from an `AudioService`
+// callback, guard `AddSamples()` and the reads with a mutex, and use
+// `CopyFeatures()` so the lock isn't held while the features are normalized.
+class AudioFrontendStream {
+ public:
+  AudioFrontendStream() = default;
+  // @cond
+  AudioFrontendStream(const AudioFrontendStream&) = delete;
+  AudioFrontendStream& operator=(const AudioFrontendStream&) = delete;
+  ~AudioFrontendStream();
+  // @endcond
+
+  // Prepares the frontend and the slice ring for `model_type`. Must be called
+  // before any other function.
+  //
+  // @param model_type The type of audio model.
+  // @return true on `FrontendPopulateState()` success, else false.
+  bool Init(AudioModel model_type);
+
+  // Runs the frontend on new audio samples. Each completed slice replaces the
+  // oldest one.
+  //
+  // @param samples The new samples, at the model's sample rate.
+  // @param num_samples The number of samples.
+  void AddSamples(const int16_t* samples, size_t num_samples);
+
+  // Clears the slices and the frontend state, for example after a gap in the
+  // audio.
+  void Reset();
+
+  // Whether a full window of slices has been computed.
+  bool full() const { return num_slices_ == slice_count_; }
+
+  // Gets the window's features, `slice_count() * slice_size()` values with the
+  // oldest slice first. Valid until the next call to `AddSamples()`.
+  const int16_t* features() const {
+    return slices_.data() + next_slice_ * slice_size_;
+  }
+
+  // Copies the window's features, oldest slice first.
+  //
+  // @param features The destination, with room for `slice_count() *
+  //   slice_size()` values.
+  // @return False if the stream isn't `full()`, in which case nothing is
+  //   copied.
+  bool CopyFeatures(int16_t* features) const;
+
+  // The model type given to `Init()`.
+  AudioModel model_type() const { return model_type_; }
+  // The number of feature slices in the window.
+  size_t slice_count() const { return slice_count_; }
+  // The number of values in each feature slice.
+  size_t slice_size() const { return slice_size_; }
+
+ private:
+  FrontendState state_{};
+  bool initialized_ = false;
+  AudioModel model_type_ = kYAMNet;
+  size_t slice_size_ = 0;
+  size_t slice_count_ = 0;
+  // The ring of slices, stored twice in a row so the window is always
+  // contiguous.
+  std::array<int16_t, 2 * kMaxAudioFeatureElementCount> slices_;
+  // The ring index of the oldest slice, which the next slice replaces.
+  size_t next_slice_ = 0;
+  size_t num_slices_ = 0;
+};
+
+// Converts frontend features into a model's input tensor, scaled by the range
+// of the features in the window, without allocating.
+//
+// YAMNet features are centered and scaled to floats in [-3.5, 3.5]. Keyword
+// detector features are requantized to uint8 over their range with a
+// fixed-point reciprocal of the range, read from a table built at compile
+// time, so each feature costs a multiply and a shift. The object holds no
+// buffers and is cheap to create on the stack.
+class AudioFeatureNormalizer {
+ public:
+  // @param model_type The model whose input tensor is written.
+  explicit AudioFeatureNormalizer(AudioModel model_type)
+      : model_type_(model_type) {}
+
+  // Writes the normalized features into the input tensor.
+  //
+  // @param features The features of a full window, as produced by the
+  //   frontend for the normalizer's model.
+  // @param input_tensor The model's input tensor.
+  // @return False if the tensor's type or size doesn't match the model.
+  bool Normalize(const int16_t* features, TfLiteTensor* input_tensor) const;
+
+  // Same as above, for the features of a `full()` stream initialized for the
+  // normalizer's model.
+  bool Normalize(const AudioFrontendStream& stream,
+                 TfLiteTensor* input_tensor) const;
+
+  // The model type given to the constructor.
+  AudioModel model_type() const { return model_type_; }
+
+ private:
+  AudioModel model_type_;
+};
+
+// Converts whole windows of raw audio into a model's input tensor, like
+// `YamNetPreprocessInput()` and `KeywordDetectorPreprocessInput()`, but with
+// the frontend state, the spectrogram and the normalizer owned by the object.
+// The spectrogram is sized for the largest supported model, so preprocessing
+// doesn't allocate after `Init()`. The object is about 15 KB, so allocate it
+// statically rather than on a task stack.
+//
+// To process a continuous stream of audio, `AudioFrontendStream` avoids
+// re-running the frontend on the overlapping part of consecutive windows.
+class AudioPreprocessor {
+ public:
+  // @param model_type The model whose input tensor is written.
+  explicit AudioPreprocessor(AudioModel model_type)
+      : model_type_(model_type), normalizer_(model_type) {}
+  // @cond
+  AudioPreprocessor(const AudioPreprocessor&) = delete;
+  AudioPreprocessor& operator=(const AudioPreprocessor&) = delete;
+  ~AudioPreprocessor();
+  // @endcond
+
+  // Prepares the frontend. Must be called before `Preprocess()`.
+  //
+  // @return true on `FrontendPopulateState()` success, else false.
+  bool Init();
+
+  // Converts a window of audio into the input tensor. The frontend is reset
+  // first, so consecutive windows don't need to be contiguous.
+  //
+  // @param audio_data The window's samples, `kYamnetAudioSize` or
+  //   `kKeywordDetectorAudioSize` signed int16 values at the model's sample
+  //   rate.
+  // @param input_tensor The model's input tensor.
+  // @return False if the tensor's type or size doesn't match the model.
+  bool Preprocess(const int16_t* audio_data, TfLiteTensor* input_tensor);
+
+  // The model type given to the constructor.
+  AudioModel model_type() const { return model_type_; }
+
+ private:
+  AudioModel model_type_;
+  FrontendState state_{};
+  bool initialized_ = false;
+  std::array<int16_t, kMaxAudioFeatureElementCount> features_;
+  AudioFeatureNormalizer normalizer_;
+};
+
 // @cond
 void PreprocessAudioInput(const int16_t* audio_data,
                           FrontendState* frontend_state, AudioModel model_type,
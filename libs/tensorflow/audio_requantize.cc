@@ -0,0 +1,71 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "libs/tensorflow/audio_requantize.h"
+
+#include <array>
+
+namespace coralmicro::tensorflow {
+namespace {
+// Features are requantized to `floor(value * 256 / range)`, where `value` is
+// in [0, range], as `(value * scale) >> shift` with
+// `scale = ceil(2^(shift + 8) / range)`. The rounding error of the scale is
+// below `1 / range` as long as `2^shift > range^2`, so the result is exact
+// with a shift of 22 for ranges below `kScaleTableSize`, and a shift of 33
+// for any int16 range.
+struct RequantizeScale {
+  uint32_t scale;
+  int shift;
+};
+
+constexpr int kScaleTableSize = 2048;
+constexpr int kTableShift = 22;
+constexpr int kWideShift = 33;
+
+constexpr uint32_t ReciprocalScale(uint32_t range, int shift) {
+  return static_cast<uint32_t>(((uint64_t{1} << (shift + 8)) + range - 1) /
+                               range);
+}
+
+constexpr std::array<uint32_t, kScaleTableSize> MakeScaleTable() {
+  std::array<uint32_t, kScaleTableSize> table{};
+  for (uint32_t range = 1; range < kScaleTableSize; ++range) {
+    table[range] = ReciprocalScale(range, kTableShift);
+  }
+  return table;
+}
+
+// Precomputed, so common windows don't divide at all.
+constexpr std::array<uint32_t, kScaleTableSize> kScaleTable = MakeScaleTable();
+
+RequantizeScale GetRequantizeScale(uint32_t range) {
+  if (range < kScaleTableSize) return {kScaleTable[range], kTableShift};
+  return {ReciprocalScale(range, kWideShift), kWideShift};
+}
+}  // namespace
+
+void RequantizeFeatures(const int16_t* features, size_t count, int min,
+                        int max, uint8_t* output) {
+  const auto [scale, shift] = GetRequantizeScale(max - min);
+  for (size_t i = 0; i < count; ++i) {
+    const uint32_t value = features[i] - min;
+    const uint32_t scaled =
+        static_cast<uint32_t>((static_cast<uint64_t>(value) * scale) >> shift);
+    // The top of the range maps to 256.
+    output[i] = scaled > 255 ? uint8_t{255} : static_cast<uint8_t>(scaled);
+  }
+}
+
+}  // namespace coralmicro::tensorflow
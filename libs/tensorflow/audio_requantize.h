@@ -0,0 +1,38 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LIBS_TENSORFLOW_AUDIO_REQUANTIZE_H_
+#define LIBS_TENSORFLOW_AUDIO_REQUANTIZE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace coralmicro::tensorflow {
+
+// Requantizes int16 audio features to uint8 over their range, as
+// `min(floor((value - min) * 256 / (max - min)), 255)`, exactly and without
+// dividing per value. Used for the keyword detector's input.
+//
+// @param features The features to requantize, all in [min, max].
+// @param count The number of features.
+// @param min The smallest feature.
+// @param max The largest feature. Must be greater than `min`.
+// @param output Receives `count` requantized features.
+void RequantizeFeatures(const int16_t* features, size_t count, int min,
+                        int max, uint8_t* output);
+
+}  // namespace coralmicro::tensorflow
+
+#endif  // LIBS_TENSORFLOW_AUDIO_REQUANTIZE_H_
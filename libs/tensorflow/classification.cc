@@ -16,9 +16,11 @@
 
 #include "libs/tensorflow/classification.h"
 
+#include <array>
 #include <queue>
 #include <vector>
 
+#include "libs/tensorflow/top_k.h"
 #include "libs/tensorflow/utils.h"
 
 namespace coralmicro::tensorflow {
@@ -30,6 +32,9 @@ struct ClassComparator {
     return std::tie(lhs.score, lhs.id) > std::tie(rhs.score, rhs.id);
   }
 };
+
+constexpr float kMean = 128;
+constexpr float kStd = 128;
 }  // namespace
 
 std::string FormatClassificationOutput(
@@ -80,43 +85,94 @@ std::vector<Class> GetClassificationResults(
   }
 }
 
+bool GetClassificationResults(const TfLiteTensor& scores, float threshold,
+                              ClassificationResults* results) {
+  results->size = 0;
+  size_t count = 1;
+  for (int i = 0; i < scores.dims->size; ++i) count *= scores.dims->data[i];
+
+  const float scale = scores.params.scale;
+  const int32_t zero_point = scores.params.zero_point;
+  size_t size;
+  switch (scores.type) {
+    case kTfLiteUInt8:
+      size = SelectQuantizedTopK(scores.data.uint8, count, threshold, scale,
+                                 zero_point, results->capacity, results->ids);
+      for (size_t i = 0; i < size; ++i) {
+        results->scores[i] =
+            scale * (scores.data.uint8[results->ids[i]] - zero_point);
+      }
+      break;
+    case kTfLiteInt8:
+      size = SelectQuantizedTopK(scores.data.int8, count, threshold, scale,
+                                 zero_point, results->capacity, results->ids);
+      for (size_t i = 0; i < size; ++i) {
+        results->scores[i] =
+            scale * (scores.data.int8[results->ids[i]] - zero_point);
+      }
+      break;
+    case kTfLiteFloat32:
+      size = SelectTopK(scores.data.f, count, threshold, results->capacity,
+                        results->ids);
+      for (size_t i = 0; i < size; ++i) {
+        results->scores[i] = scores.data.f[results->ids[i]];
+      }
+      break;
+    default:
+      return false;
+  }
+  results->size = size;
+  return true;
+}
+
+bool GetClassificationResults(tflite::MicroInterpreter* interpreter,
+                              float threshold,
+                              ClassificationResults* results) {
+  return GetClassificationResults(*interpreter->output_tensor(0), threshold,
+                                  results);
+}
+
 bool ClassificationInputNeedsPreprocessing(const TfLiteTensor& input_tensor) {
   const float scale = input_tensor.params.scale;
   const float zero_point = input_tensor.params.zero_point;
-  const float mean = 128;
-  const float std = 128;
   const float epsilon = 1e-5;
-  if (std::abs(scale * std - 1) < epsilon &&
-      std::abs(mean - zero_point) < epsilon) {
-    return false;
-  } else {
-    return true;
+  return !(std::abs(scale * kStd - 1) < epsilon &&
+           std::abs(kMean - zero_point) < epsilon);
+}
+
+ClassificationPreprocessor::ClassificationPreprocessor(
+    const TfLiteTensor& input_tensor)
+    : valid_(input_tensor.type == kTfLiteUInt8) {
+  if (!valid_) return;
+  const float scale = input_tensor.params.scale;
+  const auto zero_point = static_cast<float>(input_tensor.params.zero_point);
+  for (int i = 0; i < 256; ++i) {
+    // Same arithmetic as the per-byte conversion this table replaces.
+    const float tmp = (i - kMean) / (kStd * scale) + zero_point;
+    if (tmp > 255) {
+      table_[i] = 255;
+    } else if (tmp < 0) {
+      table_[i] = 0;
+    } else {
+      table_[i] = static_cast<uint8_t>(tmp);
+    }
   }
 }
 
-bool ClassificationPreprocess(TfLiteTensor* input_tensor) {
-  if (input_tensor->type != kTfLiteUInt8) {
+bool ClassificationPreprocessor::Preprocess(TfLiteTensor* input_tensor) const {
+  if (!valid_ || input_tensor->type != kTfLiteUInt8) {
     return false;
   }
-  const float scale = input_tensor->params.scale;
-  const float zero_point = input_tensor->params.zero_point;
-  const float mean = 128;
-  const float std = 128;
   const size_t size = input_tensor->bytes;
-
   uint8_t* input_tensor_data = tflite::GetTensorData<uint8_t>(input_tensor);
   for (size_t i = 0; i < size; ++i) {
-    const float tmp =
-        (input_tensor_data[i] - mean) / (std * scale) + zero_point;
-    if (tmp > 255) {
-      input_tensor_data[i] = 255;
-    } else if (tmp < 0) {
-      input_tensor_data[i] = 0;
-    } else {
-      input_tensor_data[i] = static_cast<uint8_t>(tmp);
-    }
+    input_tensor_data[i] = table_[input_tensor_data[i]];
   }
   return true;
 }
 
+bool ClassificationPreprocess(TfLiteTensor* input_tensor) {
+  return ClassificationPreprocessor(*input_tensor).Preprocess(input_tensor);
+}
+
 }  // namespace coralmicro::tensorflow
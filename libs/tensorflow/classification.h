@@ -17,6 +17,8 @@
 #ifndef LIBS_TENSORFLOW_CLASSIFICATION_H_
 #define LIBS_TENSORFLOW_CLASSIFICATION_H_
 
+#include <array>
+#include <cstdint>
 #include <limits>
 #include <vector>
 
@@ -32,6 +34,36 @@ struct Class {
   float score;
 };
 
+// Caller-provided storage for classification results, as parallel arrays (one
+// entry per class). Filled by the `GetClassificationResults()` overloads that
+// don't allocate; see `ClassificationStorage` for a fixed-size backing store.
+struct ClassificationResults {
+  // The class label ids. Must have room for `capacity` entries.
+  int* ids;
+  // The prediction scores. Must have room for `capacity` entries.
+  float* scores;
+  // The maximum number of results to keep (top-k).
+  size_t capacity;
+  // The number of results written, ordered by score (highest first).
+  size_t size;
+};
+
+// Fixed-size backing store for `ClassificationResults`, for example:
+//
+// ```
+// static ClassificationStorage<3> storage;
+// auto results = storage.results();
+// GetClassificationResults(interpreter, 0.1f, &results);
+// ```
+template <size_t N>
+struct ClassificationStorage {
+  int ids[N];
+  float scores[N];
+
+  // Gets an empty `ClassificationResults` backed by this storage.
+  ClassificationResults results() { return {ids, scores, N, 0}; }
+};
+
 // Format the Classification outputs into a string.
 //
 // @param classes All the classification class predictions, as returned by
@@ -70,13 +102,79 @@ std::vector<Class> GetClassificationResults(
     float threshold = -std::numeric_limits<float>::infinity(),
     size_t top_k = std::numeric_limits<size_t>::max());
 
+// Gets the top classes from a classification output tensor into `results`,
+// without allocating.
+//
+// Quantized scores are compared against the threshold and each other in
+// their quantized form; only the selected scores are dequantized.
+//
+// @param scores The output tensor (float32, uint8 or int8).
+// @param threshold The score threshold for results. All returned results have
+//   a score greater-than-or-equal-to this value.
+// @param results Receives up to `results->capacity` classes, ordered by score
+//   (highest first). Equal scores are ordered by id (lowest first).
+// @return False if the tensor type isn't supported.
+bool GetClassificationResults(const TfLiteTensor& scores, float threshold,
+                              ClassificationResults* results);
+
+// Gets the top classes from a classification model into `results`, without
+// allocating. Same as above, for the interpreter's first output tensor.
+//
+// @param interpreter The already-invoked interpreter for your classification
+//   model.
+// @param threshold The score threshold for results.
+// @param results Receives up to `results->capacity` classes.
+// @return False if the output tensor type isn't supported.
+bool GetClassificationResults(tflite::MicroInterpreter* interpreter,
+                              float threshold, ClassificationResults* results);
+
 // Checks whether an input tensor needs pre-processing for classification.
 // @param intput_tensor The tensor intended as input for a classification model.
 // @returns True if the input tensor requires normalization AND quantization
 //   (you should run ClassificationPreprocess()); false otherwise.
 bool ClassificationInputNeedsPreprocessing(const TfLiteTensor& input_tensor);
 
+// Normalizes and quantizes the input of one classification model. Input bytes
+// only take 256 values, so the constructor builds a table that maps each byte
+// to its pre-processed value for the model's quantization parameters, and a
+// whole image then costs one lookup per byte.
+//
+// Keep one per model, created once after allocating tensors, for example:
+//
+// ```
+// ClassificationPreprocessor preprocessor(*interpreter.input_tensor(0));
+// CameraFrameFormat fmt;
+// fmt.lut = preprocessor.lut();
+// ```
+//
+// The table is only read after construction, so it can be shared by tasks
+// and stays valid while the preprocessor exists.
+class ClassificationPreprocessor {
+ public:
+  // @param input_tensor The input tensor of a classification model.
+  explicit ClassificationPreprocessor(const TfLiteTensor& input_tensor);
+
+  // Whether the input tensor is uint8, the only type pre-processed.
+  bool valid() const { return valid_; }
+
+  // Gets the 256-entry table, to pass to `CameraFrameFormat::lut` to
+  // pre-process images while they are captured.
+  // @returns The table, or nullptr if the tensor type isn't uint8.
+  const uint8_t* lut() const { return valid_ ? table_.data() : nullptr; }
+
+  // Pre-processes the given tensor in place.
+  // @param input_tensor The input tensor of the model.
+  // @returns False if the tensor type isn't uint8.
+  bool Preprocess(TfLiteTensor* input_tensor) const;
+
+ private:
+  bool valid_;
+  std::array<uint8_t, 256> table_;
+};
+
 // Performs normalization and quantization pre-processing on the given tensor.
+// Builds a `ClassificationPreprocessor` for each call, so keep one instead
+// when pre-processing every frame.
 // @param input_tensor The tensor you want to pre-process for a clasification
 //   model.
 // @returns True upon success; false if the tensor type is the wrong format.
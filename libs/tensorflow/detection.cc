@@ -16,8 +16,12 @@
 
 #include "libs/tensorflow/detection.h"
 
+#include <algorithm>
 #include <cmath>
 #include <queue>
+#include <tuple>
+
+#include "libs/tensorflow/tensor_top_k.h"
 
 namespace coralmicro::tensorflow {
 
@@ -73,6 +77,60 @@ std::vector<Object> GetDetectionResults(const float* bboxes, const float* ids,
   return ret;
 }
 
+bool GetDetectionResults(const TfLiteTensor& bboxes, const TfLiteTensor& ids,
+                         const TfLiteTensor& scores, size_t count,
+                         float threshold, DetectionResults* results) {
+  results->size = 0;
+  if (!IsSupportedTensorType(bboxes) || !IsSupportedTensorType(ids) ||
+      !IsSupportedTensorType(scores)) {
+    return false;
+  }
+
+  // The selected indices are kept in the id array until they are resolved.
+  int* indices = results->ids;
+  const size_t size =
+      SelectTensorTopK(scores, count, threshold, results->capacity, indices);
+
+  for (size_t i = 0; i < size; ++i) {
+    const size_t index = indices[i];
+    results->scores[i] = TensorValue(scores, index);
+    results->bboxes[i] = {std::max(0.0f, TensorValue(bboxes, 4 * index)),
+                          std::max(0.0f, TensorValue(bboxes, 4 * index + 1)),
+                          std::max(0.0f, TensorValue(bboxes, 4 * index + 2)),
+                          std::max(0.0f, TensorValue(bboxes, 4 * index + 3))};
+    indices[i] = std::round(TensorValue(ids, index));
+  }
+  results->size = size;
+  return true;
+}
+
+bool GetDetectionResults(tflite::MicroInterpreter* interpreter,
+                         float threshold, DetectionResults* results) {
+  results->size = 0;
+  if (interpreter->outputs().size() != 4) {
+    printf("Output size mismatch\r\n");
+    return false;
+  }
+
+  const TfLiteTensor *bboxes, *ids, *scores, *count;
+  if (interpreter->output_tensor(2)->dims->size == 1) {
+    scores = interpreter->output_tensor(0);
+    bboxes = interpreter->output_tensor(1);
+    count = interpreter->output_tensor(2);
+    ids = interpreter->output_tensor(3);
+  } else {
+    bboxes = interpreter->output_tensor(0);
+    ids = interpreter->output_tensor(1);
+    scores = interpreter->output_tensor(2);
+    count = interpreter->output_tensor(3);
+  }
+  if (!IsSupportedTensorType(*count)) return false;
+
+  return GetDetectionResults(*bboxes, *ids, *scores,
+                             static_cast<size_t>(TensorValue(*count, 0)),
+                             threshold, results);
+}
+
 std::vector<Object> GetDetectionResults(tflite::MicroInterpreter* interpreter,
                                         float threshold, size_t top_k) {
   if (interpreter->outputs().size() != 4) {
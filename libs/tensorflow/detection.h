@@ -18,35 +18,14 @@
 #define LIBS_TENSORFLOW_DETECTION_H_
 
 #include <limits>
+#include <string>
 #include <vector>
 
+#include "libs/tensorflow/detection_results.h"
 #include "third_party/tflite-micro/tensorflow/lite/micro/micro_interpreter.h"
 
 namespace coralmicro::tensorflow {
 
-// Represents the bounding box of a detected object.
-template <typename T>
-struct BBox {
-  // The box y-minimum (top-most) point.
-  T ymin;
-  // The box x-minimum (left-most) point.
-  T xmin;
-  // The box y-maximum (bottom-most) point.
-  T ymax;
-  // The box x-maximum (right-most) point.
-  T xmax;
-};
-
-// Represents a detected object.
-struct Object {
-  // The class label id.
-  int id;
-  // The prediction score.
-  float score;
-  // The bounding-box (ymin,xmin,ymax,xmax).
-  BBox<float> bbox;
-};
-
 // Formats the detection outputs into a string.
 //
 // @param object A vector with all the objects in an object detection
@@ -86,6 +65,35 @@ std::vector<Object> GetDetectionResults(
     float threshold = -std::numeric_limits<float>::infinity(),
     size_t top_k = std::numeric_limits<size_t>::max());
 
+// Selects the top detections from detection output tensors into `results`,
+// without allocating. The tensors can be float, uint8 or int8. Quantized
+// scores are compared against `threshold` in their quantized form, and only
+// the selected objects are dequantized.
+//
+// @param bboxes The bounding box tensor, in box-corner encoding.
+// @param ids The label id tensor.
+// @param scores The score tensor.
+// @param count The number of detected objects in the tensors.
+// @param threshold The score threshold for results. All returned results have
+//   a score greater-than-or-equal-to this value.
+// @param results Receives up to `results->capacity` objects, ordered by score
+//   (first element has the highest score; equal scores keep tensor order).
+// @return False if a tensor has an unsupported type.
+bool GetDetectionResults(const TfLiteTensor& bboxes, const TfLiteTensor& ids,
+                         const TfLiteTensor& scores, size_t count,
+                         float threshold, DetectionResults* results);
+
+// Gets results from a detection model into `results`, without allocating.
+//
+// @param interpreter The already-invoked interpreter for your detection model.
+// @param threshold The score threshold for results. All returned results have
+//   a score greater-than-or-equal-to this value.
+// @param results Receives up to `results->capacity` objects, ordered by score
+//   (first element has the highest score).
+// @return False if the model outputs are not detection outputs.
+bool GetDetectionResults(tflite::MicroInterpreter* interpreter,
+                         float threshold, DetectionResults* results);
+
 }  // namespace coralmicro::tensorflow
 
 #endif  // LIBS_TENSORFLOW_DETECTION_H_
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TENSORFLOW_DETECTION_RESULTS_H_
+#define LIBS_TENSORFLOW_DETECTION_RESULTS_H_
+
+#include <cstddef>
+
+namespace coralmicro::tensorflow {
+
+// Represents the bounding box of a detected object.
+template <typename T>
+struct BBox {
+  // The box y-minimum (top-most) point.
+  T ymin;
+  // The box x-minimum (left-most) point.
+  T xmin;
+  // The box y-maximum (bottom-most) point.
+  T ymax;
+  // The box x-maximum (right-most) point.
+  T xmax;
+};
+
+// Represents a detected object.
+struct Object {
+  // The class label id.
+  int id;
+  // The prediction score.
+  float score;
+  // The bounding-box (ymin,xmin,ymax,xmax).
+  BBox<float> bbox;
+};
+
+// Caller-provided storage for detection results, as parallel arrays (one
+// entry per object). Filled by the `GetDetectionResults()` overloads that
+// don't allocate; see `DetectionStorage` for a fixed-size backing store.
+struct DetectionResults {
+  // The class label ids. Must have room for `capacity` entries.
+  int* ids;
+  // The prediction scores. Must have room for `capacity` entries.
+  float* scores;
+  // The bounding boxes (ymin,xmin,ymax,xmax). Must have room for `capacity`
+  // entries.
+  BBox<float>* bboxes;
+  // The maximum number of results to keep (top-k).
+  size_t capacity;
+  // The number of results written, ordered by score (highest first).
+  size_t size;
+};
+
+// Fixed-size backing store for `DetectionResults`, for example:
+//
+// ```
+// static DetectionStorage<10> storage;
+// auto results = storage.results();
+// GetDetectionResults(interpreter, 0.5f, &results);
+// ```
+template <size_t N>
+struct DetectionStorage {
+  int ids[N];
+  float scores[N];
+  BBox<float> bboxes[N];
+
+  // Gets an empty `DetectionResults` backed by this storage.
+  DetectionResults results() { return {ids, scores, bboxes, N, 0}; }
+};
+
+}  // namespace coralmicro::tensorflow
+
+#endif  // LIBS_TENSORFLOW_DETECTION_RESULTS_H_
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/tensorflow/nms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+namespace coralmicro::tensorflow {
+namespace {
+// Boxes are mapped onto [0, 2^15] along each axis, so areas fit in 30 bits
+// and `area * 2^16` fits comfortably in 64 bits.
+constexpr int kFixedBits = 15;
+constexpr float kFixedOne = 1 << kFixedBits;
+constexpr int kIouBits = 16;
+
+void CopyDetection(const DetectionResults& from, size_t i,
+                   DetectionResults* to, size_t j) {
+  to->ids[j] = from.ids[i];
+  to->scores[j] = from.scores[i];
+  to->bboxes[j] = from.bboxes[i];
+}
+
+void SwapDetections(DetectionResults* results, size_t i, size_t j) {
+  std::swap(results->ids[i], results->ids[j]);
+  std::swap(results->scores[i], results->scores[j]);
+  std::swap(results->bboxes[i], results->bboxes[j]);
+}
+}  // namespace
+
+NonMaxSuppressor::NonMaxSuppressor(const NmsOptions& options,
+                                   size_t max_results)
+    : options_(options),
+      max_results_(max_results),
+      bucket_words_((max_results + kWordBits - 1) / kWordBits),
+      kept_(std::make_unique<FixedBox[]>(max_results)),
+      kept_ids_(std::make_unique<int[]>(max_results)),
+      buckets_(std::make_unique<uint32_t[]>(kGridSize * kGridSize *
+                                            bucket_words_)) {}
+
+void NonMaxSuppressor::SetExtent(const DetectionResults& candidates) {
+  float ymin = 0.0f, xmin = 0.0f, ymax = 0.0f, xmax = 0.0f;
+  for (size_t i = 0; i < candidates.size; ++i) {
+    const auto& box = candidates.bboxes[i];
+    if (i == 0) {
+      ymin = box.ymin;
+      xmin = box.xmin;
+      ymax = box.ymax;
+      xmax = box.xmax;
+      continue;
+    }
+    ymin = std::min(ymin, box.ymin);
+    xmin = std::min(xmin, box.xmin);
+    ymax = std::max(ymax, box.ymax);
+    xmax = std::max(xmax, box.xmax);
+  }
+  y_origin_ = ymin;
+  x_origin_ = xmin;
+  // IoU doesn't change when an axis is scaled, so each axis gets its own
+  // scale.
+  y_scale_ = ymax > ymin ? kFixedOne / (ymax - ymin) : 0.0f;
+  x_scale_ = xmax > xmin ? kFixedOne / (xmax - xmin) : 0.0f;
+  iou_threshold_q16_ = static_cast<int64_t>(
+      std::lround(options_.iou_threshold * (1 << kIouBits)));
+}
+
+NonMaxSuppressor::FixedBox NonMaxSuppressor::ToFixed(
+    const BBox<float>& box) const {
+  FixedBox fixed;
+  fixed.ymin = static_cast<int32_t>((box.ymin - y_origin_) * y_scale_);
+  fixed.xmin = static_cast<int32_t>((box.xmin - x_origin_) * x_scale_);
+  fixed.ymax = static_cast<int32_t>((box.ymax - y_origin_) * y_scale_);
+  fixed.xmax = static_cast<int32_t>((box.xmax - x_origin_) * x_scale_);
+  fixed.area = fixed.ymax > fixed.ymin && fixed.xmax > fixed.xmin
+                   ? static_cast<int64_t>(fixed.ymax - fixed.ymin) *
+                         (fixed.xmax - fixed.xmin)
+                   : 0;
+  return fixed;
+}
+
+int64_t NonMaxSuppressor::Intersection(const FixedBox& a,
+                                       const FixedBox& b) {
+  const int32_t h = std::min(a.ymax, b.ymax) - std::max(a.ymin, b.ymin);
+  const int32_t w = std::min(a.xmax, b.xmax) - std::max(a.xmin, b.xmin);
+  return h > 0 && w > 0 ? static_cast<int64_t>(h) * w : 0;
+}
+
+bool NonMaxSuppressor::Overlaps(const FixedBox& a, const FixedBox& b) const {
+  const int64_t intersection = Intersection(a, b);
+  if (intersection == 0) return false;
+  const int64_t union_area = a.area + b.area - intersection;
+  // intersection / union > threshold, without the division.
+  return (intersection << kIouBits) > iou_threshold_q16_ * union_area;
+}
+
+float NonMaxSuppressor::Iou(const FixedBox& a, const FixedBox& b) const {
+  const int64_t intersection = Intersection(a, b);
+  if (intersection == 0) return 0.0f;
+  return static_cast<float>(intersection) /
+         static_cast<float>(a.area + b.area - intersection);
+}
+
+void NonMaxSuppressor::Run(DetectionResults* candidates,
+                           DetectionResults* results) {
+  results->size = 0;
+  if (candidates->size == 0) return;
+  SetExtent(*candidates);
+  if (options_.method == NmsMethod::kGreedy) {
+    RunGreedy(*candidates, results);
+  } else {
+    RunSoft(candidates, results);
+  }
+}
+
+void NonMaxSuppressor::RunGreedy(const DetectionResults& candidates,
+                                 DetectionResults* results) {
+  const size_t capacity = std::min(results->capacity, max_results_);
+  const size_t words = (capacity + kWordBits - 1) / kWordBits;
+  for (int bucket = 0; bucket < kGridSize * kGridSize; ++bucket) {
+    std::memset(&buckets_[bucket * bucket_words_], 0,
+                words * sizeof(buckets_[0]));
+  }
+  // Grid coordinates are in [0, 2^15]; the last bucket also takes 2^15.
+  constexpr int kBucketShift = kFixedBits - 3;
+  static_assert(kGridSize == 1 << 3, "Bucket shift assumes an 8x8 grid");
+  auto bucket_of = [](int32_t v) {
+    return std::clamp(v >> kBucketShift, 0, kGridSize - 1);
+  };
+  auto bucket_word = [this](int y, int x, size_t w) -> uint32_t& {
+    return buckets_[(y * kGridSize + x) * bucket_words_ + w];
+  };
+
+  size_t kept = 0;
+  for (size_t i = 0; i < candidates.size && kept < capacity; ++i) {
+    const FixedBox box = ToFixed(candidates.bboxes[i]);
+    const int y0 = bucket_of(box.ymin), y1 = bucket_of(box.ymax);
+    const int x0 = bucket_of(box.xmin), x1 = bucket_of(box.xmax);
+
+    bool suppressed = false;
+    for (size_t w = 0; w < words && !suppressed; ++w) {
+      // Kept boxes that share a bucket with this one.
+      uint32_t nearby = 0;
+      for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) nearby |= bucket_word(y, x, w);
+      }
+      while (nearby && !suppressed) {
+        const int bit = __builtin_ctz(nearby);
+        nearby &= nearby - 1;
+        const size_t k = w * kWordBits + bit;
+        if (options_.class_aware && kept_ids_[k] != candidates.ids[i]) {
+          continue;
+        }
+        suppressed = Overlaps(kept_[k], box);
+      }
+    }
+    if (suppressed) continue;
+
+    kept_[kept] = box;
+    kept_ids_[kept] = candidates.ids[i];
+    const uint32_t mask = 1u << (kept % kWordBits);
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        bucket_word(y, x, kept / kWordBits) |= mask;
+      }
+    }
+    CopyDetection(candidates, i, results, kept);
+    ++kept;
+  }
+  results->size = kept;
+}
+
+void NonMaxSuppressor::RunSoft(DetectionResults* candidates,
+                               DetectionResults* results) {
+  const size_t capacity = results->capacity;
+  size_t remaining = candidates->size;
+  size_t kept = 0;
+  while (kept < capacity && remaining > 0) {
+    // Decayed scores are no longer sorted, so find the best one.
+    size_t best = 0;
+    for (size_t i = 1; i < remaining; ++i) {
+      if (candidates->scores[i] > candidates->scores[best]) best = i;
+    }
+    if (candidates->scores[best] < options_.score_threshold) break;
+
+    CopyDetection(*candidates, best, results, kept);
+    ++kept;
+    const FixedBox box = ToFixed(candidates->bboxes[best]);
+    const int id = candidates->ids[best];
+    SwapDetections(candidates, best, --remaining);
+
+    // Walks backwards, so a dropped box is swapped with one that has already
+    // been decayed.
+    for (size_t i = remaining; i-- > 0;) {
+      if (options_.class_aware && candidates->ids[i] != id) continue;
+      const float iou = Iou(box, ToFixed(candidates->bboxes[i]));
+      if (options_.method == NmsMethod::kSoftLinear) {
+        if (iou > options_.iou_threshold) {
+          candidates->scores[i] *= 1.0f - iou;
+        }
+      } else {
+        candidates->scores[i] *= std::exp(-iou * iou / options_.sigma);
+      }
+      if (candidates->scores[i] < options_.score_threshold) {
+        SwapDetections(candidates, i, --remaining);
+      }
+    }
+  }
+  results->size = kept;
+}
+
+}  // namespace coralmicro::tensorflow
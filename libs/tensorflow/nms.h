@@ -0,0 +1,169 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TENSORFLOW_NMS_H_
+#define LIBS_TENSORFLOW_NMS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "libs/tensorflow/detection_results.h"
+
+struct TfLiteTensor;
+
+namespace coralmicro::tensorflow {
+
+// The suppression rule used by `NonMaxSuppressor`.
+enum class NmsMethod : uint8_t {
+  // Drops every box that overlaps a higher-scoring kept box by more than the
+  // IoU threshold.
+  kGreedy,
+  // Soft-NMS: multiplies the score of each box that overlaps a kept box by
+  // more than the IoU threshold by `1 - IoU`.
+  kSoftLinear,
+  // Soft-NMS: multiplies the score of each overlapping box by
+  // `exp(-IoU^2 / sigma)`.
+  kSoftGaussian,
+};
+
+// Options for `NonMaxSuppressor`.
+struct NmsOptions {
+  NmsMethod method = NmsMethod::kGreedy;
+  // Overlap (intersection over union) above which boxes are suppressed.
+  float iou_threshold = 0.5f;
+  // Soft-NMS drops boxes whose decayed score falls below this value.
+  float score_threshold = 0.0f;
+  // Width of the `kSoftGaussian` decay.
+  float sigma = 0.5f;
+  // Whether boxes only suppress boxes of the same class. If false, boxes of
+  // all classes suppress each other.
+  bool class_aware = true;
+};
+
+// How a raw box tensor encodes each box.
+enum class BoxEncoding : uint8_t {
+  // (ymin, xmin, ymax, xmax).
+  kCorners,
+  // (x_center, y_center, width, height), as output by YOLO-style models.
+  kCenterSize,
+};
+
+// Non-maximum suppression over detection candidates. The state for the kept
+// boxes is allocated by the constructor, so `Run()` doesn't allocate.
+//
+// Overlaps are computed in fixed point: boxes are mapped onto a 2^15 grid
+// spanning all candidates, so the IoU test is an integer comparison with no
+// division. For `kGreedy`, kept boxes are also registered in an 8x8 grid of
+// buckets, so each candidate is only compared against the kept boxes that
+// share a bucket with it. This keeps the cost close to linear in the number
+// of candidates, which can run into the thousands for raw-box models.
+class NonMaxSuppressor {
+ public:
+  // The default maximum number of detections kept by one `kGreedy` run.
+  static constexpr size_t kDefaultMaxResults = 128;
+
+  // @param options The suppression to run.
+  // @param max_results The maximum number of detections kept by one `kGreedy`
+  //   run. Each one takes about 36 bytes of state. Soft-NMS has no limit of
+  //   its own.
+  explicit NonMaxSuppressor(const NmsOptions& options = NmsOptions(),
+                            size_t max_results = kDefaultMaxResults);
+  NonMaxSuppressor(const NonMaxSuppressor&) = delete;
+  NonMaxSuppressor& operator=(const NonMaxSuppressor&) = delete;
+
+  void set_options(const NmsOptions& options) { options_ = options; }
+  const NmsOptions& options() const { return options_; }
+  size_t max_results() const { return max_results_; }
+
+  // Runs non-maximum suppression.
+  //
+  // @param candidates The candidate detections, ordered by score (highest
+  //   first), as produced by `GetDetectionResults()`. Soft-NMS reorders them
+  //   and rewrites their scores.
+  // @param results Receives up to `results->capacity` kept detections (and,
+  //   for `kGreedy`, at most `max_results()`), ordered by score (highest
+  //   first) for `kGreedy` and in selection order for soft-NMS (which is also
+  //   by decayed score).
+  void Run(DetectionResults* candidates, DetectionResults* results);
+
+ private:
+  static constexpr int kGridSize = 8;
+  static constexpr int kWordBits = 32;
+
+  struct FixedBox {
+    int32_t ymin;
+    int32_t xmin;
+    int32_t ymax;
+    int32_t xmax;
+    int64_t area;
+  };
+
+  void SetExtent(const DetectionResults& candidates);
+  FixedBox ToFixed(const BBox<float>& box) const;
+  static int64_t Intersection(const FixedBox& a, const FixedBox& b);
+  bool Overlaps(const FixedBox& a, const FixedBox& b) const;
+  float Iou(const FixedBox& a, const FixedBox& b) const;
+  void RunGreedy(const DetectionResults& candidates, DetectionResults* results);
+  void RunSoft(DetectionResults* candidates, DetectionResults* results);
+
+  NmsOptions options_;
+  size_t max_results_;
+  // Words in each bucket's bitset.
+  size_t bucket_words_;
+  // Maps box coordinates onto the fixed-point grid.
+  float y_origin_ = 0.0f;
+  float x_origin_ = 0.0f;
+  float y_scale_ = 0.0f;
+  float x_scale_ = 0.0f;
+  int64_t iou_threshold_q16_ = 0;
+  std::unique_ptr<FixedBox[]> kept_;
+  std::unique_ptr<int[]> kept_ids_;
+  // For each bucket, one bit per kept box that overlaps the bucket.
+  std::unique_ptr<uint32_t[]> buckets_;
+};
+
+// Gets results from a model that outputs raw boxes and per-class scores
+// (without the TFLite detection postprocess op), such as YOLO-style models,
+// into `results`, without allocating.
+//
+// Every (box, class) pair whose score reaches `threshold` is a candidate. The
+// highest-scoring `candidates->capacity` of them are selected, with quantized
+// scores compared in their quantized form, and then go through `nms`.
+//
+// @param bboxes The box tensor, with 4 values per box.
+// @param scores The score tensor, with one score per box and class
+//   (box-major). The number of classes is the number of scores per box.
+// @param encoding How `bboxes` encodes each box.
+// @param threshold The score threshold for candidates.
+// @param nms The non-maximum suppression to run.
+// @param candidates Scratch storage for the candidates; its capacity bounds
+//   how many candidates go through NMS.
+// @param results Receives the kept detections.
+// @return False if a tensor has an unsupported type or the tensor sizes don't
+//   match.
+//
+// Defined in nms_tensor.cc, so `NonMaxSuppressor` itself doesn't depend on
+// TFLM.
+bool GetDetectionResults(const TfLiteTensor& bboxes,
+                         const TfLiteTensor& scores, BoxEncoding encoding,
+                         float threshold, NonMaxSuppressor* nms,
+                         DetectionResults* candidates,
+                         DetectionResults* results);
+
+}  // namespace coralmicro::tensorflow
+
+#endif  // LIBS_TENSORFLOW_NMS_H_
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/tensorflow/nms.h"
+#include "libs/tensorflow/tensor_top_k.h"
+
+namespace coralmicro::tensorflow {
+namespace {
+size_t ElementCount(const TfLiteTensor& tensor) {
+  size_t count = 1;
+  for (int i = 0; i < tensor.dims->size; ++i) count *= tensor.dims->data[i];
+  return count;
+}
+}  // namespace
+
+bool GetDetectionResults(const TfLiteTensor& bboxes,
+                         const TfLiteTensor& scores, BoxEncoding encoding,
+                         float threshold, NonMaxSuppressor* nms,
+                         DetectionResults* candidates,
+                         DetectionResults* results) {
+  candidates->size = 0;
+  results->size = 0;
+  if (!IsSupportedTensorType(bboxes) || !IsSupportedTensorType(scores)) {
+    return false;
+  }
+
+  const size_t num_boxes = ElementCount(bboxes) / 4;
+  if (num_boxes == 0 || ElementCount(scores) % num_boxes != 0) return false;
+  const size_t num_classes = ElementCount(scores) / num_boxes;
+  if (num_classes == 0) return false;
+
+  // Scores are box-major, so each selected index encodes a box and a class.
+  int* indices = candidates->ids;
+  const size_t size = SelectTensorTopK(scores, num_boxes * num_classes,
+                                       threshold, candidates->capacity,
+                                       indices);
+  for (size_t i = 0; i < size; ++i) {
+    const size_t index = indices[i];
+    const size_t box = index / num_classes;
+    const float a = TensorValue(bboxes, 4 * box);
+    const float b = TensorValue(bboxes, 4 * box + 1);
+    const float c = TensorValue(bboxes, 4 * box + 2);
+    const float d = TensorValue(bboxes, 4 * box + 3);
+    candidates->scores[i] = TensorValue(scores, index);
+    if (encoding == BoxEncoding::kCenterSize) {
+      // (x_center, y_center, width, height).
+      candidates->bboxes[i] = {b - d / 2, a - c / 2, b + d / 2, a + c / 2};
+    } else {
+      candidates->bboxes[i] = {a, b, c, d};
+    }
+    indices[i] = static_cast<int>(index % num_classes);
+  }
+  candidates->size = size;
+
+  nms->Run(candidates, results);
+  return true;
+}
+
+}  // namespace coralmicro::tensorflow
@@ -20,9 +20,17 @@
 #include <array>
 #include <cmath>
 #include <cstring>
+#include <limits>
 #include <numeric>
+#include <type_traits>
 #include <vector>
 
+#include "libs/tensorflow/top_k.h"
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+#include "third_party/CMSIS/CMSIS/Core/Include/cmsis_compiler.h"
+#endif
+
 namespace coralmicro {
 
 using posenet_decoder_op::kNumKeypoints;
@@ -156,17 +164,20 @@ void BuildBilinearInterpolation(const float y, const float x, const int height,
   *bottom_right = (y_ceil * width + x_ceil) * num_channels;
 }
 
+namespace {
 // Sample the input tensor values at position (x, y) and at multiple channels.
 // The input tensor has shape [height, width, num_channels]. We bilinearly
 // sample its value at tensor(y, x, c), for c in the channels specified. This
 // is faster than calling the single channel interpolation function multiple
 // times because the computation of the positions needs to be done only once.
-void SampleTensorAtMultipleChannels(const float* tensor, const int height,
-                                    const int width, const int num_channels,
-                                    const float y, const float x,
-                                    const int* result_channels,
-                                    const size_t n_result_channels,
-                                    float* result) {
+//
+// `Tensor` is either a float pointer or a `DecoderTensor`, which dequantizes
+// only the values read here.
+template <typename Tensor>
+void SampleChannels(const Tensor& tensor, const int height, const int width,
+                    const int num_channels, const float y, const float x,
+                    const int* result_channels, const size_t n_result_channels,
+                    float* result) {
   int top_left;
   int top_right;
   int bottom_left;
@@ -185,26 +196,24 @@ void SampleTensorAtMultipleChannels(const float* tensor, const int height,
   }
 }
 
-// Sample the input tensor values at position (x, y) and at a single channel.
-// The input tensor has shape [height, width, num_channels]. We bilinearly
-// sample its value at tensor(y, x, channel).
-float SampleTensorAtSingleChannel(const float* tensor, const int height,
-                                  const int width, const int num_channels,
-                                  const Point& point, const int c) {
+template <typename Tensor>
+float SampleChannel(const Tensor& tensor, const int height, const int width,
+                    const int num_channels, const Point& point, const int c) {
   float result;
-  SampleTensorAtMultipleChannels(tensor, height, width, num_channels, point.y,
-                                 point.x, &c, 1, &result);
+  SampleChannels(tensor, height, width, num_channels, point.y, point.x, &c, 1,
+                 &result);
   return result;
 }
 
 // Follows the mid-range offsets, and then refines the position by the short-
 // range offsets for a fixed number of steps.
-Point FindDisplacedPosition(const float* short_offsets,
-                            const float* mid_offsets, const int height,
-                            const int width, const int num_keypoints,
-                            const int num_edges, const Point& source,
-                            const int edge_id, const int target_id,
-                            const int mid_short_offset_refinement_steps) {
+template <typename Tensor>
+Point DisplacedPosition(const Tensor& short_offsets, const Tensor& mid_offsets,
+                        const int height, const int width,
+                        const int num_keypoints, const int num_edges,
+                        const Point& source, const int edge_id,
+                        const int target_id,
+                        const int mid_short_offset_refinement_steps) {
   float y = source.y;
   float x = source.x;
   float offsets[2];
@@ -212,23 +221,77 @@ Point FindDisplacedPosition(const float* short_offsets,
   int channels[] = {edge_id, num_edges + edge_id};
   const int n_channels = 2;
   // Total size of mid_offsets is height x width x 2*2*num_edges
-  SampleTensorAtMultipleChannels(mid_offsets, height, width, 2 * 2 * num_edges,
-                                 y, x, channels, n_channels, &offsets[0]);
+  SampleChannels(mid_offsets, height, width, 2 * 2 * num_edges, y, x, channels,
+                 n_channels, &offsets[0]);
   y = clamp(y + offsets[0], 0.0f, height - 1.0f);
   x = clamp(x + offsets[1], 0.0f, width - 1.0f);
   // Refine by the short-range offsets.
   channels[0] = target_id;
   channels[1] = num_keypoints + target_id;
   for (int i = 0; i < mid_short_offset_refinement_steps; ++i) {
-    SampleTensorAtMultipleChannels(short_offsets, height, width,
-                                   2 * num_keypoints, y, x, channels,
-                                   n_channels, &offsets[0]);
+    SampleChannels(short_offsets, height, width, 2 * num_keypoints, y, x,
+                   channels, n_channels, &offsets[0]);
     y = clamp(y + offsets[0], 0.0f, height - 1.0f);
     x = clamp(x + offsets[1], 0.0f, width - 1.0f);
   }
   return Point{y, x};
 }
 
+// Follows the long-range offsets, and then refines the position by the
+// long-range offsets for a fixed number of steps.
+template <typename Tensor>
+Point Embedding(const int y_location, const int x_location,
+                const Tensor& long_offsets, const int keypoint_index,
+                const int refinement_steps, const int height, const int width,
+                const int num_keypoints, const int stride) {
+  float y = static_cast<float>(y_location);
+  float x = static_cast<float>(x_location);
+  const int channels[] = {keypoint_index, keypoint_index + num_keypoints};
+  constexpr int num_channels = 2;
+  for (int i = 0; i <= refinement_steps; i++) {
+    float offsets[2];
+    SampleChannels(long_offsets, height, width, 2 * num_keypoints, y, x,
+                   channels, num_channels, offsets);
+    y = clamp(y + offsets[0], 0.0f, height - 1.0f);
+    x = clamp(x + offsets[1], 0.0f, width - 1.0f);
+  }
+  return Point{y * stride, x * stride};
+}
+}  // namespace
+
+void SampleTensorAtMultipleChannels(const float* tensor, const int height,
+                                    const int width, const int num_channels,
+                                    const float y, const float x,
+                                    const int* result_channels,
+                                    const size_t n_result_channels,
+                                    float* result) {
+  SampleChannels(tensor, height, width, num_channels, y, x, result_channels,
+                 n_result_channels, result);
+}
+
+// Sample the input tensor values at position (x, y) and at a single channel.
+// The input tensor has shape [height, width, num_channels]. We bilinearly
+// sample its value at tensor(y, x, channel).
+float SampleTensorAtSingleChannel(const float* tensor, const int height,
+                                  const int width, const int num_channels,
+                                  const Point& point, const int c) {
+  float result;
+  SampleTensorAtMultipleChannels(tensor, height, width, num_channels, point.y,
+                                 point.x, &c, 1, &result);
+  return result;
+}
+
+Point FindDisplacedPosition(const float* short_offsets,
+                            const float* mid_offsets, const int height,
+                            const int width, const int num_keypoints,
+                            const int num_edges, const Point& source,
+                            const int edge_id, const int target_id,
+                            const int mid_short_offset_refinement_steps) {
+  return DisplacedPosition(short_offsets, mid_offsets, height, width,
+                           num_keypoints, num_edges, source, edge_id,
+                           target_id, mid_short_offset_refinement_steps);
+}
+
 // Build an adjacency list of the pose graph.
 AdjacencyList BuildAdjacencyList() {
   AdjacencyList adjacency_list(posenet_decoder_op::kNumKeypoints);
@@ -426,25 +489,12 @@ float ComputeSumSquaredDistance(const std::vector<Point>& embedding,
   return distance;
 }
 
-// Follows the long-range offsets, and then refines the position by the
-// long-range offsets for a fixed number of steps.
 Point GetEmbedding(const int y_location, const int x_location,
                    const float* long_offsets, const int keypoint_index,
                    const int refinement_steps, const int height,
                    const int width, const int num_keypoints, const int stride) {
-  float y = static_cast<float>(y_location);
-  float x = static_cast<float>(x_location);
-  const int channels[] = {keypoint_index, keypoint_index + num_keypoints};
-  constexpr int num_channels = 2;
-  for (int i = 0; i <= refinement_steps; i++) {
-    float offsets[2];
-    SampleTensorAtMultipleChannels(long_offsets, height, width,
-                                   2 * num_keypoints, y, x, channels,
-                                   num_channels, offsets);
-    y = clamp(y + offsets[0], 0.0f, height - 1.0f);
-    x = clamp(x + offsets[1], 0.0f, width - 1.0f);
-  }
-  return Point{y * stride, x * stride};
+  return Embedding(y_location, x_location, long_offsets, keypoint_index,
+                   refinement_steps, height, width, num_keypoints, stride);
 }
 
 // Matches the list of embeddings to a pose in a list of poses based off the
@@ -470,6 +520,391 @@ int MatchEmbeddingToInstance(const int y_location, const int x_location,
                        std::min_element(dists.begin(), dists.end()));
 }
 
+namespace {
+using posenet_decoder_op::DecoderTensor;
+using posenet_decoder_op::kNumEdges;
+using posenet_decoder_op::PoseDecoderOptions;
+
+// A keypoint candidate. Same as `KeypointWithScore`, but trivially
+// constructible, so arrays of it can live in scratch memory.
+struct Candidate {
+  Point point;
+  int id;
+  float score;
+};
+
+bool LowerScore(const Candidate& lhs, const Candidate& rhs) {
+  return lhs.score < rhs.score;
+}
+
+// A root candidate and its heatmap index, which orders equal scores, so
+// that a scan can resume after the last root of the previous one.
+struct Root {
+  Candidate candidate;
+  uint32_t index;
+};
+
+// Whether `lhs` is tried before `rhs`: by decreasing score, then by
+// increasing heatmap index.
+bool RootBefore(const Root& lhs, const Root& rhs) {
+  return lhs.candidate.score > rhs.candidate.score ||
+         (lhs.candidate.score == rhs.candidate.score && lhs.index < rhs.index);
+}
+
+// The pose graph as fixed-size arrays. No keypoint has more than 4 children.
+constexpr int kMaxChildren = 4;
+struct Children {
+  int count;
+  int ids[kMaxChildren];
+  int edge_ids[kMaxChildren];
+};
+using FixedAdjacencyList = std::array<Children, kNumKeypoints>;
+
+const FixedAdjacencyList& GetFixedAdjacencyList() {
+  static const FixedAdjacencyList adjacency_list = [] {
+    FixedAdjacencyList list{};
+    for (size_t k = 0; k < kEdgeList.size(); ++k) {
+      Children& children = list[kEdgeList[k].first];
+      children.ids[children.count] = kEdgeList[k].second;
+      children.edge_ids[children.count] = k;
+      ++children.count;
+    }
+    return list;
+  }();
+  return adjacency_list;
+}
+
+// Working memory of the allocation-free `DecodeAllPoses()`, carved out of
+// the caller's scratch buffer.
+struct PoseDecoderScratch {
+  Root* roots;
+  PoseKeypoints* poses;
+  PoseKeypointScores* keypoint_scores;
+  float* instance_scores;
+  int* order;
+};
+
+// Lays out the scratch buffer at `memory` (if not null) and returns its size.
+size_t LayoutScratch(const PoseDecoderOptions& options, void* memory,
+                     PoseDecoderScratch* scratch) {
+  auto* base = static_cast<uint8_t*>(memory);
+  size_t offset = 0;
+  auto take = [&](auto** ptr, size_t count) {
+    using Type = std::remove_pointer_t<std::remove_pointer_t<decltype(ptr)>>;
+    static_assert(alignof(Type) <= alignof(float),
+                  "Scratch is only aligned for float");
+    if (base) *ptr = reinterpret_cast<Type*>(base + offset);
+    offset += count * sizeof(Type);
+  };
+  const size_t max_detections = std::max(options.max_detections, 0);
+  take(&scratch->roots, std::max(options.max_root_candidates, 0));
+  take(&scratch->poses, max_detections);
+  take(&scratch->keypoint_scores, max_detections);
+  take(&scratch->instance_scores, max_detections);
+  take(&scratch->order, max_detections);
+  return offset;
+}
+
+// Orders `indices` by decreasing score, like `DecreasingArgSort()`.
+void DecreasingArgSortInPlace(const float* scores, int* indices, size_t len) {
+  std::iota(indices, indices + len, 0);
+  std::sort(indices, indices + len, [scores](const int i, const int j) {
+    return scores[i] > scores[j];
+  });
+}
+
+// Converts a logit threshold into the heatmap's stored type, so that cells
+// can be compared without dequantizing them.
+template <typename T>
+bool ScoreThreshold(const DecoderTensor<T>& scores, float logit, T* threshold) {
+  if constexpr (std::is_floating_point_v<T>) {
+    *threshold = logit / (scores.scale * scores.rescale);
+    return true;
+  } else {
+    return tensorflow::QuantizeThreshold(logit, scores.scale * scores.rescale,
+                                         scores.zero_point, threshold);
+  }
+}
+
+// Calls `visit(index)` for each of the `count` values in `data` that is
+// greater-than-or-equal-to `threshold`, in index order.
+template <typename T, typename Visit>
+void ForEachAtLeast(const T* data, const size_t count, const T threshold,
+                    Visit visit) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!(data[i] < threshold)) visit(i);
+  }
+}
+
+// Gets 0x80 in each byte of `x` that is greater-than-or-equal-to the same
+// byte of `t`, and 0 in the others.
+inline uint32_t AtLeastBytes(uint32_t x, uint32_t t) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  // The Cortex-M7 DSP extension compares all four bytes at once: USUB8 sets
+  // the GE flag of each byte that doesn't borrow, and SEL picks by them.
+  (void)__USUB8(x, t);
+  return __SEL(0x80808080u, 0u);
+#else
+  // Per byte, x >= t: the low 7 bits are compared by a subtraction that
+  // can't borrow across bytes, and the top bits decide when they differ.
+  constexpr uint32_t kHigh = 0x80808080u;
+  const uint32_t low = (x | kHigh) - (t & ~kHigh);
+  return ((x & ~t) | (~(x ^ t) & low)) & kHigh;
+#endif
+}
+
+// Same for quantized heatmaps, comparing four values per 32-bit word with
+// `AtLeastBytes()`. Nearly all heatmap cells are far below the threshold, so
+// most words are rejected without per-byte branches.
+template <typename Visit>
+void ForEachAtLeast(const uint8_t* data, const size_t count,
+                    const uint8_t threshold, Visit visit) {
+  const uint32_t t = threshold * 0x01010101u;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint32_t x;
+    std::memcpy(&x, data + i, sizeof(x));
+    uint32_t at_least = AtLeastBytes(x, t);
+    while (at_least) {
+      // Little-endian: the lowest byte is the first value.
+      visit(i + __builtin_ctz(at_least) / 8);
+      at_least &= at_least - 1;
+    }
+  }
+  for (; i < count; ++i) {
+    if (data[i] >= threshold) visit(i);
+  }
+}
+
+// Finds the heatmap cells that reach `threshold` and are a local maximum of
+// their keypoint, refined by the short offsets. Keeps the first `capacity` in
+// `RootBefore()` order that come after `after` (if not null) and returns how
+// many were kept, in that order.
+//
+// This runs in two phases: a scan that rejects cells below the threshold in
+// the heatmap's stored type, then the local-maximum check, which only runs on
+// the few cells that pass.
+template <typename T>
+size_t FindRootCandidates(const DecoderTensor<T>& scores,
+                          const DecoderTensor<T>& short_offsets,
+                          const int height, const int width,
+                          const T threshold, const int local_maximum_radius,
+                          const Root* after, Root* roots,
+                          const size_t capacity) {
+  if (capacity == 0) return 0;
+  size_t size = 0;
+  const size_t count = static_cast<size_t>(height) * width * kNumKeypoints;
+  ForEachAtLeast(scores.data, count, threshold, [&](const size_t index) {
+    const float score = scores[index];
+    const Root root{{Point{}, 0, score}, static_cast<uint32_t>(index)};
+    if (after && !RootBefore(*after, root)) return;
+    // The kept roots are a heap whose top is the last in order; it is
+    // replaced first.
+    if (size == capacity && !RootBefore(root, roots[0])) return;
+
+    const T raw_score = scores.data[index];
+    const int j = index % kNumKeypoints;
+    const int cell = index / kNumKeypoints;
+    const int y = cell / width;
+    const int x = cell % width;
+    // Only consider keypoints whose score is maximum in a local window.
+    const int y_start = std::max(y - local_maximum_radius, 0);
+    const int y_end = std::min(y + local_maximum_radius + 1, height);
+    const int x_start = std::max(x - local_maximum_radius, 0);
+    const int x_end = std::min(x + local_maximum_radius + 1, width);
+    for (int y_current = y_start; y_current < y_end; ++y_current) {
+      for (int x_current = x_start; x_current < x_end; ++x_current) {
+        if (scores.data[(y_current * width + x_current) * kNumKeypoints + j] >
+            raw_score) {
+          return;
+        }
+      }
+    }
+
+    if (size == capacity) {
+      std::pop_heap(roots, roots + size, RootBefore);
+      --size;
+    }
+    const int offset_index = 2 * cell * kNumKeypoints + j;
+    const float dy = short_offsets[offset_index];
+    const float dx = short_offsets[offset_index + kNumKeypoints];
+    roots[size++] = {{Point{clamp(y + dy, 0.0f, height - 1.0f),
+                            clamp(x + dx, 0.0f, width - 1.0f)},
+                      j, score},
+                     root.index};
+    std::push_heap(roots, roots + size, RootBefore);
+  });
+  std::sort_heap(roots, roots + size, RootBefore);
+  return size;
+}
+
+// Same as `BacktrackDecodePose()`, with a fixed-size queue.
+template <typename T>
+void DecodePose(const DecoderTensor<T>& scores,
+                const DecoderTensor<T>& short_offsets,
+                const DecoderTensor<T>& mid_offsets, const int height,
+                const int width, const Candidate& root,
+                const int mid_short_offset_refinement_steps,
+                PoseKeypoints* pose_keypoints,
+                PoseKeypointScores* keypoint_scores) {
+  const FixedAdjacencyList& adjacency_list = GetFixedAdjacencyList();
+  // Each edge is followed at most once, when its parent is decoded.
+  std::array<Candidate, kEdgeList.size() + 1> queue;
+  size_t queue_size = 0;
+  auto push = [&](const Candidate& candidate) {
+    queue[queue_size++] = candidate;
+    std::push_heap(queue.begin(), queue.begin() + queue_size, LowerScore);
+  };
+
+  push({root.point, root.id,
+        SampleChannel(scores, height, width, kNumKeypoints, root.point,
+                      root.id)});
+  std::array<bool, kNumKeypoints> keypoint_decoded{};
+  while (queue_size > 0) {
+    std::pop_heap(queue.begin(), queue.begin() + queue_size, LowerScore);
+    const Candidate current = queue[--queue_size];
+    if (keypoint_decoded[current.id]) continue;
+
+    pose_keypoints->keypoint[current.id] = current.point;
+    keypoint_scores->keypoint[current.id] = current.score;
+    keypoint_decoded[current.id] = true;
+
+    const Children& children = adjacency_list[current.id];
+    for (int j = 0; j < children.count; ++j) {
+      const int child_id = children.ids[j];
+      if (keypoint_decoded[child_id]) continue;
+      // See `BacktrackDecodePose()` for the mid-offsets layout.
+      int edge_id = children.edge_ids[j];
+      if (edge_id >= kNumEdges) edge_id += kNumEdges;
+
+      const Point child_point = DisplacedPosition(
+          short_offsets, mid_offsets, height, width, kNumKeypoints, kNumEdges,
+          current.point, edge_id, child_id, mid_short_offset_refinement_steps);
+      push({child_point, child_id,
+            SampleChannel(scores, height, width, kNumKeypoints, child_point,
+                          child_id)});
+    }
+  }
+}
+
+// Same as `PerformSoftKeypointNMS()`, without allocating.
+void SoftKeypointNms(const int* decreasing_indices, const int num_instances,
+                     const PoseKeypoints* all_keypoint_coords,
+                     const PoseKeypointScores* all_keypoint_scores,
+                     const float squared_nms_radius, const int topk,
+                     float* all_instance_scores) {
+  std::array<int, kNumKeypoints> indices;
+  for (int i = 0; i < num_instances; ++i) {
+    const int current_index = decreasing_indices[i];
+    const PoseKeypoints& current = all_keypoint_coords[current_index];
+    std::array<bool, kNumKeypoints> keypoint_occluded{};
+    for (int j = 0; j < i; ++j) {
+      const PoseKeypoints& previous =
+          all_keypoint_coords[decreasing_indices[j]];
+      for (int k = 0; k < kNumKeypoints; ++k) {
+        if (ComputeSquaredDistance(current.keypoint[k], previous.keypoint[k]) <=
+            squared_nms_radius) {
+          keypoint_occluded[k] = true;
+        }
+      }
+    }
+    const float* keypoint_scores = all_keypoint_scores[current_index].keypoint;
+    DecreasingArgSortInPlace(keypoint_scores, indices.data(), kNumKeypoints);
+    float total_score = 0.0f;
+    for (int k = 0; k < topk; ++k) {
+      if (!keypoint_occluded[indices[k]]) {
+        total_score += keypoint_scores[indices[k]];
+      }
+    }
+    all_instance_scores[current_index] = total_score / topk;
+  }
+}
+
+// A pose's keypoint bounding box in block space, grown by the mask margin.
+struct InstanceBox {
+  float ymin;
+  float xmin;
+  float ymax;
+  float xmax;
+};
+
+void BuildInstanceBoxes(const PoseKeypoints* poses, const size_t num_poses,
+                        const int stride, const float margin,
+                        InstanceBox* boxes) {
+  const float scale = 1.0f / stride;
+  for (size_t i = 0; i < num_poses; ++i) {
+    const Point* keypoints = poses[i].keypoint;
+    InstanceBox box{keypoints[0].y, keypoints[0].x, keypoints[0].y,
+                    keypoints[0].x};
+    for (int k = 1; k < kNumKeypoints; ++k) {
+      box.ymin = std::min(box.ymin, keypoints[k].y);
+      box.xmin = std::min(box.xmin, keypoints[k].x);
+      box.ymax = std::max(box.ymax, keypoints[k].y);
+      box.xmax = std::max(box.xmax, keypoints[k].x);
+    }
+    boxes[i] = {box.ymin * scale - margin, box.xmin * scale - margin,
+                box.ymax * scale + margin, box.xmax * scale + margin};
+  }
+}
+
+bool InsideAnyBox(const InstanceBox* boxes, const size_t num_boxes,
+                  const float y, const float x) {
+  for (size_t i = 0; i < num_boxes; ++i) {
+    if (y >= boxes[i].ymin && y <= boxes[i].ymax && x >= boxes[i].xmin &&
+        x <= boxes[i].xmax) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Same as calling `Embedding()` for every keypoint. The first step starts on
+// a grid location, so it reads the offsets there instead of interpolating.
+template <typename T>
+void EmbeddingAllKeypoints(const DecoderTensor<T>& long_offsets,
+                           const int y_location, const int x_location,
+                           const int height, const int width,
+                           const int refinement_steps, const int stride,
+                           Point* embedding) {
+  const int base = (y_location * width + x_location) * 2 * kNumKeypoints;
+  for (int k = 0; k < kNumKeypoints; ++k) {
+    float y = clamp(y_location + long_offsets[base + k], 0.0f, height - 1.0f);
+    float x = clamp(x_location + long_offsets[base + kNumKeypoints + k], 0.0f,
+                    width - 1.0f);
+    const int channels[] = {k, k + kNumKeypoints};
+    for (int i = 0; i < refinement_steps; ++i) {
+      float offsets[2];
+      SampleChannels(long_offsets, height, width, 2 * kNumKeypoints, y, x,
+                     channels, 2, offsets);
+      y = clamp(y + offsets[0], 0.0f, height - 1.0f);
+      x = clamp(x + offsets[1], 0.0f, width - 1.0f);
+    }
+    embedding[k] = Point{y * stride, x * stride};
+  }
+}
+
+// Same as `MatchEmbeddingToInstance()`, for a precomputed embedding. The
+// squared distances only grow as keypoints are added, so an instance is
+// dropped as soon as its partial sum reaches the best distance so far; the
+// result is the same as comparing full sums.
+size_t NearestInstance(const Point* embedding, const PoseKeypoints* poses,
+                       const size_t num_poses) {
+  size_t nearest = 0;
+  float min_distance = std::numeric_limits<float>::infinity();
+  for (size_t i = 0; i < num_poses; ++i) {
+    float distance = 0.0f;
+    for (int k = 0; k < kNumKeypoints && distance < min_distance; ++k) {
+      distance += ComputeSquaredDistance(embedding[k], poses[i].keypoint[k]);
+    }
+    if (distance < min_distance) {
+      min_distance = distance;
+      nearest = i;
+    }
+  }
+  return nearest;
+}
+}  // namespace
+
 namespace posenet_decoder_op {
 
 int DecodeAllPoses(const float* scores, const float* short_offsets,
@@ -600,5 +1035,176 @@ void DecodeInstanceMasks(const float* long_offsets, int height, int width,
   }
 }
 
+size_t PoseDecoderScratchBytes(const PoseDecoderOptions& options) {
+  PoseDecoderScratch scratch;
+  return LayoutScratch(options, nullptr, &scratch);
+}
+
+template <typename T>
+int DecodeAllPoses(const DecoderTensor<T>& scores,
+                   const DecoderTensor<T>& short_offsets,
+                   const DecoderTensor<T>& mid_offsets, const int height,
+                   const int width, const PoseDecoderOptions& options,
+                   void* scratch_memory, PoseKeypoints* pose_keypoints,
+                   PoseKeypointScores* pose_keypoint_scores,
+                   float* pose_scores) {
+  static const int kLocalMaximumRadius = 1;
+  const int topk = kNumKeypoints;
+  const float score_threshold = options.score_threshold;
+  const float squared_nms_radius = options.nms_radius * options.nms_radius;
+
+  PoseDecoderScratch scratch;
+  LayoutScratch(options, scratch_memory, &scratch);
+
+  // score_threshold threshold as a logit, before sigmoid
+  T min_score;
+  if (!ScoreThreshold(scores, Logodds(score_threshold), &min_score)) return 0;
+
+  // Generate at most max_detections object instances per image in decreasing
+  // root part score order. Roots are found `capacity` at a time: when they
+  // run out before max_detections poses are found, the heatmap is scanned
+  // again for the roots that come after the last one tried, so every root is
+  // still tried, in the same order.
+  const size_t capacity = std::max(options.max_root_candidates, 0);
+  int pose_counter = 0;
+  std::array<int, kNumKeypoints> indices;
+  const Root* after = nullptr;
+  Root last;
+  while (pose_counter < options.max_detections) {
+    const size_t num_roots = FindRootCandidates(
+        scores, short_offsets, height, width, min_score, kLocalMaximumRadius,
+        after, scratch.roots, capacity);
+    for (size_t r = 0; r < num_roots && pose_counter < options.max_detections;
+         ++r) {
+      const Candidate& root = scratch.roots[r].candidate;
+      if (!PassKeypointNMS(scratch.poses, pose_counter,
+                           KeypointWithScore(root.point, root.id, root.score),
+                           squared_nms_radius)) {
+        continue;
+      }
+
+      auto next_pose = &scratch.poses[pose_counter];
+      auto next_scores = &scratch.keypoint_scores[pose_counter];
+      for (int k = 0; k < kNumKeypoints; ++k) {
+        next_pose->keypoint[k].x = -1.0f;
+        next_pose->keypoint[k].y = -1.0f;
+        next_scores->keypoint[k] = -1E5;
+      }
+      DecodePose(scores, short_offsets, mid_offsets, height, width, root,
+                 options.mid_short_offset_refinement_steps, next_pose,
+                 next_scores);
+
+      for (int k = 0; k < kNumKeypoints; ++k) {
+        next_scores->keypoint[k] = Sigmoid(next_scores->keypoint[k]);
+      }
+      DecreasingArgSortInPlace(next_scores->keypoint, indices.data(),
+                               kNumKeypoints);
+      float instance_score = 0.0f;
+      for (int j = 0; j < topk; ++j) {
+        instance_score += next_scores->keypoint[indices[j]];
+      }
+      instance_score /= topk;
+
+      if (instance_score >= score_threshold) {
+        scratch.instance_scores[pose_counter++] = instance_score;
+      }
+    }
+    // A scan that didn't fill the buffer found every remaining root.
+    if (num_roots < capacity || capacity == 0) break;
+    last = scratch.roots[num_roots - 1];
+    after = &last;
+  }
+
+  DecreasingArgSortInPlace(scratch.instance_scores, scratch.order,
+                           pose_counter);
+  SoftKeypointNms(scratch.order, pose_counter, scratch.poses,
+                  scratch.keypoint_scores, squared_nms_radius, topk,
+                  scratch.instance_scores);
+  DecreasingArgSortInPlace(scratch.instance_scores, scratch.order,
+                           pose_counter);
+
+  const int num_poses = pose_counter;
+  pose_counter = 0;
+  for (int i = 0; i < num_poses; ++i) {
+    const int index = scratch.order[i];
+    if (scratch.instance_scores[index] < score_threshold) {
+      break;
+    }
+    for (int k = 0; k < kNumKeypoints; ++k) {
+      pose_keypoints[pose_counter].keypoint[k].y =
+          scratch.poses[index].keypoint[k].y * options.stride;
+      pose_keypoints[pose_counter].keypoint[k].x =
+          scratch.poses[index].keypoint[k].x * options.stride;
+    }
+    std::memcpy(&pose_keypoint_scores[pose_counter],
+                &scratch.keypoint_scores[index], sizeof(PoseKeypointScores));
+    pose_scores[pose_counter] = scratch.instance_scores[index];
+    pose_counter++;
+  }
+  return pose_counter;
+}
+
+size_t InstanceMaskScratchBytes(int max_poses) {
+  return max_poses * sizeof(InstanceBox);
+}
+
+template <typename T>
+void DecodeInstanceMasks(const DecoderTensor<T>& long_offsets, int height,
+                         int width, const PoseKeypoints* poses,
+                         size_t num_poses, const InstanceMaskOptions& options,
+                         void* scratch, float* instance_masks) {
+  std::fill(instance_masks, instance_masks + height * width * num_poses, 0.0f);
+  if (num_poses == 0) return;
+  const bool cull = options.bbox_margin >= 0.0f;
+  auto* boxes = static_cast<InstanceBox*>(scratch);
+  if (cull) {
+    BuildInstanceBoxes(poses, num_poses, options.stride, options.bbox_margin,
+                       boxes);
+  }
+  const int step = std::max(options.downsample, 1);
+  std::array<Point, kNumKeypoints> embedding;
+  for (int y0 = 0; y0 < height; y0 += step) {
+    const int y1 = std::min(y0 + step, height);
+    // Each block is decoded at its middle location.
+    const int y = (y0 + y1 - 1) / 2;
+    for (int x0 = 0; x0 < width; x0 += step) {
+      const int x1 = std::min(x0 + step, width);
+      const int x = (x0 + x1 - 1) / 2;
+      if (cull && !InsideAnyBox(boxes, num_poses, y, x)) continue;
+
+      EmbeddingAllKeypoints(long_offsets, y, x, height, width,
+                            options.refinement_steps, options.stride,
+                            embedding.data());
+      const size_t instance_index =
+          NearestInstance(embedding.data(), poses, num_poses);
+      float* mask = instance_masks + instance_index * height * width;
+      for (int block_y = y0; block_y < y1; ++block_y) {
+        std::fill(mask + block_y * width + x0, mask + block_y * width + x1,
+                  1.0f);
+      }
+    }
+  }
+}
+
+template int DecodeAllPoses<uint8_t>(const DecoderTensor<uint8_t>&,
+                                     const DecoderTensor<uint8_t>&,
+                                     const DecoderTensor<uint8_t>&, int, int,
+                                     const PoseDecoderOptions&, void*,
+                                     PoseKeypoints*, PoseKeypointScores*,
+                                     float*);
+template int DecodeAllPoses<float>(const DecoderTensor<float>&,
+                                   const DecoderTensor<float>&,
+                                   const DecoderTensor<float>&, int, int,
+                                   const PoseDecoderOptions&, void*,
+                                   PoseKeypoints*, PoseKeypointScores*, float*);
+template void DecodeInstanceMasks<uint8_t>(const DecoderTensor<uint8_t>&, int,
+                                           int, const PoseKeypoints*, size_t,
+                                           const InstanceMaskOptions&, void*,
+                                           float*);
+template void DecodeInstanceMasks<float>(const DecoderTensor<float>&, int, int,
+                                         const PoseKeypoints*, size_t,
+                                         const InstanceMaskOptions&, void*,
+                                         float*);
+
 }  // namespace posenet_decoder_op
 }  // namespace coralmicro
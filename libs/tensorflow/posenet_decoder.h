@@ -17,6 +17,8 @@
 #ifndef LIBS_POSENET_POSENET_DECODER_H_
 #define LIBS_POSENET_POSENET_DECODER_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <ostream>
 #include <queue>
 #include <vector>
@@ -109,6 +111,106 @@ void DecodeInstanceMasks(const float* long_offsets, int height, int width,
                          PoseKeypoints* poses, size_t num_poses,
                          int refinement_steps, int stride,
                          float* instance_masks);
+
+// A decoder input tensor of shape [height, width, channels], kept in its
+// stored type (uint8_t or float) and dequantized only at the locations the
+// decoder reads.
+template <typename T>
+struct DecoderTensor {
+  const T* data;
+  // The quantization parameters. Leave them at 0 and 1 for float tensors.
+  int32_t zero_point = 0;
+  float scale = 1.0f;
+  // A factor applied after dequantization, such as 1/stride to convert
+  // offsets from pixels into block space.
+  float rescale = 1.0f;
+
+  float operator[](int index) const {
+    return (data[index] - zero_point) * scale * rescale;
+  }
+};
+
+// Options for the `DecodeAllPoses()` overload that takes `DecoderTensor`s.
+struct PoseDecoderOptions {
+  // The maximum number of poses to detect.
+  int max_detections;
+  // The minimum pose score, between 0 and 1.
+  float score_threshold;
+  // The number of short-offset refinement steps, roughly 1-10.
+  int mid_short_offset_refinement_steps;
+  // The exclusion radius for keypoints of the same kind, in block space.
+  float nms_radius;
+  // The network stride, used to rescale keypoints into pixel space.
+  int stride;
+  // The number of root keypoint candidates found per heatmap scan, highest
+  // scores first. Roots are tried in score order until `max_detections` poses
+  // are found. If a scan's roots run out first, the heatmap is scanned again
+  // for the next ones, so this only trades memory for scans: the decoded
+  // poses are the same for any positive value.
+  int max_root_candidates;
+};
+
+// Gets the size of the scratch memory `DecodeAllPoses()` needs for `options`.
+size_t PoseDecoderScratchBytes(const PoseDecoderOptions& options);
+
+// Same as the float `DecodeAllPoses()`, but reads the network outputs in their
+// stored type and uses only `scratch` for working memory, so it doesn't
+// allocate. Heatmap scores are thresholded and compared in their stored type;
+// values are only dequantized where the decoder samples them.
+//
+// @param scratch Working memory of `PoseDecoderScratchBytes(options)` bytes,
+//   aligned for float.
+// @return The number of poses written to the outputs.
+template <typename T>
+int DecodeAllPoses(const DecoderTensor<T>& scores,
+                   const DecoderTensor<T>& short_offsets,
+                   const DecoderTensor<T>& mid_offsets, int height, int width,
+                   const PoseDecoderOptions& options, void* scratch,
+                   PoseKeypoints* pose_keypoints,
+                   PoseKeypointScores* pose_keypoint_scores,
+                   float* pose_scores);
+
+// Options for the `DecodeInstanceMasks()` overload that takes a
+// `DecoderTensor`.
+struct InstanceMaskOptions {
+  // The number of long-range offset refinement steps.
+  int refinement_steps = 2;
+  // The network stride, used to compare embeddings with keypoints in pixel
+  // space.
+  int stride = 16;
+  // Decodes one location per `downsample` x `downsample` block, at the middle
+  // of the block, and assigns the whole block to its instance
+  // (nearest-neighbor upsampling). 1 decodes every location.
+  int downsample = 1;
+  // Locations (block middles) farther than this from the keypoint bounding
+  // box of every pose, in block space, are left out of all masks. Negative
+  // assigns every location to an instance.
+  float bbox_margin = -1.0f;
+};
+
+// Gets the size of the scratch memory `DecodeInstanceMasks()` needs for up to
+// `max_poses` poses.
+size_t InstanceMaskScratchBytes(int max_poses);
+
+// Same as the float `DecodeInstanceMasks()`, but reads the long-range offsets
+// in their stored type, doesn't allocate, and can trade resolution for speed.
+//
+// The embedding at each decoded location is computed once for all keypoints
+// and matched against the poses directly, dropping a pose as soon as its
+// partial distance can no longer win. With `downsample` 1 and a negative
+// `bbox_margin`, every location is assigned as in the float decoder.
+//
+// @param poses The decoded poses, in pixel space.
+// @param scratch Working memory of `InstanceMaskScratchBytes(num_poses)`
+//   bytes, aligned for float. Only used if `options.bbox_margin` is
+//   non-negative, so it may be null otherwise.
+// @param instance_masks Receives `num_poses` masks of `height` x `width`,
+//   with 1 where the location belongs to that pose and 0 elsewhere.
+template <typename T>
+void DecodeInstanceMasks(const DecoderTensor<T>& long_offsets, int height,
+                         int width, const PoseKeypoints* poses,
+                         size_t num_poses, const InstanceMaskOptions& options,
+                         void* scratch, float* instance_masks);
 }  // namespace posenet_decoder_op
 
 // Defines a 2-D keypoint with (x, y) float coordinates and its type id.
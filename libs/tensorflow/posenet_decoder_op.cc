@@ -17,6 +17,7 @@
 #include "posenet_decoder_op.h"
 
 #include <cmath>
+#include <cstdio>
 #include <numeric>
 #include <string>
 
@@ -49,6 +50,12 @@ constexpr int kOutputTensorPoseScores = 2;
 constexpr int kOutputTensorPoseCount = 3;
 constexpr int kOutputTensorInstanceMasks = 4;
 
+// Root keypoint candidates found per heatmap scan, per detection. Each
+// detected pose usually also rejects a candidate for most of its other
+// keypoints, so this leaves room for those; a crowded heatmap that needs more
+// is scanned again rather than dropping poses.
+constexpr int kRootCandidatesPerDetection = 2 * kNumKeypoints;
+
 struct OpData {
   // Decoder parameters
   int max_detections;
@@ -56,16 +63,29 @@ struct OpData {
   int stride;
   float nms_radius;
 
-  // Temporary tensors (e.g for dequantized values)
-  void* heatmaps_float_ptr;
-  void* shorts_float_ptr;
-  void* mids_float_ptr;
-  void* longs_float_ptr;
+  // Decoder working memory, sized in Prepare.
+  void* scratch;
+
+  // Instance mask parameters and working memory.
+  InstanceMaskOptions mask_options;
+  void* mask_scratch;
 
   int zero_point[kNumInputs];
   float scale[kNumInputs];
 };
 
+PoseDecoderOptions GetDecoderOptions(const OpData* op_data) {
+  PoseDecoderOptions options;
+  options.max_detections = op_data->max_detections;
+  options.score_threshold = op_data->score_threshold;
+  options.mid_short_offset_refinement_steps = 5;
+  options.nms_radius = op_data->nms_radius / op_data->stride;
+  options.stride = op_data->stride;
+  options.max_root_candidates =
+      kRootCandidatesPerDetection * op_data->max_detections;
+  return options;
+}
+
 void* Init(TfLiteContext* context, const char* buffer, size_t length) {
   auto* op_data = new OpData;
   const uint8_t* buffer_t = reinterpret_cast<const uint8_t*>(buffer);
@@ -76,46 +96,59 @@ void* Init(TfLiteContext* context, const char* buffer, size_t length) {
   op_data->stride = m["stride"].AsInt32();
   op_data->nms_radius = m["nms_radius"].AsFloat();
 
+  // Models may lower the mask resolution or skip locations away from the
+  // poses; by default every location is decoded.
+  op_data->mask_options.refinement_steps = 2;
+  op_data->mask_options.stride = op_data->stride;
+  if (auto downsample = m["mask_downsample"]; !downsample.IsNull()) {
+    op_data->mask_options.downsample = downsample.AsInt32();
+  }
+  if (auto margin = m["mask_bbox_margin"]; !margin.IsNull()) {
+    op_data->mask_options.bbox_margin = margin.AsFloat();
+  }
+  op_data->mask_scratch = nullptr;
+
   return op_data;
 }
 
-void Free(TfLiteContext* context, void* buffer) {
-  delete reinterpret_cast<OpData*>(buffer);
+// `Init()` only gets the model's options, so each distinct set of mask
+// options given to `RegisterPosenetDecoderOp()` gets a registration of its
+// own, whose `Init()` is instantiated for that set's slot. A slot is written
+// once, when its registration is created, so later registrations never
+// change the ops of earlier ones.
+constexpr int kMaxMaskOptions = 4;
+PosenetMaskOptions mask_options_slots[kMaxMaskOptions];
+int num_mask_options_slots = 0;
+
+template <int kSlot>
+void* InitWithMaskOptions(TfLiteContext* context, const char* buffer,
+                          size_t length) {
+  auto* op_data = static_cast<OpData*>(Init(context, buffer, length));
+  op_data->mask_options.downsample = mask_options_slots[kSlot].downsample;
+  op_data->mask_options.bbox_margin = mask_options_slots[kSlot].bbox_margin;
+  return op_data;
 }
 
-TfLiteStatus PrepTempTensor(TfLiteContext* context, void** temp_tensor_ptr,
-                            const TfLiteIntArray* dims) {
-  int bytes = sizeof(float);
-  for (int i = 0; i < dims->size; ++i) {
-    bytes *= dims->data[i];
-  }
-  *temp_tensor_ptr = context->AllocatePersistentBuffer(context, bytes);
-  if (*temp_tensor_ptr) {
-    return kTfLiteOk;
-  } else {
-    return kTfLiteError;
-  }
+void Free(TfLiteContext* context, void* buffer) {
+  delete reinterpret_cast<OpData*>(buffer);
 }
 
-void DequantizeTensor(const TfLiteEvalTensor* src, void* dst,
-                      const OpData* op_data, const int tensor_type,
-                      float extra_scale = 1.0) {
-  if (tensor_type >= kNumInputs || tensor_type < 0) {
-    assert(false);
-  }
+// Reads input `tensor_type` in its stored type; offsets are also rescaled
+// from pixels into block space.
+template <typename T>
+DecoderTensor<T> GetDecoderTensor(const TfLiteEvalTensor* src,
+                                  const OpData* op_data,
+                                  const int tensor_type) {
+  DecoderTensor<T> tensor;
+  tensor.data = tflite::micro::GetTensorData<T>(src);
   if (src->type == kTfLiteUInt8) {
-    const int num_elements = tflite::micro::GetTensorShape(src).FlatSize();
-    const uint8_t* src_data = tflite::micro::GetTensorData<uint8_t>(src);
-    assert(src_data != nullptr);
-    float* dst_data = reinterpret_cast<float*>(dst);
-    assert(dst_data != nullptr);
-    for (int idx = 0; idx < num_elements; ++idx) {
-      dst_data[idx] = (src_data[idx] - op_data->zero_point[tensor_type]) *
-                      op_data->scale[tensor_type] * extra_scale;
-    }
-  } else {
-    assert(false);
+    tensor.zero_point = op_data->zero_point[tensor_type];
+    tensor.scale = op_data->scale[tensor_type];
   }
+  if (tensor_type != kInputTensorHeatmaps) {
+    tensor.rescale = 1.0f / op_data->stride;
+  }
+  return tensor;
 }
 
 TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
@@ -154,17 +187,20 @@ TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
   TF_LITE_ENSURE_EQ(context, shorts->dims->data[3], 2 * kNumKeypoints);
   TF_LITE_ENSURE_EQ(context, mids->dims->data[3], 2 * 2 * kNumEdges);
 
-  TF_LITE_ENSURE_OK(
-      context,
-      PrepTempTensor(context, &op_data->heatmaps_float_ptr, heatmaps->dims));
+  // The decoder reads all inputs through the same type.
+  TF_LITE_ENSURE_EQ(context, shorts->type, heatmaps->type);
+  TF_LITE_ENSURE_EQ(context, mids->type, heatmaps->type);
+
+  // Inputs are read in place and dequantized where they are sampled, so the
+  // only persistent memory is the decoder's scratch.
+  TF_LITE_ENSURE(context, op_data->stride > 0);
+  op_data->scratch = context->AllocatePersistentBuffer(
+      context, PoseDecoderScratchBytes(GetDecoderOptions(op_data)));
+  TF_LITE_ENSURE(context, op_data->scratch != nullptr);
   op_data->scale[kInputTensorHeatmaps] = heatmaps->params.scale;
   op_data->zero_point[kInputTensorHeatmaps] = heatmaps->params.zero_point;
-  TF_LITE_ENSURE_OK(context, PrepTempTensor(context, &op_data->shorts_float_ptr,
-                                            shorts->dims));
   op_data->scale[kInputTensorShortOffsets] = shorts->params.scale;
   op_data->zero_point[kInputTensorShortOffsets] = shorts->params.zero_point;
-  TF_LITE_ENSURE_OK(
-      context, PrepTempTensor(context, &op_data->mids_float_ptr, mids->dims));
   op_data->scale[kInputTensorMidOffsets] = mids->params.scale;
   op_data->zero_point[kInputTensorMidOffsets] = mids->params.zero_point;
 
@@ -172,17 +208,19 @@ TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
     TfLiteTensor* longs =
         micro_context->AllocateTempInputTensor(node, kInputTensorLongOffsets);
     TF_LITE_ENSURE(context, longs != nullptr);
-    TF_LITE_ENSURE(context, (longs->type == kTfLiteUInt8 ||  //
-                             longs->type == kTfLiteFloat32));
+    TF_LITE_ENSURE_EQ(context, longs->type, heatmaps->type);
     TF_LITE_ENSURE_EQ(context, NumDimensions(longs), 4);
     TF_LITE_ENSURE_EQ(context, longs->dims->data[0], 1);
     TF_LITE_ENSURE_EQ(context, longs->dims->data[3], 2 * kNumKeypoints);
 
-    TF_LITE_ENSURE_OK(
-        context,
-        PrepTempTensor(context, &op_data->longs_float_ptr, longs->dims));
     op_data->scale[kInputTensorLongOffsets] = longs->params.scale;
     op_data->zero_point[kInputTensorLongOffsets] = longs->params.zero_point;
+
+    if (op_data->mask_options.bbox_margin >= 0.0f) {
+      op_data->mask_scratch = context->AllocatePersistentBuffer(
+          context, InstanceMaskScratchBytes(op_data->max_detections));
+      TF_LITE_ENSURE(context, op_data->mask_scratch != nullptr);
+    }
     micro_context->DeallocateTempTfLiteTensor(longs);
   }
 
@@ -193,7 +231,8 @@ TfLiteStatus Prepare(TfLiteContext* context, TfLiteNode* node) {
   return kTfLiteOk;
 }
 
-TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+template <typename T>
+TfLiteStatus EvalTyped(TfLiteContext* context, TfLiteNode* node) {
   auto* op_data = reinterpret_cast<OpData*>(node->user_data);
 
   TF_LITE_ENSURE(context, op_data->stride > 0);
@@ -207,20 +246,6 @@ TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
       tflite::micro::GetEvalInput(context, node, kInputTensorMidOffsets);
   TF_LITE_ENSURE(context, mids != nullptr);
 
-  // Dequantize (and rescale) input tensors
-  DequantizeTensor(heatmaps, op_data->heatmaps_float_ptr, op_data,
-                   kInputTensorHeatmaps);
-  DequantizeTensor(shorts, op_data->shorts_float_ptr, op_data,
-                   kInputTensorShortOffsets, 1.0 / op_data->stride);
-  DequantizeTensor(mids, op_data->mids_float_ptr, op_data,
-                   kInputTensorMidOffsets, 1.0 / op_data->stride);
-
-  const float* heatmaps_data =
-      reinterpret_cast<float*>(op_data->heatmaps_float_ptr);
-  const float* shorts_data =
-      reinterpret_cast<float*>(op_data->shorts_float_ptr);
-  const float* mids_data = reinterpret_cast<float*>(op_data->mids_float_ptr);
-
   TfLiteEvalTensor* pose_keypoints =
       tflite::micro::GetEvalOutput(context, node, kOutputTensorPoseKeypoints);
   TF_LITE_ENSURE(context, pose_keypoints != nullptr);
@@ -241,14 +266,13 @@ TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
   float* pose_scores_data = tflite::micro::GetTensorData<float>(pose_scores);
   float* pose_count_data = tflite::micro::GetTensorData<float>(pose_count);
 
-  const float nms_radius = op_data->nms_radius / op_data->stride;
   pose_count_data[0] = DecodeAllPoses(
-      heatmaps_data, shorts_data, mids_data,
+      GetDecoderTensor<T>(heatmaps, op_data, kInputTensorHeatmaps),
+      GetDecoderTensor<T>(shorts, op_data, kInputTensorShortOffsets),
+      GetDecoderTensor<T>(mids, op_data, kInputTensorMidOffsets),
       /*height = */ heatmaps->dims->data[1],
-      /*width = */ heatmaps->dims->data[2], op_data->max_detections,
-      op_data->score_threshold,
-      /*mid_short_offset_refinement_steps = */ 5, nms_radius, op_data->stride,
-      reinterpret_cast<PoseKeypoints*>(pose_keypoints_data),
+      /*width = */ heatmaps->dims->data[2], GetDecoderOptions(op_data),
+      op_data->scratch, reinterpret_cast<PoseKeypoints*>(pose_keypoints_data),
       reinterpret_cast<PoseKeypointScores*>(pose_keypoint_scores_data),
       pose_scores_data);
 
@@ -256,27 +280,34 @@ TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
     const TfLiteEvalTensor* longs =
         tflite::micro::GetEvalInput(context, node, kInputTensorLongOffsets);
     TF_LITE_ENSURE(context, longs != nullptr);
-    DequantizeTensor(longs, op_data->longs_float_ptr, op_data,
-                     kInputTensorLongOffsets, 1.0 / op_data->stride);
-    const float* longs_data =
-        reinterpret_cast<float*>(op_data->longs_float_ptr);
     TfLiteEvalTensor* instance_masks =
         tflite::micro::GetEvalOutput(context, node, kOutputTensorInstanceMasks);
     TF_LITE_ENSURE(context, instance_masks != nullptr);
     float* instance_masks_data =
         tflite::micro::GetTensorData<float>(instance_masks);
 
-    DecodeInstanceMasks(longs_data, /*height = */ longs->dims->data[1],
-                        /*width = */ longs->dims->data[2],
-                        reinterpret_cast<PoseKeypoints*>(pose_keypoints_data),
-                        /*num_poses = */ pose_count_data[0],
-                        /*refinement_steps = */ 2, op_data->stride,
-                        instance_masks_data);
+    DecodeInstanceMasks(
+        GetDecoderTensor<T>(longs, op_data, kInputTensorLongOffsets),
+        /*height = */ longs->dims->data[1],
+        /*width = */ longs->dims->data[2],
+        reinterpret_cast<PoseKeypoints*>(pose_keypoints_data),
+        /*num_poses = */ pose_count_data[0], op_data->mask_options,
+        op_data->mask_scratch, instance_masks_data);
   }
 
   return kTfLiteOk;
 }
 
+TfLiteStatus Eval(TfLiteContext* context, TfLiteNode* node) {
+  const TfLiteEvalTensor* heatmaps =
+      tflite::micro::GetEvalInput(context, node, kInputTensorHeatmaps);
+  TF_LITE_ENSURE(context, heatmaps != nullptr);
+  if (heatmaps->type == kTfLiteUInt8) {
+    return EvalTyped<uint8_t>(context, node);
+  }
+  return EvalTyped<float>(context, node);
+}
+
 }  // namespace posenet_decoder_op
 
 TfLiteRegistration* RegisterPosenetDecoderOp() {
@@ -286,4 +317,34 @@ TfLiteRegistration* RegisterPosenetDecoderOp() {
   return &r;
 }
 
+TfLiteRegistration* RegisterPosenetDecoderOp(
+    const PosenetMaskOptions& mask_options) {
+  using posenet_decoder_op::Eval;
+  using posenet_decoder_op::Free;
+  using posenet_decoder_op::InitWithMaskOptions;
+  using posenet_decoder_op::kMaxMaskOptions;
+  using posenet_decoder_op::mask_options_slots;
+  using posenet_decoder_op::num_mask_options_slots;
+  using posenet_decoder_op::Prepare;
+  static TfLiteRegistration registrations[kMaxMaskOptions] = {
+      {InitWithMaskOptions<0>, Free, Prepare, Eval},
+      {InitWithMaskOptions<1>, Free, Prepare, Eval},
+      {InitWithMaskOptions<2>, Free, Prepare, Eval},
+      {InitWithMaskOptions<3>, Free, Prepare, Eval},
+  };
+  for (int i = 0; i < num_mask_options_slots; ++i) {
+    if (mask_options_slots[i].downsample == mask_options.downsample &&
+        mask_options_slots[i].bbox_margin == mask_options.bbox_margin) {
+      return &registrations[i];
+    }
+  }
+  if (num_mask_options_slots == kMaxMaskOptions) {
+    printf("Too many PoseNet mask options, at most %d are supported\r\n",
+           kMaxMaskOptions);
+    return nullptr;
+  }
+  mask_options_slots[num_mask_options_slots] = mask_options;
+  return &registrations[num_mask_options_slots++];
+}
+
 }  // namespace coralmicro
@@ -30,6 +30,31 @@ inline constexpr char kPosenetDecoderOp[] = "PosenetDecoderOp";
 // `tflite::MicroMutableOpResolver::AddCustom()`.
 TfLiteRegistration* RegisterPosenetDecoderOp();
 
+// Options for the instance masks of decoder ops that output them, such as
+// BodyPix models. Lowering the mask resolution or skipping the locations away
+// from the poses makes the masks much cheaper to decode.
+struct PosenetMaskOptions {
+  // Decodes one location per `downsample` x `downsample` block and assigns
+  // the whole block to its instance. 1 decodes every location.
+  int downsample = 1;
+  // Locations farther than this from the keypoint bounding box of every
+  // pose, in blocks, are left out of all masks. Negative assigns every
+  // location to an instance.
+  float bbox_margin = -1.0f;
+};
+
+// Same as above, but the decoder ops use `mask_options` instead of the
+// model's `mask_downsample` and `mask_bbox_margin` options. Each distinct set
+// of options has its own registration, so registering other options later
+// doesn't affect the interpreters that use this one.
+//
+// @param mask_options The instance mask options.
+// @return The registration, to pass to
+//   `tflite::MicroMutableOpResolver::AddCustom()`, or nullptr if four other
+//   sets of options are already registered.
+TfLiteRegistration* RegisterPosenetDecoderOp(
+    const PosenetMaskOptions& mask_options);
+
 }  // namespace coralmicro
 
 #endif  // LIBS_POSENET_POSENET_DECODER_OP_H_
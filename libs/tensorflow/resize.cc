@@ -0,0 +1,179 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/tensorflow/resize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace coralmicro::tensorflow {
+namespace {
+// Bilinear weights are in Q11, so a weighted sum of two Q11 products still
+// fits in 32 bits.
+constexpr int kWeightBits = 11;
+constexpr uint32_t kWeightOne = 1u << kWeightBits;
+
+// Same as TFLM's RESIZE_NEAREST_NEIGHBOR with align_corners and
+// half_pixel_centers both false, including its float rounding.
+int NearestSource(int out, int in_size, int out_size) {
+  const float scale = in_size / static_cast<float>(out_size);
+  return std::min(static_cast<int>(std::floor(out * scale)), in_size - 1);
+}
+
+// Maps an output coordinate to the input with half-pixel centers, as a Q11
+// position: `(out + 0.5) * in_size / out_size - 0.5`, clamped to the image.
+void BilinearSource(int out, int in_size, int out_size, int* lo, int* hi,
+                    uint32_t* frac) {
+  const int64_t pos =
+      ((2 * static_cast<int64_t>(out) + 1) * in_size << kWeightBits) /
+          (2 * out_size) -
+      kWeightOne / 2;
+  if (pos <= 0) {
+    *lo = *hi = 0;
+    *frac = 0;
+    return;
+  }
+  *lo = std::min(static_cast<int>(pos >> kWeightBits), in_size - 1);
+  *hi = std::min(*lo + 1, in_size - 1);
+  *frac = static_cast<uint32_t>(pos) & (kWeightOne - 1);
+}
+
+// The overlap of input pixel `in` with output pixel `out`, in units of
+// 1/`out_size` input pixels.
+int AreaWeight(int in, int out, int in_size, int out_size) {
+  const int begin = std::max(in * out_size, out * in_size);
+  const int end = std::min((in + 1) * out_size, (out + 1) * in_size);
+  return std::max(0, end - begin);
+}
+
+void ResizeNearest(const ImageDims& in_dims, const uint8_t* in,
+                   const ImageDims& out_dims, uint8_t* out) {
+  const int depth = in_dims.depth;
+  const size_t in_stride = in_dims.width * depth;
+  const size_t out_stride = out_dims.width * depth;
+  int previous_y = -1;
+  for (int y = 0; y < out_dims.height; ++y) {
+    uint8_t* row = out + y * out_stride;
+    const int in_y = NearestSource(y, in_dims.height, out_dims.height);
+    // Upscaling repeats source rows; copy the row that's already done.
+    if (in_y == previous_y) {
+      std::memcpy(row, row - out_stride, out_stride);
+      continue;
+    }
+    previous_y = in_y;
+    const uint8_t* in_row = in + in_y * in_stride;
+    for (int x = 0; x < out_dims.width; ++x) {
+      const int in_x = NearestSource(x, in_dims.width, out_dims.width);
+      std::memcpy(row + x * depth, in_row + in_x * depth, depth);
+    }
+  }
+}
+
+void ResizeBilinear(const ImageDims& in_dims, const uint8_t* in,
+                    const ImageDims& out_dims, uint8_t* out) {
+  const int depth = in_dims.depth;
+  const size_t in_stride = in_dims.width * depth;
+  constexpr uint32_t kRound = 1u << (2 * kWeightBits - 1);
+  for (int y = 0; y < out_dims.height; ++y) {
+    int y0, y1;
+    uint32_t fy;
+    BilinearSource(y, in_dims.height, out_dims.height, &y0, &y1, &fy);
+    const uint8_t* top = in + y0 * in_stride;
+    const uint8_t* bottom = in + y1 * in_stride;
+    for (int x = 0; x < out_dims.width; ++x) {
+      int x0, x1;
+      uint32_t fx;
+      BilinearSource(x, in_dims.width, out_dims.width, &x0, &x1, &fx);
+      for (int c = 0; c < depth; ++c) {
+        const uint32_t t = top[x0 * depth + c] * (kWeightOne - fx) +
+                           top[x1 * depth + c] * fx;
+        const uint32_t b = bottom[x0 * depth + c] * (kWeightOne - fx) +
+                           bottom[x1 * depth + c] * fx;
+        *out++ = static_cast<uint8_t>(
+            (t * (kWeightOne - fy) + b * fy + kRound) >> (2 * kWeightBits));
+      }
+    }
+  }
+}
+
+void ResizeArea(const ImageDims& in_dims, const uint8_t* in,
+                const ImageDims& out_dims, uint8_t* out) {
+  const int depth = in_dims.depth;
+  const size_t in_stride = in_dims.width * depth;
+  // Every output pixel covers the same total weight.
+  const uint64_t total =
+      static_cast<uint64_t>(in_dims.height) * in_dims.width;
+  for (int y = 0; y < out_dims.height; ++y) {
+    // Input rows that overlap this output row.
+    const int y_begin = y * in_dims.height / out_dims.height;
+    const int y_end = std::min(
+        ((y + 1) * in_dims.height + out_dims.height - 1) / out_dims.height,
+        in_dims.height);
+    for (int x = 0; x < out_dims.width; ++x) {
+      const int x_begin = x * in_dims.width / out_dims.width;
+      const int x_end = std::min(
+          ((x + 1) * in_dims.width + out_dims.width - 1) / out_dims.width,
+          in_dims.width);
+      for (int c = 0; c < depth; ++c) {
+        uint64_t sum = 0;
+        for (int in_y = y_begin; in_y < y_end; ++in_y) {
+          const uint32_t wy =
+              AreaWeight(in_y, y, in_dims.height, out_dims.height);
+          const uint8_t* in_row = in + in_y * in_stride + c;
+          uint64_t row_sum = 0;
+          for (int in_x = x_begin; in_x < x_end; ++in_x) {
+            row_sum += in_row[in_x * depth] *
+                       static_cast<uint32_t>(AreaWeight(
+                           in_x, x, in_dims.width, out_dims.width));
+          }
+          sum += row_sum * wy;
+        }
+        *out++ = static_cast<uint8_t>((sum + total / 2) / total);
+      }
+    }
+  }
+}
+}  // namespace
+
+bool ResizeImage(const ImageDims& in_dims, const uint8_t* uin,
+                 const ImageDims& out_dims, uint8_t* uout,
+                 ResizeMethod method) {
+  if (in_dims.depth != out_dims.depth) {
+    printf("ResizeImage can't change the image depth\r\n");
+    return false;
+  }
+  if (in_dims == out_dims) {
+    std::memcpy(uout, uin, ImageSize(in_dims));
+    return true;
+  }
+
+  switch (method) {
+    case ResizeMethod::kNearest:
+      ResizeNearest(in_dims, uin, out_dims, uout);
+      break;
+    case ResizeMethod::kBilinear:
+      ResizeBilinear(in_dims, uin, out_dims, uout);
+      break;
+    case ResizeMethod::kArea:
+      ResizeArea(in_dims, uin, out_dims, uout);
+      break;
+  }
+  return true;
+}
+
+}  // namespace coralmicro::tensorflow
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TENSORFLOW_RESIZE_H_
+#define LIBS_TENSORFLOW_RESIZE_H_
+
+#include <cstdint>
+
+namespace coralmicro::tensorflow {
+
+// Represents the dimensions of an image.
+struct ImageDims {
+  // Pixel height.
+  int height;
+  // Pixel width.
+  int width;
+  // Channel depth.
+  int depth;
+};
+
+// Operator == to compares 2 ImageDims object.
+inline bool operator==(const ImageDims& a, const ImageDims& b) {
+  return a.height == b.height && a.width == b.width && a.depth == b.depth;
+}
+
+// Gets an ImageDims's size.
+inline int ImageSize(const ImageDims& dims) {
+  return dims.height * dims.width * dims.depth;
+}
+
+// The interpolation used by `ResizeImage()`.
+enum class ResizeMethod {
+  // Nearest neighbor, identical to TFLite's RESIZE_NEAREST_NEIGHBOR with
+  // `align_corners` and `half_pixel_centers` false.
+  kNearest,
+  // Bilinear interpolation with half-pixel centers, in fixed point.
+  kBilinear,
+  // Averages every input pixel an output pixel covers, weighted by coverage.
+  // Best for downscaling by large factors, where the other methods alias.
+  kArea,
+};
+
+// Resizes a bitmap image, directly on the caller's buffers and without
+// allocating.
+// @param in_dims The current dimensions for image `uin`.
+// @param uin The input image location.
+// @param out_dims The desired dimensions for image `uout`. The depth must
+//   match `in_dims`.
+// @param uout The output image location.
+// @param method The interpolation to use.
+// @return False if the depths don't match.
+bool ResizeImage(const ImageDims& in_dims, const uint8_t* uin,
+                 const ImageDims& out_dims, uint8_t* uout,
+                 ResizeMethod method = ResizeMethod::kNearest);
+
+}  // namespace coralmicro::tensorflow
+
+#endif  // LIBS_TENSORFLOW_RESIZE_H_
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/tensorflow/segmentation.h"
+
+#include <algorithm>
+
+namespace coralmicro::tensorflow {
+
+namespace {
+// Argmax with the class count known at compile time, so the inner loop is
+// fully unrolled for the common small class counts.
+template <int N, typename T>
+void ArgmaxFixed(const T* logits, size_t num_pixels, uint8_t* labels) {
+  for (size_t i = 0; i < num_pixels; ++i, logits += N) {
+    int best = 0;
+    T best_logit = logits[0];
+    for (int c = 1; c < N; ++c) {
+      if (logits[c] > best_logit) {
+        best_logit = logits[c];
+        best = c;
+      }
+    }
+    labels[i] = static_cast<uint8_t>(best);
+  }
+}
+
+template <typename T>
+void Argmax(const T* logits, size_t num_pixels, int num_classes,
+            uint8_t* labels) {
+  switch (num_classes) {
+    case 1:
+      std::fill(labels, labels + num_pixels, 0);
+      return;
+    case 2:
+      return ArgmaxFixed<2>(logits, num_pixels, labels);
+    case 3:
+      return ArgmaxFixed<3>(logits, num_pixels, labels);
+    case 4:
+      return ArgmaxFixed<4>(logits, num_pixels, labels);
+    default:
+      break;
+  }
+  for (size_t i = 0; i < num_pixels; ++i, logits += num_classes) {
+    labels[i] = static_cast<uint8_t>(
+        std::max_element(logits, logits + num_classes) - logits);
+  }
+}
+
+size_t WriteVarint(size_t value, uint8_t* out, size_t capacity) {
+  size_t size = 0;
+  do {
+    if (size == capacity) return 0;
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if (value) byte |= 0x80;
+    out[size++] = byte;
+  } while (value);
+  return size;
+}
+}  // namespace
+
+bool GetSegmentationLabels(const TfLiteTensor& output, uint8_t* labels,
+                           size_t capacity, int* num_classes) {
+  const TfLiteIntArray* dims = output.dims;
+  if (dims->size == 0) return false;
+  size_t num_values = 1;
+  for (int i = 0; i < dims->size; ++i) num_values *= dims->data[i];
+
+  if (output.type == kTfLiteInt32) {
+    if (num_values > capacity) return false;
+    const int32_t* data = tflite::GetTensorData<int32_t>(&output);
+    int max_label = 0;
+    for (size_t i = 0; i < num_values; ++i) {
+      if (data[i] < 0 || data[i] >= kMaxSegmentationClasses) return false;
+      labels[i] = static_cast<uint8_t>(data[i]);
+      max_label = std::max(max_label, static_cast<int>(data[i]));
+    }
+    if (num_classes) *num_classes = max_label + 1;
+    return true;
+  }
+
+  const int classes = dims->data[dims->size - 1];
+  if (classes < 1 || classes > kMaxSegmentationClasses) return false;
+  const size_t num_pixels = num_values / classes;
+  if (num_pixels > capacity) return false;
+  switch (output.type) {
+    case kTfLiteFloat32:
+      Argmax(tflite::GetTensorData<float>(&output), num_pixels, classes,
+             labels);
+      break;
+    case kTfLiteUInt8:
+      Argmax(tflite::GetTensorData<uint8_t>(&output), num_pixels, classes,
+             labels);
+      break;
+    case kTfLiteInt8:
+      Argmax(tflite::GetTensorData<int8_t>(&output), num_pixels, classes,
+             labels);
+      break;
+    default:
+      return false;
+  }
+  if (num_classes) *num_classes = classes;
+  return true;
+}
+
+void GetSegmentationStats(const uint8_t* labels, int height, int width,
+                          int num_classes, SegmentationStats* stats) {
+  std::fill(stats, stats + num_classes, SegmentationStats{});
+  // Pixels are visited run by run, so each run costs a single update.
+  for (int y = 0; y < height; ++y) {
+    const uint8_t* row = labels + y * width;
+    int x = 0;
+    while (x < width) {
+      const uint8_t label = row[x];
+      const int start = x;
+      while (x < width && row[x] == label) ++x;
+      if (label >= num_classes) continue;
+
+      SegmentationStats& s = stats[label];
+      if (s.area == 0) {
+        s.bbox = {y, start, y, x - 1};
+      } else {
+        s.bbox.xmin = std::min(s.bbox.xmin, start);
+        s.bbox.xmax = std::max(s.bbox.xmax, x - 1);
+        s.bbox.ymax = y;
+      }
+      s.area += x - start;
+    }
+  }
+}
+
+size_t EncodeLabelRuns(const uint8_t* labels, size_t num_labels, uint8_t* out,
+                       size_t capacity) {
+  size_t size = 0;
+  size_t i = 0;
+  while (i < num_labels) {
+    const uint8_t label = labels[i];
+    const size_t start = i;
+    while (i < num_labels && labels[i] == label) ++i;
+
+    if (size == capacity) return 0;
+    out[size++] = label;
+    const size_t written = WriteVarint(i - start, out + size, capacity - size);
+    if (written == 0) return 0;
+    size += written;
+  }
+  return size;
+}
+
+size_t DecodeLabelRuns(const uint8_t* data, size_t size, uint8_t* labels,
+                       size_t capacity) {
+  size_t num_labels = 0;
+  size_t i = 0;
+  while (i < size) {
+    const uint8_t label = data[i++];
+    size_t length = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+      if (i == size || shift >= 35) return 0;
+      byte = data[i++];
+      length |= static_cast<size_t>(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    if (length == 0 || length > capacity - num_labels) return 0;
+    std::fill(labels + num_labels, labels + num_labels + length, label);
+    num_labels += length;
+  }
+  return num_labels;
+}
+
+}  // namespace coralmicro::tensorflow
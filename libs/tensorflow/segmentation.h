@@ -0,0 +1,104 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TENSORFLOW_SEGMENTATION_H_
+#define LIBS_TENSORFLOW_SEGMENTATION_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "libs/tensorflow/detection.h"
+#include "third_party/tflite-micro/tensorflow/lite/micro/micro_interpreter.h"
+
+namespace coralmicro::tensorflow {
+
+// The maximum number of classes in a label map, so that labels fit in a byte.
+inline constexpr int kMaxSegmentationClasses = 256;
+
+// Per-class statistics of a label map.
+struct SegmentationStats {
+  // The number of pixels with this label.
+  size_t area;
+  // The bounding box of those pixels, in pixels (inclusive). Only valid if
+  // `area` is non-zero.
+  BBox<int> bbox;
+};
+
+// Gets the label map (the highest-scoring class of each pixel) from a
+// semantic segmentation output tensor, without allocating.
+//
+// Logit tensors of shape [..., height, width, classes] can be float, uint8 or
+// int8; quantized logits are compared in their quantized form, which gives the
+// same label as comparing dequantized values. Equal logits resolve to the
+// lowest class, as with the TFLite `ARG_MAX` op. Models that already end with
+// `ARG_MAX` output int32 labels, which are copied.
+//
+// @param output The segmentation output tensor.
+// @param labels Receives one label per pixel, in row-major order.
+// @param capacity The size of `labels`.
+// @param num_classes Receives the number of classes. Optional.
+// @return False if the tensor has an unsupported type, more than
+//   `kMaxSegmentationClasses` classes, or more pixels than `capacity`.
+bool GetSegmentationLabels(const TfLiteTensor& output, uint8_t* labels,
+                           size_t capacity, int* num_classes = nullptr);
+
+// Computes the area and bounding box of each class in a label map.
+//
+// @param labels The label map, in row-major order.
+// @param height The label map height.
+// @param width The label map width.
+// @param num_classes The number of classes. Labels of `num_classes` or more
+//   are ignored.
+// @param stats Receives `num_classes` entries, indexed by label.
+void GetSegmentationStats(const uint8_t* labels, int height, int width,
+                          int num_classes, SegmentationStats* stats);
+
+// Gets the maximum size of `EncodeLabelRuns()` output for `num_labels`
+// labels.
+constexpr size_t MaxEncodedLabelRunsSize(size_t num_labels) {
+  return 2 * num_labels;
+}
+
+// Run-length encodes a label map for transport.
+//
+// Each run of equal labels, in row-major order, is written as the label byte
+// followed by the run length as an unsigned LEB128 varint (7 bits per byte,
+// least significant group first, high bit set on all but the last byte). A
+// map with few regions takes a few bytes per region boundary.
+//
+// @param labels The label map.
+// @param num_labels The number of labels (height * width).
+// @param out Receives the encoded runs.
+// @param capacity The size of `out`. `MaxEncodedLabelRunsSize(num_labels)`
+//   always suffices.
+// @return The number of bytes written, or 0 if `capacity` is too small.
+size_t EncodeLabelRuns(const uint8_t* labels, size_t num_labels, uint8_t* out,
+                       size_t capacity);
+
+// Decodes the output of `EncodeLabelRuns()`.
+//
+// @param data The encoded runs.
+// @param size The size of `data`.
+// @param labels Receives the label map.
+// @param capacity The size of `labels`.
+// @return The number of labels written, or 0 if `data` is malformed or the
+//   labels don't fit in `capacity`.
+size_t DecodeLabelRuns(const uint8_t* data, size_t size, uint8_t* labels,
+                       size_t capacity);
+
+}  // namespace coralmicro::tensorflow
+
+#endif  // LIBS_TENSORFLOW_SEGMENTATION_H_
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TENSORFLOW_TENSOR_TOP_K_H_
+#define LIBS_TENSORFLOW_TENSOR_TOP_K_H_
+
+#include <cstddef>
+
+#include "libs/tensorflow/top_k.h"
+#include "third_party/tflite-micro/tensorflow/lite/c/common.h"
+
+// The `TfLiteTensor` front ends of top_k.h, which itself doesn't depend on
+// TFLM.
+
+namespace coralmicro::tensorflow {
+
+// Whether a tensor holds float, uint8 or int8 values, the types read by
+// `TensorValue()` and `SelectTensorTopK()`.
+inline bool IsSupportedTensorType(const TfLiteTensor& tensor) {
+  return tensor.type == kTfLiteFloat32 || tensor.type == kTfLiteUInt8 ||
+         tensor.type == kTfLiteInt8;
+}
+
+// Reads one element of a float, uint8 or int8 tensor as a real value.
+inline float TensorValue(const TfLiteTensor& tensor, size_t index) {
+  switch (tensor.type) {
+    case kTfLiteUInt8:
+      return tensor.params.scale *
+             (tensor.data.uint8[index] - tensor.params.zero_point);
+    case kTfLiteInt8:
+      return tensor.params.scale *
+             (tensor.data.int8[index] - tensor.params.zero_point);
+    default:
+      return tensor.data.f[index];
+  }
+}
+
+// Selects the indices of the highest of the first `count` scores of a float,
+// uint8 or int8 tensor, with `SelectTopK()` or `SelectQuantizedTopK()`.
+inline size_t SelectTensorTopK(const TfLiteTensor& scores, size_t count,
+                               float threshold, size_t capacity,
+                               int* indices) {
+  switch (scores.type) {
+    case kTfLiteUInt8:
+      return SelectQuantizedTopK(scores.data.uint8, count, threshold,
+                                 scores.params.scale, scores.params.zero_point,
+                                 capacity, indices);
+    case kTfLiteInt8:
+      return SelectQuantizedTopK(scores.data.int8, count, threshold,
+                                 scores.params.scale, scores.params.zero_point,
+                                 capacity, indices);
+    default:
+      return SelectTopK(scores.data.f, count, threshold, capacity, indices);
+  }
+}
+
+}  // namespace coralmicro::tensorflow
+
+#endif  // LIBS_TENSORFLOW_TENSOR_TOP_K_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TENSORFLOW_TOP_K_H_
+#define LIBS_TENSORFLOW_TOP_K_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace coralmicro::tensorflow {
+
+// Finds the smallest quantized value whose dequantized value,
+// `scale * (q - zero_point)`, is greater-than-or-equal-to `threshold`, so that
+// quantized scores can be compared against a threshold without dequantizing
+// them.
+//
+// @param threshold The threshold as a real value.
+// @param scale The quantization scale (must be positive).
+// @param zero_point The quantization zero point.
+// @param quantized Receives the quantized threshold.
+// @tparam T The quantized type, `uint8_t` or `int8_t`.
+// @return False if no quantized value reaches `threshold`.
+template <typename T>
+bool QuantizeThreshold(float threshold, float scale, int32_t zero_point,
+                       T* quantized) {
+  static_assert(std::is_integral_v<T>, "T must be a quantized type");
+  constexpr int32_t kMin = std::numeric_limits<T>::min();
+  constexpr int32_t kMax = std::numeric_limits<T>::max();
+  auto reaches = [&](int32_t q) {
+    return scale * static_cast<float>(q - zero_point) >= threshold;
+  };
+  if (!reaches(kMax)) return false;
+  if (!(threshold > scale * static_cast<float>(kMin - zero_point))) {
+    *quantized = static_cast<T>(kMin);
+    return true;
+  }
+  // Start from the rounded estimate and fix up float rounding either way.
+  int32_t q = static_cast<int32_t>(std::ceil(threshold / scale)) + zero_point;
+  q = q < kMin ? kMin : (q > kMax ? kMax : q);
+  while (q > kMin && reaches(q - 1)) --q;
+  while (!reaches(q)) ++q;
+  *quantized = static_cast<T>(q);
+  return true;
+}
+
+// Selects the indices of the highest scores that are
+// greater-than-or-equal-to `threshold`, without allocating. Scores are
+// compared in their own type, so quantized scores need no dequantization.
+//
+// The selected indices are kept in a heap, in `indices`, whose root is the
+// lowest selected score. Most scores are rejected with a single comparison
+// against the root, and the others cost O(log(capacity)), so large
+// `capacity` values (such as the candidates of raw-box detection models)
+// stay cheap.
+//
+// @param scores The scores.
+// @param count The number of scores.
+// @param threshold The minimum score, in the same type as the scores.
+// @param capacity The maximum number of indices to select (top-k).
+// @param indices Receives the selected indices, ordered by score (highest
+//   first). Equal scores are ordered by index (lowest first). Must have room
+//   for `capacity` entries.
+// @return The number of indices selected.
+template <typename T>
+size_t SelectTopK(const T* scores, size_t count, T threshold, size_t capacity,
+                  int* indices) {
+  if (capacity == 0) return 0;
+  // Orders indices from best to worst, so the heap root is the worst one.
+  auto better = [scores](int a, int b) {
+    return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+  };
+  size_t size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const T score = scores[i];
+    if (score < threshold) continue;
+    if (size < capacity) {
+      indices[size++] = static_cast<int>(i);
+      std::push_heap(indices, indices + size, better);
+      continue;
+    }
+    // Indices only grow, so an equal score is worse than the root too.
+    if (!(score > scores[indices[0]])) continue;
+    std::pop_heap(indices, indices + size, better);
+    indices[size - 1] = static_cast<int>(i);
+    std::push_heap(indices, indices + size, better);
+  }
+  std::sort_heap(indices, indices + size, better);
+  return size;
+}
+
+// Selects the indices of the highest quantized scores whose dequantized value
+// is greater-than-or-equal-to `threshold`. Same as `SelectTopK()`, with the
+// threshold converted with `QuantizeThreshold()`.
+//
+// @param scores The quantized scores.
+// @param count The number of scores.
+// @param threshold The minimum score, as a real value.
+// @param scale The quantization scale of the scores.
+// @param zero_point The quantization zero point of the scores.
+// @param capacity The maximum number of indices to select (top-k).
+// @param indices Receives the selected indices, ordered by score (highest
+//   first).
+// @return The number of indices selected.
+template <typename T>
+size_t SelectQuantizedTopK(const T* scores, size_t count, float threshold,
+                           float scale, int32_t zero_point, size_t capacity,
+                           int* indices) {
+  T quantized_threshold;
+  if (!QuantizeThreshold(threshold, scale, zero_point, &quantized_threshold)) {
+    return 0;
+  }
+  return SelectTopK(scores, count, quantized_threshold, capacity, indices);
+}
+
+}  // namespace coralmicro::tensorflow
+
+#endif  // LIBS_TENSORFLOW_TOP_K_H_
@@ -17,6 +17,7 @@
 #ifndef LIBS_TENSORFLOW_UTILS_H_
 #define LIBS_TENSORFLOW_UTILS_H_
 
+#include "libs/tensorflow/resize.h"
 #include "libs/tpu/edgetpu_manager.h"
 #include "libs/tpu/edgetpu_op.h"
 #include "third_party/tflite-micro/tensorflow/lite/micro/micro_error_reporter.h"
@@ -44,34 +45,6 @@
 
 namespace coralmicro::tensorflow {
 
-// Represents the dimensions of an image.
-struct ImageDims {
-  // Pixel height.
-  int height;
-  // Pixel width.
-  int width;
-  // Channel depth.
-  int depth;
-};
-
-// Operator == to compares 2 ImageDims object.
-inline bool operator==(const ImageDims& a, const ImageDims& b) {
-  return a.height == b.height && a.width == b.width && a.depth == b.depth;
-}
-
-// Gets an ImageDims's size.
-inline int ImageSize(const ImageDims& dims) {
-  return dims.height * dims.width * dims.depth;
-}
-
-// Resizes a bitmap image.
-// @param in_dims The current dimensions for image `uin`.
-// @param uin The input image location.
-// @param out_dims The desired dimensions for image `uout`.
-// @param uout The output image location.
-bool ResizeImage(const ImageDims& in_dims, const uint8_t* uin,
-                 const ImageDims& out_dims, uint8_t* uout);
-
 // Gets the size of a tensor.
 // @param tensor The tensor to get the size.
 // @return The size of the tensor.
@@ -33,8 +33,10 @@
 #include "libs/tensorflow/classification.h"
 #include "libs/tensorflow/detection.h"
 #include "libs/tensorflow/posenet_decoder_op.h"
+#include "libs/tensorflow/segmentation.h"
 #include "libs/tensorflow/utils.h"
 #include "libs/tpu/edgetpu_manager.h"
+#include "libs/tpu/edgetpu_profiler.h"
 #include "libs/tpu/edgetpu_task.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
 #include "third_party/tflite-micro/tensorflow/lite/micro/micro_error_reporter.h"
@@ -120,6 +122,57 @@ void SetTPUPowerState(struct jsonrpc_request* request) {
   jsonrpc_return_success(request, "{}");
 }
 
+// Implements the "set_tpu_profiling" RPC.
+// Enables or disables the Edge TPU inference profiler and clears any events
+// recorded so far.
+void SetTpuProfiling(struct jsonrpc_request* request) {
+  bool enable;
+  if (!JsonRpcGetBooleanParam(request, "enable", &enable)) return;
+
+  auto* profiler = EdgeTpuProfiler::GetSingleton();
+  profiler->Clear();
+  profiler->SetEnabled(enable);
+  jsonrpc_return_success(request, "{}");
+}
+
+// Implements the "get_tpu_profile" RPC.
+// Returns the recorded Edge TPU phases as a Chrome trace ("trace") and the
+// per-phase totals ("phases") of time, bytes and USB transfers.
+void GetTpuProfile(struct jsonrpc_request* request) {
+  auto* profiler = EdgeTpuProfiler::GetSingleton();
+  const auto totals = profiler->GetTotals();
+  std::string phases = "{";
+  for (size_t i = 0; i < totals.size(); ++i) {
+    StrAppend(&phases,
+              "%s\"%s\":{\"count\":%llu,\"us\":%llu,\"bytes\":%llu,"
+              "\"transfers\":%llu}",
+              i ? "," : "", TpuPhaseName(static_cast<TpuPhase>(i)),
+              static_cast<unsigned long long>(totals[i].count),
+              static_cast<unsigned long long>(totals[i].duration_us),
+              static_cast<unsigned long long>(totals[i].bytes),
+              static_cast<unsigned long long>(totals[i].transfers));
+  }
+  phases += "}";
+  jsonrpc_return_success(request, "{%Q:%s,%Q:%s}", "phases", phases.c_str(),
+                         "trace", profiler->ToChromeTrace().c_str());
+}
+
+// Implements the "get_tpu_bring_up" RPC.
+// Returns the time of each step of the last Edge TPU bring-up ("steps"), in
+// microseconds since boot, keyed by step name. Steps that were not reached
+// are 0.
+void GetTpuBringUp(struct jsonrpc_request* request) {
+  const auto timeline = EdgeTpuProfiler::GetSingleton()->GetBringUpTimeline();
+  std::string steps = "{";
+  for (size_t i = 0; i < timeline.size(); ++i) {
+    StrAppend(&steps, "%s\"%s\":%llu", i ? "," : "",
+              TpuBringUpStepName(static_cast<TpuBringUpStep>(i)),
+              static_cast<unsigned long long>(timeline[i]));
+  }
+  steps += "}";
+  jsonrpc_return_success(request, "{%Q:%s}", "steps", steps.c_str());
+}
+
 void BeginUploadResource(struct jsonrpc_request* request) {
   std::string resource_name;
   if (!JsonRpcGetStringParam(request, "name", &resource_name)) return;
@@ -533,15 +586,31 @@ void RunSegmentationModel(struct jsonrpc_request* request) {
     return;
   }
   auto invoke_latency = coralmicro::TimerMicros() - invoke_start;
-  // Return results to post process on host side
-  auto* output_tensor = interpreter.output_tensor(0);
-  auto* output_mask = tflite::GetTensorData<uint8_t>(output_tensor);
-  auto size = coralmicro::tensorflow::TensorSize(output_tensor);
+  // Returns the run-length encoded label map rather than the raw logits.
+  const auto* output_tensor = interpreter.output_tensor(0);
+  if (output_tensor->dims->size < 3) {
+    jsonrpc_return_error(request, -1, "Unsupported segmentation output",
+                         nullptr);
+    return;
+  }
+  const int height = output_tensor->dims->data[1];
+  const int width = output_tensor->dims->data[2];
+  std::vector<uint8_t> labels(height * width);
+  if (!tensorflow::GetSegmentationLabels(*output_tensor, labels.data(),
+                                         labels.size())) {
+    jsonrpc_return_error(request, -1, "Unsupported segmentation output",
+                         nullptr);
+    return;
+  }
+  std::vector<uint8_t> label_runs(
+      tensorflow::MaxEncodedLabelRunsSize(labels.size()));
+  const size_t runs_size = tensorflow::EncodeLabelRuns(
+      labels.data(), labels.size(), label_runs.data(), label_runs.size());
 
   jsonrpc_return_success(
-      request, "{%Q:%lu, %Q:%V}", "latency",
-      static_cast<uint32_t>(invoke_latency + preprocess_latency), "output_mask",
-      size, output_mask);
+      request, "{%Q:%lu, %Q:%d, %Q:%d, %Q:%V}", "latency",
+      static_cast<uint32_t>(invoke_latency + preprocess_latency), "width",
+      width, "height", height, "label_runs", runs_size, label_runs.data());
 }
 
 void PosenetStressRun(struct jsonrpc_request* request) {
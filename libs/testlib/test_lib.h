@@ -27,6 +27,9 @@ namespace coralmicro::testlib {
 inline constexpr char kMethodGetSerialNumber[] = "get_serial_number";
 inline constexpr char kMethodRunTestConv1[] = "run_testconv1";
 inline constexpr char kMethodSetTPUPowerState[] = "set_tpu_power_state";
+inline constexpr char kMethodSetTpuProfiling[] = "set_tpu_profiling";
+inline constexpr char kMethodGetTpuProfile[] = "get_tpu_profile";
+inline constexpr char kMethodGetTpuBringUp[] = "get_tpu_bring_up";
 inline constexpr char kMethodPosenetStressRun[] = "posenet_stress_run";
 inline constexpr char kMethodBeginUploadResource[] = "begin_upload_resource";
 inline constexpr char kMethodUploadResourceChunk[] = "upload_resource_chunk";
@@ -59,6 +62,9 @@ inline constexpr char kMethodBleScan[] = "ble_scan";
 void GetSerialNumber(struct jsonrpc_request* request);
 void RunTestConv1(struct jsonrpc_request* request);
 void SetTPUPowerState(struct jsonrpc_request* request);
+void SetTpuProfiling(struct jsonrpc_request* request);
+void GetTpuProfile(struct jsonrpc_request* request);
+void GetTpuBringUp(struct jsonrpc_request* request);
 void BeginUploadResource(struct jsonrpc_request* request);
 void UploadResourceChunk(struct jsonrpc_request* request);
 void DeleteResource(struct jsonrpc_request* request);
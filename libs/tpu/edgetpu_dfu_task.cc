@@ -20,6 +20,7 @@
 #include <functional>
 
 #include "libs/tpu/edgetpu_manager.h"
+#include "libs/tpu/edgetpu_profiler.h"
 #include "libs/usb/usb_host_task.h"
 #include "third_party/nxp/rt1176-sdk/middleware/usb/host/class/usb_host_dfu.h"
 #include "third_party/nxp/rt1176-sdk/middleware/usb/host/usb_host_devices.h"
@@ -230,6 +231,8 @@ void EdgeTpuDfuTask::HandleNextState(NextStateRequest &req) {
     case DfuState::kUnattached:
       break;
     case DfuState::kAttached:
+      EdgeTpuProfiler::GetSingleton()->MarkBringUp(
+          TpuBringUpStep::kDfuAttached);
       ret = USB_HostDfuInit(device_handle(), &class_handle_);
       if (ret == kStatus_USB_Success) {
         SetNextState(DfuState::kSetInterface);
@@ -312,6 +315,8 @@ void EdgeTpuDfuTask::HandleNextState(NextStateRequest &req) {
       }
       break;
     case DfuState::kComplete:
+      EdgeTpuProfiler::GetSingleton()->MarkBringUp(
+          TpuBringUpStep::kFirmwareLoaded);
       USB_HostEhciResetBus(static_cast<usb_host_ehci_instance_t *>(
           host_instance()->controllerHandle));
       ret = USB_HostDfuDeinit(device_handle(), class_handle());
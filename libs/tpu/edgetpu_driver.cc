@@ -16,41 +16,29 @@
 
 #include "libs/tpu/edgetpu_driver.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 
 #include "libs/base/check.h"
 #include "libs/tpu/darwinn/driver/config/beagle/beagle_chip_config.h"
 #include "libs/tpu/darwinn/driver/config/beagle_csr_helper.h"
 #include "libs/tpu/darwinn/driver/config/common_csr_helper.h"
-#include "third_party/freertos_kernel/include/FreeRTOS.h"
-#include "third_party/freertos_kernel/include/semphr.h"
-#include "third_party/nxp/rt1176-sdk/components/osa/fsl_os_abstraction.h"
-#include "third_party/nxp/rt1176-sdk/middleware/usb/include/usb_spec.h"
+#include "libs/tpu/edgetpu_profiler.h"
 
 namespace coralmicro {
 namespace {
-constexpr uint8_t kSingleBulkOutEndpoint = 1;
-constexpr uint8_t kEventInEndpoint = 2;
-constexpr uint8_t kInterruptInEndpoint = 3;
 constexpr uint32_t kMaxBulkBufferSize = 32 * 1024;
-uint8_t BulkTransferBuffer[kMaxBulkBufferSize];
-
-struct UsbTransferMetadata {
-  SemaphoreHandle_t sema;
-  usb_status_t status;
-  size_t bytes_transferred;
-};
+// Streamed inputs and outputs alternate between the two halves of
+// `BulkTransferBuffer`, so each transfer is as large as an unstreamed one.
+constexpr uint32_t kStreamChunkSize = kMaxBulkBufferSize;
+uint8_t BulkTransferBuffer[2 * kStreamChunkSize];
 }  // namespace
 
 namespace registers = platforms::darwinn::driver::config::registers;
 
-bool TpuDriver::Initialize(usb_host_edgetpu_instance_t *usb_instance,
-                           PerformanceMode mode) {
-  if (usb_instance == nullptr) {
-    return false;
-  }
-  usb_instance_ = usb_instance;
-
+void TpuDriver::PrepareChip() {
   // Check chip id and test write
   uint32_t omc0_00_reg;
   CHECK(Read32(chip_config_.GetApexCsrOffsets().omc0_00, &omc0_00_reg));
@@ -74,6 +62,63 @@ bool TpuDriver::Initialize(usb_host_edgetpu_instance_t *usb_instance,
   scu_ctrl_0.set_rg_usb_inact_phy_mode(0);
   CHECK(Write32(chip_config_.GetScuCsrOffsets().scu_ctrl_0, scu_ctrl_0.raw()));
   CHECK(Read32(chip_config_.GetScuCsrOffsets().scu_ctrl_0, &scu_ctrl_0_reg));
+}
+
+void TpuDriver::ConfigureUsbAndTempsense() {
+  CHECK(Write64(chip_config_.GetUsbCsrOffsets().descr_ep, 0xF0));
+  CHECK(Write64(chip_config_.GetUsbCsrOffsets().multi_bo_ep, 0));
+  CHECK(Write64(chip_config_.GetUsbCsrOffsets().outfeed_chunk_length, 0x20));
+
+  uint32_t omc0_d0_reg, omc0_d8_reg, omc0_dc_reg;
+
+  // Enables tempsense clock.
+  CHECK(Read32(chip_config_.GetApexCsrOffsets().omc0_d0, &omc0_d0_reg));
+  registers::Omc0D0 omc0_d0(omc0_d0_reg);
+  omc0_d0.set_clk_en(0x1);
+  omc0_d0.set_adr(0xC);
+  omc0_d0.set_tref(0);
+  omc0_d0.set_tslope(0);
+  omc0_d0.set_t_setting(0);
+  CHECK(Write32(chip_config_.GetApexCsrOffsets().omc0_d0, omc0_d0.raw()));
+
+  // Enables tempsense input ports.
+  CHECK(Read32(chip_config_.GetApexCsrOffsets().omc0_d8, &omc0_d8_reg));
+  registers::Omc0D8 omc0_d8(omc0_d8_reg);
+  omc0_d8.set_enbg(0x1);
+  omc0_d8.set_envr(0x1);
+  omc0_d8.set_enad(0x1);
+  CHECK(Write32(chip_config_.GetApexCsrOffsets().omc0_d8, omc0_d8.raw()));
+
+  // Wait 100 us before enabling tempsense flow.
+  transport_->DelayMicros(100);
+
+  // Enables tempsense flow.
+  CHECK(Read32(chip_config_.GetApexCsrOffsets().omc0_dc, &omc0_dc_reg));
+  registers::Omc0DC omc0_dc(omc0_dc_reg);
+  omc0_dc.set_enthmc(0x1);
+  CHECK(Write32(chip_config_.GetApexCsrOffsets().omc0_dc, omc0_dc.raw()));
+}
+
+bool TpuDriver::Initialize(TpuTransport *transport, PerformanceMode mode) {
+  if (transport == nullptr) {
+    return false;
+  }
+  transport_ = transport;
+  bulk_out_pending_ = 0;
+  return BringUp(mode);
+}
+
+bool TpuDriver::SetPerformanceMode(PerformanceMode mode) {
+  if (transport_ == nullptr) {
+    return false;
+  }
+  // Whether the chip setup survives the reset hasn't been checked on
+  // hardware, so all of it is repeated.
+  return BringUp(mode);
+}
+
+bool TpuDriver::BringUp(PerformanceMode mode) {
+  PrepareChip();
 
   // Disable clock gating
   uint32_t scu_ctrl_2_reg;
@@ -100,9 +145,8 @@ bool TpuDriver::Initialize(usb_host_edgetpu_instance_t *usb_instance,
     CHECK(Write32(chip_config_.GetCbBridgeCsrOffsets().gcbb_credit0, 0x0));
   }
 
-  // Set performance mode and exit reset.
-  CHECK(Read32(chip_config_.GetScuCsrOffsets().scu_ctrl_3, &scu_ctrl_3_reg));
-  scu_ctrl_3.set_raw(scu_ctrl_3_reg);
+  // Set performance mode and exit reset. `scu_ctrl_3` already holds the
+  // last value read back from the chip.
   scu_ctrl_3.set_rg_force_sleep(0x2);
   switch (mode) {
     case PerformanceMode::kMax:
@@ -172,93 +216,13 @@ bool TpuDriver::Initialize(usb_host_edgetpu_instance_t *usb_instance,
   scu_ctrl_2.set_rg_gated_gcb(1);
   CHECK(Write32(chip_config_.GetScuCsrOffsets().scu_ctrl_2, scu_ctrl_2.raw()));
 
-  CHECK(Write64(chip_config_.GetUsbCsrOffsets().descr_ep, 0xF0));
-  CHECK(Write64(chip_config_.GetUsbCsrOffsets().multi_bo_ep, 0));
-  CHECK(Write64(chip_config_.GetUsbCsrOffsets().outfeed_chunk_length, 0x20));
-
-  uint32_t omc0_d0_reg, omc0_d8_reg, omc0_dc_reg;
-
-  // Enables tempsense clock.
-  CHECK(Read32(chip_config_.GetApexCsrOffsets().omc0_d0, &omc0_d0_reg));
-  registers::Omc0D0 omc0_d0(omc0_d0_reg);
-  omc0_d0.set_clk_en(0x1);
-  omc0_d0.set_adr(0xC);
-  omc0_d0.set_tref(0);
-  omc0_d0.set_tslope(0);
-  omc0_d0.set_t_setting(0);
-  CHECK(Write32(chip_config_.GetApexCsrOffsets().omc0_d0, omc0_d0.raw()));
-
-  // Enables tempsense input ports.
-  CHECK(Read32(chip_config_.GetApexCsrOffsets().omc0_d8, &omc0_d8_reg));
-  registers::Omc0D8 omc0_d8(omc0_d8_reg);
-  omc0_d8.set_enbg(0x1);
-  omc0_d8.set_envr(0x1);
-  omc0_d8.set_enad(0x1);
-  CHECK(Write32(chip_config_.GetApexCsrOffsets().omc0_d8, omc0_d8.raw()));
-
-  // Wait 100 us before enabling tempsense flow.
-  SDK_DelayAtLeastUs(100, CLOCK_GetFreq(kCLOCK_CpuClk));
-
-  // Enables tempsense flow.
-  CHECK(Read32(chip_config_.GetApexCsrOffsets().omc0_dc, &omc0_dc_reg));
-  registers::Omc0DC omc0_dc(omc0_dc_reg);
-  omc0_dc.set_enthmc(0x1);
-  CHECK(Write32(chip_config_.GetApexCsrOffsets().omc0_dc, omc0_dc.raw()));
+  ConfigureUsbAndTempsense();
 
   CHECK(DoRunControl(platforms::darwinn::driver::RunControl::kMoveToRun));
 
   return true;
 }
 
-bool TpuDriver::CSRTransfer(uint64_t reg, void *data, bool read,
-                            RegisterSize reg_size) {
-  bool ret = false;
-  usb_status_t control_status;
-  usb_setup_struct_t setup_packet;
-  setup_packet.bmRequestType =
-      USB_REQUEST_TYPE_TYPE_VENDOR | USB_REQUEST_TYPE_RECIPIENT_DEVICE;
-  setup_packet.bmRequestType |=
-      read ? USB_REQUEST_TYPE_DIR_IN : USB_REQUEST_TYPE_DIR_OUT;
-  switch (reg_size) {
-    case RegisterSize::kRegSize32:
-      setup_packet.bRequest = 1;
-      setup_packet.wLength = 4;
-      break;
-    case RegisterSize::kRegSize64:
-      setup_packet.bRequest = 0;
-      setup_packet.wLength = 8;
-      break;
-  }
-
-  setup_packet.wValue = 0xFFFF & reg;
-  setup_packet.wIndex = 0xFFFF & (reg >> 16);
-
-  SemaphoreHandle_t sema = xSemaphoreCreateBinary();
-
-  control_status = USB_HostEdgeTpuControl(
-      usb_instance_, &setup_packet, (uint8_t *)data,
-      [](void *param, uint8_t *data, uint32_t data_length,
-         usb_status_t status) {
-        SemaphoreHandle_t sema = (SemaphoreHandle_t)param;
-        xSemaphoreGive(sema);
-      },
-      sema);
-  if (control_status != kStatus_USB_Success) {
-    printf("USB_HostEdgeTpuControl failed\r\n");
-    goto exit;
-  }
-  if (xSemaphoreTake(sema, pdMS_TO_TICKS(200)) == pdFALSE) {
-    ret = false;
-    printf("%s didn't get semaphore\r\n", __func__);
-    goto exit;
-  }
-
-  ret = true;
-exit:
-  vSemaphoreDelete(sema);
-  return ret;
-}
-
 bool TpuDriver::SendData(DescriptorTag tag, const uint8_t *data,
                          uint32_t length) const {
   if (!WriteHeader(tag, length)) {
@@ -270,7 +234,7 @@ bool TpuDriver::SendData(DescriptorTag tag, const uint8_t *data,
     printf("BulkOutTransfer failed\r\n");
     return false;
   }
-  return true;
+  return coalesce_bulk_out_ || FlushBulkOut();
 }
 
 bool TpuDriver::SendParameters(const uint8_t *data, uint32_t length) const {
@@ -281,196 +245,220 @@ bool TpuDriver::SendInputs(const uint8_t *data, uint32_t length) const {
   return SendData(DescriptorTag::kInputActivations, data, length);
 }
 
+bool TpuDriver::SendInputs(uint32_t length,
+                           const TpuInputProducer &producer) const {
+  if (!WriteHeader(DescriptorTag::kInputActivations, length)) {
+    printf("WriteHeader failed\r\n");
+    return false;
+  }
+  if (length == 0) return true;
+
+  // The staged header (and anything staged before it) goes out with the
+  // first chunk, so it has to fit in one half of the buffer.
+  if (bulk_out_pending_ > kStreamChunkSize && !FlushBulkOut()) return false;
+  uint32_t used = bulk_out_pending_;
+  bulk_out_pending_ = 0;
+
+  const uint8_t *in_flight = nullptr;
+  uint32_t in_flight_size = 0;
+  uint32_t offset = 0;
+  int half = 0;
+  bool ok = true;
+  bool produced = true;
+  while (offset < length) {
+    uint8_t *chunk = BulkTransferBuffer + half * kStreamChunkSize;
+    const uint32_t count = std::min(kStreamChunkSize - used, length - offset);
+    // The header already announced `length` bytes, so after a producer
+    // failure the rest is sent as zeros to keep the stream in sync.
+    if (produced && !producer(chunk + used, offset, count)) {
+      printf("Input producer failed\r\n");
+      produced = false;
+    }
+    if (!produced) memset(chunk + used, 0, count);
+    used += count;
+    offset += count;
+    if (used < kStreamChunkSize && offset < length) continue;
+
+    // The other half must be sent before this one starts, and before the
+    // producer overwrites it.
+    if (!FinishStreamChunk(in_flight, in_flight_size)) {
+      in_flight = nullptr;
+      ok = false;
+      break;
+    }
+    EdgeTpuProfiler::GetSingleton()->CountTransfer();
+    if (!transport_->StartBulkOut(chunk, used)) {
+      printf("Bad StartBulkOut\r\n");
+      in_flight = nullptr;
+      ok = false;
+      break;
+    }
+    in_flight = chunk;
+    in_flight_size = used;
+    used = 0;
+    half ^= 1;
+  }
+  return FinishStreamChunk(in_flight, in_flight_size) && ok && produced;
+}
+
+bool TpuDriver::FinishStreamChunk(const uint8_t *data, uint32_t length) const {
+  if (data == nullptr) return true;
+  ssize_t bytes_sent = transport_->FinishBulkOut();
+  // Send whatever a short transfer left over synchronously.
+  while (bytes_sent > 0 && static_cast<uint32_t>(bytes_sent) < length) {
+    data += bytes_sent;
+    length -= bytes_sent;
+    EdgeTpuProfiler::GetSingleton()->CountTransfer();
+    bytes_sent = transport_->BulkOut(data, length);
+  }
+  if (bytes_sent <= 0) {
+    printf("Bad FinishBulkOut\r\n");
+    return false;
+  }
+  return true;
+}
+
 bool TpuDriver::SendInstructions(const uint8_t *data, uint32_t length) const {
   return SendData(DescriptorTag::kInstructions, data, length);
 }
 
 bool TpuDriver::GetOutputs(uint8_t *data, uint32_t length) const {
-  return BulkInTransfer(data, length);
+  return GetOutputs(length,
+                    [data](const uint8_t *chunk, uint32_t offset,
+                           uint32_t chunk_length) {
+                      memcpy(data + offset, chunk, chunk_length);
+                      return true;
+                    });
+}
+
+bool TpuDriver::GetOutputs(uint32_t length,
+                           const TpuOutputConsumer &consumer) const {
+  if (!FlushBulkOut()) return false;
+
+  const uint8_t *ready = nullptr;
+  uint32_t ready_offset = 0;
+  uint32_t ready_size = 0;
+  uint32_t received = 0;
+  int half = 0;
+  bool ok = true;
+  while (received < length) {
+    uint8_t *chunk = BulkTransferBuffer + half * kStreamChunkSize;
+    EdgeTpuProfiler::GetSingleton()->CountTransfer();
+    if (!transport_->StartBulkIn(
+            chunk, std::min(kStreamChunkSize, length - received))) {
+      printf("Bad StartBulkIn\r\n");
+      ok = false;
+      break;
+    }
+    // Consume the previous chunk while this one is received.
+    if (ready && !consumer(ready, ready_offset, ready_size)) {
+      ok = false;
+    }
+    ready = nullptr;
+    ssize_t bytes_received = transport_->FinishBulkIn();
+    if (!ok) break;
+    if (bytes_received <= 0) {
+      printf("Bad FinishBulkIn\r\n");
+      ok = false;
+      break;
+    }
+    ready = chunk;
+    ready_offset = received;
+    ready_size = bytes_received;
+    received += bytes_received;
+    half ^= 1;
+  }
+  if (ok && ready) {
+    ok = consumer(ready, ready_offset, ready_size);
+  }
+  return ok;
 }
 
 bool TpuDriver::Read32(uint64_t reg, uint32_t *val) {
-  return CSRTransfer(reg, val, true, RegisterSize::kRegSize32);
+  return transport_->ReadRegister(reg, val, sizeof(*val));
 }
 
 bool TpuDriver::Read64(uint64_t reg, uint64_t *val) {
-  return CSRTransfer(reg, val, true, RegisterSize::kRegSize64);
+  return transport_->ReadRegister(reg, val, sizeof(*val));
 }
 
 bool TpuDriver::Write32(uint64_t reg, uint32_t val) {
-  return CSRTransfer(reg, &val, false, RegisterSize::kRegSize32);
+  return transport_->WriteRegister(reg, &val, sizeof(val));
 }
 
 bool TpuDriver::Write64(uint64_t reg, uint64_t val) {
-  return CSRTransfer(reg, &val, false, RegisterSize::kRegSize64);
-}
-
-ssize_t TpuDriver::BulkOutTransferInternal(uint8_t endpoint,
-                                           const uint8_t *data,
-                                           uint32_t data_length) const {
-  UsbTransferMetadata meta;
-  meta.sema = xSemaphoreCreateBinary();
-  meta.status = kStatus_USB_Error;
-
-  usb_status_t bulk_status = USB_HostEdgeTpuBulkOutSend(
-      usb_instance_, endpoint, (uint8_t *)data, data_length,
-      [](void *param, uint8_t *data, uint32_t data_length,
-         usb_status_t status) {
-        UsbTransferMetadata *meta = static_cast<UsbTransferMetadata *>(param);
-        meta->bytes_transferred = data_length;
-        meta->status = status;
-        xSemaphoreGive(meta->sema);
-      },
-      &meta);
-
-  if (bulk_status != kStatus_USB_Success) {
-    printf("USB_HostEdgeTpuBulkOutSend failed\r\n");
-    goto exit;
-  }
-
-  if (xSemaphoreTake(meta.sema, pdMS_TO_TICKS(200)) == pdFALSE) {
-    printf("%s didn't get semaphore\r\n", __func__);
-  };
-
-exit:
-  vSemaphoreDelete(meta.sema);
-
-  if (meta.status == kStatus_USB_Success) {
-    return meta.bytes_transferred;
-  } else {
-    return -meta.status;
-  }
+  return transport_->WriteRegister(reg, &val, sizeof(val));
 }
 
 bool TpuDriver::BulkOutTransfer(const uint8_t *data,
                                 uint32_t data_length) const {
-  uint8_t *current_chunk = const_cast<uint8_t *>(data);
-  uint32_t bytes_left = data_length;
-
-  while (bytes_left > 0) {
-    uint32_t chunk_size = std::min(kMaxBulkBufferSize, bytes_left);
-    memcpy(BulkTransferBuffer, current_chunk, chunk_size);
-    ssize_t bytes_sent = BulkOutTransferInternal(
-        kSingleBulkOutEndpoint, BulkTransferBuffer, chunk_size);
-    if (bytes_sent > 0) {
-      current_chunk += bytes_sent;
-      bytes_left -= bytes_sent;
-    } else {
-      printf("Bad BulkOutTransferInternal\r\n");
+  // Data is staged in `BulkTransferBuffer` and sent once the buffer is full
+  // or a bulk in transfer needs the device to have seen it, so headers and
+  // small descriptors share USB transfers with the data around them.
+  while (data_length > 0) {
+    const uint32_t chunk_size =
+        std::min(kMaxBulkBufferSize - bulk_out_pending_, data_length);
+    memcpy(BulkTransferBuffer + bulk_out_pending_, data, chunk_size);
+    bulk_out_pending_ += chunk_size;
+    data += chunk_size;
+    data_length -= chunk_size;
+    if (bulk_out_pending_ == kMaxBulkBufferSize && !FlushBulkOut()) {
       return false;
     }
   }
-
   return true;
 }
 
-ssize_t TpuDriver::BulkInTransferInternal(uint8_t endpoint, uint8_t *data,
-                                          uint32_t data_length) const {
-  UsbTransferMetadata meta;
-  meta.sema = xSemaphoreCreateBinary();
-  meta.status = kStatus_USB_Error;
-
-  usb_status_t bulk_status = USB_HostEdgeTpuBulkInRecv(
-      usb_instance_, endpoint, data, data_length,
-      [](void *param, uint8_t *data, uint32_t data_length,
-         usb_status_t status) {
-        UsbTransferMetadata *meta = static_cast<UsbTransferMetadata *>(param);
-        meta->bytes_transferred = data_length;
-        meta->status = status;
-        xSemaphoreGive(meta->sema);
-      },
-      &meta);
-
-  if (bulk_status != kStatus_USB_Success) {
-    printf("USB_HostEdgeTpuBulkInRecv failed\r\n");
-    goto exit;
-  }
-
-  if (xSemaphoreTake(meta.sema, pdMS_TO_TICKS(200)) == pdFALSE) {
-    printf("%s didn't get semaphore\r\n", __func__);
-  };
-
-exit:
-  vSemaphoreDelete(meta.sema);
-
-  if (meta.status == kStatus_USB_Success) {
-    return meta.bytes_transferred;
-  } else {
-    return -meta.status;
-  }
-}
-
-bool TpuDriver::BulkInTransfer(uint8_t *data, uint32_t data_length) const {
-  uint8_t *current_chunk = data;
-  uint32_t bytes_left = data_length;
-  while (bytes_left > 0) {
-    uint32_t chunk_size = std::min(kMaxBulkBufferSize, bytes_left);
-    ssize_t bytes_received = BulkInTransferInternal(
-        kSingleBulkOutEndpoint, BulkTransferBuffer, chunk_size);
-    if (bytes_received > 0) {
-      memcpy(current_chunk, BulkTransferBuffer, chunk_size);
-      current_chunk += bytes_received;
-      bytes_left -= bytes_received;
+bool TpuDriver::FlushBulkOut() const {
+  uint32_t offset = 0;
+  while (offset < bulk_out_pending_) {
+    EdgeTpuProfiler::GetSingleton()->CountTransfer();
+    ssize_t bytes_sent = transport_->BulkOut(BulkTransferBuffer + offset,
+                                             bulk_out_pending_ - offset);
+    if (bytes_sent > 0) {
+      offset += bytes_sent;
     } else {
-      printf("Bad BulkInTransferInternal\r\n");
+      printf("Bad BulkOut\r\n");
+      bulk_out_pending_ = 0;
       return false;
     }
   }
+  bulk_out_pending_ = 0;
   return true;
 }
 
-std::vector<uint8_t> TpuDriver::PrepareHeader(DescriptorTag tag,
-                                              uint32_t length) const {
-  constexpr size_t kPacketHeaderRawDataSizeInBytes = 8;
-  constexpr size_t kLengthSizeInBytes = sizeof(length);
-  std::vector<uint8_t> header_packet(kPacketHeaderRawDataSizeInBytes);
-  std::fill(header_packet.begin(), header_packet.end(), 0);
-  memcpy(header_packet.data(), &length, kLengthSizeInBytes);
-
-  *(header_packet.data() + sizeof(kLengthSizeInBytes)) =
-      (static_cast<uint8_t>(tag) & 0xF);
-
+std::array<uint8_t, TpuDriver::kHeaderSizeBytes> TpuDriver::PrepareHeader(
+    DescriptorTag tag, uint32_t length) const {
+  std::array<uint8_t, kHeaderSizeBytes> header_packet{};
+  memcpy(header_packet.data(), &length, sizeof(length));
+  header_packet[sizeof(length)] = (static_cast<uint8_t>(tag) & 0xF);
   return header_packet;
 }
 
 bool TpuDriver::WriteHeader(DescriptorTag tag, uint32_t length) const {
-  std::vector<uint8_t> header_packet = PrepareHeader(tag, length);
-  return BulkOutTransfer(header_packet.data(), header_packet.size());
+  const auto header_packet = PrepareHeader(tag, length);
+  return BulkOutTransfer(header_packet.data(), header_packet.size()) &&
+         (coalesce_bulk_out_ || FlushBulkOut());
 }
 
 bool TpuDriver::ReadEvent() const {
-  bool ret = false;
-  constexpr size_t kEventSizeBytes = 16;
-  uint8_t *buf = (uint8_t *)OSA_MemoryAllocate(kEventSizeBytes);
-  SemaphoreHandle_t sema = xSemaphoreCreateBinary();
-  usb_status_t bulk_status = USB_HostEdgeTpuBulkInRecv(
-      usb_instance_, kEventInEndpoint, buf, kEventSizeBytes,
-      [](void *param, uint8_t *data, uint32_t data_length,
-         usb_status_t status) {
-        uint32_t len;
-        uint64_t address;
-        uint8_t tag;
-        memcpy(&address, data, sizeof(address));
-        memcpy(&len, data + sizeof(address), sizeof(len));
-        tag = *(data + sizeof(address) + sizeof(len)) & 0xF;
-        // For now, we don't do anything with these events we've read back.
-        (void)tag;
-        SemaphoreHandle_t sema = (SemaphoreHandle_t)param;
-        xSemaphoreGive(sema);
-      },
-      sema);
-  if (bulk_status != kStatus_USB_Success) {
+  if (!FlushBulkOut()) return false;
+  EdgeTpuProfiler::GetSingleton()->CountTransfer();
+  uint8_t event[TpuTransport::kEventSizeBytes];
+  if (!transport_->ReadEvent(event)) {
     printf("ReadEvent failed\r\n");
-    goto exit;
-  }
-  if (xSemaphoreTake(sema, pdMS_TO_TICKS(200)) == pdFALSE) {
-    goto exit;
-  };
-  ret = true;
-exit:
-  vSemaphoreDelete(sema);
-  OSA_MemoryFree(buf);
-  return ret;
+    return false;
+  }
+
+  uint32_t len;
+  uint64_t address;
+  uint8_t tag;
+  memcpy(&address, event, sizeof(address));
+  memcpy(&len, event + sizeof(address), sizeof(len));
+  tag = *(event + sizeof(address) + sizeof(len)) & 0xF;
+  // For now, we don't do anything with these events we've read back.
+  (void)tag;
+  return true;
 }
 
 bool TpuDriver::DoRunControl(platforms::darwinn::driver::RunControl run_state) {
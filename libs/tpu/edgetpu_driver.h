@@ -17,74 +17,96 @@
 #ifndef LIBS_TPU_EDGETPU_DRIVER_H_
 #define LIBS_TPU_EDGETPU_DRIVER_H_
 
+#include <array>
 #include <cstdint>
-#include <vector>
+#include <functional>
 
 #include "libs/tpu/darwinn/driver/config/beagle/beagle_chip_config.h"
 #include "libs/tpu/darwinn/driver/hardware_structures.h"
-#include "libs/tpu/usb_host_edgetpu.h"
+#include "libs/tpu/edgetpu_performance_mode.h"
+#include "libs/tpu/edgetpu_transport.h"
 
 namespace coralmicro {
 
-enum class PerformanceMode {
-  kLow,
-  kMedium,
-  kHigh,
-  kMax,
-};
+// Writes `length` bytes of a descriptor payload, starting at byte `offset` of
+// the payload, into `buffer`.
+// @return True on success. On false, the rest of the payload is sent as zeros
+// (the descriptor header already gave its length) and the send fails.
+using TpuInputProducer =
+    std::function<bool(uint8_t* buffer, uint32_t offset, uint32_t length)>;
 
-enum class DescriptorTag {
-  kUnknown = -1,
-  kInstructions = 0,
-  kInputActivations = 1,
-  kParameters = 2,
-  kOutputActivations = 3,
-  kInterrupt0 = 4,
-  kInterrupt1 = 5,
-  kInterrupt2 = 6,
-  kInterrupt3 = 7,
-};
+// Receives `length` bytes of a descriptor payload, starting at byte `offset`
+// of the payload. `data` is only valid during the call.
+// @return True on success; false aborts the transfer.
+using TpuOutputConsumer = std::function<bool(const uint8_t* data,
+                                             uint32_t offset, uint32_t length)>;
 
 class TpuDriver {
  public:
   TpuDriver() = default;
   TpuDriver(const TpuDriver&) = delete;
   TpuDriver& operator=(const TpuDriver&) = delete;
-  bool Initialize(usb_host_edgetpu_instance_t* usb_instance,
-                  PerformanceMode mode);
+  // Initializes an Edge TPU reached through `transport`: an
+  // `EdgeTpuUsbTransport` for the device on the USB host port, or an
+  // `EdgeTpuSimulator`. `transport` must outlive the driver's use of it.
+  bool Initialize(TpuTransport* transport, PerformanceMode mode);
+  // Changes the clock rates of an initialized Edge TPU by running the same
+  // bring-up as `Initialize()` on the device that is already enumerated. This
+  // takes the chip through reset, which drops any parameters cached on it.
+  bool SetPerformanceMode(PerformanceMode mode);
   bool SendParameters(const uint8_t* data, uint32_t length) const;
   bool SendInputs(const uint8_t* data, uint32_t length) const;
+  // Sends `length` bytes of input activations that `producer` writes directly
+  // into the USB transfer buffers. Each chunk is produced while the previous
+  // one is being sent, so input preparation overlaps the transfer. The
+  // producer is called with increasing, contiguous offsets and must not use
+  // the driver itself.
+  bool SendInputs(uint32_t length, const TpuInputProducer& producer) const;
   bool SendInstructions(const uint8_t* data, uint32_t length) const;
   bool GetOutputs(uint8_t* data, uint32_t length) const;
+  // Receives `length` bytes of output activations and hands each chunk to
+  // `consumer` straight from the USB transfer buffers. Each chunk is consumed
+  // while the next one is being received, so postprocessing overlaps the
+  // transfer. The consumer must not use the driver itself.
+  bool GetOutputs(uint32_t length, const TpuOutputConsumer& consumer) const;
   bool ReadEvent() const;
   float GetTemperature();
 
+  // Sets whether descriptor headers and payloads are packed together into
+  // bulk out transfers of up to 32 KB, instead of sending each header and
+  // each payload as transfers of their own (the default). Packing changes the
+  // USB transfer pattern of every inference and hasn't been validated on
+  // hardware yet, so it is off by default.
+  void SetCoalesceBulkOut(bool coalesce) { coalesce_bulk_out_ = coalesce; }
+
  private:
-  enum class RegisterSize {
-    kRegSize32,
-    kRegSize64,
-  };
+  static constexpr size_t kHeaderSizeBytes = 8;
 
   bool BulkOutTransfer(const uint8_t* data, uint32_t data_length) const;
-  ssize_t BulkOutTransferInternal(uint8_t endpoint, const uint8_t* data,
-                                  uint32_t data_length) const;
-  bool BulkInTransfer(uint8_t* data, uint32_t data_length) const;
-  ssize_t BulkInTransferInternal(uint8_t endpoint, uint8_t* data,
-                                 uint32_t data_length) const;
+  bool FlushBulkOut() const;
+  bool FinishStreamChunk(const uint8_t* data, uint32_t length) const;
 
   bool SendData(DescriptorTag tag, const uint8_t* data, uint32_t length) const;
   bool WriteHeader(DescriptorTag tag, uint32_t length) const;
-  std::vector<uint8_t> PrepareHeader(DescriptorTag tag, uint32_t length) const;
+  std::array<uint8_t, kHeaderSizeBytes> PrepareHeader(DescriptorTag tag,
+                                                      uint32_t length) const;
 
-  bool CSRTransfer(uint64_t reg, void* data, bool read, RegisterSize reg_size);
   bool Read32(uint64_t reg, uint32_t* val);
   bool Read64(uint64_t reg, uint64_t* val);
   bool Write32(uint64_t reg, uint32_t val);
   bool Write64(uint64_t reg, uint64_t val);
   bool DoRunControl(platforms::darwinn::driver::RunControl run_state);
 
+  // Sets up the chip and resets the core into `mode`.
+  bool BringUp(PerformanceMode mode);
+  void PrepareChip();
+  void ConfigureUsbAndTempsense();
+
   platforms::darwinn::driver::config::BeagleChipConfig chip_config_;
-  usb_host_edgetpu_instance_t* usb_instance_ = nullptr;
+  TpuTransport* transport_ = nullptr;
+  // Bytes staged for the next bulk out transfer.
+  mutable uint32_t bulk_out_pending_ = 0;
+  bool coalesce_bulk_out_ = false;
 };
 
 }  // namespace coralmicro
@@ -16,7 +16,11 @@
 
 #include "libs/tpu/edgetpu_executable.h"
 
+#include <algorithm>
+
+#include "libs/tpu/edgetpu_profiler.h"
 #include "tensorflow/lite/micro/kernels/kernel_util.h"
+#include "tensorflow/lite/micro/memory_helpers.h"
 
 namespace {
 int TensorDataTypeSize(platforms::darwinn::DataType data_type) {
@@ -40,6 +44,29 @@ int TensorDataTypeSize(platforms::darwinn::DataType data_type) {
       return 0;
   }
 }
+
+// Applies the transform of `OutputLayer::TransformSignedDataType()` to
+// `length` bytes that start at byte `position` of a tensor: flips the MSB of
+// each little-endian element of `data_type_size` bytes.
+void TransformSignedBytes(uint8_t* data, uint32_t position, uint32_t length,
+                          int data_type_size) {
+  for (uint32_t i = 0; i < length; ++i) {
+    if ((position + i) % data_type_size ==
+        static_cast<uint32_t>(data_type_size - 1)) {
+      data[i] ^= 128;
+    }
+  }
+}
+
+// Gets the size of a tensor in bytes, or 0 for an unknown type.
+int TensorSizeBytes(const TfLiteEvalTensor* tensor) {
+  size_t type_size = 0;
+  if (tflite::TfLiteTypeSizeOf(tensor->type, &type_size) != kTfLiteOk) {
+    return 0;
+  }
+  return tflite::micro::GetTensorShape(tensor).FlatSize() *
+         static_cast<int>(type_size);
+}
 }  // namespace
 
 namespace coralmicro {
@@ -68,105 +95,319 @@ EdgeTpuExecutable::~EdgeTpuExecutable() {
     }                         \
   } while (0);
 
-TfLiteStatus EdgeTpuExecutable::Invoke(const TpuDriver& tpu_driver,
-                                       TfLiteContext* context,
-                                       TfLiteNode* node) {
-  const TfLiteEvalTensor* input_tensor =
-      tflite::micro::GetEvalInput(context, node, 0);
-  const int input_size = tflite::micro::GetTensorShape(input_tensor).FlatSize();
-  if (!input_tensor) {
-    return kTfLiteError;
+int EdgeTpuExecutable::BatchCount(int input_bytes) const {
+  if (!executable_->input_layers() || executable_->input_layers()->size() == 0)
+    return 1;
+  const auto* input_layer = executable_->input_layers()->Get(0);
+  const int batch_bytes = input_layer->x_dim() * input_layer->y_dim() *
+                          input_layer->z_dim() *
+                          TensorDataTypeSize(input_layer->data_type());
+  if (batch_bytes <= 0 || input_bytes <= batch_bytes ||
+      input_bytes % batch_bytes != 0)
+    return 1;
+  return input_bytes / batch_bytes;
+}
+
+bool EdgeTpuExecutable::SendStreamedInputs(
+    const TpuDriver& tpu_driver, uint32_t base, uint32_t length,
+    const TpuInputProducer& input_producer, bool* produced) const {
+  int type_size = 0;
+  if (executable_->input_layers() && executable_->input_layers()->size() > 0) {
+    const auto* input_layer = executable_->input_layers()->Get(0);
+    if (OutputLayer::SignedDataType(input_layer->data_type())) {
+      type_size = TensorDataTypeSize(input_layer->data_type());
+    }
+  }
+  // A failed producer can't abort the descriptor, whose length has already
+  // been sent: the rest of the input is sent as zeros instead, and the
+  // inference runs to completion before it fails.
+  struct State {
+    const TpuInputProducer* producer;
+    uint32_t base;
+    int type_size;
+    bool* produced;
+  } state{&input_producer, base, type_size, produced};
+  return tpu_driver.SendInputs(
+      length, [&state](uint8_t* buffer, uint32_t offset, uint32_t count) {
+        if (!*state.produced) {
+          memset(buffer, 0, count);
+          return true;
+        }
+        if (!(*state.producer)(buffer, state.base + offset, count)) {
+          printf("Input producer failed\r\n");
+          *state.produced = false;
+          memset(buffer, 0, count);
+          return true;
+        }
+        if (state.type_size > 0) {
+          TransformSignedBytes(buffer, state.base + offset, count,
+                               state.type_size);
+        }
+        return true;
+      });
+}
+
+bool EdgeTpuExecutable::ReceiveOutputs(const TpuDriver& tpu_driver,
+                                       OutputLayer* output_layer,
+                                       uint32_t length) {
+  if (!output_layer->relayout_pending()) {
+    // The output has no tensor to go to, but must still be read from the
+    // Edge TPU.
+    return tpu_driver.GetOutputs(
+        length, [](const uint8_t*, uint32_t, uint32_t) { return true; });
   }
+  return tpu_driver.GetOutputs(
+      length, [output_layer](const uint8_t* data, uint32_t offset,
+                             uint32_t count) {
+        return output_layer->ConsumeOutput(data, offset, count);
+      });
+}
 
+TfLiteStatus EdgeTpuExecutable::SendHints(
+    const TpuDriver& tpu_driver, const uint8_t* input,
+    const TpuInputProducer* input_producer) {
   const platforms::darwinn::DmaDescriptorHint* dma_hint;
   const char* name;
-  uint8_t* output;
   int32_t ins_idx;
   const flatbuffers::Vector<uint8_t>* bitstream;
+  bool produced = true;
 
   for (const auto* hint : *(executable_->dma_hints()->hints())) {
     switch (hint->any_hint_type()) {
       case platforms::darwinn::AnyHint_DmaDescriptorHint:
         dma_hint = hint->any_hint_as_DmaDescriptorHint();
         switch (dma_hint->meta()->desc()) {
-          case platforms::darwinn::Description_BASE_ADDRESS_PARAMETER:
+          case platforms::darwinn::Description_BASE_ADDRESS_PARAMETER: {
+            ScopedTpuPhase phase(TpuPhase::kParameters,
+                                 dma_hint->size_in_bytes());
             RETURN_IF_ERROR(tpu_driver.SendParameters(
                 executable_->parameters()->data() + dma_hint->offset_in_bytes(),
                 dma_hint->size_in_bytes()));
             break;
-          case platforms::darwinn::Description_BASE_ADDRESS_INPUT_ACTIVATION:
-            name = dma_hint->meta()->name()->c_str();
-            if (executable_->input_layers()) {
-              for (const auto* input_layer : *(executable_->input_layers())) {
-                if (!strcmp(input_layer->name()->c_str(), name)) {
-                  if (OutputLayer::SignedDataType(input_layer->data_type())) {
-                    OutputLayer::TransformSignedDataType(
-                        input_tensor->data.uint8, input_size,
-                        TensorDataTypeSize(input_layer->data_type()),
-                        input_layer->x_dim(), input_layer->y_dim(),
-                        input_layer->z_dim());
-                  }
-                }
-              }
+          }
+          case platforms::darwinn::Description_BASE_ADDRESS_INPUT_ACTIVATION: {
+            ScopedTpuPhase phase(TpuPhase::kInputs, dma_hint->size_in_bytes());
+            if (input_producer) {
+              RETURN_IF_ERROR(SendStreamedInputs(
+                  tpu_driver, dma_hint->offset_in_bytes(),
+                  dma_hint->size_in_bytes(), *input_producer, &produced));
+              break;
             }
-            RETURN_IF_ERROR(tpu_driver.SendInputs(
-                input_tensor->data.uint8 + dma_hint->offset_in_bytes(),
-                dma_hint->size_in_bytes()));
+            RETURN_IF_ERROR(
+                tpu_driver.SendInputs(input + dma_hint->offset_in_bytes(),
+                                      dma_hint->size_in_bytes()));
             break;
-          case platforms::darwinn::Description_BASE_ADDRESS_OUTPUT_ACTIVATION:
+          }
+          case platforms::darwinn::Description_BASE_ADDRESS_OUTPUT_ACTIVATION: {
+            ScopedTpuPhase phase(TpuPhase::kOutputs, dma_hint->size_in_bytes());
             name = dma_hint->meta()->name()->c_str();
             if (output_layers_.find(name) == output_layers_.end()) {
               printf("Executable does not have output layer %s\r\n", name);
               break;
             }
-            output = output_layers_.at(name)->output_buffer();
-            RETURN_IF_ERROR(
-                tpu_driver.GetOutputs(output, dma_hint->size_in_bytes()));
+            RETURN_IF_ERROR(ReceiveOutputs(tpu_driver, output_layers_.at(name),
+                                           dma_hint->size_in_bytes()));
             break;
+          }
           default:
             break;
         }
         break;
-      case platforms::darwinn::AnyHint_InstructionHint:
+      case platforms::darwinn::AnyHint_InstructionHint: {
         ins_idx =
             hint->any_hint_as_InstructionHint()->instruction_chunk_index();
         bitstream =
             executable_->instruction_bitstreams()->Get(ins_idx)->bitstream();
+        ScopedTpuPhase phase(TpuPhase::kInstructions, bitstream->size());
         RETURN_IF_ERROR(
             tpu_driver.SendInstructions(bitstream->data(), bitstream->size()));
         break;
+      }
       default:
         break;
     }
   }
 
-  tpu_driver.ReadEvent();
+  {
+    ScopedTpuPhase phase(TpuPhase::kExecute, 0);
+    tpu_driver.ReadEvent();
+  }
+  return produced ? kTfLiteOk : kTfLiteError;
+}
+
+TfLiteStatus EdgeTpuExecutable::Invoke(
+    const TpuDriver& tpu_driver, TfLiteContext* context, TfLiteNode* node,
+    const TpuInputProducer* input_producer) {
+  const TfLiteEvalTensor* input_tensor =
+      tflite::micro::GetEvalInput(context, node, 0);
+  if (!input_tensor) {
+    return kTfLiteError;
+  }
+  const int input_size = TensorSizeBytes(input_tensor);
+
+  // An input tensor holding several inputs for the executable (a batch
+  // dimension larger than the compiled one) is run as consecutive
+  // inferences, with each output relayouted into its slice of the output
+  // tensor. Parameters cached on the TPU are loaded once for the batch.
+  // Sizes here are all in bytes.
+  const int batches = input_producer ? 1 : BatchCount(input_size);
+  const int input_batch_size = input_size / batches;
+
+  if (!input_producer && executable_->input_layers() &&
+      executable_->input_layers()->size() > 0) {
+    const auto* input_layer = executable_->input_layers()->Get(0);
+    if (OutputLayer::SignedDataType(input_layer->data_type())) {
+      for (int batch = 0; batch < batches; ++batch) {
+        OutputLayer::TransformSignedDataType(
+            input_tensor->data.uint8 + batch * input_batch_size,
+            input_batch_size, TensorDataTypeSize(input_layer->data_type()),
+            input_layer->x_dim(), input_layer->y_dim(), input_layer->z_dim());
+      }
+    }
+  }
+
+  for (int batch = 0; batch < batches; ++batch) {
+    EdgeTpuProfiler::GetSingleton()->BeginInference();
 
-  if (!output_layers_.empty()) {
-    for (int i = 0; i < node->outputs->size; ++i) {
+    // Outputs are relayouted into their tensors while they are received.
+    for (int i = 0; !output_layers_.empty() && i < node->outputs->size; ++i) {
       const TfLiteEvalTensor* output_tensor =
           tflite::micro::GetEvalOutput(context, node, i);
-      const int output_size =
-          tflite::micro::GetTensorShape(output_tensor).FlatSize();
       if (!output_tensor) {
         return kTfLiteError;
       }
-      name = executable_->output_layers()->Get(i)->name()->c_str();
+      const char* name = executable_->output_layers()->Get(i)->name()->c_str();
       if (output_layers_.find(name) == output_layers_.end()) {
         printf("Executable does not have buffer for %s\r\n", name);
         return kTfLiteError;
       }
       OutputLayer* output_layer = output_layers_[name];
+      const int output_batch_size = output_layer->RelayoutSizeBytes();
+      if ((batch + 1) * output_batch_size > TensorSizeBytes(output_tensor)) {
+        printf("Output tensor %s is too small for %d batches\r\n", name,
+               batches);
+        for (auto& entry : output_layers_) entry.second->CancelRelayout();
+        return kTfLiteError;
+      }
+      output_layer->BeginRelayout(output_tensor->data.uint8 +
+                                  batch * output_batch_size);
+    }
 
-      output_layer->Relayout(output_tensor->data.uint8);
-      output_layer->TransformSignedDataType(output_tensor->data.uint8,
-                                            output_size);
+    if (SendHints(tpu_driver,
+                  input_tensor->data.uint8 + batch * input_batch_size,
+                  input_producer) != kTfLiteOk) {
+      for (auto& entry : output_layers_) entry.second->CancelRelayout();
+      return kTfLiteError;
+    }
+
+    // Finishes the rows that weren't complete until the last chunk.
+    for (auto& entry : output_layers_) {
+      if (!entry.second->relayout_pending()) continue;
+      ScopedTpuPhase phase(TpuPhase::kRelayout,
+                           entry.second->RelayoutSizeBytes());
+      entry.second->EndRelayout();
     }
   }
 
   return kTfLiteOk;
 }
 
+OutputLayer::OutputLayer(const platforms::darwinn::Layer* layer)
+    : output_layer_(layer),
+      active_tile_x_sizes_(std::make_unique<int[]>(x_dim())) {
+  // Direct outputs are received straight into their tensor.
+  if (DirectOutput()) return;
+  output_buffer_ = std::make_unique<uint8_t[]>(layer->size_bytes());
+  if (y_dim() == 1 && x_dim() == 1) return;
+
+  const int data_type_size = DataTypeSize();
+  const int z_bytes = z_dim() * data_type_size;
+  row_ready_bytes_ = std::make_unique<int[]>(y_dim());
+  int ready_bytes = 0;
+  for (int y = 0; y < y_dim(); ++y) {
+    const auto y_buffer_index = GetYBufferIndex(y);
+    for (int x = 0; x < x_dim(); ++x) {
+      ready_bytes = std::max(
+          ready_bytes,
+          GetBufferIndex(y_buffer_index, x, 0) * data_type_size + z_bytes);
+    }
+    row_ready_bytes_[y] = ready_bytes;
+  }
+}
+
+bool OutputLayer::DirectOutput() const {
+  return y_dim() == 1 && x_dim() == 1 &&
+         (execution_count_per_inference() == 1 ||
+          PaddedSizeBytes() == ActualSizeBytes());
+}
+
+void OutputLayer::BeginRelayout(uint8_t* dest) {
+  dest_ = dest;
+  received_ = 0;
+  next_row_ = 0;
+}
+
+bool OutputLayer::ConsumeOutput(const uint8_t* data, uint32_t offset,
+                                uint32_t length) {
+  if (!dest_) return false;
+
+  if (DirectOutput()) {
+    // Only the first execution's elements are transformed, as in
+    // `TransformSignedDataType()`.
+    const uint32_t actual_size = ActualSizeBytes();
+    const uint32_t signed_size = ExecutionSizeBytes();
+    if (offset < actual_size) {
+      const uint32_t count = std::min(length, actual_size - offset);
+      memcpy(dest_ + offset, data, count);
+      if (SignedDataType() && offset < signed_size) {
+        TransformSignedBytes(dest_ + offset, offset,
+                             std::min(count, signed_size - offset),
+                             DataTypeSize());
+      }
+    }
+    return true;
+  }
+
+  const uint32_t size = output_layer_->size_bytes();
+  if (offset < size) {
+    memcpy(output_buffer_.get() + offset, data,
+           std::min(length, size - offset));
+  }
+  received_ = offset + length;
+  if (row_ready_bytes_) {
+    int rows = next_row_;
+    while (rows < y_dim() &&
+           static_cast<uint32_t>(row_ready_bytes_[rows]) <= received_) {
+      ++rows;
+    }
+    FinishRows(rows);
+  }
+  return true;
+}
+
+void OutputLayer::EndRelayout() {
+  if (!dest_) return;
+  if (row_ready_bytes_) {
+    FinishRows(y_dim());
+  } else if (!DirectOutput()) {
+    Relayout(dest_);
+    TransformSignedDataType(dest_, RelayoutSizeBytes());
+  }
+  dest_ = nullptr;
+}
+
+void OutputLayer::FinishRows(int y_end) {
+  if (y_end <= next_row_) return;
+  RelayoutRows(dest_, next_row_, y_end);
+  if (SignedDataType()) {
+    const int row_bytes = x_dim() * z_dim() * DataTypeSize();
+    TransformSignedDataType(dest_ + next_row_ * row_bytes,
+                            (y_end - next_row_) * row_bytes, DataTypeSize(),
+                            x_dim(), y_end - next_row_, z_dim());
+  }
+  next_row_ = y_end;
+}
+
 int OutputLayer::DataTypeSize() const {
   return TensorDataTypeSize(output_layer_->data_type());
 }
@@ -199,6 +440,7 @@ bool OutputLayer::SignedDataType(platforms::darwinn::DataType type) {
 
 void OutputLayer::Relayout(uint8_t* dest) const {
   uint8_t* src = output_buffer_.get();
+  if (!src) return;
   const auto data_type_size = DataTypeSize();
   const int z_bytes = z_dim() * data_type_size;
 
@@ -222,6 +464,16 @@ void OutputLayer::Relayout(uint8_t* dest) const {
       }
     }
   } else {
+    RelayoutRows(dest, 0, y_dim());
+  }
+}
+
+void OutputLayer::RelayoutRows(uint8_t* dest, int y_begin, int y_end) const {
+  uint8_t* src = output_buffer_.get();
+  const auto data_type_size = DataTypeSize();
+  const int z_bytes = z_dim() * data_type_size;
+  dest += y_begin * x_dim() * z_bytes;
+  {
     int z_bytes_padded;
     if (x_dim() > 1) {
       // If x-dim is > 1, padded-z-size can be deduced by looking at
@@ -262,7 +514,7 @@ void OutputLayer::Relayout(uint8_t* dest) const {
     // compiler optimizations based on compile-time-constants can kick in.
 #define RELAYOUT_WITH_Z_BYTES_SPECIALIZATION(num_z_bytes, num_z_bytes_padded) \
   do {                                                                        \
-    for (int y = 0; y < y_dim(); ++y) {                                       \
+    for (int y = y_begin; y < y_end; ++y) {                                   \
       const auto y_buffer_index = GetYBufferIndex(y);                         \
       int tile_starting_x = 0;                                                \
       for (size_t x_tile = 0; x_tile < active_tile_x_count; ++x_tile) {       \
@@ -329,7 +581,7 @@ void OutputLayer::TransformSignedDataType(uint8_t* buffer,
     return;
   }
 
-  if (buffer_size < ActualSizeBytes()) {
+  if (buffer_size < ExecutionSizeBytes()) {
     printf("Provided buffer size is less than actual size_bytes.");
     return;
   }
@@ -20,6 +20,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <map>
+#include <memory>
 
 #include "libs/tpu/edgetpu_driver.h"
 #include "libs/tpu/executable_generated.h"
@@ -29,13 +30,9 @@ namespace coralmicro {
 
 class OutputLayer {
  public:
-  explicit OutputLayer(const platforms::darwinn::Layer* layer)
-      : output_layer_(layer),
-        output_buffer_(std::make_unique<uint8_t[]>(layer->size_bytes())),
-        active_tile_x_sizes_(std::make_unique<int[]>(x_dim())) {}
+  explicit OutputLayer(const platforms::darwinn::Layer* layer);
   OutputLayer(const OutputLayer&) = delete;
   OutputLayer& operator=(const OutputLayer&) = delete;
-  uint8_t* output_buffer() { return output_buffer_.get(); }
 
   static bool SignedDataType(platforms::darwinn::DataType type);
   static void TransformSignedDataType(uint8_t* buffer, int buffer_size,
@@ -43,6 +40,28 @@ class OutputLayer {
                                       int z_dim);
   void Relayout(uint8_t* dest) const;
   void TransformSignedDataType(uint8_t* buffer, int buffer_size) const;
+  int ActualSizeBytes() const {
+    return ExecutionSizeBytes() * execution_count_per_inference();
+  }
+  // The number of bytes a relayout writes to `dest`: the unpadded output of
+  // every execution for one dimensional outputs, and of one execution
+  // otherwise.
+  int RelayoutSizeBytes() const {
+    return y_dim() == 1 && x_dim() == 1 ? ActualSizeBytes()
+                                        : ExecutionSizeBytes();
+  }
+
+  // Relayouts the output into `dest` as it is received: call
+  // `BeginRelayout()`, pass every received chunk in order to
+  // `ConsumeOutput()`, then call `EndRelayout()`. Rows are relayouted (and
+  // their signed type transformed) as soon as all their data has arrived.
+  // Outputs that don't need a relayout are written straight to `dest`
+  // without a staging buffer.
+  void BeginRelayout(uint8_t* dest);
+  bool ConsumeOutput(const uint8_t* data, uint32_t offset, uint32_t length);
+  void EndRelayout();
+  void CancelRelayout() { dest_ = nullptr; }
+  bool relayout_pending() const { return dest_ != nullptr; }
 
  private:
   struct YBufferIndex {
@@ -51,6 +70,11 @@ class OutputLayer {
     // Holds local offset within a data chunk returned by a given tile.
     int local_y_coordinate;
   };
+  // Whether the padded output is the output itself, followed by padding.
+  bool DirectOutput() const;
+  void RelayoutRows(uint8_t* dest, int y_begin, int y_end) const;
+  void FinishRows(int y_end);
+
   YBufferIndex GetYBufferIndex(int y) const;
   int GetBufferIndex(int y, int x, int z) const;
   int GetBufferIndex(const YBufferIndex& y_buffer_index, int x, int z) const;
@@ -58,14 +82,12 @@ class OutputLayer {
   int execution_count_per_inference() const {
     return output_layer_->execution_count_per_inference();
   }
-  int ActualSizeBytes() const {
-    const int num_elements = x_dim() * y_dim() * z_dim();
-    return num_elements * DataTypeSize() * execution_count_per_inference();
-  }
-
   int PaddedSizeBytes() const {
     return output_layer_->size_bytes() * execution_count_per_inference();
   }
+  int ExecutionSizeBytes() const {
+    return x_dim() * y_dim() * z_dim() * DataTypeSize();
+  }
 
   int DataTypeSize() const;
   bool SignedDataType() const;
@@ -76,6 +98,14 @@ class OutputLayer {
   const platforms::darwinn::Layer* output_layer_;
   std::unique_ptr<uint8_t[]> output_buffer_;
   std::unique_ptr<int[]> active_tile_x_sizes_;
+  // For each y, the number of received bytes after which rows 0 to y can be
+  // relayouted. Only set for multi-dimensional outputs.
+  std::unique_ptr<int[]> row_ready_bytes_;
+
+  // State of a chunked relayout.
+  uint8_t* dest_ = nullptr;
+  uint32_t received_ = 0;
+  int next_row_ = 0;
 };
 
 class EdgeTpuExecutable {
@@ -85,14 +115,36 @@ class EdgeTpuExecutable {
   EdgeTpuExecutable(const EdgeTpuExecutable&) = delete;
   EdgeTpuExecutable& operator=(const EdgeTpuExecutable&) = delete;
 
+  // Runs the executable on the node's first input. If the input tensor holds
+  // a whole number of inputs greater than one (a batch), each batch element
+  // is run in turn and written to the matching slice of each output tensor.
+  //
+  // If `input_producer` is given, the input activations are streamed from it
+  // instead of being read from the input tensor, which is left untouched.
+  // Streamed inputs can't be batched. If the producer fails, the inference
+  // still runs (on zeros) so the Edge TPU stays in sync, and then fails.
   TfLiteStatus Invoke(const TpuDriver& tpu_driver, TfLiteContext* context,
-                      TfLiteNode* node);
+                      TfLiteNode* node,
+                      const TpuInputProducer* input_producer = nullptr);
 
   uint64_t ParameterCachingToken() const {
     return executable_->parameter_caching_token();
   }
 
  private:
+  // Gets the number of executable inputs held by `input_bytes` of input.
+  int BatchCount(int input_bytes) const;
+  TfLiteStatus SendHints(const TpuDriver& tpu_driver, const uint8_t* input,
+                         const TpuInputProducer* input_producer);
+  bool ReceiveOutputs(const TpuDriver& tpu_driver, OutputLayer* output_layer,
+                      uint32_t length);
+  // Sends inputs from `input_producer`. `produced` is cleared if the producer
+  // fails, in which case zeros are sent in place of the rest of the input.
+  bool SendStreamedInputs(const TpuDriver& tpu_driver, uint32_t base,
+                          uint32_t length,
+                          const TpuInputProducer& input_producer,
+                          bool* produced) const;
+
   const platforms::darwinn::Executable* executable_;
 
   struct Less {
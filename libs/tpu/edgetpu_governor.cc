@@ -0,0 +1,122 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/tpu/edgetpu_governor.h"
+
+#include <algorithm>
+
+namespace coralmicro {
+namespace {
+// Modes are declared from slowest to fastest.
+int Level(PerformanceMode mode) { return static_cast<int>(mode); }
+}  // namespace
+
+EdgeTpuGovernor::EdgeTpuGovernor(const EdgeTpuGovernorConfig& config,
+                                 PerformanceMode mode)
+    : config_(config), running_mode_(mode) {
+  stats_.mode = mode;
+}
+
+void EdgeTpuGovernor::Reset(PerformanceMode mode) {
+  stats_.mode = mode;
+  stats_.thermal_cap = PerformanceMode::kMax;
+  throttled_ = false;
+  running_mode_ = mode;
+  high_streak_ = 0;
+  low_streak_ = 0;
+  since_change_ = 0;
+  since_cap_change_ = 0;
+}
+
+void EdgeTpuGovernor::UpdateThermalCap(
+    const std::optional<float>& temperature_c, PerformanceMode current) {
+  ++since_cap_change_;
+  if (!temperature_c.has_value()) return;
+  stats_.last_temperature_c = *temperature_c;
+
+  const float limit = config_.throttle_temperature_c;
+  if (*temperature_c >= limit) {
+    if (throttled_ && since_cap_change_ < config_.min_dwell_samples) return;
+    const int cap = throttled_ ? Level(stats_.thermal_cap) : Level(current);
+    if (!throttled_) ++stats_.thermal_throttles;
+    throttled_ = true;
+    stats_.thermal_cap = static_cast<PerformanceMode>(std::max(cap - 1, 0));
+    since_cap_change_ = 0;
+  } else if (throttled_ &&
+             *temperature_c <= limit - config_.temperature_hysteresis_c) {
+    throttled_ = false;
+    stats_.thermal_cap = PerformanceMode::kMax;
+    since_cap_change_ = 0;
+  }
+}
+
+PerformanceMode EdgeTpuGovernor::Update(const EdgeTpuGovernorSample& sample) {
+  ++stats_.samples;
+  ++stats_.mode_samples[Level(sample.mode)];
+  stats_.last_latency_us = sample.latency_us;
+  if (sample.mode != running_mode_) {
+    running_mode_ = sample.mode;
+    since_change_ = 0;
+    high_streak_ = 0;
+    low_streak_ = 0;
+  }
+  ++since_change_;
+  UpdateThermalCap(sample.temperature_c, sample.mode);
+
+  // The gap between the slow and fast thresholds, and the runs of samples
+  // needed on either side, keep a load near one threshold from flipping the
+  // mode back and forth.
+  const uint64_t latency = sample.latency_us;
+  const uint64_t target = config_.target_latency_us;
+  const int current = Level(sample.mode);
+  int desired = current;
+  if (latency * 100 > target * (100 + config_.up_margin_percent) ||
+      sample.queue_depth >= config_.up_queue_depth) {
+    low_streak_ = 0;
+    if (++high_streak_ >= config_.up_samples) ++desired;
+  } else if (latency * 100 < target * config_.down_threshold_percent &&
+             sample.queue_depth == 0) {
+    high_streak_ = 0;
+    if (++low_streak_ >= config_.down_samples) --desired;
+  } else {
+    high_streak_ = 0;
+    low_streak_ = 0;
+  }
+
+  const int low = Level(config_.min_mode);
+  const int high = std::max(
+      low, std::min(Level(config_.max_mode), Level(stats_.thermal_cap)));
+  desired = std::clamp(desired, low, high);
+
+  // Thermal limits apply right away; load changes wait out the dwell time.
+  const bool forced = current > high;
+  if (desired != current && !forced &&
+      since_change_ < config_.min_dwell_samples) {
+    desired = current;
+  }
+  const auto mode = static_cast<PerformanceMode>(desired);
+  if (mode != stats_.mode && desired != current) {
+    if (desired > current) {
+      ++stats_.up_switches;
+    } else {
+      ++stats_.down_switches;
+    }
+  }
+  stats_.mode = mode;
+  return stats_.mode;
+}
+
+}  // namespace coralmicro
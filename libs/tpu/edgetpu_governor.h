@@ -0,0 +1,128 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TPU_EDGETPU_GOVERNOR_H_
+#define LIBS_TPU_EDGETPU_GOVERNOR_H_
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#include "libs/tpu/edgetpu_performance_mode.h"
+
+namespace coralmicro {
+
+// Tuning for `EdgeTpuGovernor`.
+struct EdgeTpuGovernorConfig {
+  // Latency target for one inference, in microseconds.
+  uint32_t target_latency_us = 50000;
+  // An inference is slow when its latency exceeds the target by this
+  // percentage, or when at least `up_queue_depth` inferences are waiting for
+  // the Edge TPU. The mode steps up after `up_samples` slow inferences in a
+  // row.
+  uint32_t up_margin_percent = 10;
+  uint32_t up_queue_depth = 2;
+  uint32_t up_samples = 3;
+  // An inference is fast when its latency is below this percentage of the
+  // target and no inferences are waiting. The mode steps down after
+  // `down_samples` fast inferences in a row. Inferences that are neither
+  // slow nor fast keep the mode.
+  uint32_t down_threshold_percent = 60;
+  uint32_t down_samples = 20;
+  // Minimum number of inferences run in a mode before the load can change
+  // it again.
+  uint32_t min_dwell_samples = 10;
+  // The range of modes to use. `kMax` is left out by default because it can
+  // make the module hot to the touch.
+  PerformanceMode min_mode = PerformanceMode::kLow;
+  PerformanceMode max_mode = PerformanceMode::kHigh;
+  // At or above this die temperature, the mode is capped one step below the
+  // current mode, and lowered one more step after every `min_dwell_samples`
+  // inferences that are still too hot. The cap is lifted once the temperature
+  // drops `temperature_hysteresis_c` below the limit.
+  float throttle_temperature_c = 85.0f;
+  float temperature_hysteresis_c = 5.0f;
+  // Reads the temperature every this many inferences (reading it takes a USB
+  // control transfer).
+  uint32_t temperature_interval = 16;
+};
+
+// Measurements taken after one inference.
+struct EdgeTpuGovernorSample {
+  uint32_t latency_us;
+  // Inferences waiting for the Edge TPU when this one finished.
+  uint32_t queue_depth;
+  // Die temperature, if it was read for this sample.
+  std::optional<float> temperature_c;
+  // The mode the inference ran in. This can lag behind the mode asked for by
+  // the governor, which its user may only apply later.
+  PerformanceMode mode;
+};
+
+// Counters kept by `EdgeTpuGovernor`.
+struct EdgeTpuGovernorStats {
+  uint32_t samples = 0;
+  uint32_t up_switches = 0;
+  uint32_t down_switches = 0;
+  uint32_t thermal_throttles = 0;
+  // Inferences run in each mode, indexed by `PerformanceMode`.
+  std::array<uint32_t, 4> mode_samples{};
+  uint32_t last_latency_us = 0;
+  float last_temperature_c = 0.0f;
+  // The mode asked for by the governor.
+  PerformanceMode mode = PerformanceMode::kHigh;
+  // Highest mode allowed by the thermal limit.
+  PerformanceMode thermal_cap = PerformanceMode::kMax;
+};
+
+// Picks an Edge TPU `PerformanceMode` from the latency, queue depth and
+// temperature of recent inferences. The governor only computes decisions, so
+// it can be driven by synthetic traces; `EdgeTpuManager::EnableGovernor()`
+// feeds it from real inferences and applies its decisions.
+class EdgeTpuGovernor {
+ public:
+  EdgeTpuGovernor(const EdgeTpuGovernorConfig& config, PerformanceMode mode);
+
+  // Restarts from `mode`, keeping the stats.
+  void Reset(PerformanceMode mode);
+
+  // Records one inference.
+  // @return The mode to use for the next inference. Decisions are made
+  // relative to `sample.mode`, so a mode that isn't applied yet is asked for
+  // again rather than stepped past.
+  PerformanceMode Update(const EdgeTpuGovernorSample& sample);
+
+  PerformanceMode mode() const { return stats_.mode; }
+  const EdgeTpuGovernorConfig& config() const { return config_; }
+  const EdgeTpuGovernorStats& stats() const { return stats_; }
+
+ private:
+  void UpdateThermalCap(const std::optional<float>& temperature_c,
+                        PerformanceMode current);
+
+  EdgeTpuGovernorConfig config_;
+  EdgeTpuGovernorStats stats_;
+  bool throttled_ = false;
+  PerformanceMode running_mode_;
+  uint32_t high_streak_ = 0;
+  uint32_t low_streak_ = 0;
+  uint32_t since_change_ = 0;
+  uint32_t since_cap_change_ = 0;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_TPU_EDGETPU_GOVERNOR_H_
@@ -16,11 +16,19 @@
 
 #include "libs/tpu/edgetpu_manager.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <vector>
 
 #include "libs/base/check.h"
+#include "libs/base/filesystem.h"
 #include "libs/base/mutex.h"
+#include "libs/base/tasks.h"
+#include "libs/base/timer.h"
+#include "libs/tpu/edgetpu_profiler.h"
 #include "libs/tpu/edgetpu_task.h"
+#include "tensorflow/lite/micro/kernels/kernel_util.h"
 #include "third_party/flatbuffers/include/flatbuffers/flatbuffers.h"
 #include "third_party/flatbuffers/include/flatbuffers/flexbuffers.h"
 #include "third_party/nxp/rt1176-sdk/components/osa/fsl_os_abstraction.h"
@@ -31,6 +39,90 @@ constexpr char kKeyVersion[] = "1";
 constexpr char kKeyChipName[] = "2";
 constexpr char kKeyParamCache_DEPRECATED[] = "3";
 constexpr char kKeyExecutable[] = "4";
+
+constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ull;
+// Bytes hashed at each end of a package by `Fingerprint()`.
+constexpr size_t kFingerprintBytes = 4096;
+
+// 64-bit FNV-1a, continuing from `hash`.
+uint64_t Fnv1a(const uint8_t* data, size_t length, uint64_t hash) {
+  constexpr uint64_t kFnvPrime = 0x100000001b3ull;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= data[i];
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+// Hash of the package length and its first and last `kFingerprintBytes`,
+// which costs the same for any package size. It tells whether a registered
+// buffer still holds the same package, since a different model loaded into
+// it changes its header, its trailing metadata or its length.
+uint64_t Fingerprint(const uint8_t* data, size_t length) {
+  uint64_t hash = Fnv1a(reinterpret_cast<const uint8_t*>(&length),
+                        sizeof(length), kFnvOffsetBasis);
+  if (length <= 2 * kFingerprintBytes) return Fnv1a(data, length, hash);
+  hash = Fnv1a(data, kFingerprintBytes, hash);
+  return Fnv1a(data + length - kFingerprintBytes, kFingerprintBytes, hash);
+}
+
+#if CORAL_MICRO_EDGETPU_FAST_VERIFY
+// Fast verification trusts the fingerprint to identify a package, so a
+// package that was verified before is never read in full by the CPU. Zero is
+// reserved to mark empty parameter cache slots.
+uint64_t ContentHash(const uint8_t* data, size_t length, uint64_t fingerprint) {
+  return fingerprint ? fingerprint : 1;
+}
+
+// Content hashes of packages that passed full verification, persisted so
+// that later boots can skip the flatbuffers verifier for the same model.
+constexpr char kVerifiedPackagesPath[] = "/cache/edgetpu_verified";
+constexpr size_t kMaxVerifiedPackages = 16;
+
+std::vector<uint64_t>* VerifiedPackages() {
+  static std::vector<uint64_t>* hashes = [] {
+    auto* hashes = new std::vector<uint64_t>();
+    std::vector<uint8_t> buf;
+    if (LfsReadFile(kVerifiedPackagesPath, &buf)) {
+      hashes->resize(std::min(buf.size() / sizeof(uint64_t),
+                              kMaxVerifiedPackages));
+      std::memcpy(hashes->data(), buf.data(),
+                  hashes->size() * sizeof(uint64_t));
+    }
+    return hashes;
+  }();
+  return hashes;
+}
+
+bool IsVerifiedPackage(uint64_t content_hash) {
+  const auto* hashes = VerifiedPackages();
+  return std::find(hashes->begin(), hashes->end(), content_hash) !=
+         hashes->end();
+}
+
+void AddVerifiedPackage(uint64_t content_hash) {
+  auto* hashes = VerifiedPackages();
+  // Most recently verified last; forget the oldest once full.
+  if (hashes->size() == kMaxVerifiedPackages) hashes->erase(hashes->begin());
+  hashes->push_back(content_hash);
+  if (!LfsMakeDirs(LfsDirname(kVerifiedPackagesPath).c_str()) ||
+      !LfsWriteFile(kVerifiedPackagesPath,
+                    reinterpret_cast<const uint8_t*>(hashes->data()),
+                    hashes->size() * sizeof(uint64_t))) {
+    printf("Failed to save verified package cache.\r\n");
+  }
+}
+#else
+// Hash of the whole package. Zero is reserved to mark empty parameter cache
+// slots.
+uint64_t ContentHash(const uint8_t* data, size_t length, uint64_t fingerprint) {
+  const uint64_t hash = Fnv1a(data, length, kFnvOffsetBasis);
+  return hash ? hash : 1;
+}
+
+bool IsVerifiedPackage(uint64_t content_hash) { return false; }
+void AddVerifiedPackage(uint64_t content_hash) {}
+#endif  // CORAL_MICRO_EDGETPU_FAST_VERIFY
 }  // namespace
 
 EdgeTpuContext::EdgeTpuContext() {
@@ -38,13 +130,99 @@ EdgeTpuContext::EdgeTpuContext() {
 }
 
 EdgeTpuContext::~EdgeTpuContext() {
+  EdgeTpuManager::GetSingleton()->ReleasePower();
+}
+
+EdgeTpuManager::EdgeTpuManager()
+    : mutex_(xSemaphoreCreateMutex()), power_mutex_(xSemaphoreCreateMutex()) {
+  CHECK(mutex_);
+  CHECK(power_mutex_);
+  // The period is set each time the timer is armed. The callback runs in the
+  // timer task, which must not block, so it only wakes `idle_task_`.
+  idle_timer_ = xTimerCreate(
+      "edgetpu_idle", /*xTimerPeriodInTicks=*/1, pdFALSE, this,
+      +[](TimerHandle_t timer) {
+        xTaskNotifyGive(
+            static_cast<EdgeTpuManager*>(pvTimerGetTimerID(timer))
+                ->idle_task_);
+      });
+  CHECK(idle_timer_);
+}
+
+void EdgeTpuManager::IdleTaskMain(void* param) {
+  auto* manager = static_cast<EdgeTpuManager*>(param);
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    manager->IdleTimeout();
+  }
+}
+
+void EdgeTpuManager::PowerOff() {
   EdgeTpuTask::GetSingleton()->SetPower(false);
   // Small delay ensuring usb instance is released.
   vTaskDelay(pdMS_TO_TICKS(30));
 }
 
-EdgeTpuManager::EdgeTpuManager() : mutex_(xSemaphoreCreateMutex()) {
-  CHECK(mutex_);
+// The idle timer commands are sent without holding `power_mutex_`, so a full
+// timer command queue doesn't hold up `OpenDevice()`.
+void EdgeTpuManager::ReleasePower() {
+  TickType_t period;
+  {
+    MutexLock lock(power_mutex_);
+    if (idle_timeout_ms_ == 0) {
+      PowerOff();
+      return;
+    }
+    // Keep the released context's power reference until the idle timer
+    // fires or the next `OpenDevice()` takes it back.
+    warm_ = true;
+    warm_since_ = xTaskGetTickCount();
+    period = pdMS_TO_TICKS(idle_timeout_ms_);
+  }
+  xTimerChangePeriod(idle_timer_, period, portMAX_DELAY);
+}
+
+void EdgeTpuManager::IdleTimeout() {
+  MutexLock lock(power_mutex_);
+  // The timer fires late if it was re-armed, or the warm reference taken
+  // back, after it expired.
+  if (!warm_ ||
+      xTaskGetTickCount() - warm_since_ < pdMS_TO_TICKS(idle_timeout_ms_)) {
+    return;
+  }
+  warm_ = false;
+  ++power_stats_.idle_power_offs;
+  PowerOff();
+}
+
+void EdgeTpuManager::SetIdleTimeout(uint32_t timeout_ms) {
+  {
+    MutexLock lock(power_mutex_);
+    if (timeout_ms > 0 && !idle_task_) {
+      CHECK(xTaskCreate(IdleTaskMain, "edgetpu_idle",
+                        configMINIMAL_STACK_SIZE * 3, this,
+                        kEdgeTpuTaskPriority, &idle_task_) == pdPASS);
+    }
+    idle_timeout_ms_ = timeout_ms;
+    if (!warm_) return;
+    if (timeout_ms == 0) {
+      warm_ = false;
+      PowerOff();
+      return;
+    }
+    warm_since_ = xTaskGetTickCount();
+  }
+  xTimerChangePeriod(idle_timer_, pdMS_TO_TICKS(timeout_ms), portMAX_DELAY);
+}
+
+EdgeTpuPowerStats EdgeTpuManager::GetPowerStats() {
+  MutexLock lock(power_mutex_);
+  return power_stats_;
+}
+
+void EdgeTpuManager::SetCoalesceBulkOut(bool coalesce) {
+  MutexLock lock(mutex_);
+  tpu_driver_.SetCoalesceBulkOut(coalesce);
 }
 
 void EdgeTpuManager::NotifyConnected(
@@ -54,6 +232,7 @@ void EdgeTpuManager::NotifyConnected(
   // The EdgeTPU has left the USB bus -- clean up state.
   if (!usb_instance_) {
     current_parameter_caching_token_ = 0;
+    cached_packages_.fill(0);
   }
 }
 
@@ -66,7 +245,28 @@ std::shared_ptr<EdgeTpuContext> EdgeTpuManager::OpenDevice(
   auto context = context_.lock();
   if (context) return context;
 
-  context = std::make_shared<EdgeTpuContext>();
+  const uint64_t start_us = TimerMicros();
+  {
+    MutexLock power_lock(power_mutex_);
+    context = std::make_shared<EdgeTpuContext>();
+    if (warm_) {
+      // The new context holds its own power reference now. Once `warm_` is
+      // cleared the timer does nothing, so don't wait on the timer task.
+      xTimerStop(idle_timer_, 0);
+      warm_ = false;
+      EdgeTpuTask::GetSingleton()->SetPower(false);
+      // A warm Edge TPU that is still on the bus keeps its firmware, clock
+      // setup and cached parameters, so it is ready to use.
+      if (usb_instance_ && SetMode(mode)) {
+        if (governor_) governor_->Reset(mode);
+        ++power_stats_.warm_opens;
+        power_stats_.last_warm_open_us =
+            static_cast<uint32_t>(TimerMicros() - start_us);
+        context_ = context;
+        return context;
+      }
+    }
+  }
 
   while (!usb_instance_) {
     if (usb_error_) {
@@ -79,10 +279,20 @@ std::shared_ptr<EdgeTpuContext> EdgeTpuManager::OpenDevice(
   }
 
   // Got tpu usb instance, init the tpu driver.
-  if (!tpu_driver_.Initialize(usb_instance_, mode)) {
+  usb_transport_.SetUsbInstance(usb_instance_);
+  if (!tpu_driver_.Initialize(&usb_transport_, mode)) {
     return nullptr;
   }
+  mode_ = mode;
+  if (governor_) governor_->Reset(mode);
+  EdgeTpuProfiler::GetSingleton()->MarkBringUp(TpuBringUpStep::kInitialized);
 
+  {
+    MutexLock power_lock(power_mutex_);
+    ++power_stats_.cold_opens;
+    power_stats_.last_cold_open_us =
+        static_cast<uint32_t>(TimerMicros() - start_us);
+  }
   context_ = context;
   return context;
 }
@@ -91,17 +301,32 @@ EdgeTpuPackage* EdgeTpuManager::RegisterPackage(const char* package_content,
                                                 size_t length) {
   MutexLock lock(mutex_);
   auto package_ptr = (uintptr_t)package_content;
+  const auto key = PackageKey{
+      package_ptr, length,
+      Fingerprint(reinterpret_cast<const uint8_t*>(package_content), length)};
 
-  if (packages_.find(package_ptr) != packages_.end()) {
-    return packages_[package_ptr];
+  if (auto it = packages_.find(key); it != packages_.end()) {
+    ++it->second.refs;
+    return it->second.package.get();
   }
 
+  // Only new packages pay for hashing their whole content, and only with
+  // strict verification.
+  const uint64_t content_hash =
+      ContentHash(reinterpret_cast<const uint8_t*>(package_content), length,
+                  std::get<2>(key));
+
+  // Packages whose content hash is in the verified-package cache already
+  // passed every verifier pass below on an earlier boot.
+  const bool verified = IsVerifiedPackage(content_hash);
+
   auto flexbuffer_map =
       flexbuffers::GetRoot((const uint8_t*)package_ptr, length).AsMap();
   auto package_binary = flexbuffer_map[kKeyExecutable].AsString();
   flatbuffers::Verifier package_verifier((const uint8_t*)package_binary.c_str(),
                                          package_binary.length());
-  if (!package_verifier.VerifyBuffer<platforms::darwinn::Package>()) {
+  if (!verified &&
+      !package_verifier.VerifyBuffer<platforms::darwinn::Package>()) {
     printf("Package verification failed.\r\n");
     return nullptr;
   }
@@ -119,8 +344,8 @@ EdgeTpuPackage* EdgeTpuManager::RegisterPackage(const char* package_content,
   flatbuffers::Verifier multi_executable_verifier(
       package->serialized_multi_executable()->data(),
       flatbuffers::VectorLength(package->serialized_multi_executable()));
-  if (!multi_executable_verifier
-           .VerifyBuffer<platforms::darwinn::MultiExecutable>()) {
+  if (!verified && !multi_executable_verifier
+                        .VerifyBuffer<platforms::darwinn::MultiExecutable>()) {
     printf("MultiExecutable verification failed.\r\n");
     return nullptr;
   }
@@ -133,7 +358,7 @@ EdgeTpuPackage* EdgeTpuManager::RegisterPackage(const char* package_content,
     flatbuffers::Verifier verifier(
         (const uint8_t*)executable_serialized->c_str(),
         executable_serialized->size());
-    if (!verifier.VerifyBuffer<platforms::darwinn::Executable>()) {
+    if (!verified && !verifier.VerifyBuffer<platforms::darwinn::Executable>()) {
       printf("Executable verification failed.\r\n");
       return nullptr;
     }
@@ -156,30 +381,60 @@ EdgeTpuPackage* EdgeTpuManager::RegisterPackage(const char* package_content,
     return nullptr;
   }
 
-  auto* edgetpu_package =
-      new EdgeTpuPackage(inference_exe, parameter_caching_exe);
-  packages_[package_ptr] = edgetpu_package;
+  if (!verified) AddVerifiedPackage(content_hash);
 
-  return edgetpu_package;
+  auto& entry = packages_[key];
+  entry.package = std::make_unique<EdgeTpuPackage>(
+      inference_exe, parameter_caching_exe, content_hash);
+  entry.refs = 1;
+
+  return entry.package.get();
+}
+
+void EdgeTpuManager::UnregisterPackage(EdgeTpuPackage* package) {
+  if (!package) return;
+  MutexLock lock(mutex_);
+  for (auto it = packages_.begin(); it != packages_.end(); ++it) {
+    if (it->second.package.get() != package) continue;
+    if (--it->second.refs > 0) return;
+    // The parameters stay on the TPU, and `cached_packages_` tracks them by
+    // content hash, so re-registering the same model can still use them.
+    packages_.erase(it);
+    return;
+  }
+  printf("%s: Unknown package %p\r\n", __func__, package);
 }
 
 TfLiteStatus EdgeTpuManager::Invoke(EdgeTpuPackage* package,
                                     TfLiteContext* context, TfLiteNode* node) {
+  ++waiting_invokes_;
   MutexLock lock(mutex_);
+  --waiting_invokes_;
+  if (governor_ && governor_->mode() != mode_) {
+    // Changing the mode resets the Edge TPU, which drops its cached
+    // parameters, so they're cached again below. The governor's dwell time
+    // and hysteresis keep this rare.
+    SetMode(governor_->mode());
+  }
+  // Timed after any mode change, so the Edge TPU bring-up doesn't look like
+  // a slow inference to the governor.
+  const uint64_t start_us = governor_ ? TimerMicros() : 0;
   if (package->parameter_caching_exe()) {
     auto token = package->parameter_caching_exe()->ParameterCachingToken();
+    const uint64_t content_hash = package->content_hash();
     if (token != current_parameter_caching_token_) {
-      cached_packages_.fill(nullptr);
+      cached_packages_.fill(0);
       package->parameter_caching_exe()->Invoke(tpu_driver_, context, node);
       current_parameter_caching_token_ = token;
-      cached_packages_[0] = package;
+      cached_packages_[0] = content_hash;
     } else {
       for (auto& cached_package : cached_packages_) {
-        if (cached_package == package) {
+        if (cached_package == content_hash) {
           break;
-        } else if (cached_package == nullptr) {
+        } else if (cached_package == 0) {
           package->parameter_caching_exe()->Invoke(tpu_driver_, context, node);
-          cached_package = package;
+          cached_package = content_hash;
+          break;
         }
       }
     }
@@ -187,7 +442,93 @@ TfLiteStatus EdgeTpuManager::Invoke(EdgeTpuPackage* package,
     current_parameter_caching_token_ = 0;
   }
 
-  return package->inference_exe()->Invoke(tpu_driver_, context, node);
+  const TfLiteStatus status = package->inference_exe()->Invoke(
+      tpu_driver_, context, node, FindInputProducer(context, node));
+  if (governor_ && status == kTfLiteOk) {
+    UpdateGovernor(static_cast<uint32_t>(TimerMicros() - start_us));
+  }
+  return status;
+}
+
+void EdgeTpuManager::UpdateGovernor(uint32_t latency_us) {
+  EdgeTpuGovernorSample sample{latency_us, waiting_invokes_.load(),
+                               std::nullopt, mode_};
+  const uint32_t interval = governor_->config().temperature_interval;
+  if (interval > 0 && governor_->stats().samples % interval == 0) {
+    sample.temperature_c = tpu_driver_.GetTemperature();
+  }
+  // Load changes are applied before the next inference, but the thermal
+  // limit can't wait for it.
+  const PerformanceMode mode = governor_->Update(sample);
+  if (mode_ > governor_->stats().thermal_cap) SetMode(mode);
+}
+
+bool EdgeTpuManager::SetMode(PerformanceMode mode) {
+  if (mode == mode_) return true;
+  if (!tpu_driver_.SetPerformanceMode(mode)) {
+    printf("Failed to change Edge TPU performance mode\r\n");
+    return false;
+  }
+  mode_ = mode;
+  // The reset dropped the cached parameters.
+  current_parameter_caching_token_ = 0;
+  cached_packages_.fill(0);
+  return true;
+}
+
+void EdgeTpuManager::EnableGovernor(const EdgeTpuGovernorConfig& config) {
+  MutexLock lock(mutex_);
+  governor_ = std::make_unique<EdgeTpuGovernor>(config, mode_);
+}
+
+void EdgeTpuManager::DisableGovernor() {
+  MutexLock lock(mutex_);
+  governor_.reset();
+}
+
+std::optional<EdgeTpuGovernorStats> EdgeTpuManager::GetGovernorStats() {
+  MutexLock lock(mutex_);
+  if (!governor_) return std::nullopt;
+  return governor_->stats();
+}
+
+ScopedTpuInputProducer::ScopedTpuInputProducer(const TfLiteTensor* input,
+                                               TpuInputProducer producer)
+    : input_(input ? input->data.data : nullptr),
+      producer_(std::move(producer)) {
+  EdgeTpuManager::GetSingleton()->AddInputProducer(this);
+}
+
+ScopedTpuInputProducer::~ScopedTpuInputProducer() {
+  EdgeTpuManager::GetSingleton()->RemoveInputProducer(this);
+}
+
+void EdgeTpuManager::AddInputProducer(const ScopedTpuInputProducer* producer) {
+  MutexLock lock(mutex_);
+  auto it = std::find(input_producers_.begin(), input_producers_.end(),
+                      nullptr);
+  CHECK(it != input_producers_.end());
+  *it = producer;
+}
+
+void EdgeTpuManager::RemoveInputProducer(
+    const ScopedTpuInputProducer* producer) {
+  MutexLock lock(mutex_);
+  std::replace(input_producers_.begin(), input_producers_.end(), producer,
+               static_cast<const ScopedTpuInputProducer*>(nullptr));
+}
+
+// Called with `mutex_` held.
+const TpuInputProducer* EdgeTpuManager::FindInputProducer(
+    TfLiteContext* context, TfLiteNode* node) const {
+  const TfLiteEvalTensor* input = tflite::micro::GetEvalInput(context, node, 0);
+  if (!input || !input->data.data) return nullptr;
+  for (const auto* producer : input_producers_) {
+    if (producer && producer->input_ == input->data.data) {
+      return &producer->producer_;
+    }
+  }
+  return nullptr;
 }
 
 std::optional<float> EdgeTpuManager::GetTemperature() {
@@ -18,16 +18,23 @@
 #define LIBS_TPU_EDGETPU_MANAGER_H_
 
 #include <cstdlib>
+#include <array>
+#include <atomic>
 #include <map>
 #include <memory>
 #include <optional>
+#include <tuple>
 
 #include "libs/tpu/edgetpu_driver.h"
 #include "libs/tpu/edgetpu_executable.h"
+#include "libs/tpu/edgetpu_governor.h"
+#include "libs/tpu/edgetpu_usb_transport.h"
 #include "libs/tpu/executable_generated.h"
 #include "libs/tpu/usb_host_edgetpu.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
 #include "third_party/freertos_kernel/include/semphr.h"
+#include "third_party/freertos_kernel/include/task.h"
+#include "third_party/freertos_kernel/include/timers.h"
 #include "third_party/tflite-micro/tensorflow/lite/c/common.h"
 
 namespace coralmicro {
@@ -39,7 +46,9 @@ namespace coralmicro {
 //
 // The `EdgeTpuContext` can be shared among multiple software components, and
 // the life of this object is directly tied to the Edge TPU power, so the
-// Edge TPU powers down after the last `EdgeTpuContext` reference leaves scope.
+// Edge TPU powers down after the last `EdgeTpuContext` reference leaves scope
+// (or, if `EdgeTpuManager::SetIdleTimeout()` is used, once it has stayed
+// unused for the idle timeout).
 //
 // The lifetime of the `EdgeTpuContext` must be longer than all associated
 // `tflite::MicroInterpreter` instances.
@@ -56,7 +65,9 @@ class EdgeTpuContext {
 class EdgeTpuPackage {
  public:
   EdgeTpuPackage(const platforms::darwinn::Executable* inference_exe,
-                 const platforms::darwinn::Executable* parameter_caching_exe) {
+                 const platforms::darwinn::Executable* parameter_caching_exe,
+                 uint64_t content_hash)
+      : content_hash_(content_hash) {
     inference_ = std::make_unique<EdgeTpuExecutable>(inference_exe);
     if (parameter_caching_exe) {
       parameter_caching_ =
@@ -67,13 +78,63 @@ class EdgeTpuPackage {
     return parameter_caching_.get();
   }
   EdgeTpuExecutable* inference_exe() { return inference_.get(); }
+  uint64_t content_hash() const { return content_hash_; }
 
  private:
   std::unique_ptr<EdgeTpuExecutable> inference_;
   std::unique_ptr<EdgeTpuExecutable> parameter_caching_;
+  uint64_t content_hash_;
 };
 // @endcond
 
+// Counts of how `EdgeTpuManager::OpenDevice()` found the Edge TPU.
+struct EdgeTpuPowerStats {
+  // Opens that powered on and initialized the Edge TPU.
+  uint32_t cold_opens = 0;
+  // Opens that reused an Edge TPU kept on by the idle timeout.
+  uint32_t warm_opens = 0;
+  // Times the idle timeout expired and powered off the Edge TPU.
+  uint32_t idle_power_offs = 0;
+  // Duration of the last cold and warm open, in microseconds.
+  uint32_t last_cold_open_us = 0;
+  uint32_t last_warm_open_us = 0;
+};
+
+// Streams the input activations of Edge TPU inferences from a producer instead
+// of the input tensor, so the input can be generated (for example, by
+// `CameraFrameStream::Read()`) while it is sent over USB.
+//
+// While this object is in scope, every Edge TPU custom op whose input is
+// `input` reads its input from `producer` and leaves the tensor untouched.
+// Custom ops with other inputs (such as ones that follow other ops, which
+// still read the unfilled tensor) are not affected. For example:
+//
+// ```
+// ScopedTpuInputProducer producer(
+//     interpreter->input(0),
+//     [&stream](uint8_t* buffer, uint32_t offset, uint32_t length) {
+//       return stream.Read(buffer, offset, length);
+//     });
+// interpreter->Invoke();
+// ```
+//
+// If the producer fails, the rest of the input is sent as zeros so the
+// Edge TPU stays in sync, and the inference fails.
+class ScopedTpuInputProducer {
+ public:
+  // @param input The input tensor to stream.
+  // @param producer Writes the requested byte range of the input.
+  ScopedTpuInputProducer(const TfLiteTensor* input, TpuInputProducer producer);
+  ~ScopedTpuInputProducer();
+  ScopedTpuInputProducer(const ScopedTpuInputProducer&) = delete;
+  ScopedTpuInputProducer& operator=(const ScopedTpuInputProducer&) = delete;
+
+ private:
+  friend class EdgeTpuManager;
+  const void* input_;
+  TpuInputProducer producer_;
+};
+
 // Singleton Edge TPU manager for allocating new instances of `EdgeTpuContext`.
 class EdgeTpuManager {
  public:
@@ -90,7 +151,19 @@ class EdgeTpuManager {
   }
 
   // @cond Do not generate docs
+  // Returns the package for `package_content`, creating it if needed, and
+  // takes a reference on it. Packages are keyed by their address, length and
+  // a fingerprint of their first and last bytes, so a buffer that is
+  // rewritten in place (for example, by loading a different model file into
+  // it) gets a fresh package, while finding an existing package doesn't read
+  // the whole buffer.
   EdgeTpuPackage* RegisterPackage(const char* package_content, size_t length);
+  // Drops a reference taken by `RegisterPackage()` and frees the package
+  // once the last reference is gone. Called by the custom op when its
+  // interpreter is destroyed, so models can be swapped at runtime by
+  // destroying the interpreter, replacing the model buffer and creating a
+  // new interpreter.
+  void UnregisterPackage(EdgeTpuPackage* package);
   TfLiteStatus Invoke(EdgeTpuPackage* package, TfLiteContext* context,
                       TfLiteNode* node);
   // @endcond
@@ -120,22 +193,105 @@ class EdgeTpuManager {
   // @cond Do not generate docs
   void NotifyError();
   void NotifyConnected(usb_host_edgetpu_instance_t* usb_instance);
+  // Drops the power reference of an `EdgeTpuContext`.
+  void ReleasePower();
   // @endcond
 
+  // Keeps the Edge TPU powered for `timeout_ms` after the last
+  // `EdgeTpuContext` is released. An `OpenDevice()` within that time reuses
+  // the running Edge TPU, skipping USB enumeration and initialization and
+  // keeping its cached model parameters. This suits bursty workloads that
+  // drop the context between bursts, at the cost of idle power.
+  //
+  // @param timeout_ms The idle time before powering off, in milliseconds.
+  // The default of 0 powers off as soon as the last context is released.
+  void SetIdleTimeout(uint32_t timeout_ms);
+
+  // Gets the counts of cold and warm opens.
+  EdgeTpuPowerStats GetPowerStats();
+
+  // Sets whether small descriptors share USB bulk out transfers. This is
+  // experimental and off by default; see `TpuDriver::SetCoalesceBulkOut()`.
+  void SetCoalesceBulkOut(bool coalesce);
+
+  // Lets an `EdgeTpuGovernor` pick the performance mode after every
+  // inference, from the inference latency, the number of inferences waiting
+  // and the die temperature. This replaces the mode given to `OpenDevice()`
+  // until `DisableGovernor()` is called. A mode change resets the Edge TPU
+  // (without re-enumerating it) and drops the cached model parameters, so the
+  // next inference caches them again. The governor's dwell time and
+  // hysteresis limit how often that happens. The change is applied before
+  // the next inference, except that the thermal limit lowers the mode right
+  // away.
+  //
+  // @param config The governor's targets and thresholds.
+  void EnableGovernor(const EdgeTpuGovernorConfig& config);
+
+  // Stops changing the performance mode. The current mode is kept.
+  void DisableGovernor();
+
+  // Gets the governor's counters and current mode.
+  // @return The stats, or `std::nullopt` if the governor is disabled.
+  std::optional<EdgeTpuGovernorStats> GetGovernorStats();
+
   // Gets the current Edge TPU junction temperature.
   // @returns The temperature in Celcius, or `std::nullopt` if
   // `EdgeTpuContext` is empty.
   std::optional<float> GetTemperature();
 
  private:
+  friend class ScopedTpuInputProducer;
+  // Maximum number of `ScopedTpuInputProducer` objects in scope at once.
+  static constexpr size_t kMaxInputProducers = 4;
+
+  void AddInputProducer(const ScopedTpuInputProducer* producer);
+  void RemoveInputProducer(const ScopedTpuInputProducer* producer);
+  const TpuInputProducer* FindInputProducer(TfLiteContext* context,
+                                            TfLiteNode* node) const;
+  void UpdateGovernor(uint32_t latency_us);
+  bool SetMode(PerformanceMode mode);
+  void PowerOff();
+  void IdleTimeout();
+  static void IdleTaskMain(void* param);
+
   TpuDriver tpu_driver_;
-  std::map<uintptr_t, EdgeTpuPackage*> packages_;
-  std::array<EdgeTpuPackage*, 2> cached_packages_;
+  struct PackageEntry {
+    std::unique_ptr<EdgeTpuPackage> package;
+    int refs;
+  };
+  // The package content address, length and fingerprint.
+  using PackageKey = std::tuple<uintptr_t, size_t, uint64_t>;
+  std::map<PackageKey, PackageEntry> packages_;
+  // Content hashes of the packages whose parameters are cached on the TPU
+  // under `current_parameter_caching_token_`. Hashes rather than pointers are
+  // kept so that the cache stays valid across a package being freed and
+  // re-registered with the same content.
+  std::array<uint64_t, 2> cached_packages_{};
   uint64_t current_parameter_caching_token_ = 0;
   usb_host_edgetpu_instance_t* usb_instance_ = nullptr;
+  EdgeTpuUsbTransport usb_transport_;
   std::weak_ptr<EdgeTpuContext> context_;
+  std::array<const ScopedTpuInputProducer*, kMaxInputProducers>
+      input_producers_{};
+  PerformanceMode mode_ = PerformanceMode::kHigh;
+  std::unique_ptr<EdgeTpuGovernor> governor_;
+  // Inferences waiting for `mutex_` in `Invoke()`.
+  std::atomic<uint32_t> waiting_invokes_{0};
   SemaphoreHandle_t mutex_;
   bool usb_error_{false};
+
+  // Guards the power state below. Taken after `mutex_` when both are needed.
+  SemaphoreHandle_t power_mutex_;
+  TimerHandle_t idle_timer_;
+  // Powers off after the idle timer fires, since that can't be done in the
+  // timer task. Created by the first `SetIdleTimeout()`.
+  TaskHandle_t idle_task_ = nullptr;
+  uint32_t idle_timeout_ms_ = 0;
+  // Whether the manager holds the power reference of the last released
+  // context, and since when.
+  bool warm_ = false;
+  TickType_t warm_since_ = 0;
+  EdgeTpuPowerStats power_stats_;
 };
 
 }  // namespace coralmicro
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TPU_EDGETPU_PERFORMANCE_MODE_H_
+#define LIBS_TPU_EDGETPU_PERFORMANCE_MODE_H_
+
+namespace coralmicro {
+
+// Clock rates of the Edge TPU, from slowest to fastest.
+enum class PerformanceMode {
+  kLow,
+  kMedium,
+  kHigh,
+  kMax,
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_TPU_EDGETPU_PERFORMANCE_MODE_H_
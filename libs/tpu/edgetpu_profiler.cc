@@ -0,0 +1,210 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/tpu/edgetpu_profiler.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "libs/base/check.h"
+#include "libs/base/strings.h"
+#include "libs/base/timer.h"
+
+#if CORAL_MICRO_HOST
+#include <mutex>
+#else
+#include "libs/base/mutex.h"
+#endif
+
+namespace coralmicro {
+namespace {
+// Guards the event ring and the bring-up timeline. There is a single
+// profiler, so the lock is kept here rather than in each instance, which keeps
+// RTOS types out of the header.
+class ProfilerLock {
+ public:
+  ProfilerLock() : lock_(Mutex()) {}
+  ProfilerLock(const ProfilerLock&) = delete;
+  ProfilerLock& operator=(const ProfilerLock&) = delete;
+
+ private:
+#if CORAL_MICRO_HOST
+  static std::mutex& Mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+  std::lock_guard<std::mutex> lock_;
+#else
+  static SemaphoreHandle_t Mutex() {
+    static SemaphoreHandle_t mutex = [] {
+      SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+      CHECK(mutex);
+      return mutex;
+    }();
+    return mutex;
+  }
+  MutexLock lock_;
+#endif
+};
+}  // namespace
+
+const char* TpuPhaseName(TpuPhase phase) {
+  switch (phase) {
+    case TpuPhase::kParameters:
+      return "parameters";
+    case TpuPhase::kInputs:
+      return "inputs";
+    case TpuPhase::kInstructions:
+      return "instructions";
+    case TpuPhase::kExecute:
+      return "execute";
+    case TpuPhase::kOutputs:
+      return "outputs";
+    case TpuPhase::kRelayout:
+      return "relayout";
+    default:
+      return "unknown";
+  }
+}
+
+const char* TpuBringUpStepName(TpuBringUpStep step) {
+  switch (step) {
+    case TpuBringUpStep::kPowerOn:
+      return "power_on";
+    case TpuBringUpStep::kPowerGood:
+      return "power_good";
+    case TpuBringUpStep::kDfuAttached:
+      return "dfu_attached";
+    case TpuBringUpStep::kFirmwareLoaded:
+      return "firmware_loaded";
+    case TpuBringUpStep::kConnected:
+      return "connected";
+    case TpuBringUpStep::kInitialized:
+      return "initialized";
+    default:
+      return "unknown";
+  }
+}
+
+void EdgeTpuProfiler::Clear() {
+  ProfilerLock lock;
+  next_ = 0;
+  size_ = 0;
+}
+
+void EdgeTpuProfiler::BeginInference() {
+  if (!enabled_) return;
+  ProfilerLock lock;
+  ++inference_;
+}
+
+void EdgeTpuProfiler::Record(TpuPhase phase, uint64_t start_us,
+                             uint32_t duration_us, uint32_t bytes,
+                             uint32_t transfers) {
+  ProfilerLock lock;
+  events_[next_] = {inference_, phase, start_us, duration_us, bytes, transfers};
+  next_ = (next_ + 1) % kMaxEvents;
+  if (size_ < kMaxEvents) ++size_;
+}
+
+size_t EdgeTpuProfiler::GetEvents(TpuPhaseEvent* events,
+                                  size_t max_events) const {
+  ProfilerLock lock;
+  const size_t count = std::min(size_, max_events);
+  // Skip the oldest events if the caller's array can't hold all of them.
+  size_t index = (next_ + kMaxEvents - count) % kMaxEvents;
+  for (size_t i = 0; i < count; ++i) {
+    events[i] = events_[index];
+    index = (index + 1) % kMaxEvents;
+  }
+  return count;
+}
+
+std::array<TpuPhaseTotals, static_cast<size_t>(TpuPhase::kCount)>
+EdgeTpuProfiler::GetTotals() const {
+  std::array<TpuPhaseTotals, static_cast<size_t>(TpuPhase::kCount)> totals{};
+  ProfilerLock lock;
+  size_t index = (next_ + kMaxEvents - size_) % kMaxEvents;
+  for (size_t i = 0; i < size_; ++i) {
+    const auto& event = events_[index];
+    auto& total = totals[static_cast<size_t>(event.phase)];
+    ++total.count;
+    total.duration_us += event.duration_us;
+    total.bytes += event.bytes;
+    total.transfers += event.transfers;
+    index = (index + 1) % kMaxEvents;
+  }
+  return totals;
+}
+
+std::string EdgeTpuProfiler::ToChromeTrace() const {
+  auto events = std::make_unique<TpuPhaseEvent[]>(kMaxEvents);
+  const size_t count = GetEvents(events.get(), kMaxEvents);
+
+  // Timestamps are emitted relative to the oldest event.
+  const uint64_t base_us = count ? events[0].start_us : 0;
+  std::string trace;
+  trace.reserve(64 + count * 160);
+  trace += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (size_t i = 0; i < count; ++i) {
+    const auto& event = events[i];
+    StrAppend(&trace,
+              "%s{\"name\":\"%s\",\"cat\":\"edgetpu\",\"ph\":\"X\",\"pid\":1,"
+              "\"tid\":1,\"ts\":%llu,\"dur\":%llu,"
+              "\"args\":{\"inference\":%llu,\"bytes\":%llu,"
+              "\"transfers\":%llu}}",
+              i ? "," : "", TpuPhaseName(event.phase),
+              static_cast<unsigned long long>(event.start_us - base_us),
+              static_cast<unsigned long long>(event.duration_us),
+              static_cast<unsigned long long>(event.inference),
+              static_cast<unsigned long long>(event.bytes),
+              static_cast<unsigned long long>(event.transfers));
+  }
+  trace += "]}";
+  return trace;
+}
+
+void EdgeTpuProfiler::MarkBringUp(TpuBringUpStep step) {
+  const uint64_t now_us = TimerMicros();
+  ProfilerLock lock;
+  if (step == TpuBringUpStep::kPowerOn) bring_up_.fill(0);
+  bring_up_[static_cast<size_t>(step)] = now_us;
+}
+
+TpuBringUpTimeline EdgeTpuProfiler::GetBringUpTimeline() const {
+  ProfilerLock lock;
+  return bring_up_;
+}
+
+ScopedTpuPhase::ScopedTpuPhase(TpuPhase phase, uint32_t bytes)
+    : phase_(phase),
+      bytes_(bytes),
+      active_(EdgeTpuProfiler::GetSingleton()->enabled()) {
+  if (!active_) return;
+  start_transfers_ = EdgeTpuProfiler::GetSingleton()->transfer_count();
+  start_us_ = TimerMicros();
+}
+
+ScopedTpuPhase::~ScopedTpuPhase() {
+  if (!active_) return;
+  const uint64_t end_us = TimerMicros();
+  auto* profiler = EdgeTpuProfiler::GetSingleton();
+  profiler->Record(phase_, start_us_,
+                   static_cast<uint32_t>(end_us - start_us_), bytes_,
+                   profiler->transfer_count() - start_transfers_);
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TPU_EDGETPU_PROFILER_H_
+#define LIBS_TPU_EDGETPU_PROFILER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace coralmicro {
+
+// Phases of an Edge TPU inference that are timed by `EdgeTpuProfiler`.
+enum class TpuPhase : uint8_t {
+  kParameters,
+  kInputs,
+  kInstructions,
+  kExecute,
+  kOutputs,
+  kRelayout,
+  kCount,
+};
+
+// Gets a printable name for a `TpuPhase`.
+const char* TpuPhaseName(TpuPhase phase);
+
+// A single timed phase of an inference.
+struct TpuPhaseEvent {
+  // Sequence number of the inference this phase belongs to.
+  uint32_t inference;
+  TpuPhase phase;
+  // Start time in microseconds since boot.
+  uint64_t start_us;
+  uint32_t duration_us;
+  // Bytes moved over USB (or relayouted) during the phase.
+  uint32_t bytes;
+  // Number of USB bulk transfers issued during the phase. When `TpuDriver`
+  // packs descriptors into shared bulk out transfers, a transfer is counted in
+  // the phase that sends it, which can be a later phase than the one that
+  // queued the data.
+  uint32_t transfers;
+};
+
+// Steps of Edge TPU bring-up, from power-on until the Edge TPU is ready for
+// the first inference.
+enum class TpuBringUpStep : uint8_t {
+  // The Edge TPU power supply is switched on.
+  kPowerOn,
+  // Power is good and the Edge TPU is out of reset.
+  kPowerGood,
+  // The DFU bootloader has enumerated on USB.
+  kDfuAttached,
+  // The runtime firmware has been downloaded and read back.
+  kFirmwareLoaded,
+  // The runtime device has enumerated on USB.
+  kConnected,
+  // `TpuDriver::Initialize()` has finished.
+  kInitialized,
+  kCount,
+};
+
+// Gets a printable name for a `TpuBringUpStep`.
+const char* TpuBringUpStepName(TpuBringUpStep step);
+
+// Time of each step of the last bring-up, in microseconds since boot, indexed
+// by `TpuBringUpStep`. Steps that were not reached are 0.
+using TpuBringUpTimeline =
+    std::array<uint64_t, static_cast<size_t>(TpuBringUpStep::kCount)>;
+
+// Per-phase totals over all events currently held by the profiler.
+struct TpuPhaseTotals {
+  uint32_t count;
+  uint64_t duration_us;
+  uint64_t bytes;
+  uint32_t transfers;
+};
+
+// Records a timeline of Edge TPU inference phases into a fixed-size ring
+// buffer. Profiling is disabled by default and costs a single branch per phase
+// while disabled.
+//
+// When enabled, `EdgeTpuExecutable` timestamps each DMA hint (parameters,
+// inputs, instructions and outputs), the execution wait and the output
+// relayout, and `TpuDriver` counts the USB transfers issued in each phase.
+// Outputs are relayouted while they are received, so `kRelayout` only covers
+// the rows left once the last chunk has arrived.
+// Comparing the USB phases against `kExecute` tells whether a model is
+// USB-bound or compute-bound.
+class EdgeTpuProfiler {
+ public:
+  // Maximum number of events held; the oldest events are overwritten first.
+  static constexpr size_t kMaxEvents = 256;
+
+  // @cond Do not generate docs
+  EdgeTpuProfiler() = default;
+  EdgeTpuProfiler(const EdgeTpuProfiler&) = delete;
+  EdgeTpuProfiler& operator=(const EdgeTpuProfiler&) = delete;
+  // @endcond
+
+  // Gets a pointer to the `EdgeTpuProfiler` singleton object.
+  static EdgeTpuProfiler* GetSingleton() {
+    static EdgeTpuProfiler profiler;
+    return &profiler;
+  }
+
+  // Enables or disables recording. Existing events are kept.
+  void SetEnabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  // Drops all recorded events.
+  void Clear();
+
+  // @cond Do not generate docs
+  void BeginInference();
+  void CountTransfer() {
+    if (enabled_) ++transfer_count_;
+  }
+  uint32_t transfer_count() const { return transfer_count_; }
+  void Record(TpuPhase phase, uint64_t start_us, uint32_t duration_us,
+              uint32_t bytes, uint32_t transfers);
+  // @endcond
+
+  // Copies the recorded events, oldest first.
+  //
+  // @param events Array to receive the events.
+  // @param max_events Capacity of `events`.
+  // @return The number of events copied.
+  size_t GetEvents(TpuPhaseEvent* events, size_t max_events) const;
+
+  // Sums the recorded events per phase.
+  //
+  // @return Totals indexed by `TpuPhase`.
+  std::array<TpuPhaseTotals, static_cast<size_t>(TpuPhase::kCount)>
+  GetTotals() const;
+
+  // Formats the recorded events as Chrome trace event JSON, which can be
+  // loaded in `chrome://tracing` or Perfetto.
+  std::string ToChromeTrace() const;
+
+  // @cond Do not generate docs
+  // Timestamps a bring-up step. `kPowerOn` starts a new timeline. Bring-up
+  // steps are recorded even while profiling is disabled.
+  void MarkBringUp(TpuBringUpStep step);
+  // @endcond
+
+  // Gets the timeline of the last bring-up, which shows where the time to the
+  // first inference goes after a power-up.
+  TpuBringUpTimeline GetBringUpTimeline() const;
+
+ private:
+  std::array<TpuPhaseEvent, kMaxEvents> events_;
+  size_t next_ = 0;
+  size_t size_ = 0;
+  uint32_t inference_ = 0;
+  volatile uint32_t transfer_count_ = 0;
+  volatile bool enabled_ = false;
+  TpuBringUpTimeline bring_up_{};
+};
+
+// Records the enclosing scope as one `TpuPhase` when profiling is enabled.
+class ScopedTpuPhase {
+ public:
+  ScopedTpuPhase(TpuPhase phase, uint32_t bytes);
+  ~ScopedTpuPhase();
+  ScopedTpuPhase(const ScopedTpuPhase&) = delete;
+  ScopedTpuPhase& operator=(const ScopedTpuPhase&) = delete;
+
+ private:
+  TpuPhase phase_;
+  uint32_t bytes_;
+  uint32_t start_transfers_ = 0;
+  uint64_t start_us_ = 0;
+  bool active_;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_TPU_EDGETPU_PROFILER_H_
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/tpu/edgetpu_simulator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "libs/tpu/darwinn/driver/config/beagle/beagle_chip_config.h"
+#include "libs/tpu/darwinn/driver/config/beagle_csr_helper.h"
+
+namespace coralmicro {
+namespace {
+namespace registers = platforms::darwinn::driver::config::registers;
+
+constexpr uint64_t kChipId = 0x89A;
+// `ScuCtrl3::cur_pwr_state` values reported after a `rg_force_sleep` request.
+constexpr uint64_t kForceSleepReset = 0x3;
+constexpr uint64_t kForceSleepRun = 0x2;
+constexpr uint64_t kPowerStateReset = 0x2;
+constexpr uint64_t kPowerStateRun = 0x0;
+
+const platforms::darwinn::driver::config::BeagleChipConfig& ChipConfig() {
+  static const platforms::darwinn::driver::config::BeagleChipConfig config;
+  return config;
+}
+}  // namespace
+
+EdgeTpuSimulator::EdgeTpuSimulator() {
+  registers_[ChipConfig().GetApexCsrOffsets().omc0_00] = kChipId;
+}
+
+void EdgeTpuSimulator::ExpectExecutable(
+    const platforms::darwinn::Executable* exe) {
+  for (const auto* hint : *(exe->dma_hints()->hints())) {
+    switch (hint->any_hint_type()) {
+      case platforms::darwinn::AnyHint_DmaDescriptorHint: {
+        const auto* dma_hint = hint->any_hint_as_DmaDescriptorHint();
+        switch (dma_hint->meta()->desc()) {
+          case platforms::darwinn::Description_BASE_ADDRESS_PARAMETER:
+            ExpectDescriptor(DescriptorTag::kParameters,
+                             dma_hint->size_in_bytes());
+            break;
+          case platforms::darwinn::Description_BASE_ADDRESS_INPUT_ACTIVATION:
+            ExpectDescriptor(DescriptorTag::kInputActivations,
+                             dma_hint->size_in_bytes());
+            break;
+          case platforms::darwinn::Description_BASE_ADDRESS_OUTPUT_ACTIVATION:
+            ExpectOutput(dma_hint->meta()->name()->str(),
+                         dma_hint->size_in_bytes());
+            break;
+          default:
+            break;
+        }
+        break;
+      }
+      case platforms::darwinn::AnyHint_InstructionHint: {
+        const int32_t index =
+            hint->any_hint_as_InstructionHint()->instruction_chunk_index();
+        ExpectDescriptor(
+            DescriptorTag::kInstructions,
+            exe->instruction_bitstreams()->Get(index)->bitstream()->size());
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  ExpectEvent();
+}
+
+void EdgeTpuSimulator::ExpectDescriptor(DescriptorTag tag, uint32_t size) {
+  expected_.push_back({Expectation::Kind::kDescriptor, tag, size, {}});
+}
+
+void EdgeTpuSimulator::ExpectOutput(const std::string& name, uint32_t size) {
+  expected_.push_back(
+      {Expectation::Kind::kOutput, DescriptorTag::kOutputActivations, size,
+       name});
+}
+
+void EdgeTpuSimulator::ExpectEvent() {
+  expected_.push_back(
+      {Expectation::Kind::kEvent, DescriptorTag::kUnknown, 0, {}});
+}
+
+void EdgeTpuSimulator::SetOutput(const std::string& name, const uint8_t* data,
+                                 size_t size) {
+  outputs_[name].assign(data, data + size);
+}
+
+uint64_t EdgeTpuSimulator::GetRegister(uint64_t reg) const {
+  auto it = registers_.find(reg);
+  return it == registers_.end() ? 0 : it->second;
+}
+
+void EdgeTpuSimulator::Error(const char* message) {
+  printf("EdgeTpuSimulator: %s\r\n", message);
+  ++stats_.errors;
+}
+
+bool EdgeTpuSimulator::ReadRegister(uint64_t reg, void* data, size_t size) {
+  if (size != sizeof(uint32_t) && size != sizeof(uint64_t)) {
+    Error("bad register size");
+    return false;
+  }
+  ++stats_.register_reads;
+  const uint64_t value = GetRegister(reg);
+  // Registers are little-endian, like the USB control transfers.
+  memcpy(data, &value, size);
+  return true;
+}
+
+bool EdgeTpuSimulator::WriteRegister(uint64_t reg, const void* data,
+                                     size_t size) {
+  if (size != sizeof(uint32_t) && size != sizeof(uint64_t)) {
+    Error("bad register size");
+    return false;
+  }
+  ++stats_.register_writes;
+  uint64_t value = 0;
+  memcpy(&value, data, size);
+
+  // Power state changes complete immediately.
+  if (reg == ChipConfig().GetScuCsrOffsets().scu_ctrl_3) {
+    registers::ScuCtrl3 scu_ctrl_3(value);
+    if (scu_ctrl_3.rg_force_sleep() == kForceSleepReset) {
+      scu_ctrl_3.set_cur_pwr_state(kPowerStateReset);
+      // Reset stops the core.
+      registers_[ChipConfig().GetScalarCoreCsrOffsets().scalarCoreRunControl] =
+          0;
+    } else if (scu_ctrl_3.rg_force_sleep() == kForceSleepRun) {
+      scu_ctrl_3.set_cur_pwr_state(kPowerStateRun);
+    }
+    value = scu_ctrl_3.raw();
+  }
+  registers_[reg] = value;
+  return true;
+}
+
+void EdgeTpuSimulator::OnHeader() {
+  uint32_t length;
+  memcpy(&length, header_.data(), sizeof(length));
+  const auto tag = static_cast<DescriptorTag>(header_[sizeof(length)] & 0xF);
+  header_size_ = 0;
+  payload_left_ = length;
+  payload_tag_ = tag;
+
+  const size_t index = static_cast<size_t>(tag);
+  if (index >= kNumTags) {
+    Error("bad descriptor tag");
+    return;
+  }
+  ++stats_.descriptors[index];
+
+  if (expected_.empty() ||
+      expected_.front().kind != Expectation::Kind::kDescriptor) {
+    Error("unexpected descriptor");
+    return;
+  }
+  const Expectation& expected = expected_.front();
+  if (expected.tag != tag) {
+    Error("descriptor tag mismatch");
+  } else if (expected.size != length) {
+    Error("descriptor size mismatch");
+  }
+  expected_.pop_front();
+}
+
+ssize_t EdgeTpuSimulator::BulkOut(const uint8_t* data, uint32_t length) {
+  ++stats_.bulk_out_transfers;
+  uint32_t offset = 0;
+  while (offset < length) {
+    if (payload_left_ == 0) {
+      const size_t count =
+          std::min<size_t>(kHeaderSizeBytes - header_size_, length - offset);
+      memcpy(header_.data() + header_size_, data + offset, count);
+      header_size_ += count;
+      offset += count;
+      if (header_size_ == kHeaderSizeBytes) OnHeader();
+    } else {
+      const uint32_t count = std::min(payload_left_, length - offset);
+      const size_t index = static_cast<size_t>(payload_tag_);
+      if (index < kNumTags) stats_.bytes[index] += count;
+      payload_left_ -= count;
+      offset += count;
+    }
+  }
+  return length;
+}
+
+ssize_t EdgeTpuSimulator::BulkIn(uint8_t* data, uint32_t length) {
+  ++stats_.bulk_in_transfers;
+  if (payload_left_ != 0 || header_size_ != 0) {
+    Error("bulk in during an incomplete descriptor");
+    return -1;
+  }
+  if (expected_.empty() ||
+      expected_.front().kind != Expectation::Kind::kOutput) {
+    Error("unexpected bulk in");
+    return -1;
+  }
+
+  const Expectation& expected = expected_.front();
+  const uint32_t count = std::min(expected.size - output_offset_, length);
+  memset(data, 0, count);
+  auto it = outputs_.find(expected.name);
+  if (it != outputs_.end() && output_offset_ < it->second.size()) {
+    memcpy(data, it->second.data() + output_offset_,
+           std::min<size_t>(count, it->second.size() - output_offset_));
+  }
+  output_offset_ += count;
+  stats_.output_bytes += count;
+  if (output_offset_ == expected.size) {
+    output_offset_ = 0;
+    expected_.pop_front();
+  }
+  return count;
+}
+
+bool EdgeTpuSimulator::ReadEvent(uint8_t event[kEventSizeBytes]) {
+  ++stats_.events;
+  if (payload_left_ != 0 || header_size_ != 0) {
+    Error("event during an incomplete descriptor");
+    return false;
+  }
+  if (expected_.empty() ||
+      expected_.front().kind != Expectation::Kind::kEvent) {
+    Error("event before all expected traffic");
+    return false;
+  }
+  expected_.pop_front();
+  memset(event, 0, kEventSizeBytes);
+  return true;
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TPU_EDGETPU_SIMULATOR_H_
+#define LIBS_TPU_EDGETPU_SIMULATOR_H_
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "libs/tpu/edgetpu_transport.h"
+#include "libs/tpu/executable_generated.h"
+
+namespace coralmicro {
+
+// A `TpuTransport` that stands in for an Edge TPU, so `TpuDriver` and
+// `EdgeTpuExecutable` can run without an accelerator (including on a host).
+//
+// The simulator keeps a register file that answers the driver's bring-up
+// sequence, parses the bulk out stream into descriptors, and checks each
+// descriptor's tag and size against the sequence queued with
+// `ExpectExecutable()` or `ExpectDescriptor()`. Output reads return the bytes
+// set with `SetOutput()`, and the execution event is only delivered once every
+// expected descriptor and output has been consumed. Any mismatch is printed
+// and counted in `Stats::errors`.
+//
+// For example:
+//
+// ```
+// EdgeTpuSimulator simulator;
+// TpuDriver driver;
+// driver.Initialize(&simulator, PerformanceMode::kMax);
+// simulator.ExpectExecutable(exe);
+// simulator.SetOutput("output_0", golden, golden_size);
+// executable.Invoke(driver, context, node);
+// CHECK(simulator.idle() && simulator.stats().errors == 0);
+// ```
+class EdgeTpuSimulator : public TpuTransport {
+ public:
+  // Number of distinct `DescriptorTag` values in the bulk out stream.
+  static constexpr size_t kNumTags = 8;
+
+  // Counters for the traffic seen by the simulator.
+  struct Stats {
+    // Payload bytes and descriptor counts, indexed by `DescriptorTag`.
+    std::array<uint64_t, kNumTags> bytes{};
+    std::array<uint32_t, kNumTags> descriptors{};
+    uint64_t output_bytes = 0;
+    uint32_t bulk_out_transfers = 0;
+    uint32_t bulk_in_transfers = 0;
+    uint32_t events = 0;
+    uint32_t register_reads = 0;
+    uint32_t register_writes = 0;
+    uint32_t errors = 0;
+  };
+
+  EdgeTpuSimulator();
+  EdgeTpuSimulator(const EdgeTpuSimulator&) = delete;
+  EdgeTpuSimulator& operator=(const EdgeTpuSimulator&) = delete;
+
+  // Queues the traffic of one run of `exe`, in DMA hint order: parameter,
+  // input and instruction descriptors, output reads and the final event.
+  // Call once per expected run (for example, once per batch element).
+  void ExpectExecutable(const platforms::darwinn::Executable* exe);
+
+  // Queues a single descriptor in the bulk out stream.
+  void ExpectDescriptor(DescriptorTag tag, uint32_t size);
+
+  // Queues a read of `size` bytes of the output activations `name`.
+  void ExpectOutput(const std::string& name, uint32_t size);
+
+  // Queues an execution event.
+  void ExpectEvent();
+
+  // Sets the bytes returned for output activations `name`. Missing bytes
+  // read back as zero.
+  void SetOutput(const std::string& name, const uint8_t* data, size_t size);
+
+  // Sets or gets the raw value of a CSR.
+  void SetRegister(uint64_t reg, uint64_t value) { registers_[reg] = value; }
+  uint64_t GetRegister(uint64_t reg) const;
+
+  // Whether all queued expectations have been consumed.
+  bool idle() const { return expected_.empty() && payload_left_ == 0; }
+
+  const Stats& stats() const { return stats_; }
+  void ResetStats() { stats_ = Stats(); }
+
+  bool ReadRegister(uint64_t reg, void* data, size_t size) override;
+  bool WriteRegister(uint64_t reg, const void* data, size_t size) override;
+  ssize_t BulkOut(const uint8_t* data, uint32_t length) override;
+  ssize_t BulkIn(uint8_t* data, uint32_t length) override;
+  bool ReadEvent(uint8_t event[kEventSizeBytes]) override;
+  void DelayMicros(uint32_t us) override {}
+
+ private:
+  static constexpr size_t kHeaderSizeBytes = 8;
+
+  struct Expectation {
+    enum class Kind { kDescriptor, kOutput, kEvent };
+    Kind kind;
+    DescriptorTag tag;
+    uint32_t size;
+    std::string name;
+  };
+
+  void OnHeader();
+  void Error(const char* message);
+
+  std::map<uint64_t, uint64_t> registers_;
+  std::map<std::string, std::vector<uint8_t>> outputs_;
+  std::deque<Expectation> expected_;
+
+  // Parser state for the bulk out stream.
+  std::array<uint8_t, kHeaderSizeBytes> header_{};
+  size_t header_size_ = 0;
+  uint32_t payload_left_ = 0;
+  DescriptorTag payload_tag_ = DescriptorTag::kUnknown;
+
+  // Bytes of the front output expectation already returned.
+  uint32_t output_offset_ = 0;
+
+  Stats stats_;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_TPU_EDGETPU_SIMULATOR_H_
@@ -21,6 +21,7 @@
 
 #include "libs/base/gpio.h"
 #include "libs/tpu/edgetpu_manager.h"
+#include "libs/tpu/edgetpu_profiler.h"
 #include "libs/tpu/usb_host_edgetpu.h"
 #include "libs/usb/usb_host_task.h"
 
@@ -139,6 +140,8 @@ void EdgeTpuTask::HandleSetPowerRequest(SetPowerRequest &req) {
     }
   }
 
+  auto *profiler = EdgeTpuProfiler::GetSingleton();
+  if (req.enable) profiler->MarkBringUp(TpuBringUpStep::kPowerOn);
   GpioSet(Gpio::kEdgeTpuPmic, req.enable);
   if (req.enable) {
     bool power_good{false};
@@ -149,6 +152,7 @@ void EdgeTpuTask::HandleSetPowerRequest(SetPowerRequest &req) {
     vTaskDelay(pdMS_TO_TICKS(10));
   }
   GpioSet(Gpio::kEdgeTpuReset, req.enable);
+  if (req.enable) profiler->MarkBringUp(TpuBringUpStep::kPowerGood);
 }
 
 void EdgeTpuTask::HandleNextState(NextStateRequest &req) {
@@ -173,6 +177,7 @@ void EdgeTpuTask::HandleNextState(NextStateRequest &req) {
       if (ret != kStatus_USB_Success) {
         SetNextState(EdgeTpuState::kError);
       }
+      EdgeTpuProfiler::GetSingleton()->MarkBringUp(TpuBringUpStep::kConnected);
       // Thunderchild notifies EdgeTpuManager that it's connected. Should this
       // be in callback?
       EdgeTpuManager::GetSingleton()->NotifyConnected(
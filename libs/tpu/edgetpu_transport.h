@@ -0,0 +1,99 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TPU_EDGETPU_TRANSPORT_H_
+#define LIBS_TPU_EDGETPU_TRANSPORT_H_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace coralmicro {
+
+// Tags of the descriptors in the bulk out stream. Each descriptor is an 8-byte
+// header (payload length in bytes 0-3, tag in byte 4) followed by its payload.
+enum class DescriptorTag {
+  kUnknown = -1,
+  kInstructions = 0,
+  kInputActivations = 1,
+  kParameters = 2,
+  kOutputActivations = 3,
+  kInterrupt0 = 4,
+  kInterrupt1 = 5,
+  kInterrupt2 = 6,
+  kInterrupt3 = 7,
+};
+
+// Moves bytes between `TpuDriver` and an Edge TPU. `TpuDriver` builds the
+// protocol (CSR accesses, descriptor headers, chunking) on top of these
+// primitives, so the same driver can run against the USB device
+// (`EdgeTpuUsbTransport`) or a software stand-in (`EdgeTpuSimulator`).
+//
+// Calls are made one at a time by the owner of the `TpuDriver`.
+class TpuTransport {
+ public:
+  // Size of the event record read back after each execution.
+  static constexpr size_t kEventSizeBytes = 16;
+
+  virtual ~TpuTransport() = default;
+
+  // Reads or writes a 32-bit or 64-bit CSR. `size` is 4 or 8.
+  virtual bool ReadRegister(uint64_t reg, void* data, size_t size) = 0;
+  virtual bool WriteRegister(uint64_t reg, const void* data, size_t size) = 0;
+
+  // Sends `length` bytes of the descriptor stream.
+  // @return The number of bytes sent, or a non-positive value on error.
+  virtual ssize_t BulkOut(const uint8_t* data, uint32_t length) = 0;
+
+  // Starts sending `length` bytes of the descriptor stream and returns without
+  // waiting for the transfer, so the caller can prepare the next chunk while
+  // this one is sent. `data` must stay valid until `FinishBulkOut()`, and no
+  // other call may be made on the transport in between. The default sends
+  // the data synchronously.
+  virtual bool StartBulkOut(const uint8_t* data, uint32_t length) {
+    started_result_ = BulkOut(data, length);
+    return started_result_ > 0;
+  }
+
+  // Waits for the transfer begun by `StartBulkOut()`.
+  // @return The number of bytes sent, or a non-positive value on error.
+  virtual ssize_t FinishBulkOut() { return started_result_; }
+
+  // Receives up to `length` bytes of output activations.
+  // @return The number of bytes received, or a non-positive value on error.
+  virtual ssize_t BulkIn(uint8_t* data, uint32_t length) = 0;
+
+  // Like `StartBulkOut()` and `FinishBulkOut()`, for output activations.
+  virtual bool StartBulkIn(uint8_t* data, uint32_t length) {
+    started_result_ = BulkIn(data, length);
+    return started_result_ > 0;
+  }
+  virtual ssize_t FinishBulkIn() { return started_result_; }
+
+  // Waits for the event that marks the end of an execution.
+  virtual bool ReadEvent(uint8_t event[kEventSizeBytes]) = 0;
+
+  // Busy-waits for at least `us` microseconds of device time.
+  virtual void DelayMicros(uint32_t us) = 0;
+
+ private:
+  ssize_t started_result_ = 0;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_TPU_EDGETPU_TRANSPORT_H_
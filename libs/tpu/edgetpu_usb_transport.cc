@@ -0,0 +1,212 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/tpu/edgetpu_usb_transport.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "libs/base/check.h"
+#include "third_party/nxp/rt1176-sdk/components/osa/fsl_os_abstraction.h"
+#include "third_party/nxp/rt1176-sdk/middleware/usb/include/usb_spec.h"
+
+namespace coralmicro {
+namespace {
+constexpr uint8_t kSingleBulkOutEndpoint = 1;
+constexpr uint8_t kEventInEndpoint = 2;
+}  // namespace
+
+EdgeTpuUsbTransport::EdgeTpuUsbTransport() : transfer_(&transfers_[0]) {
+  for (auto &transfer : transfers_) {
+    transfer.sema = xSemaphoreCreateBinaryStatic(&transfer.sema_storage);
+    CHECK(transfer.sema);
+    transfer.status = kStatus_USB_Error;
+    transfer.bytes_transferred = 0;
+    transfer.in_flight = false;
+  }
+}
+
+bool EdgeTpuUsbTransport::BeginTransfer() {
+  for (int i = 0; i < kNumTransfers; ++i) {
+    auto &transfer = transfers_[(next_transfer_ + i) % kNumTransfers];
+    if (transfer.in_flight) continue;
+    next_transfer_ = (next_transfer_ + i + 1) % kNumTransfers;
+    // Drop the completion of an earlier transfer on this context that timed
+    // out. `in_flight` is cleared after the completion is given, so it is
+    // already there.
+    xSemaphoreTake(transfer.sema, 0);
+    transfer.status = kStatus_USB_Error;
+    transfer.bytes_transferred = 0;
+    transfer.in_flight = true;
+    transfer_ = &transfer;
+    return true;
+  }
+  printf("No free USB transfer context\r\n");
+  transfer_->status = kStatus_USB_Busy;
+  return false;
+}
+
+void EdgeTpuUsbTransport::AbortTransfer(usb_status_t status) {
+  transfer_->status = status;
+  transfer_->in_flight = false;
+}
+
+bool EdgeTpuUsbTransport::WaitTransfer(const char *caller) {
+  if (xSemaphoreTake(transfer_->sema, pdMS_TO_TICKS(200)) == pdFALSE) {
+    // The context stays claimed until the USB stack calls back.
+    printf("%s didn't get semaphore\r\n", caller);
+    transfer_->status = kStatus_USB_Error;
+    return false;
+  }
+  return true;
+}
+
+void EdgeTpuUsbTransport::TransferCallback(void *param, uint8_t *data,
+                                           uint32_t data_length,
+                                           usb_status_t status) {
+  auto *transfer = static_cast<TransferContext *>(param);
+  transfer->bytes_transferred = data_length;
+  transfer->status = status;
+  xSemaphoreGive(transfer->sema);
+  transfer->in_flight = false;
+}
+
+ssize_t EdgeTpuUsbTransport::TransferResult() {
+  if (transfer_->status == kStatus_USB_Success) {
+    return transfer_->bytes_transferred;
+  } else {
+    return -transfer_->status;
+  }
+}
+
+bool EdgeTpuUsbTransport::CSRTransfer(uint64_t reg, void *data, bool read,
+                                      size_t size) {
+  usb_status_t control_status;
+  usb_setup_struct_t setup_packet;
+  setup_packet.bmRequestType =
+      USB_REQUEST_TYPE_TYPE_VENDOR | USB_REQUEST_TYPE_RECIPIENT_DEVICE;
+  setup_packet.bmRequestType |=
+      read ? USB_REQUEST_TYPE_DIR_IN : USB_REQUEST_TYPE_DIR_OUT;
+  switch (size) {
+    case sizeof(uint32_t):
+      setup_packet.bRequest = 1;
+      setup_packet.wLength = 4;
+      break;
+    case sizeof(uint64_t):
+      setup_packet.bRequest = 0;
+      setup_packet.wLength = 8;
+      break;
+    default:
+      printf("Bad CSR size %u\r\n", static_cast<unsigned int>(size));
+      return false;
+  }
+
+  setup_packet.wValue = 0xFFFF & reg;
+  setup_packet.wIndex = 0xFFFF & (reg >> 16);
+
+  if (!BeginTransfer()) return false;
+  control_status =
+      USB_HostEdgeTpuControl(usb_instance_, &setup_packet, (uint8_t *)data,
+                             TransferCallback, transfer_);
+  if (control_status != kStatus_USB_Success) {
+    printf("USB_HostEdgeTpuControl failed\r\n");
+    AbortTransfer(control_status);
+    return false;
+  }
+  return WaitTransfer(__func__);
+}
+
+bool EdgeTpuUsbTransport::ReadRegister(uint64_t reg, void *data,
+                                       size_t size) {
+  return CSRTransfer(reg, data, true, size);
+}
+
+bool EdgeTpuUsbTransport::WriteRegister(uint64_t reg, const void *data,
+                                        size_t size) {
+  // The control transfer only reads from `data` for an OUT request.
+  return CSRTransfer(reg, const_cast<void *>(data), false, size);
+}
+
+ssize_t EdgeTpuUsbTransport::BulkOut(const uint8_t *data, uint32_t length) {
+  if (!StartBulkOut(data, length)) {
+    return -transfer_->status;
+  }
+  return FinishBulkOut();
+}
+
+bool EdgeTpuUsbTransport::StartBulkOut(const uint8_t *data, uint32_t length) {
+  if (!BeginTransfer()) return false;
+  usb_status_t bulk_status = USB_HostEdgeTpuBulkOutSend(
+      usb_instance_, kSingleBulkOutEndpoint, (uint8_t *)data, length,
+      TransferCallback, transfer_);
+  if (bulk_status != kStatus_USB_Success) {
+    printf("USB_HostEdgeTpuBulkOutSend failed\r\n");
+    AbortTransfer(bulk_status);
+    return false;
+  }
+  return true;
+}
+
+ssize_t EdgeTpuUsbTransport::FinishBulkOut() {
+  WaitTransfer(__func__);
+  return TransferResult();
+}
+
+ssize_t EdgeTpuUsbTransport::BulkIn(uint8_t *data, uint32_t length) {
+  if (!StartBulkIn(data, length)) {
+    return -transfer_->status;
+  }
+  return FinishBulkIn();
+}
+
+bool EdgeTpuUsbTransport::StartBulkIn(uint8_t *data, uint32_t length) {
+  if (!BeginTransfer()) return false;
+  usb_status_t bulk_status =
+      USB_HostEdgeTpuBulkInRecv(usb_instance_, kSingleBulkOutEndpoint, data,
+                                length, TransferCallback, transfer_);
+  if (bulk_status != kStatus_USB_Success) {
+    printf("USB_HostEdgeTpuBulkInRecv failed\r\n");
+    AbortTransfer(bulk_status);
+    return false;
+  }
+  return true;
+}
+
+ssize_t EdgeTpuUsbTransport::FinishBulkIn() {
+  WaitTransfer(__func__);
+  return TransferResult();
+}
+
+bool EdgeTpuUsbTransport::ReadEvent(uint8_t event[kEventSizeBytes]) {
+  if (!BeginTransfer()) return false;
+  usb_status_t bulk_status = USB_HostEdgeTpuBulkInRecv(
+      usb_instance_, kEventInEndpoint, transfer_->event, kEventSizeBytes,
+      TransferCallback, transfer_);
+  if (bulk_status != kStatus_USB_Success) {
+    printf("ReadEvent failed\r\n");
+    AbortTransfer(bulk_status);
+    return false;
+  }
+  if (!WaitTransfer(__func__)) return false;
+  memcpy(event, transfer_->event, kEventSizeBytes);
+  return true;
+}
+
+void EdgeTpuUsbTransport::DelayMicros(uint32_t us) {
+  SDK_DelayAtLeastUs(us, CLOCK_GetFreq(kCLOCK_CpuClk));
+}
+
+}  // namespace coralmicro
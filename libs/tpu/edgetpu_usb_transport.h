@@ -0,0 +1,91 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TPU_EDGETPU_USB_TRANSPORT_H_
+#define LIBS_TPU_EDGETPU_USB_TRANSPORT_H_
+
+#include <array>
+#include <cstdint>
+
+#include "libs/tpu/edgetpu_transport.h"
+#include "libs/tpu/usb_host_edgetpu.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+
+namespace coralmicro {
+
+// `TpuTransport` for an Edge TPU attached to the USB host port.
+class EdgeTpuUsbTransport : public TpuTransport {
+ public:
+  EdgeTpuUsbTransport();
+  EdgeTpuUsbTransport(const EdgeTpuUsbTransport&) = delete;
+  EdgeTpuUsbTransport& operator=(const EdgeTpuUsbTransport&) = delete;
+
+  // Sets the USB host class instance of the connected device.
+  void SetUsbInstance(usb_host_edgetpu_instance_t* usb_instance) {
+    usb_instance_ = usb_instance;
+  }
+
+  bool ReadRegister(uint64_t reg, void* data, size_t size) override;
+  bool WriteRegister(uint64_t reg, const void* data, size_t size) override;
+  ssize_t BulkOut(const uint8_t* data, uint32_t length) override;
+  bool StartBulkOut(const uint8_t* data, uint32_t length) override;
+  ssize_t FinishBulkOut() override;
+  ssize_t BulkIn(uint8_t* data, uint32_t length) override;
+  bool StartBulkIn(uint8_t* data, uint32_t length) override;
+  ssize_t FinishBulkIn() override;
+  bool ReadEvent(uint8_t event[kEventSizeBytes]) override;
+  void DelayMicros(uint32_t us) override;
+
+ private:
+  // Number of transfer contexts. A transfer that times out keeps its context
+  // until the USB stack completes or cancels it, so its late completion can't
+  // be mistaken for that of a later transfer.
+  static constexpr int kNumTransfers = 4;
+
+  // State of one USB transfer. Transfers are serialized by `EdgeTpuManager`,
+  // and contexts are preallocated and reused, so no transfer allocates.
+  struct TransferContext {
+    StaticSemaphore_t sema_storage;
+    SemaphoreHandle_t sema;
+    usb_status_t status;
+    uint32_t bytes_transferred;
+    // Whether the USB stack may still call back with this context.
+    volatile bool in_flight;
+    uint8_t event[kEventSizeBytes];
+  };
+
+  // Claims a free context for a new transfer. A transfer that fails to start
+  // is ended with `AbortTransfer()`; one that started with `WaitTransfer()`.
+  bool BeginTransfer();
+  void AbortTransfer(usb_status_t status);
+  bool WaitTransfer(const char* caller);
+  static void TransferCallback(void* param, uint8_t* data,
+                               uint32_t data_length, usb_status_t status);
+
+  bool CSRTransfer(uint64_t reg, void* data, bool read, size_t size);
+  ssize_t TransferResult();
+
+  usb_host_edgetpu_instance_t* usb_instance_ = nullptr;
+  std::array<TransferContext, kNumTransfers> transfers_;
+  // The context of the current transfer.
+  TransferContext* transfer_;
+  int next_transfer_ = 0;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_TPU_EDGETPU_USB_TRANSPORT_H_
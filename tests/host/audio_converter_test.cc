@@ -0,0 +1,187 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks `AudioConverter` against plain references, checks that DC removal
+// keeps tones and removes offsets, and prints how long it takes to convert a
+// second of 16 kHz audio.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "libs/audio/audio_converter.h"
+#include "libs/base/timer.h"
+#include "tests/host/test_util.h"
+
+namespace coralmicro {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr int kSampleRate = 16000;
+
+std::vector<int32_t> RandomSamples(size_t num_samples, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<int32_t> sample(
+      std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max());
+  std::vector<int32_t> samples(num_samples);
+  for (auto& value : samples) value = sample(random);
+  return samples;
+}
+
+// A 1 kHz tone on top of a DC offset.
+std::vector<int32_t> ToneWithOffset(double amplitude, double offset,
+                                    size_t num_samples) {
+  std::vector<int32_t> samples(num_samples);
+  for (size_t i = 0; i < num_samples; ++i) {
+    samples[i] = static_cast<int32_t>(std::lround(
+        offset + amplitude * std::sin(2 * kPi * 1000 * i / kSampleRate)));
+  }
+  return samples;
+}
+
+void TestDefaultOptions() {
+  // Odd sizes and an odd output address cover the single-sample tail and the
+  // unaligned pair stores.
+  const auto samples = RandomSamples(1001, 1);
+  std::vector<int16_t> int16_samples(samples.size() + 1);
+  std::vector<float> float_samples(samples.size());
+  AudioConverter converter;
+  converter.ToInt16(samples.data(), samples.size(), int16_samples.data() + 1);
+  converter.ToFloat(samples.data(), samples.size(), float_samples.data());
+  int mismatches = 0;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    if (int16_samples[i + 1] != (samples[i] >> 16)) ++mismatches;
+    if (float_samples[i] != samples[i] / 2147483648.0f) ++mismatches;
+  }
+  EXPECT_EQ(mismatches, 0);
+}
+
+void TestGainSaturates() {
+  const auto samples = RandomSamples(999, 2);
+  for (float gain : {0.0f, 0.5f, 3.0f, 1000.0f}) {
+    AudioConverter converter({gain, false});
+    std::vector<int16_t> out(samples.size());
+    converter.ToInt16(samples.data(), samples.size(), out.data());
+    const auto gain_q16 = static_cast<int64_t>(std::lround(gain * 65536.0f));
+    int mismatches = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+      const int64_t expected = std::clamp<int64_t>(
+          (samples[i] * gain_q16) >> 32, std::numeric_limits<int16_t>::min(),
+          std::numeric_limits<int16_t>::max());
+      if (out[i] != expected) ++mismatches;
+    }
+    EXPECT_EQ(mismatches, 0);
+  }
+}
+
+void TestRemoveDc() {
+  // Two seconds of audio; the offset is gone well within the first.
+  constexpr double kAmplitude = 1 << 28;
+  const auto samples = ToneWithOffset(kAmplitude, 1 << 29, 2 * kSampleRate);
+  AudioConverter int16_converter({1.0f, true});
+  AudioConverter float_converter({1.0f, true});
+  std::vector<int16_t> int16_samples(samples.size());
+  std::vector<float> float_samples(samples.size());
+  // Converted in blocks, as the service does.
+  constexpr size_t kBlockSize = 160;
+  for (size_t i = 0; i < samples.size(); i += kBlockSize) {
+    int16_converter.ToInt16(samples.data() + i, kBlockSize,
+                            int16_samples.data() + i);
+    float_converter.ToFloat(samples.data() + i, kBlockSize,
+                            float_samples.data() + i);
+  }
+  // The first sample starts the estimate, so there's no initial step.
+  EXPECT_EQ(int16_samples[0], 0);
+
+  double sum = 0.0, sum_squares = 0.0;
+  int mismatches = 0;
+  for (size_t i = kSampleRate; i < samples.size(); ++i) {
+    sum += int16_samples[i];
+    sum_squares += static_cast<double>(int16_samples[i]) * int16_samples[i];
+    if (std::abs(float_samples[i] * 32768.0f - int16_samples[i]) > 1.0f) {
+      ++mismatches;
+    }
+  }
+  EXPECT_EQ(mismatches, 0);
+  const double mean = sum / kSampleRate;
+  const double rms = std::sqrt(sum_squares / kSampleRate - mean * mean);
+  // The offset was 8192 in int16, and the tone's RMS is 4096 / sqrt(2).
+  EXPECT_TRUE(std::abs(mean) < 2.0);
+  EXPECT_NEAR(20 * std::log10(rms / (4096 / std::sqrt(2.0))), 0.0, 0.01);
+
+  // A reset restarts the estimate at the next sample.
+  int16_converter.Reset();
+  int16_t first;
+  const int32_t sample = 1 << 30;
+  int16_converter.ToInt16(&sample, 1, &first);
+  EXPECT_EQ(first, 0);
+}
+
+void TestRemoveDcSaturates() {
+  // A full-scale step after a full-scale negative offset is twice full scale.
+  std::vector<int32_t> samples(100, std::numeric_limits<int32_t>::min());
+  samples.resize(200, std::numeric_limits<int32_t>::max());
+  AudioConverter converter({1.0f, true});
+  std::vector<int16_t> out(samples.size());
+  converter.ToInt16(samples.data(), samples.size(), out.data());
+  EXPECT_EQ(out[100], std::numeric_limits<int16_t>::max());
+}
+
+void Benchmark() {
+  const auto samples = RandomSamples(kSampleRate, 3);
+  std::vector<int16_t> int16_samples(samples.size());
+  std::vector<float> float_samples(samples.size());
+  constexpr int kIterations = 100;
+  const struct {
+    const char* name;
+    bool remove_dc;
+    bool to_float;
+  } cases[] = {{"ToInt16", false, false},
+               {"ToInt16 with DC removal", true, false},
+               {"ToFloat", false, true},
+               {"ToFloat with DC removal", true, true}};
+  for (const auto& c : cases) {
+    AudioConverter converter({1.0f, c.remove_dc});
+    const uint64_t start = TimerMicros();
+    for (int i = 0; i < kIterations; ++i) {
+      if (c.to_float) {
+        converter.ToFloat(samples.data(), samples.size(),
+                          float_samples.data());
+      } else {
+        converter.ToInt16(samples.data(), samples.size(),
+                          int16_samples.data());
+      }
+    }
+    std::printf("AudioConverter %s, 1 s of 16 kHz audio: %llu us\n", c.name,
+                static_cast<unsigned long long>((TimerMicros() - start) /
+                                                kIterations));
+  }
+}
+
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  coralmicro::TestDefaultOptions();
+  coralmicro::TestGainSaturates();
+  coralmicro::TestRemoveDc();
+  coralmicro::TestRemoveDcSaturates();
+  coralmicro::Benchmark();
+  return TEST_RESULT();
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the frequency response of `AudioDecimator` with test tones, and
+// prints how long it takes to decimate a second of 48 kHz audio.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "libs/audio/audio_decimator.h"
+#include "libs/base/timer.h"
+#include "tests/host/test_util.h"
+
+namespace coralmicro {
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr int kInputRate = 48000;
+// Loud, but with headroom for the filter's ripple.
+constexpr double kAmplitude = 0.5 * std::numeric_limits<int32_t>::max();
+
+std::vector<int32_t> Tone(double frequency, size_t num_samples) {
+  std::vector<int32_t> samples(num_samples);
+  for (size_t i = 0; i < num_samples; ++i) {
+    samples[i] = static_cast<int32_t>(std::lround(
+        kAmplitude * std::sin(2 * kPi * frequency * i / kInputRate)));
+  }
+  return samples;
+}
+
+std::vector<int32_t> Decimate(int factor, const std::vector<int32_t>& input) {
+  AudioDecimator decimator(factor);
+  std::vector<int32_t> output(decimator.MaxOutputSize(input.size()));
+  output.resize(decimator.Process(input.data(), input.size(), output.data()));
+  return output;
+}
+
+// Gets the gain, in dB, of a tone at `frequency` through the decimator.
+double GainDb(int factor, double frequency) {
+  // A second of audio; the first 100 ms, with the filter's start-up
+  // transient, are left out.
+  const auto output = Decimate(factor, Tone(frequency, kInputRate));
+  const size_t skip = output.size() / 10;
+  double sum = 0.0;
+  for (size_t i = skip; i < output.size(); ++i) {
+    sum += static_cast<double>(output[i]) * output[i];
+  }
+  const double rms = std::sqrt(sum / (output.size() - skip));
+  return 20 * std::log10(rms / (kAmplitude / std::sqrt(2.0)));
+}
+
+void TestFactorOneCopies() {
+  const auto input = Tone(1000, 1000);
+  EXPECT_TRUE(Decimate(1, input) == input);
+}
+
+void TestDcGain() {
+  for (int factor = 2; factor <= AudioDecimator::kMaxFactor; ++factor) {
+    const std::vector<int32_t> input(4800, 1 << 28);
+    const auto output = Decimate(factor, input);
+    EXPECT_EQ(output.size(), input.size() / factor);
+    // Once the filter is full, the output is the input.
+    EXPECT_EQ(output.back(), 1 << 28);
+  }
+}
+
+void TestPassband() {
+  // 16 kHz output: flat to 6.4 kHz.
+  for (double frequency : {100.0, 1000.0, 3000.0, 5000.0, 6400.0}) {
+    EXPECT_NEAR(GainDb(3, frequency), 0.0, 0.01);
+  }
+  // 24 kHz output: flat to 9.6 kHz.
+  for (double frequency : {1000.0, 6000.0, 9600.0}) {
+    EXPECT_NEAR(GainDb(2, frequency), 0.0, 0.01);
+  }
+}
+
+void TestNoAliasing() {
+  // Everything past the output Nyquist frequency would fold back into the
+  // output band, and is filtered out. The Q15 coefficients limit the
+  // attenuation to about 70 dB.
+  for (double frequency : {8000.0, 8500.0, 12000.0, 16000.0, 23000.0}) {
+    EXPECT_TRUE(GainDb(3, frequency) < -60.0);
+  }
+  for (double frequency : {12000.0, 13000.0, 18000.0, 23000.0}) {
+    EXPECT_TRUE(GainDb(2, frequency) < -60.0);
+  }
+}
+
+void TestBlocksMatchOneShot() {
+  // The filter state carries over between blocks of any size, including
+  // blocks that aren't a multiple of the factor.
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int32_t> sample(
+      std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max());
+  std::vector<int32_t> input(9600);
+  for (auto& value : input) value = sample(random);
+  for (int factor = 2; factor <= AudioDecimator::kMaxFactor; ++factor) {
+    const auto expected = Decimate(factor, input);
+    AudioDecimator decimator(factor);
+    std::vector<int32_t> output;
+    std::uniform_int_distribution<size_t> block_size(1, 1000);
+    for (size_t start = 0; start < input.size();) {
+      const size_t size = std::min(block_size(random), input.size() - start);
+      std::vector<int32_t> block(decimator.MaxOutputSize(size));
+      block.resize(decimator.Process(input.data() + start, size, block.data()));
+      output.insert(output.end(), block.begin(), block.end());
+      start += size;
+    }
+    EXPECT_TRUE(output == expected);
+
+    // Full-scale noise saturates rather than wrapping, so reset gives the
+    // same output again.
+    decimator.Reset();
+    std::vector<int32_t> again(decimator.MaxOutputSize(input.size()));
+    again.resize(decimator.Process(input.data(), input.size(), again.data()));
+    EXPECT_TRUE(again == expected);
+  }
+}
+
+void Benchmark() {
+  const auto input = Tone(1000, kInputRate);
+  std::vector<int32_t> output(input.size());
+  constexpr int kIterations = 20;
+  for (int factor = 2; factor <= AudioDecimator::kMaxFactor; ++factor) {
+    AudioDecimator decimator(factor);
+    const uint64_t start = TimerMicros();
+    for (int i = 0; i < kIterations; ++i) {
+      decimator.Process(input.data(), input.size(), output.data());
+    }
+    std::printf("AudioDecimator factor %d, 1 s of 48 kHz audio: %llu us\n",
+                factor,
+                static_cast<unsigned long long>((TimerMicros() - start) /
+                                                kIterations));
+  }
+}
+
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  coralmicro::TestFactorOneCopies();
+  coralmicro::TestDcGain();
+  coralmicro::TestPassband();
+  coralmicro::TestNoAliasing();
+  coralmicro::TestBlocksMatchOneShot();
+  coralmicro::Benchmark();
+  return TEST_RESULT();
+}
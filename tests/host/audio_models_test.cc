@@ -0,0 +1,370 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the audio preprocessing of both audio models against golden
+// spectrograms computed by running the TFLM microfrontend directly on the
+// same audio, and the normalized input tensors against float references.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "libs/base/check.h"
+#include "libs/base/timer.h"
+#include "libs/tensorflow/audio_models.h"
+#include "tests/host/test_util.h"
+
+namespace coralmicro::tensorflow {
+namespace {
+
+struct ModelSpec {
+  AudioModel model;
+  int audio_size;
+  int slice_size;
+  int slice_count;
+  float lower_band_limit;
+  float upper_band_limit;
+};
+
+constexpr ModelSpec kYamnetSpec{kYAMNet,
+                                kYamnetAudioSize,
+                                kYamnetFeatureSliceSize,
+                                kYamnetFeatureSliceCount,
+                                125.0f,
+                                7500.0f};
+constexpr ModelSpec kKeywordDetectorSpec{kKeywordDetector,
+                                         kKeywordDetectorAudioSize,
+                                         kKeywordDetectorFeatureSliceSize,
+                                         kKeywordDetectorFeatureSliceCount,
+                                         60.0f,
+                                         3800.0f};
+
+// The samples between the starts of consecutive slices, and in each slice,
+// at 16 kHz.
+constexpr int kSliceStride = 160;
+constexpr int kSliceSamples = 400;
+
+constexpr float kTwoPi = 6.2831853f;
+
+// Speech-like test audio: a few drifting tones over noise, with a slow
+// amplitude envelope.
+std::vector<int16_t> SynthesizeAudio(size_t num_samples, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::normal_distribution<float> noise(0.0f, 300.0f);
+  std::vector<int16_t> audio(num_samples);
+  for (size_t i = 0; i < num_samples; ++i) {
+    const float t = i / 16000.0f;
+    const float envelope = 0.6f + 0.4f * std::sin(kTwoPi * 3 * t);
+    const float value =
+        envelope * (6000.0f * std::sin(kTwoPi * (300 + 200 * t) * t) +
+                    3000.0f * std::sin(kTwoPi * 1250 * t) +
+                    1500.0f * std::sin(kTwoPi * (3000 - 400 * t) * t)) +
+        noise(random);
+    audio[i] = static_cast<int16_t>(
+        std::clamp(std::lround(value), -32768l, 32767l));
+  }
+  return audio;
+}
+
+// The golden spectrogram: the microfrontend, configured as the models were
+// trained, run from a fresh state over one window of audio.
+std::vector<int16_t> GoldenFeatures(const ModelSpec& spec,
+                                    const int16_t* audio) {
+  FrontendConfig config{};
+  config.window.size_ms = 25;
+  config.window.step_size_ms = 10;
+  config.filterbank.num_channels = spec.slice_size;
+  config.filterbank.lower_band_limit = spec.lower_band_limit;
+  config.filterbank.upper_band_limit = spec.upper_band_limit;
+  config.noise_reduction.smoothing_bits = 10;
+  config.noise_reduction.even_smoothing = 0.025;
+  config.noise_reduction.odd_smoothing = 0.06;
+  config.noise_reduction.min_signal_remaining = 1.0;
+  config.pcan_gain_control.enable_pcan = 0;
+  config.pcan_gain_control.strength = 0.95;
+  config.pcan_gain_control.offset = 80.0;
+  config.pcan_gain_control.gain_bits = 21;
+  config.log_scale.enable_log = 1;
+  config.log_scale.scale_shift = 6;
+  FrontendState state{};
+  CHECK(FrontendPopulateState(&config, &state, 16000));
+
+  std::vector<int16_t> features;
+  size_t remaining = spec.audio_size;
+  while (remaining > 0) {
+    size_t num_read;
+    const auto output =
+        FrontendProcessSamples(&state, audio, remaining, &num_read);
+    audio += num_read;
+    remaining -= num_read;
+    if (output.values != nullptr) {
+      features.insert(features.end(), output.values,
+                      output.values + output.size);
+    }
+  }
+  FrontendFreeStateContents(&state);
+  return features;
+}
+
+// A tensor backed by `data`, which must outlive it.
+template <typename T>
+TfLiteTensor MakeTensor(TfLiteType type, std::vector<T>* data) {
+  TfLiteTensor tensor{};
+  tensor.type = type;
+  tensor.data.data = data->data();
+  tensor.bytes = data->size() * sizeof(T);
+  return tensor;
+}
+
+std::vector<float> ReferenceYamnetInput(const std::vector<int16_t>& features) {
+  const auto [min_it, max_it] =
+      std::minmax_element(features.begin(), features.end());
+  const int offset = (*max_it + *min_it) / 2;
+  std::vector<float> input(features.size(), 0.0f);
+  if (*max_it == offset) return input;
+  const double scalar = 3.5 / (*max_it - offset);
+  for (size_t i = 0; i < features.size(); ++i) {
+    input[i] = static_cast<float>((features[i] - offset) * scalar);
+  }
+  return input;
+}
+
+std::vector<uint8_t> ReferenceKeywordDetectorInput(
+    const std::vector<int16_t>& features) {
+  const auto [min_it, max_it] =
+      std::minmax_element(features.begin(), features.end());
+  const int range = *max_it - *min_it;
+  std::vector<uint8_t> input(features.size(), 0);
+  if (range == 0) return input;
+  for (size_t i = 0; i < features.size(); ++i) {
+    const int value = (features[i] - *min_it) * 256 / range;
+    input[i] = static_cast<uint8_t>(std::min(value, 255));
+  }
+  return input;
+}
+
+// Checks the normalized input tensor of `spec`'s model, computed by `fill`,
+// against the float reference for `golden`.
+template <typename Fill>
+void ExpectInputMatches(const ModelSpec& spec,
+                        const std::vector<int16_t>& golden, Fill fill) {
+  if (spec.model == kYAMNet) {
+    std::vector<float> input(golden.size());
+    auto tensor = MakeTensor(kTfLiteFloat32, &input);
+    EXPECT_TRUE(fill(&tensor));
+    const auto expected = ReferenceYamnetInput(golden);
+    float max_error = 0.0f;
+    for (size_t i = 0; i < input.size(); ++i) {
+      max_error = std::max(max_error, std::abs(input[i] - expected[i]));
+    }
+    EXPECT_TRUE(max_error < 1e-5f);
+  } else {
+    std::vector<uint8_t> input(golden.size());
+    auto tensor = MakeTensor(kTfLiteUInt8, &input);
+    EXPECT_TRUE(fill(&tensor));
+    EXPECT_TRUE(input == ReferenceKeywordDetectorInput(golden));
+  }
+}
+
+std::vector<int16_t> TestAudio(const ModelSpec& spec, size_t num_samples) {
+  if (spec.model == kYAMNet) {
+    // The example's recording, repeated as needed.
+    const auto bytes = testing::ReadFile("models/yamnet_test_audio.bin");
+    EXPECT_EQ(bytes.size(), kYamnetAudioSize * sizeof(int16_t));
+    if (bytes.size() == kYamnetAudioSize * sizeof(int16_t)) {
+      std::vector<int16_t> audio(num_samples);
+      for (size_t i = 0; i < num_samples; i += kYamnetAudioSize) {
+        std::memcpy(audio.data() + i, bytes.data(),
+                    std::min<size_t>(kYamnetAudioSize, num_samples - i) *
+                        sizeof(int16_t));
+      }
+      return audio;
+    }
+  }
+  return SynthesizeAudio(num_samples, 1);
+}
+
+// The preprocessors are too large for the stack.
+AudioPreprocessor& GetPreprocessor(AudioModel model) {
+  static AudioPreprocessor yamnet(kYAMNet);
+  static AudioPreprocessor keyword_detector(kKeywordDetector);
+  return model == kYAMNet ? yamnet : keyword_detector;
+}
+
+void TestPreprocessorMatchesGolden(const ModelSpec& spec) {
+  const auto audio = TestAudio(spec, spec.audio_size);
+  const auto golden = GoldenFeatures(spec, audio.data());
+  EXPECT_EQ(golden.size(),
+            static_cast<size_t>(spec.slice_size * spec.slice_count));
+
+  auto& preprocessor = GetPreprocessor(spec.model);
+  EXPECT_TRUE(preprocessor.Init());
+  // Twice, as the frontend state must be reset between windows.
+  for (int i = 0; i < 2; ++i) {
+    ExpectInputMatches(spec, golden, [&](TfLiteTensor* tensor) {
+      return preprocessor.Preprocess(audio.data(), tensor);
+    });
+  }
+
+  FrontendState state{};
+  EXPECT_TRUE(PrepareAudioFrontEnd(&state, spec.model));
+  ExpectInputMatches(spec, golden, [&](TfLiteTensor* tensor) {
+    return spec.model == kYAMNet
+               ? YamNetPreprocessInput(audio.data(), tensor, &state)
+               : KeywordDetectorPreprocessInput(audio.data(), tensor, &state);
+  });
+  FrontendFreeStateContents(&state);
+}
+
+void TestStreamMatchesGolden(const ModelSpec& spec) {
+  // Three windows of audio, added in 50 ms buffers, as the audio service
+  // delivers them.
+  constexpr size_t kBufferSize = 800;
+  const auto audio = TestAudio(spec, 3 * spec.audio_size);
+  static AudioFrontendStream stream;
+  EXPECT_TRUE(stream.Init(spec.model));
+  EXPECT_EQ(stream.slice_size(), static_cast<size_t>(spec.slice_size));
+  EXPECT_EQ(stream.slice_count(), static_cast<size_t>(spec.slice_count));
+  std::vector<int16_t> features(spec.slice_size * spec.slice_count);
+
+  const size_t window_samples =
+      (spec.slice_count - 1) * kSliceStride + kSliceSamples;
+  int windows = 0;
+  for (size_t added = 0; added + kBufferSize <= audio.size();) {
+    stream.AddSamples(audio.data() + added, kBufferSize);
+    added += kBufferSize;
+    if (added < window_samples) {
+      EXPECT_TRUE(!stream.full());
+      EXPECT_TRUE(!stream.CopyFeatures(features.data()));
+      continue;
+    }
+    EXPECT_TRUE(stream.full());
+    if (!stream.CopyFeatures(features.data())) continue;
+    // The window ending with the latest slice.
+    const size_t first_slice = (added - window_samples) / kSliceStride;
+    const size_t start = first_slice * kSliceStride;
+    if (start + spec.audio_size > audio.size()) break;
+    const auto golden = GoldenFeatures(spec, audio.data() + start);
+    EXPECT_TRUE(features == golden);
+    AudioFeatureNormalizer normalizer(spec.model);
+    ExpectInputMatches(spec, golden, [&](TfLiteTensor* tensor) {
+      return normalizer.Normalize(stream, tensor);
+    });
+    ++windows;
+  }
+  EXPECT_TRUE(windows > 10);
+
+  stream.Reset();
+  EXPECT_TRUE(!stream.full());
+}
+
+void TestNormalizerEdgeCases() {
+  // A flat window can't be scaled and gives zeros.
+  std::vector<int16_t> flat(kKeywordDetectorFeatureElementCount, 700);
+  std::vector<uint8_t> uint8_input(flat.size(), 1);
+  auto uint8_tensor = MakeTensor(kTfLiteUInt8, &uint8_input);
+  AudioFeatureNormalizer keyword_normalizer(kKeywordDetector);
+  EXPECT_TRUE(keyword_normalizer.Normalize(flat.data(), &uint8_tensor));
+  EXPECT_TRUE(std::all_of(uint8_input.begin(), uint8_input.end(),
+                          [](uint8_t value) { return value == 0; }));
+
+  // Every range, from narrow ones to the full int16 range, requantizes
+  // exactly, and the top of the range is clamped to 255.
+  std::mt19937 random(2);
+  for (int range : {1, 2, 3, 255, 256, 257, 1000, 2047, 2048, 2049, 12345,
+                    40000, 65535}) {
+    std::vector<int16_t> features(kKeywordDetectorFeatureElementCount);
+    const int min = -32768 + static_cast<int>(random() % (65536 - range));
+    std::uniform_int_distribution<int> value(min, min + range);
+    for (auto& feature : features) feature = value(random);
+    features[0] = min;
+    features[1] = min + range;
+    EXPECT_TRUE(keyword_normalizer.Normalize(features.data(), &uint8_tensor));
+    EXPECT_TRUE(uint8_input == ReferenceKeywordDetectorInput(features));
+    EXPECT_EQ(uint8_input[1], 255);
+  }
+
+  // Mismatched tensors are rejected rather than written.
+  std::vector<float> float_input(kKeywordDetectorFeatureElementCount);
+  auto float_tensor = MakeTensor(kTfLiteFloat32, &float_input);
+  EXPECT_TRUE(!keyword_normalizer.Normalize(flat.data(), &float_tensor));
+  std::vector<uint8_t> short_input(kKeywordDetectorFeatureElementCount - 1);
+  auto short_tensor = MakeTensor(kTfLiteUInt8, &short_input);
+  EXPECT_TRUE(!keyword_normalizer.Normalize(flat.data(), &short_tensor));
+  AudioFeatureNormalizer yamnet_normalizer(kYAMNet);
+  EXPECT_TRUE(!yamnet_normalizer.Normalize(flat.data(), &uint8_tensor));
+
+  FrontendState state{};
+  EXPECT_TRUE(PrepareAudioFrontEnd(&state, kKeywordDetector));
+  const auto audio = SynthesizeAudio(kKeywordDetectorAudioSize, 3);
+  EXPECT_TRUE(!KeywordDetectorPreprocessInput(audio.data(), &float_tensor,
+                                              &state));
+  FrontendFreeStateContents(&state);
+}
+
+void Benchmark(const ModelSpec& spec, const char* name) {
+  // A 100 ms hop, as a continuous classifier would run.
+  constexpr size_t kHop = 1600;
+  constexpr int kIterations = 20;
+  const auto audio = TestAudio(spec, spec.audio_size + kIterations * kHop);
+  auto& preprocessor = GetPreprocessor(spec.model);
+  EXPECT_TRUE(preprocessor.Init());
+  static AudioFrontendStream stream;
+  EXPECT_TRUE(stream.Init(spec.model));
+  stream.AddSamples(audio.data(), spec.audio_size);
+  AudioFeatureNormalizer normalizer(spec.model);
+
+  std::vector<float> float_input(spec.slice_size * spec.slice_count);
+  std::vector<uint8_t> uint8_input(spec.slice_size * spec.slice_count);
+  auto tensor = spec.model == kYAMNet
+                    ? MakeTensor(kTfLiteFloat32, &float_input)
+                    : MakeTensor(kTfLiteUInt8, &uint8_input);
+
+  uint64_t start = TimerMicros();
+  for (int i = 0; i < kIterations; ++i) {
+    preprocessor.Preprocess(audio.data() + i * kHop, &tensor);
+  }
+  const uint64_t window_us = (TimerMicros() - start) / kIterations;
+  start = TimerMicros();
+  for (int i = 0; i < kIterations; ++i) {
+    stream.AddSamples(audio.data() + spec.audio_size + i * kHop, kHop);
+    normalizer.Normalize(stream, &tensor);
+  }
+  const uint64_t stream_us = (TimerMicros() - start) / kIterations;
+  std::printf(
+      "%s preprocessing per 100 ms hop: window %llu us, stream %llu us\n",
+      name, static_cast<unsigned long long>(window_us),
+      static_cast<unsigned long long>(stream_us));
+}
+
+}  // namespace
+}  // namespace coralmicro::tensorflow
+
+int main() {
+  using coralmicro::tensorflow::kKeywordDetectorSpec;
+  using coralmicro::tensorflow::kYamnetSpec;
+  coralmicro::tensorflow::TestPreprocessorMatchesGolden(kYamnetSpec);
+  coralmicro::tensorflow::TestPreprocessorMatchesGolden(kKeywordDetectorSpec);
+  coralmicro::tensorflow::TestStreamMatchesGolden(kYamnetSpec);
+  coralmicro::tensorflow::TestStreamMatchesGolden(kKeywordDetectorSpec);
+  coralmicro::tensorflow::TestNormalizerEdgeCases();
+  coralmicro::tensorflow::Benchmark(kYamnetSpec, "YAMNet");
+  coralmicro::tensorflow::Benchmark(kKeywordDetectorSpec, "Keyword detector");
+  return TEST_RESULT();
+}
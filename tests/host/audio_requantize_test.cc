@@ -0,0 +1,84 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+// Checks `RequantizeFeatures()` against `floor(value * 256 / range)` for
+// every int16 range, at each value where the result steps, and prints how
+// long it takes to requantize a keyword detector window.
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "libs/base/timer.h"
+#include "libs/tensorflow/audio_requantize.h"
+#include "tests/host/test_util.h"
+
+namespace coralmicro::tensorflow {
+namespace {
+
+void TestEveryRange() {
+  // The result only grows with the value, so it's exact everywhere if it's
+  // exact on both sides of every step.
+  std::vector<int16_t> features;
+  std::vector<int> expected;
+  std::vector<uint8_t> output;
+  int mismatches = 0;
+  for (int range = 1; range <= 65535; ++range) {
+    // Both ends of the int16 range, in turn.
+    const int min = range % 2 ? -32768 : 32767 - range;
+    features.clear();
+    expected.clear();
+    for (int step = 0; step <= 256; ++step) {
+      const int value = (step * range + 255) / 256;
+      for (int v : {value - 1, value}) {
+        if (v < 0 || v > range) continue;
+        features.push_back(static_cast<int16_t>(min + v));
+        expected.push_back(std::min(v * 256 / range, 255));
+      }
+    }
+    output.assign(features.size(), 0);
+    RequantizeFeatures(features.data(), features.size(), min, min + range,
+                       output.data());
+    for (size_t i = 0; i < output.size(); ++i) {
+      if (output[i] != expected[i]) ++mismatches;
+    }
+  }
+  EXPECT_EQ(mismatches, 0);
+}
+
+void Benchmark() {
+  // The keyword detector's window: 198 slices of 32 channels.
+  constexpr size_t kCount = 198 * 32;
+  constexpr int kIterations = 1000;
+  std::vector<int16_t> features(kCount);
+  for (size_t i = 0; i < kCount; ++i) features[i] = (i * 37) % 1500;
+  std::vector<uint8_t> output(kCount);
+  const uint64_t start = TimerMicros();
+  for (int i = 0; i < kIterations; ++i) {
+    RequantizeFeatures(features.data(), kCount, 0, 1499, output.data());
+  }
+  std::printf("RequantizeFeatures %zu features: %llu us\n", kCount,
+              static_cast<unsigned long long>((TimerMicros() - start) /
+                                              kIterations));
+}
+
+}  // namespace
+}  // namespace coralmicro::tensorflow
+
+int main() {
+  coralmicro::tensorflow::TestEveryRange();
+  coralmicro::tensorflow::Benchmark();
+  return TEST_RESULT();
+}
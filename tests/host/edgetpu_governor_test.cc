@@ -0,0 +1,190 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Drives `EdgeTpuGovernor` with synthetic traces and checks its control law.
+
+#include <functional>
+
+#include "libs/tpu/edgetpu_governor.h"
+#include "tests/host/test_util.h"
+
+namespace coralmicro {
+namespace {
+
+constexpr uint32_t kTarget = 50000;
+
+// Latency of a model whose inference takes `work_us` in
+// `PerformanceMode::kLow` and scales with the core clock in faster modes.
+uint32_t Latency(uint32_t work_us, PerformanceMode mode) {
+  return work_us >> static_cast<int>(mode);
+}
+
+// Gets the sample for the `i`th inference, run in `mode`.
+using Trace =
+    std::function<EdgeTpuGovernorSample(int i, PerformanceMode mode)>;
+
+// Runs `count` inferences, applying each decision before the next one.
+PerformanceMode Run(EdgeTpuGovernor* governor, PerformanceMode mode,
+                    int count, const Trace& trace) {
+  for (int i = 0; i < count; ++i) {
+    auto sample = trace(i, mode);
+    sample.mode = mode;
+    mode = governor->Update(sample);
+  }
+  return mode;
+}
+
+Trace Load(uint32_t work_us, uint32_t queue_depth = 0) {
+  return [=](int, PerformanceMode mode) {
+    return EdgeTpuGovernorSample{Latency(work_us, mode), queue_depth,
+                                 std::nullopt, mode};
+  };
+}
+
+void TestStepsUpUnderLoad() {
+  EdgeTpuGovernor governor({}, PerformanceMode::kLow);
+  // Needs kHigh: 160 ms at kLow, 40 ms at kHigh.
+  auto mode = Run(&governor, PerformanceMode::kLow, 200, Load(160000));
+  EXPECT_EQ(mode, PerformanceMode::kHigh);
+  EXPECT_EQ(governor.stats().up_switches, 2u);
+  EXPECT_EQ(governor.stats().down_switches, 0u);
+}
+
+void TestStepsDownWhenIdle() {
+  EdgeTpuGovernor governor({}, PerformanceMode::kHigh);
+  // 20 ms at kLow is well under the target.
+  auto mode = Run(&governor, PerformanceMode::kHigh, 200, Load(20000));
+  EXPECT_EQ(mode, PerformanceMode::kLow);
+  EXPECT_EQ(governor.stats().up_switches, 0u);
+  EXPECT_EQ(governor.stats().down_switches, 2u);
+}
+
+void TestStaysWithinRange() {
+  EdgeTpuGovernorConfig config;
+  config.min_mode = PerformanceMode::kMedium;
+  config.max_mode = PerformanceMode::kHigh;
+  EdgeTpuGovernor governor(config, PerformanceMode::kMedium);
+  EXPECT_EQ(Run(&governor, PerformanceMode::kMedium, 200, Load(1000000)),
+            PerformanceMode::kHigh);
+  EXPECT_EQ(Run(&governor, PerformanceMode::kHigh, 200, Load(1000)),
+            PerformanceMode::kMedium);
+}
+
+void TestIgnoresIsolatedSpikes() {
+  EdgeTpuGovernor governor({}, PerformanceMode::kMedium);
+  // 40 ms in kMedium, with every other inference at 80 ms.
+  Run(&governor, PerformanceMode::kMedium, 500,
+      [](int i, PerformanceMode mode) {
+        const uint32_t latency = kTarget * 8 / 10 * (i % 2 ? 2 : 1);
+        return EdgeTpuGovernorSample{latency, 0, std::nullopt, mode};
+      });
+  EXPECT_EQ(governor.mode(), PerformanceMode::kMedium);
+  EXPECT_EQ(governor.stats().up_switches, 0u);
+  EXPECT_EQ(governor.stats().down_switches, 0u);
+}
+
+void TestQueueHysteresis() {
+  // One inference waiting while another runs is normal pipelining.
+  EdgeTpuGovernor pipelined({}, PerformanceMode::kMedium);
+  EXPECT_EQ(Run(&pipelined, PerformanceMode::kMedium, 200, Load(80000, 1)),
+            PerformanceMode::kMedium);
+  EXPECT_EQ(pipelined.stats().up_switches, 0u);
+
+  // A backlog steps up even when each inference meets the target.
+  EdgeTpuGovernor backlog({}, PerformanceMode::kMedium);
+  EXPECT_EQ(Run(&backlog, PerformanceMode::kMedium, 200, Load(80000, 2)),
+            PerformanceMode::kHigh);
+}
+
+void TestBoundsSwitchRate() {
+  // Too slow in kLow (110 ms) but fast in kMedium (27 ms): the load sits
+  // across both thresholds, so the mode has to alternate. The runs and the
+  // dwell time bound how often.
+  EdgeTpuGovernor governor({}, PerformanceMode::kLow);
+  Run(&governor, PerformanceMode::kLow, 1000, Load(110000));
+  const auto& stats = governor.stats();
+  const uint32_t switches = stats.up_switches + stats.down_switches;
+  EXPECT_TRUE(switches > 0);
+  // At least `down_samples` inferences are run in kMedium between switches.
+  EXPECT_TRUE(switches <= 2 * 1000 / 20 + 1);
+  EXPECT_TRUE(stats.mode_samples[static_cast<int>(PerformanceMode::kMedium)] >
+              stats.mode_samples[static_cast<int>(PerformanceMode::kLow)]);
+}
+
+void TestWaitsForPendingMode() {
+  EdgeTpuGovernor governor({}, PerformanceMode::kLow);
+  // The user doesn't apply the decisions, so every sample still runs in kLow.
+  for (int i = 0; i < 100; ++i) {
+    governor.Update({Latency(160000, PerformanceMode::kLow), 0, std::nullopt,
+                     PerformanceMode::kLow});
+  }
+  // One step up is asked for, and not stepped past.
+  EXPECT_EQ(governor.mode(), PerformanceMode::kMedium);
+  EXPECT_EQ(governor.stats().up_switches, 1u);
+
+  // Once the load goes away, the pending request is dropped.
+  for (int i = 0; i < 3; ++i) {
+    governor.Update({kTarget, 0, std::nullopt, PerformanceMode::kLow});
+  }
+  EXPECT_EQ(governor.mode(), PerformanceMode::kLow);
+}
+
+void TestThermalThrottle() {
+  EdgeTpuGovernorConfig config;
+  EdgeTpuGovernor governor(config, PerformanceMode::kHigh);
+  // Settle in kHigh, which the load needs.
+  auto mode = Run(&governor, PerformanceMode::kHigh, 50, Load(160000));
+  EXPECT_EQ(mode, PerformanceMode::kHigh);
+
+  // Too hot: the cap applies on the very next decision, within the dwell
+  // time, and tightens while the die stays hot.
+  auto hot = [](int, PerformanceMode mode) {
+    return EdgeTpuGovernorSample{Latency(160000, mode), 0, 90.0f, mode};
+  };
+  mode = Run(&governor, mode, 1, hot);
+  EXPECT_EQ(mode, PerformanceMode::kMedium);
+  EXPECT_EQ(governor.stats().thermal_throttles, 1u);
+  mode = Run(&governor, mode, config.min_dwell_samples, hot);
+  EXPECT_EQ(mode, PerformanceMode::kLow);
+
+  // Below the limit but within the hysteresis, the cap stays.
+  mode = Run(&governor, mode, 50, [](int, PerformanceMode mode) {
+    return EdgeTpuGovernorSample{Latency(160000, mode), 0, 82.0f, mode};
+  });
+  EXPECT_EQ(mode, PerformanceMode::kLow);
+
+  // Cool again: the load steps the mode back up.
+  mode = Run(&governor, mode, 100, [](int, PerformanceMode mode) {
+    return EdgeTpuGovernorSample{Latency(160000, mode), 0, 70.0f, mode};
+  });
+  EXPECT_EQ(mode, PerformanceMode::kHigh);
+  EXPECT_EQ(governor.stats().thermal_cap, PerformanceMode::kMax);
+}
+
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  coralmicro::TestStepsUpUnderLoad();
+  coralmicro::TestStepsDownWhenIdle();
+  coralmicro::TestStaysWithinRange();
+  coralmicro::TestIgnoresIsolatedSpikes();
+  coralmicro::TestQueueHysteresis();
+  coralmicro::TestBoundsSwitchRate();
+  coralmicro::TestWaitsForPendingMode();
+  coralmicro::TestThermalThrottle();
+  return TEST_RESULT();
+}
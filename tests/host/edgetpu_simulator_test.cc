@@ -0,0 +1,290 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Runs testconv1 through `EdgeTpuExecutable` and `TpuDriver` against the
+// Edge TPU simulator, which checks the whole descriptor stream of the
+// inference.
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "libs/tpu/edgetpu_driver.h"
+#include "libs/tpu/edgetpu_executable.h"
+#include "libs/tpu/edgetpu_op.h"
+#include "libs/tpu/edgetpu_simulator.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tests/host/test_util.h"
+#include "third_party/flatbuffers/include/flatbuffers/flexbuffers.h"
+
+// Heap allocations made while `g_count_allocations` is set.
+namespace {
+bool g_count_allocations = false;
+int g_allocations = 0;
+}  // namespace
+
+void* operator new(size_t size) {
+  if (g_count_allocations) ++g_allocations;
+  if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace coralmicro {
+namespace {
+
+constexpr char kModel[] = "models/testconv1-edgetpu.tflite";
+constexpr char kInput[] = "models/testconv1-test-input.bin";
+constexpr char kKeyExecutable[] = "4";
+
+struct Executables {
+  const platforms::darwinn::Executable* inference = nullptr;
+  const platforms::darwinn::Executable* parameter_caching = nullptr;
+};
+
+// Finds the executables in the package of the model's Edge TPU custom op, as
+// `EdgeTpuManager::RegisterPackage()` does.
+Executables GetExecutables(const std::vector<uint8_t>& model_data) {
+  Executables executables;
+  const auto* model = tflite::GetModel(model_data.data());
+  const auto* op_codes = model->operator_codes();
+  for (const auto* op : *model->subgraphs()->Get(0)->operators()) {
+    const auto* op_code = op_codes->Get(op->opcode_index());
+    if (!op_code->custom_code() ||
+        op_code->custom_code()->str() != kCustomOp) {
+      continue;
+    }
+    const auto* options = op->custom_options();
+    auto package_binary =
+        flexbuffers::GetRoot(options->data(), options->size())
+            .AsMap()[kKeyExecutable]
+            .AsString();
+    const auto* package =
+        flatbuffers::GetRoot<platforms::darwinn::Package>(
+            package_binary.c_str());
+    const auto* multi_executable =
+        flatbuffers::GetRoot<platforms::darwinn::MultiExecutable>(
+            package->serialized_multi_executable()->data());
+    for (const auto* serialized : *multi_executable->serialized_executables()) {
+      const auto* executable =
+          flatbuffers::GetRoot<platforms::darwinn::Executable>(
+              reinterpret_cast<const uint8_t*>(serialized->c_str()));
+      if (executable->type() ==
+          platforms::darwinn::ExecutableType_PARAMETER_CACHING) {
+        executables.parameter_caching = executable;
+      } else {
+        executables.inference = executable;
+      }
+    }
+  }
+  return executables;
+}
+
+// A single-op graph whose tensors are plain buffers.
+struct Graph {
+  static TfLiteEvalTensor* GetEvalTensor(const TfLiteContext* context,
+                                         int index) {
+    return &static_cast<Graph*>(context->impl_)->tensors[index];
+  }
+
+  Graph(size_t input_size, size_t output_size)
+      : input(input_size), output(output_size) {
+    input_dims = {1, static_cast<int>(input_size)};
+    output_dims = {1, static_cast<int>(output_size)};
+    tensors[0].data.uint8 = input.data();
+    tensors[0].dims = reinterpret_cast<TfLiteIntArray*>(input_dims.data());
+    tensors[0].type = kTfLiteUInt8;
+    tensors[1].data.uint8 = output.data();
+    tensors[1].dims = reinterpret_cast<TfLiteIntArray*>(output_dims.data());
+    tensors[1].type = kTfLiteUInt8;
+    node.inputs = reinterpret_cast<TfLiteIntArray*>(inputs.data());
+    node.outputs = reinterpret_cast<TfLiteIntArray*>(outputs.data());
+    context.impl_ = this;
+    context.GetEvalTensor = GetEvalTensor;
+  }
+
+  std::vector<uint8_t> input;
+  std::vector<uint8_t> output;
+  std::array<int, 2> input_dims;
+  std::array<int, 2> output_dims;
+  std::array<int, 2> inputs = {1, 0};
+  std::array<int, 2> outputs = {1, 1};
+  TfLiteEvalTensor tensors[2] = {};
+  TfLiteNode node = {};
+  TfLiteContext context = {};
+};
+
+// An Edge TPU simulator with a driver and testconv1 loaded.
+class TestConv1 {
+ public:
+  TestConv1()
+      : model_data_(testing::ReadFile(kModel)),
+        input_(testing::ReadFile(kInput)) {
+    if (model_data_.empty() || input_.empty()) return;
+    executables_ = GetExecutables(model_data_);
+    if (!executables_.inference) return;
+    layer_ = executables_.inference->output_layers()->Get(0);
+    if (!driver_.Initialize(&simulator_, PerformanceMode::kMax)) return;
+
+    // Raw device output with a distinct value in every byte position.
+    raw_output_.resize(layer_->size_bytes() *
+                       layer_->execution_count_per_inference());
+    for (size_t i = 0; i < raw_output_.size(); ++i) {
+      raw_output_[i] = i * 7 + i / 251;
+    }
+    simulator_.SetOutput(layer_->name()->str(), raw_output_.data(),
+                         raw_output_.size());
+
+    // The output relayouted from a single chunk holding all of it.
+    OutputLayer reference(layer_);
+    expected_output_.resize(reference.RelayoutSizeBytes());
+    reference.BeginRelayout(expected_output_.data());
+    reference.ConsumeOutput(raw_output_.data(), 0, raw_output_.size());
+    reference.EndRelayout();
+
+    executable_ = std::make_unique<EdgeTpuExecutable>(executables_.inference);
+    ok_ = true;
+  }
+
+  bool ok() const { return ok_; }
+  const std::vector<uint8_t>& input() const { return input_; }
+  const std::vector<uint8_t>& expected_output() const {
+    return expected_output_;
+  }
+  EdgeTpuSimulator& simulator() { return simulator_; }
+
+  // Invokes the executable on `graph`, expecting `runs` inferences.
+  TfLiteStatus Invoke(Graph* graph, int runs) {
+    if (!CacheParameters(graph)) return kTfLiteError;
+    Expect(runs);
+    return Run(graph);
+  }
+
+  // Loads the parameters of a parameter-caching model once.
+  bool CacheParameters(Graph* graph) {
+    if (!executables_.parameter_caching || parameters_cached_) return true;
+    EdgeTpuExecutable parameter_caching(executables_.parameter_caching);
+    simulator_.ExpectExecutable(executables_.parameter_caching);
+    parameters_cached_ = parameter_caching.Invoke(driver_, &graph->context,
+                                                  &graph->node) == kTfLiteOk;
+    return parameters_cached_;
+  }
+
+  // Queues the simulator traffic of `runs` inferences.
+  void Expect(int runs) {
+    for (int i = 0; i < runs; ++i) {
+      simulator_.ExpectExecutable(executables_.inference);
+    }
+  }
+
+  // Invokes the executable on `graph` without queuing any traffic.
+  TfLiteStatus Run(Graph* graph) {
+    simulator_.ResetStats();
+    return executable_->Invoke(driver_, &graph->context, &graph->node);
+  }
+
+ private:
+  std::vector<uint8_t> model_data_;
+  std::vector<uint8_t> input_;
+  Executables executables_;
+  const platforms::darwinn::Layer* layer_ = nullptr;
+  EdgeTpuSimulator simulator_;
+  TpuDriver driver_;
+  std::vector<uint8_t> raw_output_;
+  std::vector<uint8_t> expected_output_;
+  std::unique_ptr<EdgeTpuExecutable> executable_;
+  bool parameters_cached_ = false;
+  bool ok_ = false;
+};
+
+void TestInference() {
+  TestConv1 test;
+  EXPECT_TRUE(test.ok());
+  if (!test.ok()) return;
+
+  Graph graph(test.input().size(), test.expected_output().size());
+  std::memcpy(graph.input.data(), test.input().data(), test.input().size());
+  EXPECT_EQ(test.Invoke(&graph, 1), kTfLiteOk);
+  EXPECT_TRUE(test.simulator().idle());
+  EXPECT_EQ(test.simulator().stats().errors, 0u);
+  EXPECT_EQ(test.simulator().stats().events, 1u);
+
+  // The output relayouted while streamed in chunks must match the output
+  // relayouted from a single chunk.
+  EXPECT_TRUE(graph.output == test.expected_output());
+}
+
+void TestInvokeDoesNotAllocate() {
+  TestConv1 test;
+  EXPECT_TRUE(test.ok());
+  if (!test.ok()) return;
+
+  // Allocations made on the first inference (if any) are not counted; the
+  // simulator's expectations are queued before counting starts.
+  Graph graph(test.input().size(), test.expected_output().size());
+  EXPECT_EQ(test.Invoke(&graph, 1), kTfLiteOk);
+  test.Expect(1);
+  g_allocations = 0;
+  g_count_allocations = true;
+  const TfLiteStatus status = test.Run(&graph);
+  g_count_allocations = false;
+  EXPECT_EQ(status, kTfLiteOk);
+  EXPECT_EQ(g_allocations, 0);
+  EXPECT_TRUE(test.simulator().idle());
+}
+
+void TestBatch() {
+  TestConv1 test;
+  EXPECT_TRUE(test.ok());
+  if (!test.ok()) return;
+  const size_t input_size = test.input().size();
+  const size_t output_size = test.expected_output().size();
+
+  // Two inputs in one tensor run as two inferences, each written to its own
+  // slice of the output tensor.
+  Graph graph(2 * input_size, 2 * output_size);
+  std::memcpy(graph.input.data(), test.input().data(), input_size);
+  std::memcpy(graph.input.data() + input_size, test.input().data(),
+              input_size);
+  EXPECT_EQ(test.Invoke(&graph, 2), kTfLiteOk);
+  EXPECT_TRUE(test.simulator().idle());
+  EXPECT_EQ(test.simulator().stats().events, 2u);
+  EXPECT_TRUE(std::equal(test.expected_output().begin(),
+                         test.expected_output().end(), graph.output.begin()));
+  EXPECT_TRUE(std::equal(test.expected_output().begin(),
+                         test.expected_output().end(),
+                         graph.output.begin() + output_size));
+
+  // An output tensor without room for the second batch is rejected rather
+  // than overrun.
+  Graph small(2 * input_size, output_size);
+  EXPECT_EQ(test.Invoke(&small, 2), kTfLiteError);
+}
+
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  coralmicro::TestInference();
+  coralmicro::TestInvokeDoesNotAllocate();
+  coralmicro::TestBatch();
+  return TEST_RESULT();
+}
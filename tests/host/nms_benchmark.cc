@@ -0,0 +1,292 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks `SelectTopK()` and `NonMaxSuppressor` against straightforward
+// references and prints how long they take on raw-box model sized inputs.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "libs/base/timer.h"
+#include "libs/tensorflow/nms.h"
+#include "libs/tensorflow/top_k.h"
+#include "tests/host/test_util.h"
+
+namespace coralmicro::tensorflow {
+namespace {
+
+// Backing store for a `DetectionResults` of any capacity.
+struct Detections {
+  explicit Detections(size_t capacity)
+      : ids(capacity), scores(capacity), bboxes(capacity) {}
+  // Gets empty results backed by this store.
+  DetectionResults results() {
+    return {ids.data(), scores.data(), bboxes.data(), ids.size(), 0};
+  }
+  // Gets results holding everything in this store, as NMS candidates.
+  DetectionResults candidates() {
+    return {ids.data(), scores.data(), bboxes.data(), ids.size(), ids.size()};
+  }
+  std::vector<int> ids;
+  std::vector<float> scores;
+  std::vector<BBox<float>> bboxes;
+};
+
+// Random candidates, sorted by distinct scores. Coordinates are multiples of
+// 1/64 and the first box spans [0, 1], so the fixed-point grid of
+// `NonMaxSuppressor` represents every box exactly.
+Detections RandomCandidates(size_t count, int num_classes, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<int> corner(0, 56), size(2, 8),
+      id(0, num_classes - 1);
+  Detections candidates(count);
+  for (size_t i = 0; i < count; ++i) {
+    const int y = corner(random), x = corner(random);
+    candidates.bboxes[i] = {y / 64.0f, x / 64.0f, (y + size(random)) / 64.0f,
+                            (x + size(random)) / 64.0f};
+    candidates.ids[i] = id(random);
+    candidates.scores[i] = 1.0f - static_cast<float>(i) / count;
+  }
+  if (count > 0) candidates.bboxes[0] = {0.0f, 0.0f, 1.0f, 1.0f};
+  return candidates;
+}
+
+float Iou(const BBox<float>& a, const BBox<float>& b) {
+  const float h = std::min(a.ymax, b.ymax) - std::max(a.ymin, b.ymin);
+  const float w = std::min(a.xmax, b.xmax) - std::max(a.xmin, b.xmin);
+  if (h <= 0 || w <= 0) return 0.0f;
+  const float area_a = (a.ymax - a.ymin) * (a.xmax - a.xmin);
+  const float area_b = (b.ymax - b.ymin) * (b.xmax - b.xmin);
+  return h * w / (area_a + area_b - h * w);
+}
+
+// Greedy NMS comparing every candidate against every kept box.
+std::vector<size_t> ReferenceGreedy(const Detections& candidates,
+                                    float iou_threshold, size_t capacity) {
+  std::vector<size_t> kept;
+  for (size_t i = 0; i < candidates.ids.size() && kept.size() < capacity;
+       ++i) {
+    bool suppressed = false;
+    for (size_t k : kept) {
+      if (candidates.ids[k] == candidates.ids[i] &&
+          Iou(candidates.bboxes[k], candidates.bboxes[i]) > iou_threshold) {
+        suppressed = true;
+        break;
+      }
+    }
+    if (!suppressed) kept.push_back(i);
+  }
+  return kept;
+}
+
+void TestSelectTopK() {
+  std::mt19937 random(1);
+  // Few distinct values, so there are many ties.
+  std::vector<uint8_t> scores(5000);
+  for (auto& score : scores) score = static_cast<uint8_t>(random() % 16);
+  std::vector<int> expected(scores.size());
+  std::iota(expected.begin(), expected.end(), 0);
+  std::stable_sort(expected.begin(), expected.end(),
+                   [&](int a, int b) { return scores[a] > scores[b]; });
+  const uint8_t threshold = 4;
+  expected.erase(std::find_if(expected.begin(), expected.end(),
+                              [&](int i) { return scores[i] < threshold; }),
+                 expected.end());
+
+  for (size_t capacity : {size_t{0}, size_t{1}, size_t{10}, size_t{1000},
+                          scores.size()}) {
+    std::vector<int> indices(std::max<size_t>(capacity, 1));
+    const size_t size = SelectTopK(scores.data(), scores.size(), threshold,
+                                   capacity, indices.data());
+    EXPECT_EQ(size, std::min(capacity, expected.size()));
+    EXPECT_TRUE(std::equal(indices.begin(), indices.begin() + size,
+                           expected.begin()));
+  }
+}
+
+void TestGreedy() {
+  for (size_t count : {size_t{1}, size_t{50}, size_t{2000}}) {
+    auto candidates = RandomCandidates(count, 3, count);
+    for (size_t capacity : {size_t{5}, size_t{128}, size_t{1000}}) {
+      NonMaxSuppressor nms(NmsOptions(), capacity);
+      Detections results(capacity);
+      auto candidate_results = candidates.candidates();
+      auto kept = results.results();
+      nms.Run(&candidate_results, &kept);
+      const auto expected = ReferenceGreedy(candidates, 0.5f, capacity);
+      EXPECT_EQ(kept.size, expected.size());
+      bool same = kept.size == expected.size();
+      for (size_t i = 0; same && i < kept.size; ++i) {
+        same = kept.ids[i] == candidates.ids[expected[i]] &&
+               kept.scores[i] == candidates.scores[expected[i]];
+      }
+      EXPECT_TRUE(same);
+    }
+  }
+}
+
+void TestGreedyBeyondDefaultLimit() {
+  // 400 boxes on a grid, none overlapping: all of them are kept.
+  Detections candidates(400);
+  for (int i = 0; i < 400; ++i) {
+    const float y = (i / 20) / 20.0f, x = (i % 20) / 20.0f;
+    candidates.bboxes[i] = {y, x, y + 0.04f, x + 0.04f};
+    candidates.ids[i] = 0;
+    candidates.scores[i] = 1.0f - i / 400.0f;
+  }
+  NonMaxSuppressor nms(NmsOptions(), 400);
+  EXPECT_EQ(nms.max_results(), 400u);
+  Detections results(400);
+  auto candidate_results = candidates.candidates();
+  auto kept = results.results();
+  nms.Run(&candidate_results, &kept);
+  EXPECT_EQ(kept.size, 400u);
+}
+
+// Soft-NMS removing dropped candidates from a list. Boxes are compared in
+// units of 1/64, which scales the overlaps by a power of two and so gives the
+// same float IoU as the fixed-point grid.
+std::vector<std::pair<int, float>> ReferenceSoft(const Detections& candidates,
+                                                 const NmsOptions& options) {
+  struct Candidate {
+    int id;
+    float score;
+    int64_t ymin, xmin, ymax, xmax;
+  };
+  std::vector<Candidate> remaining;
+  for (size_t i = 0; i < candidates.ids.size(); ++i) {
+    const auto& box = candidates.bboxes[i];
+    remaining.push_back({candidates.ids[i], candidates.scores[i],
+                         std::lround(box.ymin * 64), std::lround(box.xmin * 64),
+                         std::lround(box.ymax * 64),
+                         std::lround(box.xmax * 64)});
+  }
+  auto iou = [](const Candidate& a, const Candidate& b) {
+    const int64_t h = std::min(a.ymax, b.ymax) - std::max(a.ymin, b.ymin);
+    const int64_t w = std::min(a.xmax, b.xmax) - std::max(a.xmin, b.xmin);
+    if (h <= 0 || w <= 0) return 0.0f;
+    const int64_t area_a = (a.ymax - a.ymin) * (a.xmax - a.xmin);
+    const int64_t area_b = (b.ymax - b.ymin) * (b.xmax - b.xmin);
+    return static_cast<float>(h * w) /
+           static_cast<float>(area_a + area_b - h * w);
+  };
+
+  std::vector<std::pair<int, float>> kept;
+  while (!remaining.empty()) {
+    auto best = std::max_element(
+        remaining.begin(), remaining.end(),
+        [](const auto& a, const auto& b) { return a.score < b.score; });
+    if (best->score < options.score_threshold) break;
+    const Candidate selected = *best;
+    kept.emplace_back(selected.id, selected.score);
+    remaining.erase(best);
+    for (auto& candidate : remaining) {
+      if (candidate.id != selected.id) continue;
+      const float overlap = iou(selected, candidate);
+      if (options.method == NmsMethod::kSoftLinear) {
+        if (overlap > options.iou_threshold) candidate.score *= 1.0f - overlap;
+      } else {
+        candidate.score *= std::exp(-overlap * overlap / options.sigma);
+      }
+    }
+    remaining.erase(
+        std::remove_if(remaining.begin(), remaining.end(),
+                       [&](const Candidate& candidate) {
+                         return candidate.score < options.score_threshold;
+                       }),
+        remaining.end());
+  }
+  return kept;
+}
+
+void TestSoft() {
+  for (auto method : {NmsMethod::kSoftLinear, NmsMethod::kSoftGaussian}) {
+    NmsOptions options;
+    options.method = method;
+    options.iou_threshold = 0.3f;
+    options.score_threshold = 0.3f;
+    NonMaxSuppressor nms(options);
+    auto candidates = RandomCandidates(300, 2, 7);
+    const auto expected = ReferenceSoft(candidates, options);
+    Detections results(300);
+    auto candidate_results = candidates.candidates();
+    auto kept = results.results();
+    nms.Run(&candidate_results, &kept);
+    EXPECT_TRUE(kept.size > 0);
+    EXPECT_EQ(kept.size, expected.size());
+    bool same = kept.size == expected.size();
+    for (size_t i = 0; same && i < kept.size; ++i) {
+      same = kept.ids[i] == expected[i].first &&
+             kept.scores[i] == expected[i].second;
+    }
+    EXPECT_TRUE(same);
+  }
+}
+
+void Benchmark() {
+  // The candidates of a YOLO-style model at 640x640: 8400 boxes, 80 classes.
+  constexpr size_t kNumScores = 8400 * 80;
+  std::mt19937 random(2);
+  std::vector<uint8_t> scores(kNumScores);
+  for (auto& score : scores) score = static_cast<uint8_t>(random() % 200);
+  std::vector<int> indices(1000);
+  constexpr int kIterations = 20;
+  uint64_t start = TimerMicros();
+  for (int i = 0; i < kIterations; ++i) {
+    SelectTopK(scores.data(), scores.size(), uint8_t{100}, indices.size(),
+               indices.data());
+  }
+  std::printf("SelectTopK 672000 scores -> 1000: %llu us\n",
+              static_cast<unsigned long long>((TimerMicros() - start) /
+                                              kIterations));
+
+  for (auto method : {NmsMethod::kGreedy, NmsMethod::kSoftLinear}) {
+    NmsOptions options;
+    options.method = method;
+    options.score_threshold = 0.2f;
+    NonMaxSuppressor nms(options, 1000);
+    const auto candidates = RandomCandidates(1000, 80, 3);
+    Detections results(1000);
+    start = TimerMicros();
+    for (int i = 0; i < kIterations; ++i) {
+      auto copy = candidates;
+      auto candidate_results = copy.candidates();
+      auto kept = results.results();
+      nms.Run(&candidate_results, &kept);
+    }
+    std::printf("NonMaxSuppressor %s 1000 candidates: %llu us\n",
+                method == NmsMethod::kGreedy ? "greedy" : "soft-linear",
+                static_cast<unsigned long long>((TimerMicros() - start) /
+                                                kIterations));
+  }
+}
+
+}  // namespace
+}  // namespace coralmicro::tensorflow
+
+int main() {
+  coralmicro::tensorflow::TestSelectTopK();
+  coralmicro::tensorflow::TestGreedy();
+  coralmicro::tensorflow::TestGreedyBeyondDefaultLimit();
+  coralmicro::tensorflow::TestSoft();
+  coralmicro::tensorflow::Benchmark();
+  return TEST_RESULT();
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the raw-box `GetDetectionResults()`, which reads `TfLiteTensor`s
+// and so needs tflite-micro, unlike the rest of NMS in nms_benchmark.cc.
+
+#include <vector>
+
+#include "libs/tensorflow/nms.h"
+#include "tests/host/test_util.h"
+#include "third_party/tflite-micro/tensorflow/lite/c/common.h"
+
+namespace coralmicro::tensorflow {
+namespace {
+
+// Backing store for a `DetectionResults` of any capacity.
+struct Detections {
+  explicit Detections(size_t capacity)
+      : ids(capacity), scores(capacity), bboxes(capacity) {}
+  DetectionResults results() {
+    return {ids.data(), scores.data(), bboxes.data(), ids.size(), 0};
+  }
+  std::vector<int> ids;
+  std::vector<float> scores;
+  std::vector<BBox<float>> bboxes;
+};
+
+void TestRawBoxes() {
+  // Two boxes and two classes, in (x_center, y_center, width, height).
+  std::vector<float> boxes = {0.5f, 0.5f, 0.2f, 0.2f,
+                              0.51f, 0.5f, 0.2f, 0.2f};
+  std::vector<float> scores = {0.9f, 0.1f, 0.8f, 0.7f};
+  TfLiteIntArray* box_dims = TfLiteIntArrayCreate(3);
+  box_dims->data[0] = 1;
+  box_dims->data[1] = 2;
+  box_dims->data[2] = 4;
+  TfLiteIntArray* score_dims = TfLiteIntArrayCreate(3);
+  score_dims->data[0] = 1;
+  score_dims->data[1] = 2;
+  score_dims->data[2] = 2;
+  TfLiteTensor bbox_tensor = {};
+  bbox_tensor.type = kTfLiteFloat32;
+  bbox_tensor.data.f = boxes.data();
+  bbox_tensor.dims = box_dims;
+  TfLiteTensor score_tensor = {};
+  score_tensor.type = kTfLiteFloat32;
+  score_tensor.data.f = scores.data();
+  score_tensor.dims = score_dims;
+
+  NonMaxSuppressor nms;
+  Detections candidates(8), results(8);
+  auto candidate_results = candidates.results();
+  auto kept = results.results();
+  EXPECT_TRUE(GetDetectionResults(bbox_tensor, score_tensor,
+                                  BoxEncoding::kCenterSize, 0.5f, &nms,
+                                  &candidate_results, &kept));
+  // The second box's class 0 overlaps the first box's; its class 1 is kept.
+  EXPECT_EQ(kept.size, 2u);
+  EXPECT_EQ(kept.ids[0], 0);
+  EXPECT_NEAR(kept.scores[0], 0.9f, 1e-6f);
+  EXPECT_NEAR(kept.bboxes[0].xmin, 0.4f, 1e-6f);
+  EXPECT_NEAR(kept.bboxes[0].ymax, 0.6f, 1e-6f);
+  EXPECT_EQ(kept.ids[1], 1);
+  EXPECT_NEAR(kept.scores[1], 0.7f, 1e-6f);
+  TfLiteIntArrayFree(box_dims);
+  TfLiteIntArrayFree(score_dims);
+}
+
+}  // namespace
+}  // namespace coralmicro::tensorflow
+
+int main() {
+  coralmicro::tensorflow::TestRawBoxes();
+  return TEST_RESULT();
+}
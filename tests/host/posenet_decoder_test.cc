@@ -0,0 +1,313 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks that the allocation-free `DecodeAllPoses()` decodes the same poses
+// as the float decoder, however few root candidates it keeps per scan, and
+// that quantized heatmaps are scanned consistently. Also checks downsampled
+// and culled instance masks against the full-resolution mask decoder.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "libs/tensorflow/posenet_decoder.h"
+#include "tests/host/test_util.h"
+
+namespace coralmicro::posenet_decoder_op {
+namespace {
+
+constexpr int kHeight = 13;
+constexpr int kWidth = 15;
+constexpr int kMaxDetections = 6;
+constexpr float kScoreThreshold = 0.2f;
+constexpr float kNmsRadius = 1.5f;
+constexpr int kStride = 16;
+constexpr int kRefinementSteps = 5;
+
+struct Inputs {
+  std::vector<float> scores;
+  std::vector<float> short_offsets;
+  std::vector<float> mid_offsets;
+};
+
+// Random logits, so the heatmaps are crowded with local maxima, most of
+// which are rejected as roots by the poses found before them.
+Inputs RandomInputs(uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> logit(-6.0f, 4.0f),
+      short_offset(-0.5f, 0.5f), mid_offset(-3.0f, 3.0f);
+  Inputs inputs;
+  const int cells = kHeight * kWidth;
+  inputs.scores.resize(cells * kNumKeypoints);
+  for (auto& value : inputs.scores) value = logit(random);
+  inputs.short_offsets.resize(cells * 2 * kNumKeypoints);
+  for (auto& value : inputs.short_offsets) value = short_offset(random);
+  inputs.mid_offsets.resize(cells * 2 * 2 * kNumEdges);
+  for (auto& value : inputs.mid_offsets) value = mid_offset(random);
+  return inputs;
+}
+
+struct Poses {
+  int count;
+  std::vector<PoseKeypoints> keypoints;
+  std::vector<PoseKeypointScores> keypoint_scores;
+  std::vector<float> scores;
+
+  Poses()
+      : count(0),
+        keypoints(kMaxDetections),
+        keypoint_scores(kMaxDetections),
+        scores(kMaxDetections) {}
+};
+
+Poses DecodeReference(const Inputs& inputs) {
+  Poses poses;
+  poses.count = DecodeAllPoses(
+      inputs.scores.data(), inputs.short_offsets.data(),
+      inputs.mid_offsets.data(), kHeight, kWidth, kMaxDetections,
+      kScoreThreshold, kRefinementSteps, kNmsRadius, kStride,
+      poses.keypoints.data(), poses.keypoint_scores.data(),
+      poses.scores.data());
+  return poses;
+}
+
+template <typename T>
+Poses Decode(const DecoderTensor<T>& scores,
+             const DecoderTensor<T>& short_offsets,
+             const DecoderTensor<T>& mid_offsets, int max_root_candidates) {
+  PoseDecoderOptions options;
+  options.max_detections = kMaxDetections;
+  options.score_threshold = kScoreThreshold;
+  options.mid_short_offset_refinement_steps = kRefinementSteps;
+  options.nms_radius = kNmsRadius;
+  options.stride = kStride;
+  options.max_root_candidates = max_root_candidates;
+  std::vector<float> scratch(
+      (PoseDecoderScratchBytes(options) + sizeof(float) - 1) / sizeof(float));
+  Poses poses;
+  poses.count = DecodeAllPoses(
+      scores, short_offsets, mid_offsets, kHeight, kWidth, options,
+      scratch.data(), poses.keypoints.data(), poses.keypoint_scores.data(),
+      poses.scores.data());
+  return poses;
+}
+
+Poses Decode(const Inputs& inputs, int max_root_candidates) {
+  return Decode(DecoderTensor<float>{inputs.scores.data()},
+                DecoderTensor<float>{inputs.short_offsets.data()},
+                DecoderTensor<float>{inputs.mid_offsets.data()},
+                max_root_candidates);
+}
+
+// Quantizes `values`, which are in [-range, range], to uint8.
+DecoderTensor<uint8_t> Quantize(const std::vector<float>& values, float range,
+                                std::vector<uint8_t>* quantized) {
+  DecoderTensor<uint8_t> tensor{nullptr, 128, range / 127.0f};
+  quantized->resize(values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    (*quantized)[i] = static_cast<uint8_t>(
+        std::lround(values[i] / tensor.scale) + tensor.zero_point);
+  }
+  tensor.data = quantized->data();
+  return tensor;
+}
+
+void ExpectSamePoses(const Poses& actual, const Poses& expected) {
+  EXPECT_EQ(actual.count, expected.count);
+  if (actual.count != expected.count) return;
+  for (int i = 0; i < actual.count; ++i) {
+    EXPECT_NEAR(actual.scores[i], expected.scores[i], 1e-6f);
+    for (int k = 0; k < kNumKeypoints; ++k) {
+      EXPECT_NEAR(actual.keypoints[i].keypoint[k].y,
+                  expected.keypoints[i].keypoint[k].y, 1e-4f);
+      EXPECT_NEAR(actual.keypoints[i].keypoint[k].x,
+                  expected.keypoints[i].keypoint[k].x, 1e-4f);
+      EXPECT_NEAR(actual.keypoint_scores[i].keypoint[k],
+                  expected.keypoint_scores[i].keypoint[k], 1e-6f);
+    }
+  }
+}
+
+void TestMatchesFloatDecoder() {
+  for (uint32_t seed = 1; seed <= 5; ++seed) {
+    const auto inputs = RandomInputs(seed);
+    const auto expected = DecodeReference(inputs);
+    EXPECT_TRUE(expected.count > 0);
+    // From one root per scan to every root in one scan.
+    for (int max_root_candidates :
+         {1, 3, 2 * kNumKeypoints * kMaxDetections,
+          kHeight * kWidth * kNumKeypoints}) {
+      ExpectSamePoses(Decode(inputs, max_root_candidates), expected);
+    }
+  }
+}
+
+// Gets the values of a quantized tensor as floats.
+std::vector<float> Dequantize(const DecoderTensor<uint8_t>& tensor,
+                              size_t size) {
+  std::vector<float> values(size);
+  for (size_t i = 0; i < size; ++i) values[i] = tensor[i];
+  return values;
+}
+
+void TestQuantizedMatchesFloat() {
+  // The uint8 heatmap is thresholded in its stored type, four cells at a
+  // time, and must find the same roots as the float scan of the same values.
+  // The grid has an odd number of values, and the last one is made the
+  // strongest root, so the values after the last whole word are scanned too.
+  static_assert(kHeight * kWidth * kNumKeypoints % 4 != 0);
+  for (uint32_t seed = 1; seed <= 5; ++seed) {
+    auto inputs = RandomInputs(seed);
+    inputs.scores.back() = 5.0f;
+    std::vector<uint8_t> scores, shorts, mids;
+    const auto quantized_scores = Quantize(inputs.scores, 6.0f, &scores);
+    const auto quantized_shorts = Quantize(inputs.short_offsets, 0.5f, &shorts);
+    const auto quantized_mids = Quantize(inputs.mid_offsets, 3.0f, &mids);
+    const Inputs dequantized = {
+        Dequantize(quantized_scores, scores.size()),
+        Dequantize(quantized_shorts, shorts.size()),
+        Dequantize(quantized_mids, mids.size())};
+    const auto expected =
+        Decode(dequantized, kHeight * kWidth * kNumKeypoints);
+    EXPECT_TRUE(expected.count > 0);
+    for (int max_root_candidates : {1, 3, 2 * kNumKeypoints * kMaxDetections}) {
+      ExpectSamePoses(Decode(quantized_scores, quantized_shorts,
+                             quantized_mids, max_root_candidates),
+                      expected);
+    }
+  }
+}
+
+// Two poses in opposite corners of a square grid, with long-range offsets
+// that point each location at the keypoints of the pose on its side of a
+// slanted line, plus noise.
+constexpr int kMaskSize = 17;
+constexpr int kMaskPoses = 2;
+
+struct MaskInputs {
+  std::vector<float> long_offsets;
+  std::vector<PoseKeypoints> poses;
+};
+
+MaskInputs SyntheticMaskInputs() {
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> noise(-0.3f, 0.3f);
+  MaskInputs inputs;
+  inputs.poses.resize(kMaskPoses);
+  const float pose_y[kMaskPoses] = {12.0f, 4.0f};
+  const float pose_x[kMaskPoses] = {4.0f, 12.0f};
+  for (int i = 0; i < kMaskPoses; ++i) {
+    for (int k = 0; k < kNumKeypoints; ++k) {
+      inputs.poses[i].keypoint[k] = {(pose_y[i] + 0.5f * (k % 5 - 2)) * kStride,
+                                     (pose_x[i] + (k % 3 - 1)) * kStride};
+    }
+  }
+  inputs.long_offsets.resize(kMaskSize * kMaskSize * 2 * kNumKeypoints);
+  for (int y = 0; y < kMaskSize; ++y) {
+    for (int x = 0; x < kMaskSize; ++x) {
+      const PoseKeypoints& pose = inputs.poses[x + 4 < 2 * y ? 0 : 1];
+      float* offsets =
+          &inputs.long_offsets[(y * kMaskSize + x) * 2 * kNumKeypoints];
+      for (int k = 0; k < kNumKeypoints; ++k) {
+        offsets[k] = pose.keypoint[k].y / kStride - y + noise(random);
+        offsets[kNumKeypoints + k] =
+            pose.keypoint[k].x / kStride - x + noise(random);
+      }
+    }
+  }
+  return inputs;
+}
+
+std::vector<float> DecodeMasks(const MaskInputs& inputs, int downsample,
+                               float bbox_margin) {
+  InstanceMaskOptions options;
+  options.stride = kStride;
+  options.downsample = downsample;
+  options.bbox_margin = bbox_margin;
+  std::vector<float> scratch(
+      (InstanceMaskScratchBytes(kMaskPoses) + sizeof(float) - 1) /
+      sizeof(float));
+  std::vector<float> masks(kMaskPoses * kMaskSize * kMaskSize);
+  DecodeInstanceMasks(DecoderTensor<float>{inputs.long_offsets.data()},
+                      kMaskSize, kMaskSize, inputs.poses.data(), kMaskPoses,
+                      options, scratch.data(), masks.data());
+  return masks;
+}
+
+void TestDownsampledMasks() {
+  auto inputs = SyntheticMaskInputs();
+  std::vector<float> expected(kMaskPoses * kMaskSize * kMaskSize);
+  DecodeInstanceMasks(inputs.long_offsets.data(), kMaskSize, kMaskSize,
+                      inputs.poses.data(), kMaskPoses, 2, kStride,
+                      expected.data());
+  // Both poses own part of the image.
+  for (int i = 0; i < kMaskPoses; ++i) {
+    EXPECT_TRUE(std::count(expected.begin() + i * kMaskSize * kMaskSize,
+                           expected.begin() + (i + 1) * kMaskSize * kMaskSize,
+                           1.0f) > 0);
+  }
+  EXPECT_TRUE(DecodeMasks(inputs, 1, -1.0f) == expected);
+
+  for (int downsample : {2, 3, 4}) {
+    // Each block takes the full-resolution mask at its middle location.
+    const auto masks = DecodeMasks(inputs, downsample, -1.0f);
+    int block_mismatches = 0, mismatches = 0;
+    for (int i = 0; i < kMaskPoses; ++i) {
+      for (int y = 0; y < kMaskSize; ++y) {
+        const int y0 = y / downsample * downsample;
+        const int middle_y =
+            (y0 + std::min(y0 + downsample, kMaskSize) - 1) / 2;
+        for (int x = 0; x < kMaskSize; ++x) {
+          const int x0 = x / downsample * downsample;
+          const int middle_x =
+              (x0 + std::min(x0 + downsample, kMaskSize) - 1) / 2;
+          const int plane = i * kMaskSize * kMaskSize;
+          const float value = masks[plane + y * kMaskSize + x];
+          if (value != expected[plane + middle_y * kMaskSize + middle_x]) {
+            ++block_mismatches;
+          }
+          if (value != expected[plane + y * kMaskSize + x]) ++mismatches;
+        }
+      }
+    }
+    EXPECT_EQ(block_mismatches, 0);
+    // Only the blocks along the line between the poses differ.
+    EXPECT_TRUE(mismatches <= 2 * kMaskPoses * kMaskSize * downsample);
+
+    // A margin that covers the grid culls nothing, and a tight one only
+    // clears locations.
+    EXPECT_TRUE(DecodeMasks(inputs, downsample, 100.0f) == masks);
+    const auto culled = DecodeMasks(inputs, downsample, 0.5f);
+    int added = 0, cleared = 0;
+    for (size_t j = 0; j < masks.size(); ++j) {
+      if (culled[j] > masks[j]) ++added;
+      if (culled[j] < masks[j]) ++cleared;
+    }
+    EXPECT_EQ(added, 0);
+    EXPECT_TRUE(cleared > 0);
+  }
+}
+
+}  // namespace
+}  // namespace coralmicro::posenet_decoder_op
+
+int main() {
+  coralmicro::posenet_decoder_op::TestMatchesFloatDecoder();
+  coralmicro::posenet_decoder_op::TestQuantizedMatchesFloat();
+  coralmicro::posenet_decoder_op::TestDownsampledMasks();
+  return TEST_RESULT();
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks `ResizeImage()` against float references and prints how long each
+// method takes to resize a camera frame to a model input.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "libs/base/timer.h"
+#include "libs/tensorflow/resize.h"
+#include "tests/host/test_util.h"
+
+namespace coralmicro::tensorflow {
+namespace {
+
+std::vector<uint8_t> RandomImage(const ImageDims& dims, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::vector<uint8_t> image(ImageSize(dims));
+  for (auto& value : image) value = static_cast<uint8_t>(random());
+  return image;
+}
+
+uint8_t Pixel(const std::vector<uint8_t>& image, const ImageDims& dims, int y,
+              int x, int c) {
+  return image[(y * dims.width + x) * dims.depth + c];
+}
+
+void TestIdentity() {
+  const ImageDims dims{24, 32, 3};
+  const auto in = RandomImage(dims, 1);
+  for (auto method :
+       {ResizeMethod::kNearest, ResizeMethod::kBilinear, ResizeMethod::kArea}) {
+    std::vector<uint8_t> out(ImageSize(dims));
+    EXPECT_TRUE(ResizeImage(dims, in.data(), dims, out.data(), method));
+    EXPECT_TRUE(out == in);
+  }
+}
+
+void TestDepthMismatch() {
+  const ImageDims in_dims{4, 4, 3};
+  const ImageDims out_dims{2, 2, 1};
+  std::vector<uint8_t> in(ImageSize(in_dims)), out(ImageSize(out_dims));
+  EXPECT_TRUE(!ResizeImage(in_dims, in.data(), out_dims, out.data()));
+}
+
+void TestNearest() {
+  const ImageDims in_dims{37, 53, 3};
+  const auto in = RandomImage(in_dims, 2);
+  for (const ImageDims& out_dims :
+       {ImageDims{16, 16, 3}, ImageDims{100, 71, 3}, ImageDims{37, 20, 3}}) {
+    std::vector<uint8_t> out(ImageSize(out_dims));
+    EXPECT_TRUE(ResizeImage(in_dims, in.data(), out_dims, out.data(),
+                            ResizeMethod::kNearest));
+    const float y_scale = in_dims.height / static_cast<float>(out_dims.height);
+    const float x_scale = in_dims.width / static_cast<float>(out_dims.width);
+    int mismatches = 0;
+    for (int y = 0; y < out_dims.height; ++y) {
+      const int in_y = std::min(static_cast<int>(std::floor(y * y_scale)),
+                                in_dims.height - 1);
+      for (int x = 0; x < out_dims.width; ++x) {
+        const int in_x = std::min(static_cast<int>(std::floor(x * x_scale)),
+                                  in_dims.width - 1);
+        for (int c = 0; c < 3; ++c) {
+          const uint8_t expected = Pixel(in, in_dims, in_y, in_x, c);
+          if (Pixel(out, out_dims, y, x, c) != expected) ++mismatches;
+        }
+      }
+    }
+    EXPECT_EQ(mismatches, 0);
+  }
+}
+
+void TestBilinear() {
+  const ImageDims in_dims{48, 64, 3};
+  const auto in = RandomImage(in_dims, 3);
+  for (const ImageDims& out_dims :
+       {ImageDims{20, 30, 3}, ImageDims{97, 131, 3}}) {
+    std::vector<uint8_t> out(ImageSize(out_dims));
+    EXPECT_TRUE(ResizeImage(in_dims, in.data(), out_dims, out.data(),
+                            ResizeMethod::kBilinear));
+    auto source = [](int out, int in_size, int out_size, int* lo, int* hi,
+                     float* frac) {
+      const float pos = std::max(
+          0.0f, (out + 0.5f) * in_size / static_cast<float>(out_size) - 0.5f);
+      *lo = std::min(static_cast<int>(pos), in_size - 1);
+      *hi = std::min(*lo + 1, in_size - 1);
+      *frac = pos - static_cast<int>(pos);
+    };
+    int max_error = 0;
+    for (int y = 0; y < out_dims.height; ++y) {
+      int y0, y1;
+      float fy;
+      source(y, in_dims.height, out_dims.height, &y0, &y1, &fy);
+      for (int x = 0; x < out_dims.width; ++x) {
+        int x0, x1;
+        float fx;
+        source(x, in_dims.width, out_dims.width, &x0, &x1, &fx);
+        for (int c = 0; c < 3; ++c) {
+          const float top = Pixel(in, in_dims, y0, x0, c) * (1 - fx) +
+                            Pixel(in, in_dims, y0, x1, c) * fx;
+          const float bottom = Pixel(in, in_dims, y1, x0, c) * (1 - fx) +
+                               Pixel(in, in_dims, y1, x1, c) * fx;
+          const int expected = std::lround(top * (1 - fy) + bottom * fy);
+          max_error = std::max(
+              max_error, std::abs(Pixel(out, out_dims, y, x, c) - expected));
+        }
+      }
+    }
+    // The weights are in Q11.
+    EXPECT_TRUE(max_error <= 1);
+  }
+}
+
+void TestArea() {
+  // An integer factor averages whole blocks.
+  const ImageDims in_dims{40, 60, 3};
+  const ImageDims out_dims{10, 20, 3};
+  const auto in = RandomImage(in_dims, 4);
+  std::vector<uint8_t> out(ImageSize(out_dims));
+  EXPECT_TRUE(ResizeImage(in_dims, in.data(), out_dims, out.data(),
+                          ResizeMethod::kArea));
+  int mismatches = 0;
+  for (int y = 0; y < out_dims.height; ++y) {
+    for (int x = 0; x < out_dims.width; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        int sum = 0;
+        for (int dy = 0; dy < 4; ++dy) {
+          for (int dx = 0; dx < 3; ++dx) {
+            sum += Pixel(in, in_dims, 4 * y + dy, 3 * x + dx, c);
+          }
+        }
+        if (Pixel(out, out_dims, y, x, c) != (sum + 6) / 12) ++mismatches;
+      }
+    }
+  }
+  EXPECT_EQ(mismatches, 0);
+}
+
+void Benchmark() {
+  const ImageDims in_dims{480, 640, 3};
+  const ImageDims out_dims{224, 224, 3};
+  const auto in = RandomImage(in_dims, 5);
+  std::vector<uint8_t> out(ImageSize(out_dims));
+  constexpr int kIterations = 20;
+  const struct {
+    const char* name;
+    ResizeMethod method;
+  } methods[] = {{"nearest", ResizeMethod::kNearest},
+                 {"bilinear", ResizeMethod::kBilinear},
+                 {"area", ResizeMethod::kArea}};
+  for (const auto& m : methods) {
+    const uint64_t start = TimerMicros();
+    for (int i = 0; i < kIterations; ++i) {
+      ResizeImage(in_dims, in.data(), out_dims, out.data(), m.method);
+    }
+    std::printf("ResizeImage %s 640x480 -> 224x224: %llu us\n", m.name,
+                static_cast<unsigned long long>((TimerMicros() - start) /
+                                                kIterations));
+  }
+}
+
+}  // namespace
+}  // namespace coralmicro::tensorflow
+
+int main() {
+  coralmicro::tensorflow::TestIdentity();
+  coralmicro::tensorflow::TestDepthMismatch();
+  coralmicro::tensorflow::TestNearest();
+  coralmicro::tensorflow::TestBilinear();
+  coralmicro::tensorflow::TestArea();
+  coralmicro::tensorflow::Benchmark();
+  return TEST_RESULT();
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TESTS_HOST_TEST_UTIL_H_
+#define TESTS_HOST_TEST_UTIL_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Minimal assertions for the host tests. A failed expectation is printed and
+// counted, and `TEST_RESULT()` turns the count into the process exit code that
+// ctest checks.
+
+namespace coralmicro {
+namespace testing {
+
+inline int& Failures() {
+  static int failures = 0;
+  return failures;
+}
+
+// Reads a whole file, relative to the repository root.
+inline std::vector<uint8_t> ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(file),
+                              std::istreambuf_iterator<char>());
+}
+
+}  // namespace testing
+}  // namespace coralmicro
+
+#define EXPECT_TRUE(a)                                                  \
+  do {                                                                  \
+    if (!(a)) {                                                         \
+      std::fprintf(stderr, "%s:%d %s was not true.\n", __FILE__,        \
+                   __LINE__, #a);                                       \
+      ++coralmicro::testing::Failures();                                \
+    }                                                                   \
+  } while (0)
+
+#define EXPECT_EQ(a, b) EXPECT_TRUE((a) == (b))
+#define EXPECT_NEAR(a, b, tolerance) \
+  EXPECT_TRUE(((a) > (b) ? (a) - (b) : (b) - (a)) <= (tolerance))
+
+#define TEST_RESULT()                                                    \
+  (coralmicro::testing::Failures() == 0                                  \
+       ? (std::printf("PASSED\n"), 0)                                    \
+       : (std::printf("FAILED: %d expectations\n",                       \
+                      coralmicro::testing::Failures()),                  \
+          1))
+
+#endif  // TESTS_HOST_TEST_UTIL_H_